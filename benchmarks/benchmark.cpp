@@ -1,87 +1,898 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
 #include <iomanip>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
 #include "matrix.h"
+#include "thread_pool.h"
+#include "cpu_features.h"
+#include "tuning.h"
+#include "gemm.h"
+#include "packed_matrix.h"
+#include "quantized.h"
+#include "sparse.h"
+#include "perf_counters.h"
+#include "expr.h"
+#include "tiled_matrix.h"
 
-// Helper function to measure performance
-void run_benchmark(size_t size, std::ofstream& out_file) {
-    Matrix A(size, size);
-    Matrix B(size, size);
-    Matrix C(size, size);
+namespace {
 
+const char* kUsage =
+    "Usage: benchmark [options]\n"
+    "  (no options)         Full suite on 128..1024 squares plus the sparse sweep,\n"
+    "                       written to benchmark_results.md\n"
+    "  --tune [file]        Auto-tune blocking and write the tuning file\n"
+    "  --list               List kernel ids and shape presets\n"
+    "  --kernels a,b,...    Kernel ids to run (default: all)\n"
+    "  --shapes s,...       MxNxK, N (square) or a preset: square, rect, skinny, odd,\n"
+    "                       edges (default: square)\n"
+    "  --threads t,...      Pool sizes to run each kernel with (default: current pool)\n"
+    "  --reps N             Timed repetitions per case (default: adaptive, see --min-time)\n"
+    "  --min-time S         Adaptive mode: repeat until S seconds and 5 samples (default 0.25)\n"
+    "  --warmup N           Untimed runs before sampling (default 1)\n"
+    "  --seed N             Seed for the random inputs (default 42)\n"
+    "  --json FILE          Write results as JSON ('-' for stdout; progress then goes\n"
+    "                       to stderr)\n"
+    "  --csv FILE           Write results as CSV ('-' for stdout, likewise)\n"
+    "  --markdown FILE      Write results as Markdown tables\n"
+    "  --sparse [N]         Also run the sparse density sweep at N x N (default 1024)\n"
+    "  --counters           Count cycles, IPC, cache / dTLB misses and FP vector ops per\n"
+    "                       call (Linux perf_event_open) and place each case on the\n"
+    "                       roofline; falls back to timing only without counter access\n"
+    "  --baseline FILE      Compare medians with a saved --json or --csv run and exit\n"
+    "                       with status 2 if any case is slower by more than --threshold\n"
+    "  --threshold PCT      Allowed slowdown against the baseline (default 5)\n";
+
+// ---------------------------------------------------------------- statistics
+
+struct Stats {
+    size_t reps = 0;
+    double median = 0, p10 = 0, p90 = 0, mean = 0, stddev = 0, min = 0;
+};
+
+// Linear interpolation between the closest ranks; `sorted` is ascending.
+double percentile(const std::vector<double>& sorted, double p) {
+    double rank = p * (sorted.size() - 1);
+    size_t lo = static_cast<size_t>(rank);
+    size_t hi = std::min(lo + 1, sorted.size() - 1);
+    return sorted[lo] + (rank - lo) * (sorted[hi] - sorted[lo]);
+}
+
+Stats summarize(std::vector<double> samples) {
+    Stats s;
+    std::sort(samples.begin(), samples.end());
+    s.reps = samples.size();
+    s.median = percentile(samples, 0.5);
+    s.p10 = percentile(samples, 0.1);
+    s.p90 = percentile(samples, 0.9);
+    s.min = samples.front();
+    for (double t : samples) s.mean += t;
+    s.mean /= samples.size();
+    double var = 0;
+    for (double t : samples) var += (t - s.mean) * (t - s.mean);
+    s.stddev = samples.size() > 1 ? std::sqrt(var / (samples.size() - 1)) : 0.0;
+    return s;
+}
+
+struct Sampling {
+    size_t reps = 0;        // 0 = adaptive
+    double minTime = 0.25;
+    size_t warmup = 1;
+};
+
+// Times run() one call at a time, so every sample is a separate measurement. With
+// `counters`, the timed calls are also counted and `perCall` gets their average.
+Stats measure(const std::function<void()>& run, const Sampling& sampling, PerfCounters* counters = nullptr,
+              PerfSample* perCall = nullptr) {
+    for (size_t i = 0; i < sampling.warmup; ++i) run();
+    const size_t minReps = sampling.reps ? sampling.reps : 5;
+    const size_t maxReps = sampling.reps ? sampling.reps : 1000;
+    std::vector<double> samples;
+    double total = 0;
+    if (counters) counters->start();
+    while (samples.size() < minReps || (samples.size() < maxReps && total < sampling.minTime && !sampling.reps)) {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        samples.push_back(elapsed.count());
+        total += elapsed.count();
+    }
+    if (counters) {
+        *perCall = counters->stop();
+        perCall->seconds /= samples.size();
+        for (double& v : perCall->value) v /= samples.size();
+    }
+    return summarize(samples);
+}
+
+// ---------------------------------------------------------------- kernels
+
+struct Shape {
+    size_t M, N, K;
+};
+
+std::string shape_name(const Shape& s) {
+    return std::to_string(s.M) + "x" + std::to_string(s.N) + "x" + std::to_string(s.K);
+}
+
+// Operands for one shape: C = A (M x K) * B (K x N). Inputs are uniform in [-1, 1)
+// so sums stay well inside float precision at any size.
+struct Workload {
+    Shape shape;
+    Matrix A, B, C;
+
+    Workload(const Shape& s, unsigned int seed)
+        : shape(s), A(s.M, s.K, uninitialized), B(s.K, s.N, uninitialized), C(s.M, s.N) {
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+        for (auto& v : A.data) v = dis(gen);
+        for (auto& v : B.data) v = dis(gen);
+    }
+};
+
+using Runner = std::function<void()>;
+
+struct Kernel {
+    const char* id;
+    const char* label;
+    size_t inputBytes;              // Bytes per element of A and B
+    std::function<Runner(Workload&)> prepare;
+    size_t outputBytes = sizeof(float);
+    double flopsPerMac = 2.0;       // Real flops per multiply-add: 8 for complex
+};
+
+// Runs multiply() on copies of the workload in element type T; complex operands get
+// the float value as their real part and minus half of it as the imaginary part.
+template <typename T>
+std::function<Runner(Workload&)> wide(const T& imag) {
+    return [imag](Workload& w) -> Runner {
+        struct Data {
+            BasicMatrix<T> A, B, C;
+        };
+        const Shape& s = w.shape;
+        auto d = std::make_shared<Data>(Data{BasicMatrix<T>(s.M, s.K, uninitialized),
+                                             BasicMatrix<T>(s.K, s.N, uninitialized), BasicMatrix<T>(s.M, s.N)});
+        for (size_t i = 0; i < w.A.data.size(); ++i) d->A.data[i] = T(w.A.data[i]) + imag * T(w.A.data[i]);
+        for (size_t i = 0; i < w.B.data.size(); ++i) d->B.data[i] = T(w.B.data[i]) + imag * T(w.B.data[i]);
+        return [d] { multiply(d->A, d->B, d->C); };
+    };
+}
+
+// Wraps a plain C = A * B function.
+std::function<Runner(Workload&)> plain(void (*fn)(const Matrix&, const Matrix&, Matrix&)) {
+    return [fn](Workload& w) -> Runner { return [fn, &w] { fn(w.A, w.B, w.C); }; };
+}
+
+const std::vector<Kernel>& kernels() {
+    static const std::vector<Kernel> all = {
+        {"naive", "Naive (i-j-k)", sizeof(float), plain(multiply_naive)},
+        {"v1", "Opt V1 (i-k-j)", sizeof(float), plain(multiply_optimized_v1)},
+        {"v2", "Opt V2 (Tiled)", sizeof(float), [](Workload& w) -> Runner {
+            return [&w] { multiply_optimized_v2_tiled(w.A, w.B, w.C); };
+        }},
+        {"v3", "Opt V3 (Unroll)", sizeof(float), plain(multiply_optimized_v3_unrolled)},
+        {"v4", "Opt V4 (SIMD)", sizeof(float), plain(multiply_optimized_v4_simd)},
+        {"v5", "Opt V5 (Thread)", sizeof(float), [](Workload& w) -> Runner {
+            return [&w] { multiply_optimized_v5_threaded(w.A, w.B, w.C); };
+        }},
+        {"v6", "Opt V6 (RegBlk)", sizeof(float), plain(multiply_optimized_v6_register_blocked_2x2)},
+        {"v7", "Opt V7 (Thrd+RegBlk)", sizeof(float), [](Workload& w) -> Runner {
+            return [&w] { multiply_optimized_v7_threaded_register_blocked(w.A, w.B, w.C); };
+        }},
+        {"v8", "Opt V8 (Prefetch)", sizeof(float), plain(multiply_optimized_v8_prefetch)},
+        {"v9", "Opt V9 (Transp)", sizeof(float), plain(multiply_optimized_v9_transpose)},
+        {"v10", "Opt V10 (Packed)", sizeof(float), plain(multiply_optimized_packed)},
+        {"v11", "Opt V11 (Pack+Thrd)", sizeof(float), [](Workload& w) -> Runner {
+            return [&w] { multiply_optimized_packed_threaded(w.A, w.B, w.C); };
+        }},
+        {"multiply", "multiply()", sizeof(float), plain(multiply)},
+        {"strassen", "Strassen", sizeof(float), [](Workload& w) -> Runner {
+            return [&w] { multiply_strassen(w.A, w.B, w.C); };
+        }},
+        {"prepacked", "Pre-packed B", sizeof(float), [](Workload& w) -> Runner {
+            auto packedB = std::make_shared<PackedMatrix>(w.B);
+            return [&w, packedB] { multiply(w.A, *packedB, w.C); };
+        }},
+        // Bias + GELU as a separate pass over C vs fused into the tile stores
+        {"gelu-2pass", "Bias+GELU (2 pass)", sizeof(float), [](Workload& w) -> Runner {
+            auto bias = std::make_shared<std::vector<float>>(w.shape.N, 0.5f);
+            return [&w, bias] {
+                multiply(w.A, w.B, w.C);
+                for (size_t i = 0; i < w.shape.M; ++i) {
+                    for (size_t j = 0; j < w.shape.N; ++j) {
+                        float x = w.C(i, j) + (*bias)[j];
+                        w.C(i, j) = 0.5f * x * (1.0f + std::erf(x * 0.70710678f));
+                    }
+                }
+            };
+        }},
+        {"gelu-fused", "Bias+GELU (fused)", sizeof(float), [](Workload& w) -> Runner {
+            auto bias = std::make_shared<std::vector<float>>(w.shape.N, 0.5f);
+            Epilogue biasGelu;
+            biasGelu.bias = bias->data();
+            biasGelu.activation = Activation::GELU;
+            return [&w, bias, biasGelu] { multiply(w.A, w.B, w.C, biasGelu); };
+        }},
+        // C = A * B + R through a temporary and an add loop vs a lazy expression
+        {"expr-temps", "A*B+R (temporary)", sizeof(float), [](Workload& w) -> Runner {
+            auto r = std::make_shared<Matrix>(w.shape.M, w.shape.N);
+            auto t = std::make_shared<Matrix>(w.shape.M, w.shape.N);
+            std::fill(r->data.begin(), r->data.end(), 0.25f);
+            return [&w, r, t] {
+                multiply(w.A, w.B, *t);
+                for (size_t i = 0; i < w.C.data.size(); ++i) w.C.data[i] = t->data[i] + r->data[i];
+            };
+        }},
+        {"expr-lazy", "A*B+R (expression)", sizeof(float), [](Workload& w) -> Runner {
+            auto r = std::make_shared<Matrix>(w.shape.M, w.shape.N);
+            std::fill(r->data.begin(), r->data.end(), 0.25f);
+            return [&w, r] { w.C = w.A * w.B + *r; };
+        }},
+        // Gram matrix A * A^T (M x M, for square shapes) as a full gemm vs syrk on one
+        // triangle; both are counted as the full product, so syrk's saving shows up as
+        // a higher effective rate
+        {"gram-gemm", "A*A^T (gemm)", sizeof(float), [](Workload& w) -> Runner {
+            auto g = std::make_shared<Matrix>(w.shape.M, w.shape.M);
+            return [&w, g] {
+                gemm(Transpose::NoTrans, Transpose::Trans, w.shape.M, w.shape.M, w.shape.K, 1.0f,
+                     w.A.data.data(), w.shape.K, w.A.data.data(), w.shape.K, 0.0f, g->data.data(), w.shape.M);
+            };
+        }},
+        {"gram-syrk", "A*A^T (syrk)", sizeof(float), [](Workload& w) -> Runner {
+            auto g = std::make_shared<Matrix>(w.shape.M, w.shape.M);
+            return [&w, g] {
+                syrk(Uplo::Lower, Transpose::NoTrans, w.shape.M, w.shape.K, 1.0f, w.A.data.data(), w.shape.K,
+                     0.0f, g->data.data(), w.shape.M);
+            };
+        }},
+        // Morton-ordered tiles with the recursive multiply: operands converted once up
+        // front, vs converted in and the result converted back on every call
+        {"tiled", "Tiled (Morton)", sizeof(float), [](Workload& w) -> Runner {
+            auto a = std::make_shared<TiledMatrix>(w.A);
+            auto b = std::make_shared<TiledMatrix>(w.B);
+            auto c = std::make_shared<TiledMatrix>(w.shape.M, w.shape.N);
+            return [a, b, c] { multiply(*a, *b, *c); };
+        }},
+        {"tiled-conv", "Tiled (+convert)", sizeof(float), [](Workload& w) -> Runner {
+            return [&w] {
+                TiledMatrix c(w.shape.M, w.shape.N);
+                multiply(TiledMatrix(w.A), TiledMatrix(w.B), c);
+                c.copy_to(w.C.view());
+            };
+        }},
+        // Int8 inputs hold a quarter of the bytes; ops are counted like flops
+        {"int8", "Int8 (s8s8s32)", sizeof(int8_t), [](Workload& w) -> Runner {
+            struct Data {
+                std::vector<int8_t> a, b;
+                std::vector<int32_t> c;
+            };
+            auto d = std::make_shared<Data>();
+            const Shape s = w.shape;
+            d->a.resize(s.M * s.K);
+            d->b.resize(s.K * s.N);
+            d->c.resize(s.M * s.N);
+            quantize(w.A.data.data(), d->a.size(), 1.0f / 127.0f, 0, d->a.data());
+            quantize(w.B.data.data(), d->b.size(), 1.0f / 127.0f, 0, d->b.data());
+            return [d, s] {
+                gemm_s8s8s32(s.M, s.N, s.K, d->a.data(), s.K, QuantParams(), d->b.data(), s.N, QuantParams(),
+                             d->c.data(), s.N);
+            };
+        }},
+        // Half-precision storage, fp32 accumulation
+        {"bf16", "BF16 (fp32 acc)", sizeof(bfloat16), [](Workload& w) -> Runner {
+            auto a = std::make_shared<std::vector<bfloat16>>(w.A.data.size());
+            auto b = std::make_shared<std::vector<bfloat16>>(w.B.data.size());
+            convert(w.A.data.data(), a->size(), a->data());
+            convert(w.B.data.data(), b->size(), b->data());
+            return [&w, a, b] {
+                const Shape& s = w.shape;
+                gemm(Transpose::NoTrans, Transpose::NoTrans, s.M, s.N, s.K, 1.0f, a->data(), s.K,
+                     b->data(), s.N, 0.0f, w.C.data.data(), s.N);
+            };
+        }},
+        {"fp16", "FP16 (fp32 acc)", sizeof(float16), [](Workload& w) -> Runner {
+            auto a = std::make_shared<std::vector<float16>>(w.A.data.size());
+            auto b = std::make_shared<std::vector<float16>>(w.B.data.size());
+            convert(w.A.data.data(), a->size(), a->data());
+            convert(w.B.data.data(), b->size(), b->data());
+            return [&w, a, b] {
+                const Shape& s = w.shape;
+                gemm(Transpose::NoTrans, Transpose::NoTrans, s.M, s.N, s.K, 1.0f, a->data(), s.K,
+                     b->data(), s.N, 0.0f, w.C.data.data(), s.N);
+            };
+        }},
+        // Wider element types on the same engine
+        {"double", "Double (dgemm)", sizeof(double), wide<double>(0.0), sizeof(double)},
+        {"cfloat", "Complex (cgemm)", sizeof(std::complex<float>), wide(std::complex<float>(0.0f, -0.5f)),
+         sizeof(std::complex<float>), 8.0},
+        {"cdouble", "Complex dbl (zgemm)", sizeof(std::complex<double>), wide(std::complex<double>(0.0, -0.5)),
+         sizeof(std::complex<double>), 8.0},
+    };
+    return all;
+}
+
+const std::map<std::string, std::vector<Shape>>& shape_presets() {
+    static const std::map<std::string, std::vector<Shape>> presets = {
+        {"square", {{128, 128, 128}, {256, 256, 256}, {512, 512, 512}, {1024, 1024, 1024}}},
+        {"rect", {{1000, 37, 300}, {64, 2048, 1024}, {2048, 512, 128}, {768, 3072, 768}}},
+        {"skinny", {{1, 1024, 1024}, {1024, 1, 1024}, {16, 4096, 512}, {4096, 16, 512}, {64, 64, 8192}}},
+        {"odd", {{127, 255, 383}, {333, 777, 101}, {1023, 1025, 1021}}},
+        // Aligned shapes next to odd neighbours, to see what the edge tiles cost
+        {"edges", {{512, 512, 512}, {511, 509, 513}, {1000, 32, 300}, {1000, 37, 300}, {512, 4096, 512},
+                   {513, 4097, 511}}},
+    };
+    return presets;
+}
+
+// ---------------------------------------------------------------- results
+
+struct Result {
+    std::string kernel;
+    std::string label;
+    Shape shape;
+    unsigned int threads;
+    Stats stats;
+    double gflops;
+    double gbps;
+    bool counted = false;       // --counters: the fields below are filled in
+    PerfSample perf;            // Per call
+    RooflinePoint roof{};
+};
+
+std::vector<std::string> split(const std::string& text, char sep) {
+    std::vector<std::string> parts;
+    std::stringstream ss(text);
+    std::string part;
+    while (std::getline(ss, part, sep)) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+bool parse_shape(const std::string& text, std::vector<Shape>& shapes) {
+    auto preset = shape_presets().find(text);
+    if (preset != shape_presets().end()) {
+        shapes.insert(shapes.end(), preset->second.begin(), preset->second.end());
+        return true;
+    }
+    std::vector<std::string> dims = split(text, 'x');
+    std::vector<size_t> v;
+    for (const auto& d : dims) {
+        char* end = nullptr;
+        unsigned long long n = std::strtoull(d.c_str(), &end, 10);
+        if (*end != '\0' || n == 0) return false;
+        v.push_back(static_cast<size_t>(n));
+    }
+    if (v.size() == 1) shapes.push_back({v[0], v[0], v[0]});
+    else if (v.size() == 3) shapes.push_back({v[0], v[1], v[2]});
+    else return false;
+    return true;
+}
+
+const char* kFields = "kernel,label,M,N,K,threads,reps,median_s,p10_s,p90_s,mean_s,stddev_s,min_s,gflops,gbps";
+
+// Counter columns of a --counters run, per call; empty values for events that
+// could not be counted.
+std::vector<std::pair<std::string, std::string>> counter_fields(const Result& r) {
+    std::vector<std::pair<std::string, std::string>> fields;
+    auto number = [](double v) {
+        std::ostringstream ss;
+        ss << std::setprecision(9) << v;
+        return ss.str();
+    };
+    for (int e = 0; e < kNumPerfEvents; ++e) {
+        PerfEvent event = static_cast<PerfEvent>(e);
+        fields.emplace_back(perf_event_name(event), r.perf.has(event) ? number(r.perf[event]) : "");
+    }
+    fields.emplace_back("ipc", r.perf.ipc() > 0 ? number(r.perf.ipc()) : "");
+    fields.emplace_back("intensity", number(r.roof.intensity));
+    fields.emplace_back("roof_gflops", r.roof.attainable > 0 ? number(r.roof.attainable) : "");
+    fields.emplace_back("roof_fraction", r.roof.attainable > 0 ? number(r.roof.fraction) : "");
+    return fields;
+}
+
+bool any_counted(const std::vector<Result>& results) {
+    return std::any_of(results.begin(), results.end(), [](const Result& r) { return r.counted; });
+}
+
+void write_csv(std::ostream& out, const std::vector<Result>& results) {
+    const bool counted = any_counted(results);
+    out << kFields;
+    if (counted) {
+        for (const auto& f : counter_fields(Result{})) out << "," << f.first;
+    }
+    out << "\n";
+    out << std::setprecision(9);
+    for (const auto& r : results) {
+        out << r.kernel << ",\"" << r.label << "\"," << r.shape.M << "," << r.shape.N << "," << r.shape.K << ","
+            << r.threads << "," << r.stats.reps << "," << r.stats.median << "," << r.stats.p10 << ","
+            << r.stats.p90 << "," << r.stats.mean << "," << r.stats.stddev << "," << r.stats.min << ","
+            << r.gflops << "," << r.gbps;
+        if (counted) {
+            for (const auto& f : counter_fields(r)) out << "," << f.second;
+        }
+        out << "\n";
+    }
+}
+
+void write_json(std::ostream& out, const std::vector<Result>& results) {
+    out << std::setprecision(9);
+    out << "{\n  \"isa\": \"" << isa_name(active_isa()) << "\",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        out << "    {\"kernel\": \"" << r.kernel << "\", \"label\": \"" << r.label << "\", \"M\": " << r.shape.M
+            << ", \"N\": " << r.shape.N << ", \"K\": " << r.shape.K << ", \"threads\": " << r.threads
+            << ", \"reps\": " << r.stats.reps << ", \"median_s\": " << r.stats.median
+            << ", \"p10_s\": " << r.stats.p10 << ", \"p90_s\": " << r.stats.p90
+            << ", \"mean_s\": " << r.stats.mean << ", \"stddev_s\": " << r.stats.stddev
+            << ", \"min_s\": " << r.stats.min << ", \"gflops\": " << r.gflops << ", \"gbps\": " << r.gbps;
+        if (r.counted) {
+            // Flat keys, so load_baseline still sees one object per result
+            for (const auto& f : counter_fields(r)) {
+                if (!f.second.empty()) out << ", \"" << f.first << "\": " << f.second;
+            }
+        }
+        out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+// Counter cell, or "-" when the event was not available.
+std::string perf_cell(const Result& r, PerfEvent event) {
+    if (!r.perf.has(event)) return "-";
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(2) << r.perf[event] / 1e6 << "M";
+    return ss.str();
+}
+
+void write_markdown(std::ostream& out, const std::vector<Result>& results) {
+    const bool counted = any_counted(results);
+    std::string current;
+    for (const auto& r : results) {
+        std::string heading = shape_name(r.shape) + ", " + std::to_string(r.threads) + " threads";
+        if (heading != current) {
+            if (!current.empty()) out << "\n";
+            out << "### " << (r.shape.M == r.shape.N && r.shape.N == r.shape.K
+                                  ? "Matrix Size: " + std::to_string(r.shape.M) + "x" + std::to_string(r.shape.M)
+                                  : "Shape (MxNxK): " + shape_name(r.shape))
+                << " (" << r.threads << " threads)\n\n";
+            out << "| Optimization | GFLOPS | GB/s | Median (s) | p10 (s) | p90 (s) | Stddev | Reps |"
+                << (counted ? " IPC | L1D miss | LLC miss | dTLB miss | FP vec ops | flop/B | % of roof |" : "")
+                << "\n";
+            out << "| :--- | :--- | :--- | :--- | :--- | :--- | :--- | :--- |"
+                << (counted ? " :--- | :--- | :--- | :--- | :--- | :--- | :--- |" : "") << "\n";
+            current = heading;
+        }
+        out << std::fixed << "| " << r.label << " | " << std::setprecision(2) << r.gflops << " | " << r.gbps
+            << " | " << std::setprecision(6) << r.stats.median << " | " << r.stats.p10 << " | " << r.stats.p90
+            << " | " << std::setprecision(1) << 100.0 * r.stats.stddev / r.stats.mean << "% | " << r.stats.reps
+            << " |";
+        if (counted) {
+            out << " ";
+            if (r.perf.ipc() > 0) out << std::setprecision(2) << r.perf.ipc() << " | ";
+            else out << "- | ";
+            out << perf_cell(r, PerfEvent::L1DMisses)
+                << " | " << perf_cell(r, PerfEvent::LLCMisses) << " | " << perf_cell(r, PerfEvent::DTLBMisses)
+                << " | " << perf_cell(r, PerfEvent::FpVectorOps) << " | " << std::setprecision(1)
+                << r.roof.intensity << " | ";
+            if (r.roof.attainable > 0) {
+                out << 100.0 * r.roof.fraction << "% " << (r.roof.memoryBound ? "(mem)" : "(compute)");
+            } else {
+                out << "-";
+            }
+            out << " |";
+        }
+        out << "\n";
+    }
+    out << "\n";
+}
+
+// Writes through `writer` to a file, or to `stdoutBuf` (the process's stdout) for "-".
+bool emit(const std::string& path, void (*writer)(std::ostream&, const std::vector<Result>&),
+          const std::vector<Result>& results, std::streambuf* stdoutBuf) {
+    if (path == "-") {
+        std::ostream out(stdoutBuf);
+        writer(out, results);
+        out.flush();
+        return true;
+    }
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Cannot write " << path << std::endl;
+        return false;
+    }
+    writer(out, results);
+    return true;
+}
+
+// ---------------------------------------------------------------- baseline
+
+// Key of one case, for matching a run against its baseline.
+std::string case_key(const std::string& kernel, size_t M, size_t N, size_t K, unsigned long threads) {
+    return kernel + " " + std::to_string(M) + "x" + std::to_string(N) + "x" + std::to_string(K) + " t" +
+           std::to_string(threads);
+}
+
+// Reads median times from a file written by --json or --csv. Only the flat result
+// objects (or CSV rows) this program writes need to be understood.
+bool load_baseline(const std::string& path, std::map<std::string, double>& medians) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    const std::string text = buffer.str();
+
+    std::vector<std::map<std::string, std::string>> records;
+    size_t first = text.find_first_not_of(" \t\r\n");
+    if (first != std::string::npos && text[first] == '{') {
+        // Innermost {...} objects of "key": value pairs
+        for (size_t open = text.find('{', first + 1); open != std::string::npos; open = text.find('{', open + 1)) {
+            size_t close = text.find('}', open);
+            if (close == std::string::npos) break;
+            if (text.find('{', open + 1) < close) continue;
+            std::map<std::string, std::string> record;
+            size_t pos = open + 1;
+            while (true) {
+                size_t k0 = text.find('"', pos);
+                if (k0 == std::string::npos || k0 > close) break;
+                size_t k1 = text.find('"', k0 + 1);
+                size_t colon = text.find(':', k1);
+                size_t v0 = text.find_first_not_of(" \t", colon + 1);
+                size_t v1;
+                std::string value;
+                if (text[v0] == '"') {
+                    v1 = text.find('"', v0 + 1);
+                    value = text.substr(v0 + 1, v1 - v0 - 1);
+                    ++v1;
+                } else {
+                    v1 = text.find_first_of(",}", v0);
+                    value = text.substr(v0, v1 - v0);
+                }
+                record[text.substr(k0 + 1, k1 - k0 - 1)] = value;
+                pos = v1;
+            }
+            records.push_back(record);
+        }
+    } else {
+        std::stringstream lines(text);
+        std::string line;
+        std::vector<std::string> header;
+        while (std::getline(lines, line)) {
+            // Labels are quoted and never contain commas or quotes themselves
+            line.erase(std::remove(line.begin(), line.end(), '"'), line.end());
+            std::vector<std::string> cells = split(line, ',');
+            if (header.empty()) {
+                header = cells;
+                continue;
+            }
+            std::map<std::string, std::string> record;
+            for (size_t i = 0; i < std::min(header.size(), cells.size()); ++i) record[header[i]] = cells[i];
+            records.push_back(record);
+        }
+    }
+
+    for (auto& r : records) {
+        if (!r.count("kernel") || !r.count("median_s")) continue;
+        medians[case_key(r["kernel"], std::stoul(r["M"]), std::stoul(r["N"]), std::stoul(r["K"]),
+                         std::stoul(r["threads"]))] = std::stod(r["median_s"]);
+    }
+    return true;
+}
+
+// Prints each case's median against the baseline. Returns false if any case is
+// slower by more than thresholdPct percent.
+bool compare_with_baseline(const std::vector<Result>& results, const std::map<std::string, double>& baseline,
+                           double thresholdPct) {
+    bool ok = true;
+    std::cout << std::defaultfloat << "Baseline comparison (threshold " << thresholdPct << "%)" << std::endl;
+    for (const auto& r : results) {
+        std::string key = case_key(r.kernel, r.shape.M, r.shape.N, r.shape.K, r.threads);
+        auto it = baseline.find(key);
+        std::cout << "  " << std::left << std::setw(36) << key << std::right;
+        if (it == baseline.end()) {
+            std::cout << " | not in baseline" << std::endl;
+            continue;
+        }
+        double change = 100.0 * (r.stats.median / it->second - 1.0);
+        bool regressed = change > thresholdPct;
+        ok = ok && !regressed;
+        std::cout << " | " << std::fixed << std::setprecision(6) << it->second << "s -> " << r.stats.median
+                  << "s | " << std::showpos << std::setprecision(1) << change << "%" << std::noshowpos
+                  << (regressed ? "  REGRESSION" : "") << std::endl;
+    }
+    return ok;
+}
+
+// ---------------------------------------------------------------- suites
+
+// Prints the counters and roofline position of a --counters case under its timing line.
+void print_counters(const Result& r) {
+    std::cout << "      " << std::fixed << std::setprecision(2);
+    if (r.perf.ipc() > 0) std::cout << "IPC " << r.perf.ipc() << " | ";
+    const double kflops = r.gflops * r.stats.median * 1e6;
+    for (PerfEvent event : {PerfEvent::L1DMisses, PerfEvent::LLCMisses, PerfEvent::DTLBMisses}) {
+        if (r.perf.has(event)) std::cout << perf_event_name(event) << "/kflop " << r.perf[event] / kflops << " | ";
+    }
+    if (r.perf.has(PerfEvent::FpVectorOps)) {
+        std::cout << "FP vec ops " << std::setprecision(1) << r.perf[PerfEvent::FpVectorOps] / 1e6 << "M | ";
+    }
+    std::cout << "AI " << std::setprecision(1) << r.roof.intensity << " flop/B";
+    if (r.roof.attainable > 0) {
+        std::cout << ", " << 100.0 * r.roof.fraction << "% of " << r.roof.attainable << " GFLOPS roof ("
+                  << (r.roof.memoryBound ? "memory" : "compute") << "-bound)";
+    }
+    std::cout << std::endl;
+}
+
+// With `peaks`, every case is also run under PerfCounters and placed on the roofline.
+std::vector<Result> run_cases(const std::vector<const Kernel*>& selected, const std::vector<Shape>& shapes,
+                              const std::vector<unsigned int>& threadCounts, const Sampling& sampling,
+                              unsigned int seed, const MachinePeaks* peaks) {
+    std::vector<Result> results;
+    ThreadPool& pool = ThreadPool::instance();
+    for (unsigned int threads : threadCounts) {
+        if (threads != 0) pool.set_num_threads(threads);
+        // Opened after resizing, so the counters follow every worker of this pool
+        std::unique_ptr<PerfCounters> counters(peaks ? new PerfCounters : nullptr);
+        if (counters && !counters->hardware_available()) {
+            std::cout << "Hardware counters unavailable (no PMU or perf_event_paranoid too high): timing only"
+                      << std::endl;
+        }
+        // Roof for this pool size; SMT siblings share their core's FMA pipes
+        MachinePeaks roof{};
+        if (peaks) {
+            unsigned int cores = std::max(1u, std::min(pool.num_threads(), cpu_topology().numCores));
+            roof = {peaks->gflops * cores, peaks->gbps};
+        }
+        for (const Shape& shape : shapes) {
+            Workload w(shape, seed);
+            std::cout << "Shape " << shape_name(shape) << " (MxNxK), " << pool.num_threads() << " threads, ISA "
+                      << isa_name(active_isa()) << ", partition "
+                      << partition_name(choose_gemm_partition(shape.M, shape.N, shape.K, pool.num_threads()))
+                      << std::endl;
+            for (const Kernel* k : selected) {
+                Runner run = k->prepare(w);
+                PerfSample perf;
+                Stats st = measure(run, sampling, counters.get(), &perf);
+                double ops = k->flopsPerMac * shape.M * shape.N * shape.K;
+                double bytes = (static_cast<double>(shape.M) * shape.K + static_cast<double>(shape.K) * shape.N) *
+                                   k->inputBytes + 2.0 * shape.M * shape.N * k->outputBytes;
+                Result r{k->id, k->label, shape, pool.num_threads(), st, ops / st.median / 1e9,
+                         bytes / st.median / 1e9, counters != nullptr, perf,
+                         counters ? roofline(ops, bytes, st.median, roof) : RooflinePoint{}};
+                results.push_back(r);
+
+                std::cout << "  " << std::left << std::setw(20) << r.label << std::right << std::fixed
+                          << " | GFLOPS: " << std::setprecision(2) << std::setw(7) << r.gflops
+                          << " | GB/s: " << std::setw(6) << r.gbps
+                          << " | median " << std::setprecision(6) << st.median << "s"
+                          << " [p10 " << st.p10 << ", p90 " << st.p90 << "]"
+                          << " | sd " << std::setprecision(1) << 100.0 * st.stddev / st.mean << "%"
+                          << " | n=" << st.reps << std::endl;
+                if (r.counted) print_counters(r);
+            }
+            std::cout << "--------------------------------------------------------" << std::endl;
+        }
+    }
+    return results;
+}
+
+// Sparse x dense against the dense threaded kernel over a range of densities, to
+// show where the crossover is. Nonzeros come in 4x4 blocks, as in block-pruned
+// weights; CSR stores them individually, BSR as whole blocks.
+void run_sparse_benchmark(size_t size, const Sampling& sampling, std::ostream* out_file) {
+    Matrix B(size, size), C(size, size);
     for (size_t i = 0; i < size * size; ++i) {
-        A.data[i] = static_cast<float>(i);
-        B.data[i] = static_cast<float>(i);
-    }
-
-    // Write table header for this size
-    out_file << "### Matrix Size: " << size << "x" << size << "\n\n";
-    out_file << "| Optimization | GFLOPS | Time (s) |\n";
-    out_file << "| :--- | :--- | :--- |\n";
-
-    auto benchmark_func = [&](auto func, const std::string& name) {
-        // Warmup
-        func(A, B, C);
-        
-        auto start = std::chrono::high_resolution_clock::now();
-        int iterations = (size <= 256) ? 10 : 2;
-        for (int i = 0; i < iterations; ++i) {
-            func(A, B, C);
+        B.data[i] = static_cast<float>(i % 97) * 0.01f;
+    }
+
+    auto median_of = [&](const std::function<void()>& run) { return measure(run, sampling).median; };
+
+    if (out_file) {
+        *out_file << "### Sparse x Dense: " << size << "x" << size << " (median times)\n\n";
+        *out_file << "| Density | Opt V5 (Thread) (s) | multiply() (s) | CSR (s) | BSR 4x4 (s) | CSR vs V5 | BSR vs V5 |\n";
+        *out_file << "| :--- | :--- | :--- | :--- | :--- | :--- | :--- |\n";
+    }
+    std::cout << "Sparse x Dense: " << size << "x" << size << std::endl;
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+    for (double density : {0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0}) {
+        Matrix A(size, size);
+        for (size_t bi = 0; bi < size; bi += 4) {
+            for (size_t bj = 0; bj < size; bj += 4) {
+                if (dis(gen) >= density) continue;
+                for (size_t i = bi; i < std::min(bi + 4, size); ++i) {
+                    for (size_t j = bj; j < std::min(bj + 4, size); ++j) A(i, j) = dis(gen) - 0.5f;
+                }
+            }
         }
-        auto end = std::chrono::high_resolution_clock::now();
-
-        std::chrono::duration<double> elapsed = end - start;
-        double avg_time = elapsed.count() / iterations;
-        double ops = 2.0 * size * size * size;
-        double gflops = (ops / avg_time) / 1e9;
-
-        // Console output
-        std::cout << "  " << std::left << std::setw(20) << name 
-                  << " | GFLOPS: " << std::fixed << std::setprecision(2) << gflops 
-                  << " | Time: " << std::setprecision(4) << avg_time << "s" << std::endl;
-        
-        // File output
-        out_file << "| " << name << " | " << std::fixed << std::setprecision(2) << gflops 
-                 << " | " << std::setprecision(4) << avg_time << " |\n";
-    };
+        CsrMatrix csr(A);
+        BsrMatrix bsr(A);
+
+        double v5 = median_of([&] { multiply_optimized_v5_threaded(A, B, C); });
+        double dense = median_of([&] { multiply(A, B, C); });
+        double tCsr = median_of([&] { multiply(csr, B, C); });
+        double tBsr = median_of([&] { multiply(bsr, B, C); });
+
+        std::cout << "  density " << std::fixed << std::setprecision(3) << density
+                  << " | V5: " << std::setprecision(4) << v5 << "s | multiply(): " << dense
+                  << "s | CSR: " << tCsr << "s | BSR: " << tBsr << "s" << std::endl;
+        if (out_file) {
+            *out_file << std::fixed << "| " << std::setprecision(3) << density << " | " << std::setprecision(4)
+                      << v5 << " | " << dense << " | " << tCsr << " | " << tBsr << " | " << std::setprecision(1)
+                      << v5 / tCsr << "x | " << v5 / tBsr << "x |\n";
+        }
+    }
 
-    std::cout << "Matrix Size: " << size << "x" << size << std::endl;
-    benchmark_func(multiply_naive, "Naive (i-j-k)");
-    benchmark_func(multiply_optimized_v1, "Opt V1 (i-k-j)");
-    benchmark_func([](const Matrix& A, const Matrix& B, Matrix& C) {
-        multiply_optimized_v2_tiled(A, B, C, 32);
-    }, "Opt V2 (Tiled)");
-    benchmark_func(multiply_optimized_v3_unrolled, "Opt V3 (Unroll)");
-    benchmark_func(multiply_optimized_v4_simd, "Opt V4 (SIMD)");
-    benchmark_func([](const Matrix& A, const Matrix& B, Matrix& C) {
-        multiply_optimized_v5_threaded(A, B, C);
-    }, "Opt V5 (Thread)");
-    benchmark_func(multiply_optimized_v6_register_blocked_2x2, "Opt V6 (RegBlk)");
-    benchmark_func([](const Matrix& A, const Matrix& B, Matrix& C) {
-        multiply_optimized_v7_threaded_register_blocked(A, B, C);
-    }, "Opt V7 (Thrd+RegBlk)");
-    benchmark_func(multiply_optimized_v8_prefetch, "Opt V8 (Prefetch)");
-    benchmark_func(multiply_optimized_v9_transpose, "Opt V9 (Transp)");
-    
-    out_file << "\n";
+    if (out_file) *out_file << "\n";
     std::cout << "--------------------------------------------------------" << std::endl;
 }
 
-int main() {
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    // Tuning mode: ./bin/benchmark --tune [file]
+    if (!args.empty() && args[0] == "--tune") {
+        std::string path = (args.size() > 1) ? args[1] : tuning_file_path();
+        if (!autotune(path, std::cout)) {
+            std::cerr << "Failed to write tuning file " << path << std::endl;
+            return 1;
+        }
+        std::cout << "Tuning written to " << path << std::endl;
+        return 0;
+    }
+
+    std::vector<const Kernel*> selected;
+    std::vector<Shape> shapes;
+    std::vector<unsigned int> threadCounts;
+    Sampling sampling;
+    unsigned int seed = 42;
+    std::string jsonPath, csvPath, markdownPath, baselinePath;
+    double thresholdPct = 5.0;
+    size_t sparseSize = 0;
+    bool counters = false;
+
+    // With no options, the full suite as before: squares, sparse sweep, Markdown report
+    if (args.empty()) {
+        markdownPath = "benchmark_results.md";
+        sparseSize = 1024;
+    }
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const std::string& opt = args[i];
+        bool hasValue = i + 1 < args.size() && args[i + 1].compare(0, 2, "--") != 0;
+        auto value = [&]() -> std::string {
+            if (!hasValue) {
+                std::cerr << opt << " needs a value\n" << kUsage;
+                std::exit(1);
+            }
+            return args[++i];
+        };
+
+        if (opt == "--help" || opt == "-h") {
+            std::cout << kUsage;
+            return 0;
+        } else if (opt == "--list") {
+            std::cout << "Kernels:" << std::endl;
+            for (const auto& k : kernels()) std::cout << "  " << std::left << std::setw(12) << k.id << k.label << std::endl;
+            std::cout << "Shape presets:" << std::endl;
+            for (const auto& p : shape_presets()) {
+                std::cout << "  " << std::left << std::setw(12) << p.first;
+                for (const auto& s : p.second) std::cout << shape_name(s) << " ";
+                std::cout << std::endl;
+            }
+            return 0;
+        } else if (opt == "--kernels") {
+            for (const auto& id : split(value(), ',')) {
+                auto it = std::find_if(kernels().begin(), kernels().end(), [&](const Kernel& k) { return id == k.id; });
+                if (id == "all") {
+                    for (const auto& k : kernels()) selected.push_back(&k);
+                } else if (it == kernels().end()) {
+                    std::cerr << "Unknown kernel '" << id << "' (see --list)" << std::endl;
+                    return 1;
+                } else {
+                    selected.push_back(&*it);
+                }
+            }
+        } else if (opt == "--shapes") {
+            for (const auto& s : split(value(), ',')) {
+                if (!parse_shape(s, shapes)) {
+                    std::cerr << "Bad shape '" << s << "': use MxNxK, N or a preset (see --list)" << std::endl;
+                    return 1;
+                }
+            }
+        } else if (opt == "--threads") {
+            for (const auto& t : split(value(), ',')) threadCounts.push_back(std::stoul(t));
+        } else if (opt == "--reps") {
+            sampling.reps = std::stoul(value());
+        } else if (opt == "--min-time") {
+            sampling.minTime = std::stod(value());
+        } else if (opt == "--warmup") {
+            sampling.warmup = std::stoul(value());
+        } else if (opt == "--seed") {
+            seed = std::stoul(value());
+        } else if (opt == "--json") {
+            jsonPath = value();
+        } else if (opt == "--csv") {
+            csvPath = value();
+        } else if (opt == "--markdown") {
+            markdownPath = value();
+        } else if (opt == "--sparse") {
+            sparseSize = hasValue ? std::stoul(value()) : 1024;
+        } else if (opt == "--counters") {
+            counters = true;
+        } else if (opt == "--baseline") {
+            baselinePath = value();
+        } else if (opt == "--threshold") {
+            thresholdPct = std::stod(value());
+        } else {
+            std::cerr << "Unknown option " << opt << "\n" << kUsage;
+            return 1;
+        }
+    }
+    if (selected.empty()) {
+        for (const auto& k : kernels()) selected.push_back(&k);
+    }
+    if (shapes.empty()) shapes = shape_presets().at("square");
+    if (threadCounts.empty()) threadCounts.push_back(0);
+
+    std::map<std::string, double> baseline;
+    if (!baselinePath.empty() && !load_baseline(baselinePath, baseline)) {
+        std::cerr << "Cannot read baseline " << baselinePath << std::endl;
+        return 1;
+    }
+
+    // A report on stdout has it to itself: everything else printed from here on goes
+    // to stderr, so `--json - | tool` gets a parseable stream
+    if (jsonPath == "-" && csvPath == "-") {
+        std::cerr << "Only one of --json and --csv can write to stdout\n" << kUsage;
+        return 1;
+    }
+    std::streambuf* stdoutBuf = std::cout.rdbuf();
+    if (jsonPath == "-" || csvPath == "-") std::cout.rdbuf(std::cerr.rdbuf());
+
     std::cout << "Matrix Multiplication Benchmarks" << std::endl;
     std::cout << "--------------------------------------------------------" << std::endl;
-    
-    std::ofstream out_file("benchmark_results.md");
-    out_file << "# Benchmark Results\n\n";
-    out_file << "Run on " << __DATE__ << " at " << __TIME__ << "\n\n";
-
-    run_benchmark(128, out_file);
-    run_benchmark(256, out_file);
-    run_benchmark(512, out_file); 
-    run_benchmark(1024, out_file);
-    
-    std::cout << "Results written to benchmark_results.md" << std::endl;
+    // Per-core peak from the nominal clock (0 when unknown: no compute roof) and the
+    // machine's measured triad bandwidth
+    std::unique_ptr<MachinePeaks> peaks;
+    if (counters) {
+        peaks.reset(new MachinePeaks{peak_gflops(active_isa(), nominal_ghz(), 1), measure_memory_bandwidth()});
+        std::cout << std::fixed << std::setprecision(1) << "Roofline: " << peaks->gflops << " GFLOPS per core ("
+                  << isa_name(active_isa()) << "), " << peaks->gbps << " GB/s memory bandwidth" << std::endl;
+        std::cout << "--------------------------------------------------------" << std::endl;
+    }
+    std::vector<Result> results = run_cases(selected, shapes, threadCounts, sampling, seed, peaks.get());
+
+    std::unique_ptr<std::ofstream> markdown;
+    if (!markdownPath.empty()) {
+        markdown.reset(new std::ofstream(markdownPath));
+        *markdown << "# Benchmark Results\n\n";
+        *markdown << "ISA " << isa_name(active_isa()) << ", built on " << __DATE__ << " at " << __TIME__ << "\n\n";
+        write_markdown(*markdown, results);
+    }
+    if (sparseSize) run_sparse_benchmark(sparseSize, sampling, markdown.get());
+
+    bool written = (jsonPath.empty() || emit(jsonPath, write_json, results, stdoutBuf)) &&
+                   (csvPath.empty() || emit(csvPath, write_csv, results, stdoutBuf));
+    if (!markdownPath.empty()) std::cout << "Results written to " << markdownPath << std::endl;
+    if (!written) return 1;
+
+    if (!baselinePath.empty() && !compare_with_baseline(results, baseline, thresholdPct)) {
+        std::cerr << "Slower than baseline by more than " << thresholdPct << "%" << std::endl;
+        return 2;
+    }
     return 0;
 }
@@ -0,0 +1,55 @@
+#ifndef CHAIN_H
+#define CHAIN_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "matrix.h"
+
+// Matrix chain products: C = X0 * X1 * ... * X(n-1) in the parenthesization with the
+// fewest flops (dynamic programming over the n + 1 chain dimensions, O(n^3)).
+//
+// A plan depends only on the dimensions, so it can be made once and reused. Products
+// whose operands are ready at the same time run as parallel pool tasks. Intermediates
+// live in one scratch buffer whose slots are reused once their consumer has run, so
+// the chain's peak memory (ChainPlan::scratchFloats) is known before anything runs.
+struct ChainPlan {
+    // One product: operand ids below n are chain factors, id n + s is the result of
+    // step s. The last step is the whole chain and writes C.
+    struct Step {
+        size_t left;
+        size_t right;
+        size_t rows, inner, cols;
+        size_t wave;        // Steps of one wave are independent and run concurrently
+        size_t offset;      // Floats into the scratch buffer (unused by the last step)
+        size_t ld;          // Leading dimension of the result in scratch
+    };
+
+    std::vector<size_t> dims;   // Factor i is dims[i] x dims[i + 1]
+    std::vector<Step> steps;    // In execution order, wave by wave
+    size_t numWaves = 0;
+    double flops = 0;           // 2 * M * N * K summed over the steps
+    size_t scratchFloats = 0;   // Peak size of all live intermediates
+
+    size_t factors() const { return dims.size() - 1; }
+
+    // The chosen order, e.g. "((X0 X1) (X2 X3))"
+    std::string parenthesization() const;
+};
+
+// Plans the chain of factors with the given dimensions (at least two factors, so at
+// least three dimensions). Throws std::invalid_argument otherwise.
+ChainPlan plan_chain(const std::vector<size_t>& dims);
+
+// Flops of multiplying the factors strictly left to right, for comparing with a plan.
+double chain_flops_left_to_right(const std::vector<size_t>& dims);
+
+// C = factors[0] * factors[1] * ... with a plan made for their shapes. C must not be
+// one of the factors.
+void multiply_chain(const std::vector<const Matrix*>& factors, Matrix& C);
+
+// Same with a plan made earlier; throws std::invalid_argument if the factors' shapes
+// do not match it.
+void multiply_chain(const std::vector<const Matrix*>& factors, Matrix& C, const ChainPlan& plan);
+
+#endif // CHAIN_H
@@ -0,0 +1,50 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+// Instruction sets the library ships kernels for, in increasing order of preference.
+enum class CpuIsa {
+    Scalar,
+    SSE42,
+    AVX2,       // AVX2 + FMA
+    AVX512,     // AVX-512F
+    NEON
+};
+
+// Features of the running CPU, as reported by cpuid and enabled by the OS (xgetbv).
+struct CpuFeatures {
+    bool sse42 = false;
+    bool avx = false;
+    bool avx2 = false;
+    bool fma = false;
+    bool f16c = false;
+    bool avx512f = false;
+    bool avx512bw = false;
+    bool avx512vl = false;
+    bool avx512vnni = false;
+    bool avx512bf16 = false;
+    bool avxvnni = false;
+    bool neon = false;
+};
+
+const CpuFeatures& cpu_features();
+
+// Best instruction set the running CPU supports.
+CpuIsa best_supported_isa();
+
+bool isa_supported(CpuIsa isa);
+
+// Instruction set used by multiply() and the packed kernels. Chosen once at startup:
+// the best supported one, unless $MATMUL_ISA (scalar, sse4.2, avx2, avx512, neon)
+// names another supported one.
+CpuIsa active_isa();
+
+// Overrides the active instruction set at runtime. Returns false (and keeps the
+// current choice) if the CPU does not support it.
+bool set_active_isa(CpuIsa isa);
+
+const char* isa_name(CpuIsa isa);
+
+// Parses the names accepted by $MATMUL_ISA. Returns false on unknown names.
+bool parse_isa(const char* name, CpuIsa& isa);
+
+#endif // CPU_FEATURES_H
@@ -0,0 +1,38 @@
+#ifndef EPILOGUE_H
+#define EPILOGUE_H
+
+#include <cstddef>
+
+// Element-wise operations fused into the store of C. The packed engine applies
+// them to each register tile right after its last K block, while the tile is still
+// in L1, so C is written once instead of once per extra pass.
+//
+// Each element becomes
+//     C[i][j] = activation(alpha * (A * B)[i][j] + beta * C[i][j] + bias) + residual[i][j]
+// where bias is bias[i] (PerRow) or bias[j] (PerColumn).
+
+enum class Activation {
+    None,
+    ReLU,
+    GELU,       // 0.5 * x * (1 + erf(x / sqrt(2))), the erf form (not the tanh one)
+    Sigmoid
+};
+
+enum class BiasMode {
+    PerRow,     // One value per row of C (M values)
+    PerColumn   // One value per column of C (N values)
+};
+
+struct Epilogue {
+    const float* bias = nullptr;            // nullptr = no bias
+    BiasMode biasMode = BiasMode::PerColumn;
+    Activation activation = Activation::None;
+    const float* residual = nullptr;        // M x N row-major, nullptr = none; must not overlap C
+    size_t ldResidual = 0;                  // Row stride of residual
+
+    bool empty() const {
+        return bias == nullptr && activation == Activation::None && residual == nullptr;
+    }
+};
+
+#endif // EPILOGUE_H
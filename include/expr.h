@@ -0,0 +1,253 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include "matrix.h"
+
+// Lazy matrix expressions:
+//
+//     Matrix D = A * B + C * E - F;   // two GEMMs accumulating into D, F added in
+//     D += 0.5f * A.t() * B;          // transposes are read in place
+//
+// The operators only build a tree, computing nothing. Its leaves are scaled, possibly
+// transposed references to matrices or views (MatrixTerm) and products of two of them
+// (ProductTerm). Sums combine leaves; scalars, negation and .t() are pushed down onto
+// them. Assigning the tree to a matrix evaluates it in place (see evaluate_terms):
+//  - terms that are the destination itself fold into beta, so D = A * B + D is one
+//    GEMM with beta = 1;
+//  - the other matrix terms are summed into D in one pass over it;
+//  - each product is then a gemm() call accumulating into D (beta = 1).
+// No intermediate matrix is allocated unless a term reads the destination's memory
+// in another way (D = D * B), in which case the sum is evaluated into a temporary.
+// Products of three or more factors need intermediates; see multiply_chain (chain.h).
+
+// One term of a flattened expression: scale * op(a) * op(b), or scale * op(a) when b
+// is null. rows x cols is the term's shape and inner the K of a product.
+template <typename T>
+struct ExprTerm {
+    const T* a;
+    size_t lda;
+    bool transA;
+    const T* b;
+    size_t ldb;
+    bool transB;
+    size_t rows, cols, inner;
+    T scale;
+};
+
+// dst = beta * dst + the sum of the terms, all of dst's shape. Defined for float,
+// double, std::complex<float> and std::complex<double>.
+template <typename T>
+void evaluate_terms(const ExprTerm<T>* terms, size_t count, T beta, const BasicMatrixView<T>& dst);
+
+namespace expr_detail {
+
+// Flattens `e` onto the stack and evaluates it into dst; throws std::invalid_argument
+// if the shapes differ.
+template <typename E>
+void evaluate(const E& e, const BasicMatrixView<typename E::ExprScalar>& dst, typename E::ExprScalar beta) {
+    using T = typename E::ExprScalar;
+    if (e.rows() != dst.rows || e.cols() != dst.cols) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+    ExprTerm<T> terms[E::kTerms];
+    ExprTerm<T>* out = terms;
+    e.collect(out);
+    evaluate_terms(terms, E::kTerms, beta, dst);
+}
+
+} // namespace expr_detail
+
+// scale * op(m)
+template <typename T>
+struct MatrixTerm {
+    using ExprScalar = T;
+    static constexpr size_t kTerms = 1;
+
+    BasicConstMatrixView<T> m;
+    bool trans;
+    T scale;
+
+    size_t rows() const { return trans ? m.cols : m.rows; }
+    size_t cols() const { return trans ? m.rows : m.cols; }
+    MatrixTerm t() const { return {m, !trans, scale}; }
+    MatrixTerm scaled(T s) const { return {m, trans, scale * s}; }
+
+    void collect(ExprTerm<T>*& out) const {
+        *out++ = {m.data, m.ld, trans, nullptr, 0, false, rows(), cols(), 0, scale};
+    }
+    void evaluate(const BasicMatrixView<T>& dst, T beta) const { expr_detail::evaluate(*this, dst, beta); }
+};
+
+// scale * op(a) * op(b); the factors' own scales are folded into `scale`.
+template <typename T>
+struct ProductTerm {
+    using ExprScalar = T;
+    static constexpr size_t kTerms = 1;
+
+    MatrixTerm<T> a, b;
+    T scale;
+
+    size_t rows() const { return a.rows(); }
+    size_t cols() const { return b.cols(); }
+    ProductTerm t() const { return {b.t(), a.t(), scale}; }
+    ProductTerm scaled(T s) const { return {a, b, scale * s}; }
+
+    void collect(ExprTerm<T>*& out) const {
+        *out++ = {a.m.data, a.m.ld, a.trans, b.m.data, b.m.ld, b.trans, rows(), cols(), a.cols(), scale};
+    }
+    void evaluate(const BasicMatrixView<T>& dst, T beta) const { expr_detail::evaluate(*this, dst, beta); }
+};
+
+template <typename L, typename R>
+struct SumExpr {
+    using ExprScalar = typename L::ExprScalar;
+    static constexpr size_t kTerms = L::kTerms + R::kTerms;
+
+    L l;
+    R r;
+
+    size_t rows() const { return l.rows(); }
+    size_t cols() const { return l.cols(); }
+    SumExpr t() const { return {l.t(), r.t()}; }
+    SumExpr scaled(ExprScalar s) const { return {l.scaled(s), r.scaled(s)}; }
+
+    void collect(ExprTerm<ExprScalar>*& out) const {
+        l.collect(out);
+        r.collect(out);
+    }
+    void evaluate(const BasicMatrixView<ExprScalar>& dst, ExprScalar beta) const {
+        expr_detail::evaluate(*this, dst, beta);
+    }
+};
+
+template <typename T>
+MatrixTerm<T> BasicMatrix<T>::t() const {
+    return {view(), true, T(1)};
+}
+
+namespace expr_detail {
+
+// What may appear in an expression, and the node it becomes there.
+template <typename X>
+struct Lift {
+    static constexpr bool value = false;
+};
+
+template <typename T>
+struct Lift<BasicMatrix<T>> {
+    static constexpr bool value = true;
+    using type = MatrixTerm<T>;
+    static type of(const BasicMatrix<T>& x) { return {x.view(), false, T(1)}; }
+};
+
+template <typename T>
+struct Lift<BasicMatrixView<T>> {
+    static constexpr bool value = true;
+    using type = MatrixTerm<T>;
+    static type of(const BasicMatrixView<T>& x) { return {x, false, T(1)}; }
+};
+
+template <typename T>
+struct Lift<BasicConstMatrixView<T>> {
+    static constexpr bool value = true;
+    using type = MatrixTerm<T>;
+    static type of(const BasicConstMatrixView<T>& x) { return {x, false, T(1)}; }
+};
+
+template <typename X>
+struct LiftNode {
+    static constexpr bool value = true;
+    using type = X;
+    static type of(const X& x) { return x; }
+};
+
+template <typename T>
+struct Lift<MatrixTerm<T>> : LiftNode<MatrixTerm<T>> {};
+
+template <typename T>
+struct Lift<ProductTerm<T>> : LiftNode<ProductTerm<T>> {};
+
+template <typename L, typename R>
+struct Lift<SumExpr<L, R>> : LiftNode<SumExpr<L, R>> {};
+
+template <typename X, typename Y>
+using EnableBinary = typename std::enable_if<Lift<X>::value && Lift<Y>::value, int>::type;
+
+template <typename X>
+using EnableUnary = typename std::enable_if<Lift<X>::value, int>::type;
+
+template <typename S, typename X, bool = Lift<X>::value && !Lift<S>::value>
+struct IsScalarFor : std::false_type {};
+
+template <typename S, typename X>
+struct IsScalarFor<S, X, true>
+    : std::is_convertible<S, typename Lift<X>::type::ExprScalar> {};
+
+template <typename S, typename X>
+using EnableScaled = typename std::enable_if<IsScalarFor<S, X>::value, int>::type;
+
+template <typename X>
+typename Lift<X>::type lift(const X& x) {
+    return Lift<X>::of(x);
+}
+
+template <typename L, typename R>
+SumExpr<L, R> make_sum(const L& l, const R& r) {
+    static_assert(std::is_same<typename L::ExprScalar, typename R::ExprScalar>::value,
+                  "Matrix expressions cannot mix element types.");
+    if (l.rows() != r.rows() || l.cols() != r.cols()) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+    return {l, r};
+}
+
+} // namespace expr_detail
+
+template <typename X, typename Y, expr_detail::EnableBinary<X, Y> = 0>
+auto operator+(const X& x, const Y& y) {
+    return expr_detail::make_sum(expr_detail::lift(x), expr_detail::lift(y));
+}
+
+template <typename X, typename Y, expr_detail::EnableBinary<X, Y> = 0>
+auto operator-(const X& x, const Y& y) {
+    auto r = expr_detail::lift(y);
+    return expr_detail::make_sum(expr_detail::lift(x), r.scaled(-typename decltype(r)::ExprScalar(1)));
+}
+
+template <typename X, expr_detail::EnableUnary<X> = 0>
+auto operator-(const X& x) {
+    auto e = expr_detail::lift(x);
+    return e.scaled(-typename decltype(e)::ExprScalar(1));
+}
+
+// Product of two (scaled, transposed) matrices. Throws std::invalid_argument if the
+// inner dimensions differ.
+template <typename X, typename Y, expr_detail::EnableBinary<X, Y> = 0>
+auto operator*(const X& x, const Y& y) {
+    auto l = expr_detail::lift(x);
+    auto r = expr_detail::lift(y);
+    using T = typename decltype(l)::ExprScalar;
+    static_assert(std::is_same<decltype(l), MatrixTerm<T>>::value && std::is_same<decltype(r), MatrixTerm<T>>::value,
+                  "Only products of two matrices are expressions; evaluate longer products with multiply_chain.");
+    if (l.cols() != r.rows()) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+    return ProductTerm<T>{{l.m, l.trans, T(1)}, {r.m, r.trans, T(1)}, l.scale * r.scale};
+}
+
+template <typename S, typename X, expr_detail::EnableScaled<S, X> = 0>
+auto operator*(const S& s, const X& x) {
+    auto e = expr_detail::lift(x);
+    return e.scaled(typename decltype(e)::ExprScalar(s));
+}
+
+template <typename X, typename S, expr_detail::EnableScaled<S, X> = 0>
+auto operator*(const X& x, const S& s) {
+    auto e = expr_detail::lift(x);
+    return e.scaled(typename decltype(e)::ExprScalar(s));
+}
+
+#endif // EXPR_H
@@ -0,0 +1,143 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <complex>
+#include <cstddef>
+#include "epilogue.h"
+#include "half.h"
+#include "matrix.h"
+
+// BLAS-style interface to the packed engine. All storage is row-major; lda, ldb
+// and ldc are the distances between consecutive rows as stored.
+
+enum class Transpose {
+    NoTrans,
+    Trans
+};
+
+// C[M x N] = alpha * op(A)[M x K] * op(B)[K x N] + beta * C
+//
+// op(A) = A when transA is NoTrans (A stored M x K), A^T when Trans (A stored K x M);
+// likewise for B. Transposed operands are read in place by the packing routines,
+// never copied. When beta == 0, C is not read, so it may be uninitialized.
+// Throws std::invalid_argument if a leading dimension is too small.
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          float alpha, const float* A, size_t lda, const float* B, size_t ldb,
+          float beta, float* C, size_t ldc);
+
+// Same with an epilogue (bias, activation, residual) fused into the store of C; see
+// epilogue.h. Throws std::invalid_argument if epilogue.ldResidual is below N.
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          float alpha, const float* A, size_t lda, const float* B, size_t ldb,
+          float beta, float* C, size_t ldc, const Epilogue& epilogue);
+
+// How the threaded engine splits a product across the pool, picked from M, N and K:
+//  - Tiles2D: 2D tiles of C (row blocks sharing packed B when C is tall enough; row
+//    chunks of unpacked dot products when C has only a few columns).
+//  - Columns: few rows of C (GEMV, batch-size-1 layers); C is split by columns and
+//    B streamed without packing.
+//  - SplitK:  C too small for every thread to get its own tiles but K is deep; K is
+//    split into slices whose partial products are summed by a parallel reduction.
+enum class GemmPartition {
+    Tiles2D,
+    Columns,
+    SplitK
+};
+
+GemmPartition choose_gemm_partition(size_t M, size_t N, size_t K, unsigned int threads);
+
+const char* partition_name(GemmPartition partition);
+
+// C = epilogue(alpha * A * B)
+void multiply(const Matrix& A, const Matrix& B, Matrix& C, const Epilogue& epilogue, float alpha = 1.0f);
+
+// Half-precision operands with fp32 accumulation and fp32 C. A and B are read as
+// 16-bit values and widened to float while being packed, so main-memory traffic for
+// them is halved and the float micro-kernels run unchanged.
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          float alpha, const bfloat16* A, size_t lda, const bfloat16* B, size_t ldb,
+          float beta, float* C, size_t ldc);
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          float alpha, const float16* A, size_t lda, const float16* B, size_t ldb,
+          float beta, float* C, size_t ldc);
+
+// Double and complex (BLAS dgemm / cgemm / zgemm) on the same packed engine, computing
+// in the element type. Complex operands are std::complex arrays, i.e. interleaved
+// (re, im); Trans is a plain transpose, not a conjugate one.
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          double alpha, const double* A, size_t lda, const double* B, size_t ldb,
+          double beta, double* C, size_t ldc);
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          std::complex<float> alpha, const std::complex<float>* A, size_t lda,
+          const std::complex<float>* B, size_t ldb,
+          std::complex<float> beta, std::complex<float>* C, size_t ldc);
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          std::complex<double> alpha, const std::complex<double>* A, size_t lda,
+          const std::complex<double>* B, size_t ldb,
+          std::complex<double> beta, std::complex<double>* C, size_t ldc);
+
+// Same on views; M, N and K are taken from the views and checked for consistency.
+void gemm(Transpose transA, Transpose transB, float alpha,
+          const ConstMatrixView& A, const ConstMatrixView& B,
+          float beta, const MatrixView& C);
+
+// Batched GEMM: C[i] = alpha * op(A[i]) * op(B[i]) + beta * C[i] for every i in
+// [0, batchCount), all with the same shape. The batch is split across the thread
+// pool; each product runs single-threaded. Non-transposed products with M, N and K
+// each in {4, 8, 16, 32} use kernels specialized at compile time on the shape.
+
+// Pointer-array form: A, B and C hold batchCount pointers each.
+void gemm_batch(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+                float alpha, const float* const* A, size_t lda, const float* const* B, size_t ldb,
+                float beta, float* const* C, size_t ldc, size_t batchCount);
+
+// Strided form: operand i starts at A + i * strideA (likewise B and C).
+void gemm_batch_strided(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+                        float alpha, const float* A, size_t lda, size_t strideA,
+                        const float* B, size_t ldb, size_t strideB,
+                        float beta, float* C, size_t ldc, size_t strideC, size_t batchCount);
+
+// Symmetric and triangular products (BLAS level 3) on the packed float engine. Only
+// the `uplo` triangle of a symmetric or triangular operand is read, and only the work
+// that triangle implies is done: C is cut into tiles, each tile runs the engine on
+// the part of the inner dimension it needs, and the tiles are ordered by their work
+// so every thread gets an equal share of the uneven triangle.
+enum class Uplo {
+    Upper,
+    Lower
+};
+
+enum class Side {
+    Left,       // The structured operand multiplies from the left: op(A) * B
+    Right       // ... from the right: B * op(A)
+};
+
+enum class Diag {
+    NonUnit,
+    Unit        // Diagonal taken as all ones and not read
+};
+
+// SYRK: C = alpha * op(A) * op(A)^T + beta * C on the `uplo` triangle (diagonal
+// included) of the N x N matrix C, where op(A) is N x K (A stored N x K, or K x N
+// with Trans, giving the Gram matrix A^T * A). About half the flops of the gemm.
+// The other triangle is left untouched unless `mirror`, which copies the computed
+// triangle across so C holds the whole symmetric result.
+// Throws std::invalid_argument if a leading dimension is too small.
+void syrk(Uplo uplo, Transpose trans, size_t N, size_t K, float alpha, const float* A, size_t lda,
+          float beta, float* C, size_t ldc, bool mirror = false);
+
+// SYMM: C = alpha * A * B + beta * C (Left; A is M x M) or alpha * B * A + beta * C
+// (Right; A is N x N), with C and B M x N and A symmetric, read from its `uplo`
+// triangle only (the other one need not be filled in).
+// Throws std::invalid_argument if a leading dimension is too small.
+void symm(Side side, Uplo uplo, size_t M, size_t N, float alpha, const float* A, size_t lda,
+          const float* B, size_t ldb, float beta, float* C, size_t ldc);
+
+// TRMM, out of place: C = alpha * op(A) * B + beta * C (Left; A is M x M) or
+// alpha * B * op(A) + beta * C (Right; A is N x N), with C and B M x N and A
+// triangular, read from its `uplo` triangle only. About half the flops of the gemm.
+// Throws std::invalid_argument if a leading dimension is too small.
+void trmm(Side side, Uplo uplo, Transpose transA, Diag diag, size_t M, size_t N, float alpha,
+          const float* A, size_t lda, const float* B, size_t ldb, float beta, float* C, size_t ldc);
+
+#endif // GEMM_H
@@ -0,0 +1,35 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 16-bit storage types. They only hold bits; arithmetic happens in float after
+// conversion.
+
+// bfloat16: the upper half of an IEEE float (8-bit exponent, 7-bit mantissa).
+struct bfloat16 {
+    uint16_t bits;
+};
+
+// IEEE 754 binary16 (5-bit exponent, 10-bit mantissa, max 65504).
+struct float16 {
+    uint16_t bits;
+};
+
+// Scalar conversions. Narrowing rounds to nearest even; values too large for
+// float16 become infinity, and NaNs stay NaN.
+float to_float(bfloat16 h);
+float to_float(float16 h);
+bfloat16 to_bfloat16(float f);
+float16 to_float16(float f);
+
+// Bulk conversions of `count` values. They use F16C and AVX-512 BF16 when the CPU
+// has them and active_isa() is AVX2 or better, and the scalar routines otherwise.
+// (The AVX-512 BF16 instruction flushes float denormals to zero.)
+void convert(const float* src, size_t count, bfloat16* dst);
+void convert(const float* src, size_t count, float16* dst);
+void convert(const bfloat16* src, size_t count, float* dst);
+void convert(const float16* src, size_t count, float* dst);
+
+#endif // HALF_H
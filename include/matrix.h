@@ -2,9 +2,12 @@
 #define MATRIX_H
 
 #include <vector>
+#include <complex>
 #include <cstddef>
 #include <memory>
 #include <new>
+#include <stdexcept>
+#include <utility>
 
 #if defined(__ARM_NEON) || defined(__ARM_NEON__)
 #include <arm_neon.h>
@@ -33,48 +36,227 @@ struct AlignedAllocator {
     }
 
     template <typename U> struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    // Stateless: any two instances can free each other's memory
+    template <typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
 };
 
-struct Matrix {
+// Storage for matrices and large scratch buffers (src/memory.cpp). Blocks of at least
+// kHugePageBytes are 2 MB aligned, rounded up to whole huge pages and advised for
+// transparent huge pages (MADV_HUGEPAGE), which cuts TLB misses on big operands.
+// Freed huge blocks go to a process-wide pool (capped by matrix_pool_limit) and are
+// handed back to the next allocation of the same size, already faulted in. Smaller
+// blocks are 64-byte aligned and go straight to the system allocator.
+constexpr std::size_t kHugePageBytes = std::size_t(2) << 20;
+
+void* matrix_alloc(std::size_t bytes);
+void matrix_free(void* p, std::size_t bytes) noexcept;
+
+// Bytes the pool may keep cached (default 1 GB, or $MATMUL_POOL_MB); lowering it
+// releases the excess. matrix_pool_trim() returns every cached block to the system.
+void set_matrix_pool_limit(std::size_t bytes);
+std::size_t matrix_pool_limit();
+std::size_t matrix_pool_cached_bytes();
+void matrix_pool_trim();
+
+// Allocator for Matrix data and scratch buffers. Unlike AlignedAllocator, growing a
+// vector through it leaves the new elements uninitialized, so the owner decides
+// when (and on which thread) the pages are first written.
+template <typename T>
+struct MatrixAllocator {
+    using value_type = T;
+    MatrixAllocator() noexcept = default;
+    template <typename U> MatrixAllocator(const MatrixAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        return n == 0 ? nullptr : static_cast<T*>(matrix_alloc(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        if (p) matrix_free(p, n * sizeof(T));
+    }
+
+    // Default-initialize (a no-op for float) instead of value-initializing to zero
+    template <typename U> void construct(U* p) noexcept { ::new (static_cast<void*>(p)) U; }
+    template <typename U, typename... Args> void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U> struct rebind { using other = MatrixAllocator<U>; };
+
+    template <typename U> bool operator==(const MatrixAllocator<U>&) const noexcept { return true; }
+    template <typename U> bool operator!=(const MatrixAllocator<U>&) const noexcept { return false; }
+};
+
+// Fills p[0, n) with value on the thread pool, in one contiguous chunk per thread, so
+// the pages of a large matrix are first touched by the threads that will compute on
+// them (and land on their NUMA node). Small ranges are filled on the calling thread.
+// Defined for float, double, std::complex<float> and std::complex<double>.
+template <typename T>
+void fill_first_touch(T* p, std::size_t n, T value);
+
+// Tag for constructing a Matrix without zeroing it: Matrix C(M, N, uninitialized).
+struct Uninitialized {};
+constexpr Uninitialized uninitialized{};
+
+// Non-owning view of a row-major block: element (r, c) lives at data[r * ld + c].
+// Sub-blocks keep the parent's leading dimension, so no data is copied.
+template <typename T>
+struct BasicMatrixView {
+    T* data;
+    size_t rows;
+    size_t cols;
+    size_t ld;
+
+    BasicMatrixView(T* d, size_t r, size_t c, size_t leading) : data(d), rows(r), cols(c), ld(leading) {}
+
+    T& operator()(size_t r, size_t c) const {
+        return data[r * ld + c];
+    }
+
+    BasicMatrixView block(size_t r, size_t c, size_t numRows, size_t numCols) const {
+        if (r + numRows > rows || c + numCols > cols) {
+            throw std::out_of_range("Block exceeds view bounds.");
+        }
+        return BasicMatrixView(data + r * ld + c, numRows, numCols, ld);
+    }
+};
+
+template <typename T>
+struct BasicConstMatrixView {
+    const T* data;
     size_t rows;
     size_t cols;
-    std::vector<float, AlignedAllocator<float, 64>> data;
+    size_t ld;
+
+    BasicConstMatrixView(const T* d, size_t r, size_t c, size_t leading) : data(d), rows(r), cols(c), ld(leading) {}
+    BasicConstMatrixView(const BasicMatrixView<T>& v) : data(v.data), rows(v.rows), cols(v.cols), ld(v.ld) {}
 
-    Matrix(size_t r, size_t c) : rows(r), cols(c), data(r * c, AlignedAllocator<float, 64>()) {
-        std::fill(data.begin(), data.end(), 0.0f);
+    const T& operator()(size_t r, size_t c) const {
+        return data[r * ld + c];
     }
 
-    float& operator()(size_t r, size_t c) {
+    BasicConstMatrixView block(size_t r, size_t c, size_t numRows, size_t numCols) const {
+        if (r + numRows > rows || c + numCols > cols) {
+            throw std::out_of_range("Block exceeds view bounds.");
+        }
+        return BasicConstMatrixView(data + r * ld + c, numRows, numCols, ld);
+    }
+};
+
+using MatrixView = BasicMatrixView<float>;
+using ConstMatrixView = BasicConstMatrixView<float>;
+
+// Leaf of the lazy matrix expressions in expr.h (include it to use them).
+template <typename T>
+struct MatrixTerm;
+
+// Dense row-major matrix of T: float, double, std::complex<float> or std::complex<double>
+// (see the aliases below). Note that std::complex zeroes itself on construction, so
+// an uninitialized complex matrix is still written once by the constructing thread.
+template <typename T>
+struct BasicMatrix {
+    size_t rows;
+    size_t cols;
+    std::vector<T, MatrixAllocator<T>> data;
+
+    // Zero-filled, in parallel for large matrices (see fill_first_touch)
+    BasicMatrix(size_t r, size_t c) : rows(r), cols(c), data(r * c) {
+        fill_first_touch(data.data(), data.size(), T());
+    }
+
+    // Contents are indeterminate: for outputs that a kernel overwrites anyway
+    BasicMatrix(size_t r, size_t c, Uninitialized) : rows(r), cols(c), data(r * c) {}
+
+    // Evaluated from an expression (see expr.h), e.g. Matrix D = A * B + C;
+    template <typename E, typename = typename E::ExprScalar>
+    BasicMatrix(const E& expr) : BasicMatrix(expr.rows(), expr.cols(), uninitialized) {
+        expr.evaluate(view(), T());
+    }
+
+    // Assignment evaluates straight into this matrix, which must already have the
+    // expression's shape: D = A * B + C, D += A.t() * B, D -= 2.0f * E.
+    template <typename E, typename = typename E::ExprScalar>
+    BasicMatrix& operator=(const E& expr) {
+        expr.evaluate(view(), T());
+        return *this;
+    }
+
+    template <typename E, typename = typename E::ExprScalar>
+    BasicMatrix& operator+=(const E& expr) {
+        expr.evaluate(view(), T(1));
+        return *this;
+    }
+
+    template <typename E, typename = typename E::ExprScalar>
+    BasicMatrix& operator-=(const E& expr) {
+        expr.scaled(T(-1)).evaluate(view(), T(1));
+        return *this;
+    }
+
+    // op(*this) = this^T as an expression leaf (defined in expr.h).
+    MatrixTerm<T> t() const;
+
+    T& operator()(size_t r, size_t c) {
         return data[r * cols + c];
     }
 
-    const float& operator()(size_t r, size_t c) const {
+    const T& operator()(size_t r, size_t c) const {
         return data[r * cols + c];
     }
+
+    BasicMatrixView<T> view() {
+        return BasicMatrixView<T>(data.data(), rows, cols, cols);
+    }
+
+    BasicConstMatrixView<T> view() const {
+        return BasicConstMatrixView<T>(data.data(), rows, cols, cols);
+    }
 };
 
-// Naive triple-loop matrix multiplication: C = A * B
-void multiply_naive(const Matrix& A, const Matrix& B, Matrix& C);
+// Named after the BLAS s / d / c / z prefixes.
+using Matrix = BasicMatrix<float>;
+using DMatrix = BasicMatrix<double>;
+using CMatrix = BasicMatrix<std::complex<float>>;
+using ZMatrix = BasicMatrix<std::complex<double>>;
+
+// Naive triple-loop matrix multiplication: C = A * B.
+// Like v1 and v5, defined for every element type of BasicMatrix.
+template <typename T>
+void multiply_naive(const BasicMatrix<T>& A, const BasicMatrix<T>& B, BasicMatrix<T>& C);
 
 // Optimization v1: Loop Reordering (i-k-j) for better cache locality
-void multiply_optimized_v1(const Matrix& A, const Matrix& B, Matrix& C);
+template <typename T>
+void multiply_optimized_v1(const BasicMatrix<T>& A, const BasicMatrix<T>& B, BasicMatrix<T>& C);
 
-// Optimization v2: Tiling (Blocking) to improve temporal cache locality
-void multiply_optimized_v2_tiled(const Matrix& A, const Matrix& B, Matrix& C, size_t blockSize = 32);
+// Optimization v2: Tiling (Blocking) to improve temporal cache locality.
+// blockSize = 0 picks the tuned size for this shape (see tuning.h).
+void multiply_optimized_v2_tiled(const Matrix& A, const Matrix& B, Matrix& C, size_t blockSize = 0);
 
 // Optimization v3: Loop Unrolling (4x) on the i-k-j version
 void multiply_optimized_v3_unrolled(const Matrix& A, const Matrix& B, Matrix& C);
 
-// Optimization v4: SIMD Vectorization (NEON on ARM, AVX2 on x86)
+// Optimization v4: SIMD Vectorization (NEON on ARM, AVX2 on x86 when the CPU supports it)
 void multiply_optimized_v4_simd(const Matrix& A, const Matrix& B, Matrix& C);
 
-// Optimization v5: Multi-threading with std::thread
+// Optimization v5: Multi-threading on the shared ThreadPool (2D tiles of C, work stealing).
+// numThreads caps the pool threads used; 0 uses the whole pool.
+template <typename T>
+void multiply_optimized_v5_threaded(const BasicMatrix<T>& A, const BasicMatrix<T>& B, BasicMatrix<T>& C,
+                                    unsigned int numThreads = 0);
+
+// Plain float overloads of naive, v1 and v5, the signatures these had before they
+// became templates: calls on Matrix pick them, and existing code that takes their
+// address (e.g. as a void (*)(const Matrix&, const Matrix&, Matrix&)) still compiles.
+void multiply_naive(const Matrix& A, const Matrix& B, Matrix& C);
+void multiply_optimized_v1(const Matrix& A, const Matrix& B, Matrix& C);
 void multiply_optimized_v5_threaded(const Matrix& A, const Matrix& B, Matrix& C, unsigned int numThreads = 0);
 
 // Optimization v6: Register Blocking (2x2) to increase arithmetic intensity
 void multiply_optimized_v6_register_blocked_2x2(const Matrix& A, const Matrix& B, Matrix& C);
 
-// Optimization v7: Multi-threading with Register Blocking (2x2)
+// Optimization v7: Multi-threading (shared ThreadPool) with Register Blocking (2x2)
 void multiply_optimized_v7_threaded_register_blocked(const Matrix& A, const Matrix& B, Matrix& C, unsigned int numThreads = 0);
 
 // Optimization v8: Software Prefetching to hide memory latency
@@ -86,4 +268,30 @@ Matrix transpose(const Matrix& M);
 // Optimization v9: Matrix Transposition + i-j-k loop (Dot Product)
 void multiply_optimized_v9_transpose(const Matrix& A, const Matrix& B, Matrix& C);
 
+// Optimization v10: Packed GEMM (Goto/BLIS) with MC/KC/NC cache blocking,
+// aligned packed panels of A and B, and a register-tiled SIMD micro-kernel
+void multiply_optimized_packed(const Matrix& A, const Matrix& B, Matrix& C);
+
+// Optimization v11: Packed GEMM with 2D tiles of C scheduled on the shared ThreadPool
+void multiply_optimized_packed_threaded(const Matrix& A, const Matrix& B, Matrix& C, unsigned int numThreads = 0);
+
+// Strassen-Winograd: 7 half-size products per level instead of 8 (O(n^2.81)), recursing
+// until a dimension is at most `cutoff` (0 = 1024) and then using multiply(). Odd
+// dimensions are peeled off rather than padded. Temporaries come from one scratch
+// buffer reused across calls. With up to 7 threads the top level's 7 products run
+// side by side on the pool; with more they run in turn, each using the whole pool.
+// Rounding error grows with each level, so results differ slightly from multiply().
+void multiply_strassen(const Matrix& A, const Matrix& B, Matrix& C, size_t cutoff = 0);
+
+// Front door: C = A * B with the fastest kernel for the running CPU. The instruction
+// set is picked at startup via cpuid and can be overridden with $MATMUL_ISA; blocking
+// and thread count come from the tuning file (see tuning.h).
+void multiply(const Matrix& A, const Matrix& B, Matrix& C);
+
+// Double and complex C = A * B on the same packed engine (cache blocking, tuning and
+// 2D thread tiles), with register-tiled SIMD micro-kernels computing in that type.
+void multiply(const DMatrix& A, const DMatrix& B, DMatrix& C);
+void multiply(const CMatrix& A, const CMatrix& B, CMatrix& C);
+void multiply(const ZMatrix& A, const ZMatrix& B, ZMatrix& C);
+
 #endif // MATRIX_H
@@ -0,0 +1,136 @@
+#ifndef MATRIX_IO_H
+#define MATRIX_IO_H
+
+#include <complex>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include "matrix.h"
+#include "out_of_core.h"
+
+// Matrix files that are memory-mapped and handed out as views, with no parsing into
+// or copying out of a Matrix. Two formats, chosen by extension:
+//  - ".npy": NumPy arrays (format versions 1-3) of float32, float64, complex64 or
+//    complex128, little-endian, 1-D (read as one row) or 2-D. Fortran-order arrays
+//    are mapped too; their storage is the transpose (see transposed()).
+//  - anything else: this library's binary format, a 64-byte header (magic
+//    "MATMULF\0", version, element type, rows, cols) followed by the row-major data.
+// Both formats are written with the data 64-byte aligned in the file, so views into
+// the mapping are as aligned as a Matrix's own storage.
+
+enum class ElementType {
+    Float32,
+    Float64,
+    Complex64,      // std::complex<float>
+    Complex128      // std::complex<double>
+};
+
+template <typename T>
+struct ElementTypeOf;
+template <>
+struct ElementTypeOf<float> { static constexpr ElementType value = ElementType::Float32; };
+template <>
+struct ElementTypeOf<double> { static constexpr ElementType value = ElementType::Float64; };
+template <>
+struct ElementTypeOf<std::complex<float>> { static constexpr ElementType value = ElementType::Complex64; };
+template <>
+struct ElementTypeOf<std::complex<double>> { static constexpr ElementType value = ElementType::Complex128; };
+
+size_t element_size(ElementType type);
+
+// NumPy-style names: float32, float64, complex64, complex128
+const char* element_type_name(ElementType type);
+
+enum class MatrixFileFormat {
+    Binary,
+    Npy
+};
+
+MatrixFileFormat matrix_file_format(const std::string& path);
+
+// Whether two paths name the same existing file (same device and inode, so links and
+// different spellings of one path match). False if either does not exist.
+bool same_file(const std::string& a, const std::string& b);
+
+// A matrix file mapped into memory. Pages are read on first touch (or by prefault),
+// and written ones go back to the file through the page cache.
+class MatrixFile {
+public:
+    // Maps an existing file. Throws std::runtime_error if it cannot be opened or
+    // mapped, or is not a valid matrix file; std::invalid_argument for MapMode::Create.
+    explicit MatrixFile(const std::string& path, MapMode mode = MapMode::ReadOnly);
+
+    // Creates (or truncates) a file holding a zeroed rows x cols matrix of `type`,
+    // mapped read-write, in the format its extension selects.
+    MatrixFile(const std::string& path, size_t rows, size_t cols, ElementType type);
+
+    ~MatrixFile();
+
+    MatrixFile(MatrixFile&& other) noexcept;
+    MatrixFile& operator=(MatrixFile&& other) noexcept;
+    MatrixFile(const MatrixFile&) = delete;
+    MatrixFile& operator=(const MatrixFile&) = delete;
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    ElementType type() const { return type_; }
+    MatrixFileFormat format() const { return format_; }
+    bool writable() const { return writable_; }
+
+    // True for a Fortran-order .npy file: the stored data is the row-major cols x
+    // rows transpose, and that is what view() returns (pass it to gemm as Trans).
+    bool transposed() const { return transposed_; }
+
+    // The stored matrix, in place. Throws std::invalid_argument if T is not the
+    // file's element type; mutable_view also if the mapping is read-only.
+    template <typename T>
+    BasicConstMatrixView<T> view() const {
+        check_type(ElementTypeOf<T>::value);
+        return BasicConstMatrixView<T>(static_cast<const T*>(data_), stored_rows(), stored_cols(), stored_cols());
+    }
+
+    template <typename T>
+    BasicMatrixView<T> mutable_view() {
+        check_type(ElementTypeOf<T>::value);
+        if (!writable_) {
+            throw std::invalid_argument("Matrix file is mapped read-only.");
+        }
+        return BasicMatrixView<T>(static_cast<T*>(data_), stored_rows(), stored_cols(), stored_cols());
+    }
+
+    // Reads the whole matrix in now (readahead, then one touch per page), so later
+    // accesses neither wait for the disk nor take page faults.
+    void prefault() const;
+
+    // Writes modified pages back; with wait, returns once they are on disk.
+    void flush(bool wait = true);
+
+private:
+    void map(const std::string& path, int fd, size_t fileBytes);
+    void check_type(ElementType type) const;
+    void release() noexcept;
+    size_t stored_rows() const { return transposed_ ? cols_ : rows_; }
+    size_t stored_cols() const { return transposed_ ? rows_ : cols_; }
+
+    size_t rows_ = 0;
+    size_t cols_ = 0;
+    ElementType type_ = ElementType::Float32;
+    MatrixFileFormat format_ = MatrixFileFormat::Binary;
+    bool transposed_ = false;
+    bool writable_ = false;
+    size_t dataOffset_ = 0;
+    void* data_ = nullptr;
+    void* mapBase_ = nullptr;
+    size_t mappedBytes_ = 0;
+};
+
+// Writes m to path (format by extension), creating or truncating it.
+template <typename T>
+void save_matrix(const std::string& path, const BasicConstMatrixView<T>& m);
+
+template <typename T>
+void save_matrix(const std::string& path, const BasicMatrix<T>& m) {
+    save_matrix(path, m.view());
+}
+
+#endif // MATRIX_IO_H
@@ -0,0 +1,73 @@
+#ifndef OUT_OF_CORE_H
+#define OUT_OF_CORE_H
+
+#include <cstddef>
+#include <string>
+#include "matrix.h"
+
+// Out-of-core GEMM on matrices stored in files, for operands larger than RAM.
+// Files hold the raw row-major floats with no header (native byte order).
+
+enum class MapMode {
+    ReadOnly,   // Existing file, mapped read-only
+    ReadWrite,  // Existing file, writes go back to it
+    Create      // New file (truncated if it exists), sized for rows x cols and zeroed
+};
+
+// A rows x cols matrix backed by a memory-mapped file. Pages are loaded on first
+// touch and can be evicted by the kernel, so only the parts in use take memory.
+// Throws std::runtime_error if the file cannot be opened, sized or mapped.
+class MappedMatrix {
+public:
+    MappedMatrix(const std::string& path, size_t rows, size_t cols, MapMode mode = MapMode::ReadOnly);
+    ~MappedMatrix();
+
+    MappedMatrix(MappedMatrix&& other) noexcept;
+    MappedMatrix& operator=(MappedMatrix&& other) noexcept;
+    MappedMatrix(const MappedMatrix&) = delete;
+    MappedMatrix& operator=(const MappedMatrix&) = delete;
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    bool writable() const { return writable_; }
+
+    float* data() { return data_; }
+    const float* data() const { return data_; }
+    MatrixView view() { return MatrixView(data_, rows_, cols_, cols_); }
+    ConstMatrixView view() const { return ConstMatrixView(data_, rows_, cols_, cols_); }
+
+    // Paging hints for the block rows [r0, r1) x cols [c0, c1). will_need starts
+    // reading it in; dont_need drops it from this process's resident set (written
+    // data stays in the page cache until it is flushed).
+    void will_need(size_t r0, size_t r1, size_t c0, size_t c1) const;
+    void dont_need(size_t r0, size_t r1, size_t c0, size_t c1) const;
+
+    // Schedules write-back of rows [r0, r1); with wait, returns once it is on disk.
+    void flush(size_t r0, size_t r1, bool wait = false);
+
+private:
+    void release() noexcept;
+
+    size_t rows_ = 0;
+    size_t cols_ = 0;
+    float* data_ = nullptr;
+    size_t mappedBytes_ = 0;
+    bool writable_ = false;
+};
+
+struct OutOfCoreOptions {
+    size_t memoryBudget = size_t(1) << 30;  // Bytes of A, B and C tiles resident at once
+    bool prefetch = true;                   // Read the next tiles in while computing
+};
+
+// C = A * B, walking the operands in tiles sized to fit the memory budget. Each C
+// tile stays resident while the K loop streams A and B tiles through it; with
+// prefetch, a readahead task faults the next A and B tiles in during the current
+// product. Finished C tiles are flushed and dropped before moving on. The products
+// run on the packed engine, so with I/O keeping up throughput is that of gemm().
+// Throws std::invalid_argument on mismatched shapes, a read-only C, or a budget
+// too small for 64 x 64 tiles.
+void multiply_out_of_core(const MappedMatrix& A, const MappedMatrix& B, MappedMatrix& C,
+                          const OutOfCoreOptions& options = OutOfCoreOptions());
+
+#endif // OUT_OF_CORE_H
@@ -0,0 +1,60 @@
+#ifndef PACKED_MATRIX_H
+#define PACKED_MATRIX_H
+
+#include <cstddef>
+#include <vector>
+#include "cpu_features.h"
+#include "gemm.h"
+#include "matrix.h"
+
+// Right-hand operand packed once into the panel layout of the packed engine's
+// micro-kernel, for B matrices (e.g. weights) reused across many products. The
+// kernel and its kc / nc blocking are fixed when packing, so later changes to the
+// active ISA or the tuning table don't affect an existing PackedMatrix.
+//
+// Immutable after construction: one instance can be used by any number of threads
+// at once. Multiplying against it only packs A.
+class PackedMatrix {
+public:
+    // Packs op(B), where op(B) = B for NoTrans and B^T for Trans, for active_isa().
+    explicit PackedMatrix(const Matrix& B, Transpose trans = Transpose::NoTrans);
+    explicit PackedMatrix(const ConstMatrixView& B, Transpose trans = Transpose::NoTrans);
+
+    // Shape of op(B)
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+
+    CpuIsa isa() const { return isa_; }
+    size_t kc() const { return kc_; }
+    size_t nc() const { return nc_; }
+    const float* data() const { return data_.data(); }
+
+private:
+    size_t rows_;
+    size_t cols_;
+    CpuIsa isa_;
+    size_t kc_;
+    size_t nc_;
+    std::vector<float, MatrixAllocator<float>> data_;
+};
+
+// C = A * B
+void multiply(const Matrix& A, const PackedMatrix& B, Matrix& C);
+
+// C = epilogue(alpha * A * B), e.g. a dense layer with bias and activation.
+void multiply(const Matrix& A, const PackedMatrix& B, Matrix& C, const Epilogue& epilogue, float alpha = 1.0f);
+
+// C[M x N] = alpha * op(A)[M x K] * B[K x N] + beta * C, with K and N taken from B.
+// Same conventions as gemm() in gemm.h.
+void gemm(Transpose transA, size_t M, float alpha, const float* A, size_t lda,
+          const PackedMatrix& B, float beta, float* C, size_t ldc);
+
+// Same with a fused epilogue (see epilogue.h).
+void gemm(Transpose transA, size_t M, float alpha, const float* A, size_t lda,
+          const PackedMatrix& B, float beta, float* C, size_t ldc, const Epilogue& epilogue);
+
+// Same on views.
+void gemm(Transpose transA, float alpha, const ConstMatrixView& A, const PackedMatrix& B,
+          float beta, const MatrixView& C);
+
+#endif // PACKED_MATRIX_H
@@ -0,0 +1,94 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <chrono>
+#include <cstddef>
+#include <vector>
+#include "cpu_features.h"
+
+// Hardware performance counters (Linux perf_event_open) around a region of code,
+// for explaining kernel results with measurements rather than guesses.
+
+enum class PerfEvent {
+    Cycles,
+    Instructions,
+    L1DMisses,      // L1 data cache read misses
+    LLCMisses,      // Last-level cache read misses
+    DTLBMisses,     // Data TLB read misses
+    FpVectorOps,    // Packed single-precision FP instructions (Intel FP_ARITH_INST_RETIRED)
+    TaskClock       // CPU time in ns, summed over threads (a software event)
+};
+
+constexpr int kNumPerfEvents = 7;
+
+const char* perf_event_name(PerfEvent event);
+
+// Counts for one region. Values are summed over threads and scaled up when the
+// kernel had to multiplex the counters.
+struct PerfSample {
+    double seconds = 0.0;                   // Wall time
+    bool valid[kNumPerfEvents] = {};
+    double value[kNumPerfEvents] = {};
+
+    bool has(PerfEvent event) const { return valid[static_cast<int>(event)]; }
+    double operator[](PerfEvent event) const { return value[static_cast<int>(event)]; }
+
+    // Instructions per cycle, or 0 without both counters
+    double ipc() const;
+};
+
+// Counts every event it can open on every thread of the process that exists when
+// it is constructed (so create it after sizing the thread pool). Events that the
+// CPU, a VM without a PMU, or perf_event_paranoid rule out are left invalid; with
+// none available, start() / stop() still measure wall time.
+class PerfCounters {
+public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available(PerfEvent event) const;
+    bool hardware_available() const;
+
+    void start();
+    PerfSample stop();
+
+private:
+    struct Counter {
+        int fd;
+        PerfEvent event;
+    };
+    std::vector<Counter> counters_;
+    std::chrono::steady_clock::time_point begin_;
+};
+
+// Roofline model: a kernel doing `flops` over `bytes` of memory traffic can reach
+// min(peak, intensity * bandwidth).
+struct MachinePeaks {
+    double gflops;      // Peak fp32 throughput
+    double gbps;        // Sustained memory bandwidth
+};
+
+struct RooflinePoint {
+    double intensity;       // flops per byte
+    double attainable;      // GFLOPS the roof allows at this intensity
+    double achieved;        // GFLOPS measured
+    double fraction;        // achieved / attainable
+    bool memoryBound;       // Left of the ridge point
+};
+
+RooflinePoint roofline(double flops, double bytes, double seconds, const MachinePeaks& peaks);
+
+// Peak fp32 GFLOPS of `isa` at `ghz` on `cores` cores, assuming two FMA pipes per
+// core (one add and one multiply pipe for SSE4.2).
+double peak_gflops(CpuIsa isa, double ghz, unsigned int cores);
+
+// Nominal clock from sysfs (cpuinfo_max_freq) or /proc/cpuinfo, 0 if unknown.
+double nominal_ghz();
+
+// Sustained read + write bandwidth of a triad over `bytes` of arrays (well past
+// the LLC by default), run on the thread pool.
+double measure_memory_bandwidth(size_t bytes = size_t(384) << 20);
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,54 @@
+#ifndef QUANTIZED_H
+#define QUANTIZED_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Int8 GEMM with int32 accumulation for affine-quantized operands, where a stored
+// value q stands for the real value scale * (q - zeroPoint). All storage is
+// row-major; lda, ldb and ldc are the distances between consecutive rows.
+//
+// Kernels: AVX-512 VNNI (vpdpbusd) when the CPU has it, AVX2 (vpmaddwd on int16
+// pairs) otherwise on x86, and a portable one elsewhere. Like the float engine,
+// the choice follows active_isa().
+
+// Quantization of one operand. A uses per-row parameters, B per-column ones:
+// `scales` / `zeroPoints` point at one value per row of A (or column of B), or are
+// null to use `scale` / `zeroPoint` for the whole operand.
+struct QuantParams {
+    float scale = 1.0f;
+    int32_t zeroPoint = 0;
+    const float* scales = nullptr;
+    const int32_t* zeroPoints = nullptr;
+
+    float scale_at(size_t i) const { return scales ? scales[i] : scale; }
+    int32_t zero_point_at(size_t i) const { return zeroPoints ? zeroPoints[i] : zeroPoint; }
+};
+
+// C[i][j] = sum_k (A[i][k] - zA[i]) * (B[k][j] - zB[j]), with A M x K and B K x N.
+// Scales are ignored. With zero points in [-128, 127], K up to 32768 cannot overflow.
+void gemm_s8s8s32(size_t M, size_t N, size_t K,
+                  const int8_t* A, size_t lda, const QuantParams& qa,
+                  const int8_t* B, size_t ldb, const QuantParams& qb,
+                  int32_t* C, size_t ldc);
+
+// Dequantizing form: C[i][j] = sA[i] * sB[j] * (the int32 sum above).
+void gemm_s8s8_f32(size_t M, size_t N, size_t K,
+                   const int8_t* A, size_t lda, const QuantParams& qa,
+                   const int8_t* B, size_t ldb, const QuantParams& qb,
+                   float* C, size_t ldc);
+
+// Requantizing form: the dequantized result is quantized again with the per-tensor
+// qc.scale and qc.zeroPoint, rounded to nearest and saturated to [-128, 127].
+void gemm_s8s8_s8(size_t M, size_t N, size_t K,
+                  const int8_t* A, size_t lda, const QuantParams& qa,
+                  const int8_t* B, size_t ldb, const QuantParams& qb,
+                  int8_t* C, size_t ldc, const QuantParams& qc);
+
+// dst[i] = clamp(round(src[i] / scale) + zeroPoint, -128, 127)
+void quantize(const float* src, size_t count, float scale, int32_t zeroPoint, int8_t* dst);
+
+// Name of the int8 micro-kernel used for the active instruction set.
+const char* int8_kernel_name();
+
+#endif // QUANTIZED_H
@@ -0,0 +1,78 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "matrix.h"
+
+// Sparse left-hand operands for sparse x dense products (SpMM): C = A * B with A
+// sparse and B, C dense. Both formats are built from a dense Matrix, dropping
+// entries whose magnitude is at most dropTolerance (0 keeps every nonzero).
+//
+// Products run on the shared ThreadPool in row ranges that hold about the same
+// number of stored values, so a few dense rows don't leave the other threads idle.
+// The kernels keep a strip of each C row in vector registers while they walk the
+// row's nonzeros, and follow active_isa() like the dense ones.
+
+// Compressed sparse row: row i holds values[rowPtr[i] : rowPtr[i + 1]], in
+// increasing column order, with their columns in colIdx.
+class CsrMatrix {
+public:
+    explicit CsrMatrix(const Matrix& A, float dropTolerance = 0.0f);
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    size_t nnz() const { return values_.size(); }
+
+    const std::vector<size_t>& row_ptr() const { return rowPtr_; }
+    const std::vector<uint32_t>& col_idx() const { return colIdx_; }
+    const std::vector<float>& values() const { return values_; }
+
+    Matrix to_dense() const;
+
+private:
+    size_t rows_;
+    size_t cols_;
+    std::vector<size_t> rowPtr_;
+    std::vector<uint32_t> colIdx_;
+    std::vector<float> values_;
+};
+
+// Block sparse row: A is cut into blockRows x blockCols blocks and only blocks with
+// a nonzero are kept, each stored dense and row-major (edge blocks zero-padded).
+// Block row b holds blocks blockPtr[b] : blockPtr[b + 1], whose block columns are
+// in blockCol. Every row of B loaded is reused across the rows of a block, so BSR
+// wins over CSR when the nonzeros come in clusters (e.g. block-pruned weights).
+class BsrMatrix {
+public:
+    explicit BsrMatrix(const Matrix& A, size_t blockRows = 4, size_t blockCols = 4,
+                       float dropTolerance = 0.0f);
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    size_t block_rows() const { return blockRows_; }
+    size_t block_cols() const { return blockCols_; }
+    size_t num_blocks() const { return blockCol_.size(); }
+
+    const std::vector<size_t>& block_ptr() const { return blockPtr_; }
+    const std::vector<uint32_t>& block_col() const { return blockCol_; }
+    const std::vector<float>& values() const { return values_; }
+
+    Matrix to_dense() const;
+
+private:
+    size_t rows_;
+    size_t cols_;
+    size_t blockRows_;
+    size_t blockCols_;
+    std::vector<size_t> blockPtr_;
+    std::vector<uint32_t> blockCol_;
+    std::vector<float> values_;
+};
+
+// C = A * B. numThreads = 0 uses the whole pool.
+void multiply(const CsrMatrix& A, const Matrix& B, Matrix& C, unsigned int numThreads = 0);
+void multiply(const BsrMatrix& A, const Matrix& B, Matrix& C, unsigned int numThreads = 0);
+
+#endif // SPARSE_H
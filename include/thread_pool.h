@@ -0,0 +1,86 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <thread>
+#include <vector>
+#include "topology.h"
+
+// Process-wide pool of persistent worker threads shared by all threaded kernels.
+//
+// Each parallel_for splits its tasks into one contiguous range per participating
+// thread; a thread drains its own range from the front and, once empty, steals
+// from the back of the other ranges. The calling thread always participates, so
+// a pool of N threads owns N - 1 workers. Calls made from inside a running task
+// (nested parallelism) execute serially on the calling thread.
+class ThreadPool {
+public:
+    static ThreadPool& instance();
+
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Resizes the pool. 0 selects the default: $MATMUL_NUM_THREADS if set,
+    // otherwise std::thread::hardware_concurrency().
+    void set_num_threads(unsigned int numThreads);
+    unsigned int num_threads() const { return numThreads_; }
+
+    // Pins the workers to CPUs chosen by `policy` (see topology.h), restarting them.
+    // The default comes from $MATMUL_AFFINITY, else None. The calling thread, which
+    // also runs tasks, is never pinned.
+    void set_affinity(AffinityPolicy policy);
+    AffinityPolicy affinity() const { return affinity_; }
+
+    // Last-level cache domains (sockets / clusters) the pinned workers span, and the
+    // one the calling thread is running in, in [0, num_domains()). Kernels keep one
+    // copy of shared data per domain. Always 1 and 0 when unpinned.
+    unsigned int num_domains() const { return numDomains_; }
+    unsigned int current_domain() const;
+
+    // Runs task(i) for every i in [0, numTasks) on at most maxThreads threads
+    // (0 = whole pool). Rethrows the first exception thrown by a task.
+    void parallel_for(size_t numTasks, const std::function<void(size_t)>& task,
+                      unsigned int maxThreads = 0);
+
+    // Splits [0, rows) x [0, cols) into tileRows x tileCols tiles and runs
+    // tile(rowBegin, rowEnd, colBegin, colEnd) for each of them.
+    void parallel_for_2d(size_t rows, size_t cols, size_t tileRows, size_t tileCols,
+                         const std::function<void(size_t, size_t, size_t, size_t)>& tile,
+                         unsigned int maxThreads = 0);
+
+private:
+    struct Slot;
+
+    ThreadPool();
+    void start(unsigned int numThreads);
+    void stop();
+    void worker_loop(unsigned int id);
+    void run_slots(unsigned int self);
+    bool take_task(unsigned int self, size_t& task);
+
+    unsigned int numThreads_ = 1;
+    AffinityPolicy affinity_ = AffinityPolicy::None;
+    unsigned int numDomains_ = 1;
+    std::vector<int> cpuDomain_;        // Pool domain of each pinned CPU id, -1 if unused
+    std::vector<std::thread> workers_;
+    std::unique_ptr<Slot[]> slots_;
+
+    std::mutex submitMutex_;            // Serializes jobs and resizes
+    std::mutex mutex_;                  // Guards the job state below
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    unsigned long long generation_ = 0;
+    bool stopping_ = false;
+    const std::function<void(size_t)>* job_ = nullptr;
+    unsigned int participants_ = 0;
+    unsigned int busyWorkers_ = 0;
+    std::exception_ptr error_;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,84 @@
+#ifndef TILED_MATRIX_H
+#define TILED_MATRIX_H
+
+#include <cstddef>
+#include <vector>
+#include "chain.h"
+#include "matrix.h"
+
+// Tiled storage: the matrix is cut into tile x tile blocks, each stored contiguously
+// and row-major (edge tiles zero-padded to full size), so a block of B used by a
+// kernel is one run of memory instead of `tile` rows a whole row-major stride apart,
+// touching a few pages rather than one page (and TLB entry) per row.
+//
+// The tiles themselves are laid out either row by row (block-major) or in Morton
+// (Z) order of their grid coordinates, which keeps every aligned 2^k x 2^k group of
+// tiles contiguous: each level of the recursive multiply below then works on a
+// compact range of memory whatever its size, which is what makes it cache-oblivious.
+enum class TileOrder {
+    RowMajor,
+    Morton
+};
+
+class TiledMatrix {
+public:
+    // 64 KiB per tile: the three tiles of a leaf product stay in L2
+    static constexpr size_t kDefaultTile = 128;
+
+    // Zero-filled
+    TiledMatrix(size_t rows, size_t cols, TileOrder order = TileOrder::Morton,
+                size_t tile = kDefaultTile);
+
+    // Converted from row-major, in parallel on the shared ThreadPool.
+    explicit TiledMatrix(const Matrix& A, TileOrder order = TileOrder::Morton, size_t tile = kDefaultTile);
+    explicit TiledMatrix(const ConstMatrixView& A, TileOrder order = TileOrder::Morton,
+                         size_t tile = kDefaultTile);
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    size_t tile() const { return tile_; }
+    TileOrder order() const { return order_; }
+
+    // Shape of the tile grid
+    size_t tile_rows() const { return tileRows_; }
+    size_t tile_cols() const { return tileCols_; }
+
+    // The tile x tile block at grid position (tr, tc), row-major with stride tile().
+    float* tile_data(size_t tr, size_t tc) { return data_.data() + tileOffset_[tr * tileCols_ + tc]; }
+    const float* tile_data(size_t tr, size_t tc) const { return data_.data() + tileOffset_[tr * tileCols_ + tc]; }
+
+    float operator()(size_t r, size_t c) const {
+        return tile_data(r / tile_, c / tile_)[(r % tile_) * tile_ + c % tile_];
+    }
+
+    // Back to row-major at the edges of a tiled computation, in parallel.
+    Matrix to_matrix() const;
+    void copy_to(const MatrixView& out) const;
+
+private:
+    size_t rows_;
+    size_t cols_;
+    size_t tile_;
+    TileOrder order_;
+    size_t tileRows_;
+    size_t tileCols_;
+    std::vector<size_t> tileOffset_;    // Floats from data_ to tile (tr, tc), row-major over the grid
+    std::vector<float, MatrixAllocator<float>> data_;
+};
+
+// C = A * B, natively on the tiled layout with a cache-oblivious recursion: the
+// largest of the three tile-grid dimensions is halved until a single tile product
+// is left, which runs on the packed engine against B's tiles packed once per call
+// (A's are packed by each leaf). Halves of C are independent and run as
+// pool tasks; halves of the inner dimension run in order into the same C. C must
+// have A's rows and B's columns, and all three the same tile size (any order).
+// Throws std::invalid_argument otherwise.
+void multiply(const TiledMatrix& A, const TiledMatrix& B, TiledMatrix& C);
+
+// Chain product kept in the tiled layout end to end: the plan (see chain.h) is made
+// for the factors' shapes and every intermediate is a TiledMatrix, so only the
+// caller's conversions touch row-major storage. C must not be one of the factors.
+void multiply_chain(const std::vector<const TiledMatrix*>& factors, TiledMatrix& C);
+void multiply_chain(const std::vector<const TiledMatrix*>& factors, TiledMatrix& C, const ChainPlan& plan);
+
+#endif // TILED_MATRIX_H
@@ -0,0 +1,43 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <vector>
+
+// CPU topology of the machine, read from /sys/devices/system/cpu and restricted to
+// the CPUs this process may run on (sched_getaffinity, so cgroups and taskset are
+// honoured). Without sysfs every CPU counts as its own core on one package.
+struct LogicalCpu {
+    unsigned int id;        // OS CPU number, as used by pthread_setaffinity_np
+    unsigned int core;      // Physical core, numbered 0..numCores - 1
+    unsigned int package;   // Socket, numbered 0..numPackages - 1
+    unsigned int domain;    // Last-level cache domain (L3, or cluster / socket without one)
+};
+
+struct CpuTopology {
+    std::vector<LogicalCpu> cpus;   // Ordered by domain, then core, then SMT sibling
+    unsigned int numCores = 0;
+    unsigned int numPackages = 0;
+    unsigned int numDomains = 0;
+};
+
+const CpuTopology& cpu_topology();
+
+// Where the pool's threads are pinned.
+enum class AffinityPolicy {
+    None,           // Not pinned: the OS places and migrates threads (default)
+    Cores,          // One thread per physical core; SMT siblings only once every core has one
+    Compact,        // Fill each core's SMT siblings, then the next core, one cache domain at a time
+    Scatter         // Round-robin over cache domains (sockets / clusters), one per core first
+};
+
+// CPU ids for threads 0..numThreads-1 under `policy` (empty for None). Threads
+// beyond the number of CPUs wrap around.
+std::vector<unsigned int> affinity_plan(const CpuTopology& topology, AffinityPolicy policy,
+                                        unsigned int numThreads);
+
+const char* affinity_name(AffinityPolicy policy);
+
+// Parses the names accepted by $MATMUL_AFFINITY (none, cores, compact, scatter).
+bool parse_affinity(const char* name, AffinityPolicy& policy);
+
+#endif // TOPOLOGY_H
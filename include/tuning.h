@@ -0,0 +1,63 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include "cpu_features.h"
+
+// Data cache sizes in bytes, read from /sys/devices/system/cpu/cpu0/cache.
+// Falls back to 32 KiB / 256 KiB / 8 MiB when sysfs is unavailable.
+struct CacheSizes {
+    size_t l1d;
+    size_t l2;
+    size_t l3;
+};
+
+const CacheSizes& cache_sizes();
+
+// Problem shapes that want different blocking.
+enum class ShapeClass {
+    Small,      // Every dimension fits comfortably in cache
+    Medium,
+    Large,
+    FewRows,    // M much smaller than N (short and wide C)
+    FewCols,    // N much smaller than M (tall and skinny C)
+    DeepK       // K much larger than M and N
+};
+
+constexpr int kNumShapeClasses = 6;
+
+ShapeClass classify_shape(size_t M, size_t N, size_t K);
+const char* shape_class_name(ShapeClass shape);
+
+// Blocking parameters for one (instruction set, shape class) pair.
+struct TuningParams {
+    size_t mc;              // Packed engine: rows of A per L2 block
+    size_t kc;              // Packed engine: depth of the packed panels
+    size_t nc;              // Packed engine: columns of B per L3 block
+    size_t blockSize;       // multiply_optimized_v2_tiled tile size
+    unsigned int threads;   // Threads for the threaded kernels (0 = whole pool)
+};
+
+// Analytic defaults derived from cache_sizes() and the micro-kernel's tile shape.
+TuningParams default_tuning(CpuIsa isa, ShapeClass shape);
+
+// Parameters for an M x N x K product on active_isa(). The tuning file is loaded
+// on first use; shapes without a tuned entry get default_tuning().
+TuningParams tuned_params(size_t M, size_t N, size_t K);
+
+// $MATMUL_TUNING_FILE, else $HOME/.cache/matmul_tuning.txt, else ./matmul_tuning.txt.
+std::string tuning_file_path();
+
+// Replaces the in-memory tuning table with the contents of `path`. Called before
+// first use, it also stops the default file from being loaded over it.
+// Returns false if the file can't be read.
+bool load_tuning_file(const std::string& path);
+
+// Times candidate block sizes and thread counts for every shape class on
+// active_isa(), installs the winners and writes them to `path`. Progress goes to `log`.
+// Returns false if the file can't be written.
+bool autotune(const std::string& path, std::ostream& log);
+
+#endif // TUNING_H
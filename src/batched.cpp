@@ -0,0 +1,218 @@
+#include "gemm.h"
+#include "gemm_internal.h"
+#include "thread_pool.h"
+#include "tuning.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+using SmallKernelFn = void (*)(float alpha, const float* A, size_t lda, const float* B, size_t ldb,
+                               float beta, float* C, size_t ldc);
+
+// Sizes with a compile-time specialized kernel, for each of M, N and K.
+constexpr size_t kSmallSizes[] = {4, 8, 16, 32};
+constexpr size_t kNumSmallSizes = 4;
+
+using SmallKernelTable = SmallKernelFn[kNumSmallSizes][kNumSmallSizes][kNumSmallSizes];
+
+int small_size_index(size_t n) {
+    for (size_t i = 0; i < kNumSmallSizes; ++i) {
+        if (kSmallSizes[i] == n) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+// One row of an N-wide C block as a GCC vector, lowered to the target's registers.
+template <size_t N>
+struct RowVec {
+    typedef float type __attribute__((vector_size(N * sizeof(float))));
+};
+
+// Rows of C to keep in registers: as many as fit in ~12 vector registers of
+// RegBytes each (powers of two only, so they divide M).
+constexpr size_t small_row_block(size_t N, size_t RegBytes) {
+    size_t regsPerRow = (N * sizeof(float) + RegBytes - 1) / RegBytes;
+    size_t fit = 12 / regsPerRow;
+    return fit >= 4 ? 4 : (fit >= 2 ? 2 : 1);
+}
+
+// C = alpha * A * B + beta * C with every trip count known at compile time: the K
+// loop is unrolled and each block of RB rows of C stays in registers across it.
+template <size_t M, size_t N, size_t K, size_t RegBytes>
+inline __attribute__((always_inline))
+void small_gemm_body(float alpha, const float* A, size_t lda, const float* B, size_t ldb,
+                     float beta, float* C, size_t ldc) {
+    using Vec = typename RowVec<N>::type;
+    constexpr size_t RB = small_row_block(N, RegBytes); // Rows sharing each B row load
+    static_assert(M % RB == 0, "M must be a multiple of the row block");
+
+    for (size_t i0 = 0; i0 < M; i0 += RB) {
+        Vec acc[RB] = {};
+#pragma GCC unroll 32
+        for (size_t k = 0; k < K; ++k) {
+            Vec b;
+            std::memcpy(&b, B + k * ldb, sizeof(Vec));
+            for (size_t r = 0; r < RB; ++r) {
+                acc[r] += A[(i0 + r) * lda + k] * b;
+            }
+        }
+        for (size_t r = 0; r < RB; ++r) {
+            float* c_row = C + (i0 + r) * ldc;
+            Vec out = alpha * acc[r];
+            if (beta != 0.0f) {
+                Vec c;
+                std::memcpy(&c, c_row, sizeof(Vec));
+                out += beta * c;
+            }
+            std::memcpy(c_row, &out, sizeof(Vec));
+        }
+    }
+}
+
+// One instantiation set per instruction set; the body is inlined into each and
+// compiled for that target.
+struct GenericSmall {
+    template <size_t M, size_t N, size_t K>
+    static void run(float alpha, const float* A, size_t lda, const float* B, size_t ldb,
+                    float beta, float* C, size_t ldc) {
+        small_gemm_body<M, N, K, 16>(alpha, A, lda, B, ldb, beta, C, ldc);
+    }
+};
+
+#if defined(__x86_64__) || defined(_M_X64)
+struct Avx2Small {
+    template <size_t M, size_t N, size_t K>
+    __attribute__((target("avx2,fma")))
+    static void run(float alpha, const float* A, size_t lda, const float* B, size_t ldb,
+                    float beta, float* C, size_t ldc) {
+        small_gemm_body<M, N, K, 32>(alpha, A, lda, B, ldb, beta, C, ldc);
+    }
+};
+
+struct Avx512Small {
+    template <size_t M, size_t N, size_t K>
+    __attribute__((target("avx512f")))
+    static void run(float alpha, const float* A, size_t lda, const float* B, size_t ldb,
+                    float beta, float* C, size_t ldc) {
+        small_gemm_body<M, N, K, 64>(alpha, A, lda, B, ldb, beta, C, ldc);
+    }
+};
+#endif
+
+template <typename Isa, size_t IM, size_t IN, size_t... IK>
+void fill_k(SmallKernelTable& table, std::index_sequence<IK...>) {
+    ((table[IM][IN][IK] = &Isa::template run<kSmallSizes[IM], kSmallSizes[IN], kSmallSizes[IK]>), ...);
+}
+
+template <typename Isa, size_t IM, size_t... IN>
+void fill_n(SmallKernelTable& table, std::index_sequence<IN...>) {
+    (fill_k<Isa, IM, IN>(table, std::make_index_sequence<kNumSmallSizes>{}), ...);
+}
+
+template <typename Isa, size_t... IM>
+void fill_m(SmallKernelTable& table, std::index_sequence<IM...>) {
+    (fill_n<Isa, IM>(table, std::make_index_sequence<kNumSmallSizes>{}), ...);
+}
+
+template <typename Isa>
+struct SmallKernels {
+    SmallKernelTable table;
+    SmallKernels() {
+        fill_m<Isa>(table, std::make_index_sequence<kNumSmallSizes>{});
+    }
+};
+
+// Specialized kernel for this shape on the active ISA, or nullptr.
+SmallKernelFn find_small_kernel(Transpose transA, Transpose transB, size_t M, size_t N, size_t K) {
+    if (transA != Transpose::NoTrans || transB != Transpose::NoTrans) return nullptr;
+    int im = small_size_index(M), in = small_size_index(N), ik = small_size_index(K);
+    if (im < 0 || in < 0 || ik < 0) return nullptr;
+
+    switch (active_isa()) {
+#if defined(__x86_64__) || defined(_M_X64)
+        case CpuIsa::AVX512: {
+            static const SmallKernels<Avx512Small> kernels;
+            return kernels.table[im][in][ik];
+        }
+        case CpuIsa::AVX2: {
+            static const SmallKernels<Avx2Small> kernels;
+            return kernels.table[im][in][ik];
+        }
+#endif
+        default: {
+            static const SmallKernels<GenericSmall> kernels;
+            return kernels.table[im][in][ik];
+        }
+    }
+}
+
+// Runs every batch entry (entry(i, A, B, C) yields its operands), in parallel across the batch. Entries are
+// grouped so each pool task does enough work to amortize scheduling.
+template <typename Entry>
+void run_batch(Transpose transA, Transpose transB, size_t M, size_t N, size_t K, float alpha,
+               size_t lda, size_t ldb, float beta, size_t ldc, size_t batchCount, Entry&& entry) {
+    bool tA = (transA == Transpose::Trans);
+    bool tB = (transB == Transpose::Trans);
+    if (lda < (tA ? M : K) || ldb < (tB ? K : N) || ldc < N) {
+        throw std::invalid_argument("Leading dimension too small.");
+    }
+    if (batchCount == 0 || M == 0 || N == 0) return;
+
+    // Resolved once for the whole batch
+    SmallKernelFn small = find_small_kernel(transA, transB, M, N, K);
+    TuningParams p = tuned_params(M, N, K);
+    gemm_detail::MicroKernel uk = gemm_detail::with_blocking(gemm_detail::select_micro_kernel(), p.mc, p.kc, p.nc);
+
+    auto one = [&](size_t i) {
+        const float* A;
+        const float* B;
+        float* C;
+        entry(i, A, B, C);
+        if (small) {
+            small(alpha, A, lda, B, ldb, beta, C, ldc);
+        } else {
+            gemm_detail::gemm_packed(uk, M, N, K, alpha, gemm_detail::Operand::of(A, lda, tA),
+                                     gemm_detail::Operand::of(B, ldb, tB), beta, C, ldc);
+        }
+    };
+
+    const double minTaskFlops = 1 << 18;
+    double entryFlops = 2.0 * M * N * std::max<size_t>(K, 1);
+    size_t perTask = std::max<size_t>(1, static_cast<size_t>(minTaskFlops / entryFlops));
+    size_t numTasks = (batchCount + perTask - 1) / perTask;
+
+    ThreadPool::instance().parallel_for(numTasks, [&](size_t t) {
+        size_t end = std::min(batchCount, (t + 1) * perTask);
+        for (size_t i = t * perTask; i < end; ++i) {
+            one(i);
+        }
+    });
+}
+
+} // namespace
+
+void gemm_batch(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+                float alpha, const float* const* A, size_t lda, const float* const* B, size_t ldb,
+                float beta, float* const* C, size_t ldc, size_t batchCount) {
+    run_batch(transA, transB, M, N, K, alpha, lda, ldb, beta, ldc, batchCount,
+              [&](size_t i, const float*& a, const float*& b, float*& c) {
+        a = A[i];
+        b = B[i];
+        c = C[i];
+    });
+}
+
+void gemm_batch_strided(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+                        float alpha, const float* A, size_t lda, size_t strideA,
+                        const float* B, size_t ldb, size_t strideB,
+                        float beta, float* C, size_t ldc, size_t strideC, size_t batchCount) {
+    run_batch(transA, transB, M, N, K, alpha, lda, ldb, beta, ldc, batchCount,
+              [&](size_t i, const float*& a, const float*& b, float*& c) {
+        a = A + i * strideA;
+        b = B + i * strideB;
+        c = C + i * strideC;
+    });
+}
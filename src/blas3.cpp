@@ -0,0 +1,361 @@
+#include "gemm.h"
+#include "gemm_internal.h"
+#include "thread_pool.h"
+#include "tuning.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+using gemm_detail::MicroKernel;
+using gemm_detail::Operand;
+
+namespace {
+
+// Diagonal stretches (SYRK rows, TRMM rows or columns) of at most this many are
+// computed in scratch, wasting the flops on the other triangle; longer ones are split
+// in two, recursively, so the wasted sliver stays thin.
+constexpr size_t kDiagonalRows = 64;
+
+// Block size for mirroring a triangle across the diagonal
+constexpr size_t kMirrorBlock = 64;
+
+// A tile [i0, i1) x [j0, j1) of C and its share of the flops.
+struct Tile {
+    size_t i0, i1, j0, j1;
+    double work;
+};
+
+Operand transposed(Operand X) {
+    return {X.data, X.cs, X.rs};
+}
+
+MicroKernel kernel_for(size_t M, size_t N, size_t K, unsigned int& threads) {
+    TuningParams p = tuned_params(M, N, K);
+    threads = gemm_detail::thread_budget(p.threads);
+    return gemm_detail::with_blocking(gemm_detail::select_micro_kernel(), p.mc, p.kc, p.nc);
+}
+
+// Tiles of the `lower` or upper triangle of an N x N C: strips of nb rows (a
+// multiple of mr, at most an L2 block), each cut into the stretch around its diagonal
+// block and chunks of the columns off it (multiples of nr). A single thread takes
+// whole strips; several get smaller pieces, a few each.
+std::vector<Tile> triangle_tiles(const MicroKernel& uk, bool lower, size_t N, unsigned int threads) {
+    size_t nb = uk.mc, cw = N;
+    if (threads > 1) {
+        const double area = double(N) * N / 2 / (4.0 * threads);
+        nb = std::min(uk.mc, std::max(uk.mr, size_t(std::sqrt(area)) / uk.mr * uk.mr));
+        cw = std::min(uk.nc, std::max(uk.nr, size_t(area / nb) / uk.nr * uk.nr));
+    }
+    std::vector<Tile> tiles;
+    for (size_t i0 = 0; i0 < N; i0 += nb) {
+        const size_t i1 = std::min(N, i0 + nb), rows = i1 - i0;
+        const size_t d0 = i0 / uk.nr * uk.nr, d1 = std::min(N, (i1 + uk.nr - 1) / uk.nr * uk.nr);
+        tiles.push_back({i0, i1, d0, d1, 0.5 * double(rows) * (d1 - d0)});
+        const size_t begin = lower ? 0 : d1, end = lower ? d0 : N;
+        for (size_t j0 = begin; j0 < end; j0 += cw) {
+            const size_t j1 = std::min(end, j0 + cw);
+            tiles.push_back({i0, i1, j0, j1, double(rows) * (j1 - j0)});
+        }
+    }
+    return tiles;
+}
+
+// 2D tiles for an M x N product whose Left (rows) or Right (columns) side indexes a
+// structured operand; that side is capped near an L2 block so the diagonal block
+// SYMM expands fits in scratch.
+std::vector<Tile> output_tiles(const MicroKernel& uk, Side side, size_t M, size_t N, unsigned int threads) {
+    const size_t diagonalCap = (uk.mc + uk.nr - 1) / uk.nr * uk.nr;
+    size_t tileRows, tileCols;
+    gemm_detail::choose_thread_tiles(uk.mr, uk.nr, uk.mc, side == Side::Left ? uk.nc : diagonalCap, M, N, threads,
+                                     tileRows, tileCols);
+    std::vector<Tile> tiles;
+    for (size_t i0 = 0; i0 < M; i0 += tileRows) {
+        for (size_t j0 = 0; j0 < N; j0 += tileCols) {
+            tiles.push_back({i0, std::min(M, i0 + tileRows), j0, std::min(N, j0 + tileCols), 0.0});
+        }
+    }
+    return tiles;
+}
+
+// Runs the tiles on the pool. The pool gives each thread a contiguous range of task
+// indices and lets idle threads steal from the back of the others' ranges, so the
+// tiles are dealt heaviest first in snake order: every range starts with an equal
+// mix of heavy and light tiles, and the light ones left at the ends are stolen.
+void run_tiles(std::vector<Tile>& tiles, unsigned int threads, const std::function<void(const Tile&)>& fn) {
+    std::stable_sort(tiles.begin(), tiles.end(), [](const Tile& a, const Tile& b) { return a.work > b.work; });
+    const size_t parts = std::max<size_t>(1, std::min<size_t>(threads, tiles.size()));
+    std::vector<std::vector<size_t>> ranges(parts);
+    for (size_t k = 0; k < tiles.size(); ++k) {
+        const size_t round = k / parts, pos = k % parts;
+        ranges[(round % 2) ? parts - 1 - pos : pos].push_back(k);
+    }
+    std::vector<size_t> order;
+    for (const auto& range : ranges) order.insert(order.end(), range.begin(), range.end());
+    ThreadPool::instance().parallel_for(order.size(), [&](size_t t) { fn(tiles[order[t]]); }, threads);
+}
+
+// Thread-local scratch for one expanded diagonal block
+float* diagonal_scratch(size_t floats) {
+    thread_local std::vector<float> scratch;
+    if (scratch.size() < floats) scratch.resize(floats);
+    return scratch.data();
+}
+
+// SYRK against op(A)^T packed whole, so its panels are packed once rather than per
+// tile. run(r0, r1, edge) does rows [r0, r1) of the lower triangle from column `edge`
+// (a multiple of nr) up to the diagonal, or of the upper one from the diagonal up to
+// `edge`: columns clear of the diagonal's packed panels go straight into C, the rest
+// into scratch, of which only the triangle is stored.
+struct SyrkStrips {
+    const gemm_detail::PackedB& Y;
+    Operand X;
+    bool lower;
+    size_t N;
+    float alpha;
+    float beta;
+    float* C;
+    size_t ldc;
+
+    void run(size_t r0, size_t r1, size_t edge) const {
+        const size_t nr = Y.uk.nr, rows = r1 - r0;
+        const size_t d0 = r0 / nr * nr, d1 = std::min(N, (r1 + nr - 1) / nr * nr);
+        if (lower && edge < d0) {
+            gemm_detail::gemm_prepacked(rows, d0 - edge, edge, alpha, X.offset(r0, 0), Y, beta,
+                                        C + r0 * ldc + edge, ldc);
+        } else if (!lower && d1 < edge) {
+            gemm_detail::gemm_prepacked(rows, edge - d1, d1, alpha, X.offset(r0, 0), Y, beta,
+                                        C + r0 * ldc + d1, ldc);
+        }
+        if (rows > kDiagonalRows) {
+            const size_t mid = r0 + (rows / 2 + Y.uk.mr - 1) / Y.uk.mr * Y.uk.mr;
+            run(r0, mid, lower ? d0 : d1);
+            run(mid, r1, lower ? d0 : d1);
+            return;
+        }
+        const size_t width = d1 - d0;
+        float* tile = diagonal_scratch(rows * width);
+        gemm_detail::gemm_prepacked(rows, width, d0, alpha, X.offset(r0, 0), Y, 0.0f, tile, width);
+        for (size_t i = 0; i < rows; ++i) {
+            const size_t row = r0 + i;
+            float* c = C + row * ldc;
+            const float* t = tile + i * width - d0;
+            const size_t jBegin = lower ? d0 : row, jEnd = lower ? row + 1 : d1;
+            for (size_t j = jBegin; j < jEnd; ++j) c[j] = (beta == 0.0f) ? t[j] : t[j] + beta * c[j];
+        }
+    }
+};
+
+// Copies the computed triangle of C onto the other one, a block at a time so the
+// rows read and the rows written both stay in cache.
+void mirror_triangle(bool lower, size_t N, float* C, size_t ldc, unsigned int threads) {
+    const size_t bands = (N + kMirrorBlock - 1) / kMirrorBlock;
+    ThreadPool::instance().parallel_for(bands, [&](size_t b) {
+        const size_t r0 = b * kMirrorBlock, r1 = std::min(N, r0 + kMirrorBlock);
+        const size_t cBegin = lower ? r0 : 0, cEnd = lower ? N : r1;
+        for (size_t c0 = cBegin; c0 < cEnd; c0 += kMirrorBlock) {
+            const size_t c1 = std::min(cEnd, c0 + kMirrorBlock);
+            for (size_t i = r0; i < r1; ++i) {
+                const size_t jBegin = lower ? std::max(c0, i + 1) : c0;
+                const size_t jEnd = lower ? c1 : std::min(c1, i);
+                for (size_t j = jBegin; j < jEnd; ++j) C[i * ldc + j] = C[j * ldc + i];
+            }
+        }
+    }, threads);
+}
+
+// Symmetric A's diagonal block [k0, k0 + n)^2, both triangles, read from one.
+void expand_symmetric(bool lower, const float* A, size_t lda, size_t k0, size_t n, float* dst) {
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            const bool stored = lower ? (i >= j) : (i <= j);
+            dst[i * n + j] = stored ? A[(k0 + i) * lda + k0 + j] : A[(k0 + j) * lda + k0 + i];
+        }
+    }
+}
+
+// op(A)'s diagonal block [k0, k0 + n)^2 with zeros off its triangle (and ones on the
+// diagonal for a unit triangle, which is then not read).
+void expand_triangular(bool lower, Operand opA, size_t k0, size_t n, bool unit, float* dst) {
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            float v = 0.0f;
+            if (i == j && unit) {
+                v = 1.0f;
+            } else if (lower ? j <= i : j >= i) {
+                v = opA.data[(k0 + i) * opA.rs + (k0 + j) * opA.cs];
+            }
+            dst[i * n + j] = v;
+        }
+    }
+}
+
+// TRMM on a tile of C: run(s0, s1, edge, beta) covers indices [s0, s1) of its
+// triangle side (rows of C for Left, columns for Right) and [o0, o1) of the other.
+// op(A) is dense from `edge` up to the diagonal block, or from it up to `edge`; that
+// part is one product, and the diagonal block is split in two, recursively, down to
+// blocks small enough to expand into scratch with their zeros.
+struct TrmmStrips {
+    const MicroKernel& uk;
+    Operand opA;
+    Operand B;
+    bool left;
+    bool lower;     // Of op(A)
+    bool unit;
+    float alpha;
+    float* C;
+    size_t ldc;
+    size_t o0;
+    size_t o1;
+
+    // The [s0, s1) x [o0, o1) part of C += op(A) restricted to k in [k0, k1), with
+    // `a` positioned at op(A)'s (s0, k0) (Left) or (k0, s0) (Right)
+    void product(size_t s0, size_t s1, size_t k0, size_t k1, Operand a, float beta) const {
+        if (left) {
+            gemm_detail::gemm_packed(uk, s1 - s0, o1 - o0, k1 - k0, alpha, a, B.offset(k0, o0), beta,
+                                     C + s0 * ldc + o0, ldc);
+        } else {
+            gemm_detail::gemm_packed(uk, o1 - o0, s1 - s0, k1 - k0, alpha, B.offset(o0, k0), a, beta,
+                                     C + o0 * ldc + s0, ldc);
+        }
+    }
+
+    void run(size_t s0, size_t s1, size_t edge, float beta) const {
+        // Left-lower and Right-upper read op(A) before the diagonal block, the others after
+        const bool before = (left == lower);
+        const size_t k0 = before ? edge : s1, k1 = before ? s0 : edge;
+        if (k0 < k1) {
+            product(s0, s1, k0, k1, left ? opA.offset(s0, k0) : opA.offset(k0, s0), beta);
+            beta = 1.0f;
+        }
+        const size_t n = s1 - s0;
+        if (n > kDiagonalRows) {
+            const size_t step = left ? uk.mr : uk.nr;
+            const size_t mid = s0 + (n / 2 + step - 1) / step * step;
+            run(s0, mid, before ? s0 : s1, beta);
+            run(mid, s1, before ? s0 : s1, beta);
+            return;
+        }
+        float* diagonal = diagonal_scratch(n * n);
+        expand_triangular(lower, opA, s0, n, unit, diagonal);
+        product(s0, s1, s0, s1, Operand::of(diagonal, n, false), beta);
+    }
+};
+
+} // namespace
+
+void syrk(Uplo uplo, Transpose trans, size_t N, size_t K, float alpha, const float* A, size_t lda,
+          float beta, float* C, size_t ldc, bool mirror) {
+    const bool tA = (trans == Transpose::Trans);
+    if (lda < (tA ? N : K) || ldc < N) {
+        throw std::invalid_argument("Leading dimension too small.");
+    }
+    if (N == 0) return;
+
+    unsigned int threads;
+    const MicroKernel uk = kernel_for(N, N, K, threads);
+    const bool lower = (uplo == Uplo::Lower);
+    const Operand X = Operand::of(A, lda, tA);
+    std::vector<float, MatrixAllocator<float>> packed(gemm_detail::PackedB::size(uk, K, N));
+    gemm_detail::pack_b_whole(uk, K, N, transposed(X), packed.data());
+    const gemm_detail::PackedB Y{uk, K, N, packed.data()};
+    const SyrkStrips strips{Y, X, lower, N, alpha, beta, C, ldc};
+
+    std::vector<Tile> tiles = triangle_tiles(uk, lower, N, threads);
+    run_tiles(tiles, threads, [&](const Tile& t) {
+        if (t.j0 < t.i1 && t.i0 < t.j1) {
+            strips.run(t.i0, t.i1, lower ? t.j0 : t.j1);
+        } else {
+            gemm_detail::gemm_prepacked(t.i1 - t.i0, t.j1 - t.j0, t.j0, alpha, X.offset(t.i0, 0), Y, beta,
+                                        C + t.i0 * ldc + t.j0, ldc);
+        }
+    });
+    if (mirror) mirror_triangle(lower, N, C, ldc, threads);
+}
+
+void symm(Side side, Uplo uplo, size_t M, size_t N, float alpha, const float* A, size_t lda,
+          const float* B, size_t ldb, float beta, float* C, size_t ldc) {
+    const bool left = (side == Side::Left);
+    if (lda < (left ? M : N) || ldb < N || ldc < N) {
+        throw std::invalid_argument("Leading dimension too small.");
+    }
+    if (M == 0 || N == 0) return;
+
+    unsigned int threads;
+    const size_t order = left ? M : N;
+    const MicroKernel uk = kernel_for(M, N, order, threads);
+    const bool lower = (uplo == Uplo::Lower);
+
+    // A(i, k) off the diagonal block comes from the stored triangle or its mirror:
+    // `before` for k < i, `after` for k > i
+    const Operand stored = Operand::of(A, lda, false);
+    const Operand before = lower ? stored : transposed(stored);
+    const Operand after = lower ? transposed(stored) : stored;
+    const Operand Bop = Operand::of(B, ldb, false);
+
+    std::vector<Tile> tiles = output_tiles(uk, side, M, N, threads);
+    run_tiles(tiles, threads, [&](const Tile& t) {
+        const size_t rows = t.i1 - t.i0, cols = t.j1 - t.j0;
+        float* c = C + t.i0 * ldc + t.j0;
+        // The diagonal block of A is expanded to full, the rest read in place
+        const size_t k0 = left ? t.i0 : t.j0, k1 = left ? t.i1 : t.j1, n = k1 - k0;
+        float* diagonal = diagonal_scratch(n * n);
+        expand_symmetric(lower, A, lda, k0, n, diagonal);
+        const Operand D = Operand::of(diagonal, n, false);
+        if (left) {
+            gemm_detail::gemm_packed(uk, rows, cols, n, alpha, D, Bop.offset(k0, t.j0), beta, c, ldc);
+            if (k0 > 0) {
+                gemm_detail::gemm_packed(uk, rows, cols, k0, alpha, before.offset(k0, 0), Bop.offset(0, t.j0),
+                                         1.0f, c, ldc);
+            }
+            if (k1 < M) {
+                gemm_detail::gemm_packed(uk, rows, cols, M - k1, alpha, after.offset(k0, k1), Bop.offset(k1, t.j0),
+                                         1.0f, c, ldc);
+            }
+        } else {
+            // C = B * A: rows k < j of A's columns are `after`'s mirror image, and so on
+            gemm_detail::gemm_packed(uk, rows, cols, n, alpha, Bop.offset(t.i0, k0), D, beta, c, ldc);
+            if (k0 > 0) {
+                gemm_detail::gemm_packed(uk, rows, cols, k0, alpha, Bop.offset(t.i0, 0), after.offset(0, k0),
+                                         1.0f, c, ldc);
+            }
+            if (k1 < N) {
+                gemm_detail::gemm_packed(uk, rows, cols, N - k1, alpha, Bop.offset(t.i0, k1), before.offset(k1, k0),
+                                         1.0f, c, ldc);
+            }
+        }
+    });
+}
+
+void trmm(Side side, Uplo uplo, Transpose transA, Diag diag, size_t M, size_t N, float alpha,
+          const float* A, size_t lda, const float* B, size_t ldb, float beta, float* C, size_t ldc) {
+    const bool left = (side == Side::Left);
+    if (lda < (left ? M : N) || ldb < N || ldc < N) {
+        throw std::invalid_argument("Leading dimension too small.");
+    }
+    if (M == 0 || N == 0) return;
+
+    unsigned int threads;
+    const size_t order = left ? M : N;
+    const MicroKernel uk = kernel_for(M, N, order, threads);
+    const bool tA = (transA == Transpose::Trans);
+    // Transposing swaps the triangle: op(A)(i, k) is nonzero for k <= i when lower
+    const bool lower = (uplo == Uplo::Lower) != tA;
+    const Operand opA = Operand::of(A, lda, tA);
+    const Operand Bop = Operand::of(B, ldb, false);
+
+    // Each tile's inner range stops at the triangle, so tiles further into it do more work
+    std::vector<Tile> tiles = output_tiles(uk, side, M, N, threads);
+    for (Tile& t : tiles) {
+        const size_t k0 = left ? t.i0 : t.j0, k1 = left ? t.i1 : t.j1;
+        const size_t offDiagonal = (left == lower) ? k0 : order - k1;
+        t.work = double(t.i1 - t.i0) * (t.j1 - t.j0) * (offDiagonal + 0.5 * (k1 - k0));
+    }
+    run_tiles(tiles, threads, [&](const Tile& t) {
+        const TrmmStrips strips{uk, opA, Bop, left, lower, diag == Diag::Unit, alpha, C, ldc,
+                                left ? t.j0 : t.i0, left ? t.j1 : t.i1};
+        const size_t s0 = left ? t.i0 : t.j0, s1 = left ? t.i1 : t.j1;
+        strips.run(s0, s1, (left == lower) ? 0 : order, beta);
+    });
+}
@@ -0,0 +1,207 @@
+#include "chain.h"
+#include "gemm.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// Products smaller than this per pool thread are not worth threading on their own
+constexpr double kMinThreadedFlops = 2.0 * 128 * 128 * 128;
+
+size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+double product_flops(size_t rows, size_t inner, size_t cols) {
+    return 2.0 * rows * inner * cols;
+}
+
+// Lowest offset where `floats` fit between the live blocks (sorted by offset).
+size_t first_fit(const std::vector<std::pair<size_t, size_t>>& live, size_t floats) {
+    size_t offset = 0;
+    for (const auto& block : live) {
+        if (block.first >= offset + floats) break;
+        offset = std::max(offset, block.first + block.second);
+    }
+    return offset;
+}
+
+// Assigns scratch slots wave by wave: a wave's results are placed while everything
+// it reads is still live, and the intermediates it consumes are freed after it.
+size_t assign_scratch(ChainPlan& plan) {
+    const size_t n = plan.factors();
+    std::vector<std::pair<size_t, size_t>> live;    // (offset, floats)
+    size_t peak = 0;
+    size_t s = 0;
+    while (s < plan.steps.size()) {
+        size_t end = s;
+        while (end < plan.steps.size() && plan.steps[end].wave == plan.steps[s].wave) ++end;
+        for (size_t i = s; i < end; ++i) {
+            ChainPlan::Step& step = plan.steps[i];
+            if (i + 1 == plan.steps.size()) break;      // The whole chain goes to C
+            size_t floats = step.rows * step.ld;
+            step.offset = first_fit(live, floats);
+            live.insert(std::upper_bound(live.begin(), live.end(), std::make_pair(step.offset, floats)),
+                        std::make_pair(step.offset, floats));
+            peak = std::max(peak, step.offset + floats);
+        }
+        for (size_t i = s; i < end; ++i) {
+            for (size_t id : {plan.steps[i].left, plan.steps[i].right}) {
+                if (id < n) continue;
+                size_t offset = plan.steps[id - n].offset;
+                live.erase(std::find_if(live.begin(), live.end(),
+                                        [offset](const std::pair<size_t, size_t>& b) { return b.first == offset; }));
+            }
+        }
+        s = end;
+    }
+    return peak;
+}
+
+void describe(const ChainPlan& plan, size_t id, std::string& out) {
+    const size_t n = plan.factors();
+    if (id < n) {
+        out += "X" + std::to_string(id);
+        return;
+    }
+    const ChainPlan::Step& step = plan.steps[id - n];
+    out += "(";
+    describe(plan, step.left, out);
+    out += " ";
+    describe(plan, step.right, out);
+    out += ")";
+}
+
+} // namespace
+
+std::string ChainPlan::parenthesization() const {
+    std::string out;
+    describe(*this, factors() + steps.size() - 1, out);
+    return out;
+}
+
+ChainPlan plan_chain(const std::vector<size_t>& dims) {
+    if (dims.size() < 3) {
+        throw std::invalid_argument("A matrix chain needs at least two factors.");
+    }
+    const size_t n = dims.size() - 1;
+
+    // cost[i][j]: cheapest flops for factors i..j; split[i][j]: last factor of the left half
+    std::vector<std::vector<double>> cost(n, std::vector<double>(n, 0.0));
+    std::vector<std::vector<size_t>> split(n, std::vector<size_t>(n, 0));
+    for (size_t len = 2; len <= n; ++len) {
+        for (size_t i = 0; i + len <= n; ++i) {
+            size_t j = i + len - 1;
+            cost[i][j] = -1.0;
+            for (size_t k = i; k < j; ++k) {
+                double c = cost[i][k] + cost[k + 1][j] + product_flops(dims[i], dims[k + 1], dims[j + 1]);
+                if (cost[i][j] < 0 || c < cost[i][j]) {
+                    cost[i][j] = c;
+                    split[i][j] = k;
+                }
+            }
+        }
+    }
+
+    // Steps in post-order, each in the wave after the later of its operands
+    struct Node {
+        size_t left, right;     // Factor ids, or n + post-order index
+        size_t rows, inner, cols;
+        size_t wave;
+    };
+    std::vector<Node> nodes;
+    auto wave_of = [&](size_t id) { return id < n ? 0 : nodes[id - n].wave + 1; };
+    auto build = [&](auto&& self, size_t i, size_t j) -> size_t {
+        if (i == j) return i;
+        size_t k = split[i][j];
+        size_t left = self(self, i, k);
+        size_t right = self(self, k + 1, j);
+        nodes.push_back({left, right, dims[i], dims[k + 1], dims[j + 1], std::max(wave_of(left), wave_of(right))});
+        return n + nodes.size() - 1;
+    };
+    build(build, 0, n - 1);
+
+    // Execution order: by wave, keeping post-order within a wave (the root is last)
+    std::vector<size_t> order(nodes.size());
+    for (size_t s = 0; s < order.size(); ++s) order[s] = s;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return nodes[a].wave < nodes[b].wave; });
+    std::vector<size_t> position(nodes.size());
+    for (size_t s = 0; s < order.size(); ++s) position[order[s]] = s;
+    auto remap = [&](size_t id) { return id < n ? id : n + position[id - n]; };
+
+    ChainPlan plan;
+    plan.dims = dims;
+    for (size_t s : order) {
+        const Node& node = nodes[s];
+        plan.steps.push_back({remap(node.left), remap(node.right), node.rows, node.inner, node.cols, node.wave, 0,
+                              round_up(node.cols, 16)});
+        plan.flops += product_flops(node.rows, node.inner, node.cols);
+    }
+    plan.numWaves = plan.steps.back().wave + 1;
+    plan.scratchFloats = assign_scratch(plan);
+    return plan;
+}
+
+double chain_flops_left_to_right(const std::vector<size_t>& dims) {
+    double flops = 0;
+    for (size_t i = 2; i < dims.size(); ++i) flops += product_flops(dims[0], dims[i - 1], dims[i]);
+    return flops;
+}
+
+void multiply_chain(const std::vector<const Matrix*>& factors, Matrix& C) {
+    std::vector<size_t> dims;
+    for (const Matrix* X : factors) dims.push_back(X->rows);
+    if (!factors.empty()) dims.push_back(factors.back()->cols);
+    multiply_chain(factors, C, plan_chain(dims));
+}
+
+void multiply_chain(const std::vector<const Matrix*>& factors, Matrix& C, const ChainPlan& plan) {
+    const size_t n = plan.factors();
+    bool match = factors.size() == n && C.rows == plan.dims[0] && C.cols == plan.dims[n];
+    for (size_t i = 0; match && i < n; ++i) {
+        match = factors[i]->rows == plan.dims[i] && factors[i]->cols == plan.dims[i + 1] && factors[i] != &C;
+    }
+    if (!match) {
+        throw std::invalid_argument("Matrix dimensions mismatch for chain plan.");
+    }
+
+    // Intermediates for the whole chain, kept per thread so repeated calls reuse it
+    thread_local std::vector<float, MatrixAllocator<float>> buffer;
+    if (buffer.size() < plan.scratchFloats) buffer.resize(plan.scratchFloats);
+    float* scratch = buffer.data();
+
+    auto operand = [&](size_t id) -> ConstMatrixView {
+        if (id < n) return factors[id]->view();
+        const ChainPlan::Step& s = plan.steps[id - n];
+        return ConstMatrixView(scratch + s.offset, s.rows, s.cols, s.ld);
+    };
+    auto run = [&](size_t i) {
+        const ChainPlan::Step& s = plan.steps[i];
+        MatrixView out = (i + 1 == plan.steps.size()) ? C.view() : MatrixView(scratch + s.offset, s.rows, s.cols, s.ld);
+        gemm(Transpose::NoTrans, Transpose::NoTrans, 1.0f, operand(s.left), operand(s.right), 0.0f, out);
+    };
+
+    ThreadPool& pool = ThreadPool::instance();
+    const unsigned int threads = pool.num_threads();
+    size_t begin = 0;
+    while (begin < plan.steps.size()) {
+        size_t end = begin;
+        double waveFlops = 0;
+        while (end < plan.steps.size() && plan.steps[end].wave == plan.steps[begin].wave) {
+            const ChainPlan::Step& s = plan.steps[end++];
+            waveFlops += product_flops(s.rows, s.inner, s.cols);
+        }
+        // Independent products run one per task (each single-threaded, as nested pool
+        // calls are) when there are enough of them to fill the pool or they are too
+        // small to thread; otherwise each gets the whole pool in turn.
+        const size_t count = end - begin;
+        if (count > 1 && (count >= threads || waveFlops < kMinThreadedFlops * threads)) {
+            pool.parallel_for(count, [&](size_t t) { run(begin + t); });
+        } else {
+            for (size_t i = begin; i < end; ++i) run(i);
+        }
+        begin = end;
+    }
+}
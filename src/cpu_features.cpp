@@ -0,0 +1,136 @@
+#include "cpu_features.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <cpuid.h>
+#endif
+
+namespace {
+
+#if defined(__x86_64__) || defined(_M_X64)
+// Reads XCR0 to see which register files the OS saves on context switch.
+unsigned long long read_xcr0() {
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+}
+#endif
+
+CpuFeatures detect_features() {
+    CpuFeatures f;
+#if defined(__x86_64__) || defined(_M_X64)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return f;
+
+    f.sse42 = (ecx >> 20) & 1;
+    bool osxsave = (ecx >> 27) & 1;
+    bool cpuAvx = (ecx >> 28) & 1;
+    bool cpuFma = (ecx >> 12) & 1;
+    bool cpuF16c = (ecx >> 29) & 1;
+
+    unsigned long long xcr0 = osxsave ? read_xcr0() : 0;
+    bool osYmm = (xcr0 & 0x6) == 0x6;     // XMM and YMM state
+    bool osZmm = (xcr0 & 0xE6) == 0xE6;   // plus opmask and both ZMM halves
+
+    f.avx = cpuAvx && osYmm;
+    f.fma = cpuFma && f.avx;
+    f.f16c = cpuF16c && f.avx;
+
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        f.avx2 = ((ebx >> 5) & 1) && f.avx;
+        f.avx512f = ((ebx >> 16) & 1) && osZmm;
+        f.avx512bw = ((ebx >> 30) & 1) && f.avx512f;
+        f.avx512vl = ((ebx >> 31) & 1) && f.avx512f;
+        f.avx512vnni = ((ecx >> 11) & 1) && f.avx512f;
+    }
+    if (__get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx)) {
+        f.avxvnni = ((eax >> 4) & 1) && f.avx2;
+        f.avx512bf16 = ((eax >> 5) & 1) && f.avx512f;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    f.neon = true;
+#endif
+    return f;
+}
+
+CpuIsa initial_isa() {
+    CpuIsa isa = best_supported_isa();
+    if (const char* env = std::getenv("MATMUL_ISA")) {
+        CpuIsa requested;
+        if (!parse_isa(env, requested)) {
+            std::cerr << "MATMUL_ISA: unknown instruction set '" << env << "', using "
+                      << isa_name(isa) << std::endl;
+        } else if (!isa_supported(requested)) {
+            std::cerr << "MATMUL_ISA: " << isa_name(requested) << " not supported by this CPU, using "
+                      << isa_name(isa) << std::endl;
+        } else {
+            isa = requested;
+        }
+    }
+    return isa;
+}
+
+std::atomic<CpuIsa>& active_isa_slot() {
+    static std::atomic<CpuIsa> isa(initial_isa());
+    return isa;
+}
+
+} // namespace
+
+const CpuFeatures& cpu_features() {
+    static const CpuFeatures features = detect_features();
+    return features;
+}
+
+bool isa_supported(CpuIsa isa) {
+    const CpuFeatures& f = cpu_features();
+    switch (isa) {
+        case CpuIsa::Scalar: return true;
+        case CpuIsa::SSE42: return f.sse42;
+        case CpuIsa::AVX2: return f.avx2 && f.fma;
+        case CpuIsa::AVX512: return f.avx512f;
+        case CpuIsa::NEON: return f.neon;
+    }
+    return false;
+}
+
+CpuIsa best_supported_isa() {
+    for (CpuIsa isa : {CpuIsa::NEON, CpuIsa::AVX512, CpuIsa::AVX2, CpuIsa::SSE42}) {
+        if (isa_supported(isa)) return isa;
+    }
+    return CpuIsa::Scalar;
+}
+
+CpuIsa active_isa() {
+    return active_isa_slot().load(std::memory_order_relaxed);
+}
+
+bool set_active_isa(CpuIsa isa) {
+    if (!isa_supported(isa)) return false;
+    active_isa_slot().store(isa, std::memory_order_relaxed);
+    return true;
+}
+
+const char* isa_name(CpuIsa isa) {
+    switch (isa) {
+        case CpuIsa::Scalar: return "scalar";
+        case CpuIsa::SSE42: return "sse4.2";
+        case CpuIsa::AVX2: return "avx2";
+        case CpuIsa::AVX512: return "avx512";
+        case CpuIsa::NEON: return "neon";
+    }
+    return "unknown";
+}
+
+bool parse_isa(const char* name, CpuIsa& isa) {
+    for (CpuIsa candidate : {CpuIsa::Scalar, CpuIsa::SSE42, CpuIsa::AVX2, CpuIsa::AVX512, CpuIsa::NEON}) {
+        if (std::strcmp(name, isa_name(candidate)) == 0) {
+            isa = candidate;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,149 @@
+#include "matrix.h"
+#include "gemm.h"
+#include "gemm_internal.h"
+#include "tuning.h"
+#include <stdexcept>
+
+namespace {
+
+template <typename T>
+void gemm_typed(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+                float alpha, const T* A, size_t lda, const T* B, size_t ldb,
+                float beta, float* C, size_t ldc, const Epilogue* ep = nullptr) {
+    bool tA = (transA == Transpose::Trans);
+    bool tB = (transB == Transpose::Trans);
+    if (lda < (tA ? M : K) || ldb < (tB ? K : N) || ldc < N ||
+        (ep && ep->residual && ep->ldResidual < N)) {
+        throw std::invalid_argument("Leading dimension too small.");
+    }
+
+    // Blocking and thread count come from the tuning file for this shape class
+    TuningParams p = tuned_params(M, N, K);
+    gemm_detail::MicroKernel uk = gemm_detail::with_blocking(gemm_detail::select_micro_kernel(), p.mc, p.kc, p.nc);
+
+    gemm_detail::gemm_packed_threaded(uk, M, N, K, alpha,
+                                      gemm_detail::BasicOperand<T>::of(A, lda, tA),
+                                      gemm_detail::BasicOperand<T>::of(B, ldb, tB),
+                                      beta, C, ldc, p.threads, ep);
+}
+
+// Double and complex: the wide engine with the float kernel's tuned blocking
+template <typename T>
+void gemm_wide_typed(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+                     T alpha, const T* A, size_t lda, const T* B, size_t ldb,
+                     T beta, T* C, size_t ldc) {
+    bool tA = (transA == Transpose::Trans);
+    bool tB = (transB == Transpose::Trans);
+    if (lda < (tA ? M : K) || ldb < (tB ? K : N) || ldc < N) {
+        throw std::invalid_argument("Leading dimension too small.");
+    }
+
+    TuningParams p = tuned_params(M, N, K);
+    gemm_detail::WideKernel<T> uk =
+        gemm_detail::wide_kernel<T>(gemm_detail::with_blocking(gemm_detail::select_micro_kernel(), p.mc, p.kc, p.nc));
+
+    gemm_detail::gemm_wide_threaded(uk, M, N, K, alpha,
+                                    gemm_detail::BasicOperand<T>::of(A, lda, tA),
+                                    gemm_detail::BasicOperand<T>::of(B, ldb, tB),
+                                    beta, C, ldc, p.threads);
+}
+
+template <typename T>
+void multiply_wide(const BasicMatrix<T>& A, const BasicMatrix<T>& B, BasicMatrix<T>& C) {
+    if (A.cols != B.rows || C.rows != A.rows || C.cols != B.cols) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+
+    gemm_wide_typed(Transpose::NoTrans, Transpose::NoTrans, A.rows, B.cols, A.cols,
+                    T(1), A.data.data(), A.cols, B.data.data(), B.cols, T(), C.data.data(), C.cols);
+}
+
+} // namespace
+
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          float alpha, const float* A, size_t lda, const float* B, size_t ldb,
+          float beta, float* C, size_t ldc) {
+    gemm_typed(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          float alpha, const float* A, size_t lda, const float* B, size_t ldb,
+          float beta, float* C, size_t ldc, const Epilogue& epilogue) {
+    gemm_typed(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, &epilogue);
+}
+
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          float alpha, const bfloat16* A, size_t lda, const bfloat16* B, size_t ldb,
+          float beta, float* C, size_t ldc) {
+    gemm_typed(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          float alpha, const float16* A, size_t lda, const float16* B, size_t ldb,
+          float beta, float* C, size_t ldc) {
+    gemm_typed(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+void gemm(Transpose transA, Transpose transB, float alpha,
+          const ConstMatrixView& A, const ConstMatrixView& B,
+          float beta, const MatrixView& C) {
+    size_t M = (transA == Transpose::Trans) ? A.cols : A.rows;
+    size_t K = (transA == Transpose::Trans) ? A.rows : A.cols;
+    size_t KB = (transB == Transpose::Trans) ? B.cols : B.rows;
+    size_t N = (transB == Transpose::Trans) ? B.rows : B.cols;
+    if (K != KB || C.rows != M || C.cols != N) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+
+    gemm(transA, transB, M, N, K, alpha, A.data, A.ld, B.data, B.ld, beta, C.data, C.ld);
+}
+
+void multiply(const Matrix& A, const Matrix& B, Matrix& C) {
+    if (A.cols != B.rows || C.rows != A.rows || C.cols != B.cols) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+
+    gemm(Transpose::NoTrans, Transpose::NoTrans, A.rows, B.cols, A.cols,
+         1.0f, A.data.data(), A.cols, B.data.data(), B.cols, 0.0f, C.data.data(), C.cols);
+}
+
+void multiply(const Matrix& A, const Matrix& B, Matrix& C, const Epilogue& epilogue, float alpha) {
+    if (A.cols != B.rows || C.rows != A.rows || C.cols != B.cols) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+
+    gemm(Transpose::NoTrans, Transpose::NoTrans, A.rows, B.cols, A.cols,
+         alpha, A.data.data(), A.cols, B.data.data(), B.cols, 0.0f, C.data.data(), C.cols, epilogue);
+}
+
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          double alpha, const double* A, size_t lda, const double* B, size_t ldb,
+          double beta, double* C, size_t ldc) {
+    gemm_wide_typed(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          std::complex<float> alpha, const std::complex<float>* A, size_t lda,
+          const std::complex<float>* B, size_t ldb,
+          std::complex<float> beta, std::complex<float>* C, size_t ldc) {
+    gemm_wide_typed(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+void gemm(Transpose transA, Transpose transB, size_t M, size_t N, size_t K,
+          std::complex<double> alpha, const std::complex<double>* A, size_t lda,
+          const std::complex<double>* B, size_t ldb,
+          std::complex<double> beta, std::complex<double>* C, size_t ldc) {
+    gemm_wide_typed(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+void multiply(const DMatrix& A, const DMatrix& B, DMatrix& C) {
+    multiply_wide(A, B, C);
+}
+
+void multiply(const CMatrix& A, const CMatrix& B, CMatrix& C) {
+    multiply_wide(A, B, C);
+}
+
+void multiply(const ZMatrix& A, const ZMatrix& B, ZMatrix& C) {
+    multiply_wide(A, B, C);
+}
@@ -0,0 +1,130 @@
+#include "expr.h"
+#include "gemm.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <complex>
+
+namespace {
+
+// Rows of the element-wise pass per task: about 16K elements
+size_t pass_rows(size_t cols) {
+    return std::max<size_t>(1, (size_t(1) << 14) / std::max<size_t>(1, cols));
+}
+
+// Whether the stored rows x cols block at `data` shares memory with dst (compared by
+// address ranges, so interleaved blocks of one matrix count as overlapping).
+template <typename T>
+bool overlaps(const T* data, size_t rows, size_t cols, size_t ld, const BasicMatrixView<T>& dst) {
+    if (rows == 0 || cols == 0 || dst.rows == 0 || dst.cols == 0) return false;
+    const T* end = data + (rows - 1) * ld + cols;
+    const T* dstEnd = dst.data + (dst.rows - 1) * dst.ld + dst.cols;
+    return data < dstEnd && dst.data < end;
+}
+
+template <typename T>
+bool is_product(const ExprTerm<T>& term) {
+    return term.b != nullptr;
+}
+
+// A plain, untransposed reference to dst itself
+template <typename T>
+bool is_destination(const ExprTerm<T>& term, const BasicMatrixView<T>& dst) {
+    return !is_product(term) && !term.transA && term.a == dst.data && term.lda == dst.ld;
+}
+
+template <typename T>
+bool reads_destination(const ExprTerm<T>& term, const BasicMatrixView<T>& dst) {
+    if (!is_product(term)) {
+        return term.transA ? overlaps(term.a, term.cols, term.rows, term.lda, dst)
+                           : overlaps(term.a, term.rows, term.cols, term.lda, dst);
+    }
+    bool a = term.transA ? overlaps(term.a, term.inner, term.rows, term.lda, dst)
+                         : overlaps(term.a, term.rows, term.inner, term.lda, dst);
+    bool b = term.transB ? overlaps(term.b, term.cols, term.inner, term.ldb, dst)
+                         : overlaps(term.b, term.inner, term.cols, term.ldb, dst);
+    return a || b;
+}
+
+// dst = beta * dst + the matrix terms other than dst itself, one row at a time so each
+// row of dst goes through memory once however many terms there are.
+template <typename T>
+void elementwise_pass(const ExprTerm<T>* terms, size_t count, T beta, const BasicMatrixView<T>& dst) {
+    const size_t N = dst.cols;
+    const size_t rowsPerTask = pass_rows(N);
+    ThreadPool::instance().parallel_for((dst.rows + rowsPerTask - 1) / rowsPerTask, [&](size_t t) {
+        const size_t rowEnd = std::min(dst.rows, (t + 1) * rowsPerTask);
+        for (size_t i = t * rowsPerTask; i < rowEnd; ++i) {
+            T* d = dst.data + i * dst.ld;
+            if (beta == T()) {
+                std::fill(d, d + N, T());
+            } else if (beta != T(1)) {
+                for (size_t j = 0; j < N; ++j) d[j] *= beta;
+            }
+            for (size_t k = 0; k < count; ++k) {
+                const ExprTerm<T>& term = terms[k];
+                if (is_product(term) || is_destination(term, dst)) continue;
+                const T s = term.scale;
+                if (!term.transA) {
+                    const T* a = term.a + i * term.lda;
+                    for (size_t j = 0; j < N; ++j) d[j] += s * a[j];
+                } else {
+                    for (size_t j = 0; j < N; ++j) d[j] += s * term.a[j * term.lda + i];
+                }
+            }
+        }
+    });
+}
+
+} // namespace
+
+template <typename T>
+void evaluate_terms(const ExprTerm<T>* terms, size_t count, T beta, const BasicMatrixView<T>& dst) {
+    for (size_t k = 0; k < count; ++k) {
+        if (terms[k].rows != dst.rows || terms[k].cols != dst.cols) {
+            throw std::invalid_argument("Matrix dimensions mismatch.");
+        }
+    }
+
+    // References to dst itself scale it, like beta; anything else that reads dst has
+    // to see it unmodified, so the sum is built in a temporary and added at the end
+    T scale = beta;
+    for (size_t k = 0; k < count; ++k) {
+        if (is_destination(terms[k], dst)) {
+            scale += terms[k].scale;
+        } else if (reads_destination(terms[k], dst)) {
+            BasicMatrix<T> sum(dst.rows, dst.cols, uninitialized);
+            evaluate_terms(terms, count, T(), sum.view());
+            ExprTerm<T> add = {sum.data.data(), sum.cols, false, nullptr, 0, false, dst.rows, dst.cols, 0, T(1)};
+            elementwise_pass(&add, 1, beta, dst);
+            return;
+        }
+    }
+
+    // Matrix terms seed dst in one pass; products then accumulate into it with beta = 1,
+    // which measured faster than adding a term through the residual epilogue tile by tile
+    bool matrixTerms = false;
+    for (size_t k = 0; k < count; ++k) {
+        matrixTerms = matrixTerms || (!is_product(terms[k]) && !is_destination(terms[k], dst));
+    }
+    bool products = std::any_of(terms, terms + count, is_product<T>);
+    if (matrixTerms || (!products && scale != T(1))) {
+        elementwise_pass(terms, count, scale, dst);
+        scale = T(1);
+    }
+    for (size_t k = 0; k < count; ++k) {
+        const ExprTerm<T>& term = terms[k];
+        if (!is_product(term)) continue;
+        gemm(term.transA ? Transpose::Trans : Transpose::NoTrans, term.transB ? Transpose::Trans : Transpose::NoTrans,
+             term.rows, term.cols, term.inner, term.scale, term.a, term.lda, term.b, term.ldb,
+             scale, dst.data, dst.ld);
+        scale = T(1);
+    }
+}
+
+template void evaluate_terms<float>(const ExprTerm<float>*, size_t, float, const BasicMatrixView<float>&);
+template void evaluate_terms<double>(const ExprTerm<double>*, size_t, double, const BasicMatrixView<double>&);
+template void evaluate_terms<std::complex<float>>(const ExprTerm<std::complex<float>>*, size_t,
+                                                  std::complex<float>, const BasicMatrixView<std::complex<float>>&);
+template void evaluate_terms<std::complex<double>>(const ExprTerm<std::complex<double>>*, size_t,
+                                                   std::complex<double>,
+                                                   const BasicMatrixView<std::complex<double>>&);
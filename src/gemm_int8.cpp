@@ -0,0 +1,422 @@
+#include "quantized.h"
+#include "matrix.h"
+#include "cpu_features.h"
+#include "gemm_internal.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Packed panels hold 4 bytes per row (A) or column (B) for each group of K: either
+// two int16 values (pair layout, for vpmaddwd) or four 8-bit values (quad layout,
+// for vpdpbusd). Either way one group of one row is a single int32 broadcast.
+constexpr size_t kGroupBytes = 4;
+
+constexpr size_t kMaxMR = 12;
+constexpr size_t kMaxNR = 32;
+
+using ByteBuffer = std::vector<unsigned char, AlignedAllocator<unsigned char, 64>>;
+
+// Computes an MR x NR int32 tile from `groups` packed K groups. With accumulate
+// false the tile is overwritten, otherwise added to.
+using Int8KernelFn = void (*)(size_t groups, const void* a, const void* b,
+                              int32_t* c, size_t ldc, bool accumulate);
+using PackFn = void (*)(size_t n, size_t kc, const int8_t* src, size_t ld, bool alongRows,
+                        size_t width, void* dst);
+
+struct Int8Kernel {
+    const char* name;
+    size_t mr;
+    size_t nr;
+    size_t kgroup;      // K values per packed group (2 or 4)
+    int32_t aOffset;    // Added to A while packing (128 turns s8 into u8 for vpdpbusd)
+    size_t mc;
+    size_t kc;          // Multiple of kgroup
+    size_t nc;
+    Int8KernelFn fn;
+    PackFn pack_a;      // A panels; B always packs without the offset
+};
+
+// Packs n rows of A (alongRows) or n columns of B into panels of `width` with the
+// K groups of each panel consecutive. Values past n or kc are zero; A values get
+// Offset added.
+template <typename T, size_t G, int Offset>
+void pack_groups(size_t n, size_t kc, const int8_t* src, size_t ld, bool alongRows,
+                 size_t width, void* dst) {
+    T* out = static_cast<T*>(dst);
+    for (size_t i0 = 0; i0 < n; i0 += width) {
+        size_t count = std::min(width, n - i0);
+        for (size_t k0 = 0; k0 < kc; k0 += G) {
+            for (size_t i = 0; i < width; ++i) {
+                for (size_t q = 0; q < G; ++q) {
+                    T value = 0;
+                    if (i < count && k0 + q < kc) {
+                        size_t r = i0 + i, k = k0 + q;
+                        int v = alongRows ? src[r * ld + k] : src[k * ld + r];
+                        value = static_cast<T>(v + Offset);
+                    }
+                    out[i * G + q] = value;
+                }
+            }
+            out += width * G;
+        }
+    }
+}
+
+template <size_t MR, size_t NR>
+void int8_kernel_generic(size_t groups, const void* ap, const void* bp,
+                         int32_t* c, size_t ldc, bool accumulate) {
+    const int16_t* a = static_cast<const int16_t*>(ap);
+    const int16_t* b = static_cast<const int16_t*>(bp);
+    int32_t acc[MR][NR] = {};
+    for (size_t g = 0; g < groups; ++g) {
+        for (size_t i = 0; i < MR; ++i) {
+            int32_t a0 = a[2 * i], a1 = a[2 * i + 1];
+            for (size_t j = 0; j < NR; ++j) {
+                acc[i][j] += a0 * b[2 * j] + a1 * b[2 * j + 1];
+            }
+        }
+        a += 2 * MR;
+        b += 2 * NR;
+    }
+    for (size_t i = 0; i < MR; ++i) {
+        int32_t* c_row = c + i * ldc;
+        for (size_t j = 0; j < NR; ++j) {
+            c_row[j] = accumulate ? c_row[j] + acc[i][j] : acc[i][j];
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+inline int32_t load_group(const void* p) {
+    int32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+__attribute__((target("avx2")))
+inline void store_row_avx2(int32_t* c_row, __m256i lo, __m256i hi, bool accumulate) {
+    if (accumulate) {
+        lo = _mm256_add_epi32(lo, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c_row)));
+        hi = _mm256_add_epi32(hi, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c_row + 8)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(c_row), lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(c_row + 8), hi);
+}
+
+// 6x16 tile on int16 pairs: vpmaddwd multiplies two K steps of a row of A with
+// the same two K steps of 8 columns of B and sums each pair into int32. (vpmaddubsw
+// would take bytes directly but saturates its int16 pair sums, so it is not exact.)
+__attribute__((target("avx2")))
+void int8_kernel_avx2_6x16(size_t groups, const void* ap, const void* bp,
+                           int32_t* c, size_t ldc, bool accumulate) {
+    const char* a = static_cast<const char*>(ap);
+    const char* b = static_cast<const char*>(bp);
+    __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+    __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+    __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+    __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+    __m256i c40 = _mm256_setzero_si256(), c41 = _mm256_setzero_si256();
+    __m256i c50 = _mm256_setzero_si256(), c51 = _mm256_setzero_si256();
+
+    for (size_t g = 0; g < groups; ++g) {
+        __m256i b0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(b));
+        __m256i b1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(b + 32));
+        __m256i ai;
+        ai = _mm256_set1_epi32(load_group(a + 0));
+        c00 = _mm256_add_epi32(c00, _mm256_madd_epi16(ai, b0)); c01 = _mm256_add_epi32(c01, _mm256_madd_epi16(ai, b1));
+        ai = _mm256_set1_epi32(load_group(a + 4));
+        c10 = _mm256_add_epi32(c10, _mm256_madd_epi16(ai, b0)); c11 = _mm256_add_epi32(c11, _mm256_madd_epi16(ai, b1));
+        ai = _mm256_set1_epi32(load_group(a + 8));
+        c20 = _mm256_add_epi32(c20, _mm256_madd_epi16(ai, b0)); c21 = _mm256_add_epi32(c21, _mm256_madd_epi16(ai, b1));
+        ai = _mm256_set1_epi32(load_group(a + 12));
+        c30 = _mm256_add_epi32(c30, _mm256_madd_epi16(ai, b0)); c31 = _mm256_add_epi32(c31, _mm256_madd_epi16(ai, b1));
+        ai = _mm256_set1_epi32(load_group(a + 16));
+        c40 = _mm256_add_epi32(c40, _mm256_madd_epi16(ai, b0)); c41 = _mm256_add_epi32(c41, _mm256_madd_epi16(ai, b1));
+        ai = _mm256_set1_epi32(load_group(a + 20));
+        c50 = _mm256_add_epi32(c50, _mm256_madd_epi16(ai, b0)); c51 = _mm256_add_epi32(c51, _mm256_madd_epi16(ai, b1));
+        a += 6 * kGroupBytes;
+        b += 16 * kGroupBytes;
+    }
+
+    store_row_avx2(c + 0 * ldc, c00, c01, accumulate);
+    store_row_avx2(c + 1 * ldc, c10, c11, accumulate);
+    store_row_avx2(c + 2 * ldc, c20, c21, accumulate);
+    store_row_avx2(c + 3 * ldc, c30, c31, accumulate);
+    store_row_avx2(c + 4 * ldc, c40, c41, accumulate);
+    store_row_avx2(c + 5 * ldc, c50, c51, accumulate);
+}
+
+__attribute__((target("avx512f")))
+inline void store_row_avx512(int32_t* c_row, __m512i lo, __m512i hi, bool accumulate) {
+    if (accumulate) {
+        lo = _mm512_add_epi32(lo, _mm512_loadu_si512(c_row));
+        hi = _mm512_add_epi32(hi, _mm512_loadu_si512(c_row + 16));
+    }
+    _mm512_storeu_si512(c_row, lo);
+    _mm512_storeu_si512(c_row + 16, hi);
+}
+
+// 12x32 tile on byte quads: vpdpbusd multiplies four unsigned bytes of A (stored
+// with +128) by four signed bytes of B and adds the sum to each int32 lane.
+__attribute__((target("avx512f,avx512vnni")))
+void int8_kernel_vnni_12x32(size_t groups, const void* ap, const void* bp,
+                            int32_t* c, size_t ldc, bool accumulate) {
+    const char* a = static_cast<const char*>(ap);
+    const char* b = static_cast<const char*>(bp);
+#define MM_ROW_DECL(r) __m512i c##r##_0 = _mm512_setzero_si512(), c##r##_1 = _mm512_setzero_si512();
+#define MM_ROW_DOT(r) ai = _mm512_set1_epi32(load_group(a + 4 * r)); \
+    c##r##_0 = _mm512_dpbusd_epi32(c##r##_0, ai, b0); c##r##_1 = _mm512_dpbusd_epi32(c##r##_1, ai, b1);
+    MM_ROW_DECL(0) MM_ROW_DECL(1) MM_ROW_DECL(2) MM_ROW_DECL(3) MM_ROW_DECL(4) MM_ROW_DECL(5)
+    MM_ROW_DECL(6) MM_ROW_DECL(7) MM_ROW_DECL(8) MM_ROW_DECL(9) MM_ROW_DECL(10) MM_ROW_DECL(11)
+
+    for (size_t g = 0; g < groups; ++g) {
+        __m512i b0 = _mm512_load_si512(b);
+        __m512i b1 = _mm512_load_si512(b + 64);
+        __m512i ai;
+        MM_ROW_DOT(0) MM_ROW_DOT(1) MM_ROW_DOT(2) MM_ROW_DOT(3) MM_ROW_DOT(4) MM_ROW_DOT(5)
+        MM_ROW_DOT(6) MM_ROW_DOT(7) MM_ROW_DOT(8) MM_ROW_DOT(9) MM_ROW_DOT(10) MM_ROW_DOT(11)
+        a += 12 * kGroupBytes;
+        b += 32 * kGroupBytes;
+    }
+#undef MM_ROW_DECL
+#undef MM_ROW_DOT
+
+    store_row_avx512(c + 0 * ldc, c0_0, c0_1, accumulate);
+    store_row_avx512(c + 1 * ldc, c1_0, c1_1, accumulate);
+    store_row_avx512(c + 2 * ldc, c2_0, c2_1, accumulate);
+    store_row_avx512(c + 3 * ldc, c3_0, c3_1, accumulate);
+    store_row_avx512(c + 4 * ldc, c4_0, c4_1, accumulate);
+    store_row_avx512(c + 5 * ldc, c5_0, c5_1, accumulate);
+    store_row_avx512(c + 6 * ldc, c6_0, c6_1, accumulate);
+    store_row_avx512(c + 7 * ldc, c7_0, c7_1, accumulate);
+    store_row_avx512(c + 8 * ldc, c8_0, c8_1, accumulate);
+    store_row_avx512(c + 9 * ldc, c9_0, c9_1, accumulate);
+    store_row_avx512(c + 10 * ldc, c10_0, c10_1, accumulate);
+    store_row_avx512(c + 11 * ldc, c11_0, c11_1, accumulate);
+}
+#endif
+
+const Int8Kernel& select_int8_kernel() {
+    static const Int8Kernel generic = {"scalar-4x8 (int16 pairs)", 4, 8, 2, 0, 128, 512, 4096,
+                                       int8_kernel_generic<4, 8>, pack_groups<int16_t, 2, 0>};
+#if defined(__x86_64__) || defined(_M_X64)
+    static const Int8Kernel avx2 = {"avx2-6x16 (vpmaddwd)", 6, 16, 2, 0, 120, 512, 4096,
+                                    int8_kernel_avx2_6x16, pack_groups<int16_t, 2, 0>};
+    static const Int8Kernel vnni = {"avx512-vnni-12x32 (vpdpbusd)", 12, 32, 4, 128, 144, 1024, 4096,
+                                    int8_kernel_vnni_12x32, pack_groups<uint8_t, 4, 128>};
+    CpuIsa isa = active_isa();
+    if (isa == CpuIsa::AVX512 && cpu_features().avx512vnni) return vnni;
+    if (isa == CpuIsa::AVX2 || isa == CpuIsa::AVX512) return avx2;
+#endif
+    return generic;
+}
+
+// The B side of vpdpbusd is signed, so B always packs with no offset.
+void pack_b_panels(const Int8Kernel& uk, size_t nc, size_t kc, const int8_t* B, size_t ldb, void* dst) {
+    if (uk.kgroup == 4) {
+        pack_groups<int8_t, 4, 0>(nc, kc, B, ldb, false, uk.nr, dst);
+    } else {
+        pack_groups<int16_t, 2, 0>(nc, kc, B, ldb, false, uk.nr, dst);
+    }
+}
+
+// Raw int32 products sum_k A'[i][k] * B[k][j] for an M x N block, where A' is A
+// plus the kernel's aOffset.
+void int8_block(const Int8Kernel& uk, size_t M, size_t N, size_t K,
+                const int8_t* A, size_t lda, const int8_t* B, size_t ldb,
+                int32_t* C, size_t ldc) {
+    if (K == 0) {
+        for (size_t i = 0; i < M; ++i) std::fill(C + i * ldc, C + i * ldc + N, 0);
+        return;
+    }
+
+    thread_local ByteBuffer a_buf;
+    thread_local ByteBuffer b_buf;
+    size_t groupsPerBlock = uk.kc / uk.kgroup;
+    size_t a_size = ((uk.mc + uk.mr - 1) / uk.mr) * uk.mr * groupsPerBlock * kGroupBytes;
+    size_t b_size = ((uk.nc + uk.nr - 1) / uk.nr) * uk.nr * groupsPerBlock * kGroupBytes;
+    if (a_buf.size() < a_size) a_buf.resize(a_size);
+    if (b_buf.size() < b_size) b_buf.resize(b_size);
+
+    alignas(64) int32_t edge[kMaxMR * kMaxNR];
+
+    for (size_t jc = 0; jc < N; jc += uk.nc) {
+        size_t nc = std::min(uk.nc, N - jc);
+
+        for (size_t pc = 0; pc < K; pc += uk.kc) {
+            size_t kc = std::min(uk.kc, K - pc);
+            size_t groups = (kc + uk.kgroup - 1) / uk.kgroup;
+            bool accumulate = (pc != 0);
+
+            pack_b_panels(uk, nc, kc, B + pc * ldb + jc, ldb, b_buf.data());
+
+            for (size_t ic = 0; ic < M; ic += uk.mc) {
+                size_t mc = std::min(uk.mc, M - ic);
+                uk.pack_a(mc, kc, A + ic * lda + pc, lda, true, uk.mr, a_buf.data());
+
+                for (size_t jr = 0; jr < nc; jr += uk.nr) {
+                    size_t nr = std::min(uk.nr, nc - jr);
+                    const unsigned char* b_panel = b_buf.data() + jr * groups * kGroupBytes;
+
+                    for (size_t ir = 0; ir < mc; ir += uk.mr) {
+                        size_t mr = std::min(uk.mr, mc - ir);
+                        const unsigned char* a_panel = a_buf.data() + ir * groups * kGroupBytes;
+                        int32_t* c_tile = C + (ic + ir) * ldc + jc + jr;
+
+                        if (mr == uk.mr && nr == uk.nr) {
+                            uk.fn(groups, a_panel, b_panel, c_tile, ldc, accumulate);
+                            continue;
+                        }
+
+                        uk.fn(groups, a_panel, b_panel, edge, uk.nr, false);
+                        for (size_t i = 0; i < mr; ++i) {
+                            int32_t* c_row = c_tile + i * ldc;
+                            const int32_t* e_row = edge + i * uk.nr;
+                            for (size_t j = 0; j < nr; ++j) {
+                                c_row[j] = accumulate ? c_row[j] + e_row[j] : e_row[j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Runs the product tile by tile on the pool. For each tile the raw sums go to the
+// int32 buffer from `acc(rowBegin, colBegin, rows, cols, ld)`, get the zero-point
+// correction, and are handed to `finish(rowBegin, colBegin, rows, cols, tile, ld)`
+// while still in cache.
+template <typename AccFn, typename FinishFn>
+void run_int8(size_t M, size_t N, size_t K, const int8_t* A, size_t lda, const QuantParams& qa,
+              const int8_t* B, size_t ldb, const QuantParams& qb, AccFn&& acc, FinishFn&& finish) {
+    if (M == 0 || N == 0) return;
+
+    // Row sums of A and column sums of B for the zero-point correction
+    std::vector<int32_t> rowSumA(M, 0), colSumB(N, 0);
+    for (size_t i = 0; i < M; ++i) {
+        for (size_t k = 0; k < K; ++k) rowSumA[i] += A[i * lda + k];
+    }
+    for (size_t k = 0; k < K; ++k) {
+        for (size_t j = 0; j < N; ++j) colSumB[j] += B[k * ldb + j];
+    }
+
+    // Tiles are at most one cache block even single-threaded, so the epilogue
+    // always reads C while it is still in cache.
+    const Int8Kernel& uk = select_int8_kernel();
+    unsigned int threads = gemm_detail::thread_budget(0);
+    size_t tileRows, tileCols;
+    gemm_detail::choose_thread_tiles(uk.mr, uk.nr, uk.mc, uk.nc, M, N, threads, tileRows, tileCols);
+
+    ThreadPool::instance().parallel_for_2d(M, N, tileRows, tileCols,
+                                           [&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+        size_t rows = rowEnd - rowBegin, cols = colEnd - colBegin;
+        size_t ld;
+        int32_t* tile = acc(rowBegin, colBegin, rows, cols, ld);
+        int8_block(uk, rows, cols, K, A + rowBegin * lda, lda, B + colBegin, ldb, tile, ld);
+
+        // sum (a - za)(b - zb) = sum (a + offset) b - (za + offset) sum b - zb sum a + K za zb,
+        // where a + offset is what the kernel multiplied.
+        for (size_t i = 0; i < rows; ++i) {
+            int64_t za = qa.zero_point_at(rowBegin + i);
+            int64_t rowSum = rowSumA[rowBegin + i];
+            int32_t* t_row = tile + i * ld;
+            for (size_t j = 0; j < cols; ++j) {
+                int64_t zb = qb.zero_point_at(colBegin + j);
+                int64_t v = t_row[j] - (za + uk.aOffset) * colSumB[colBegin + j] - zb * rowSum
+                          + static_cast<int64_t>(K) * za * zb;
+                t_row[j] = static_cast<int32_t>(v);
+            }
+        }
+        finish(rowBegin, colBegin, rows, cols, tile, ld);
+    }, threads);
+}
+
+// Thread-local int32 scratch for tiles whose final output is not int32.
+int32_t* scratch_tile(size_t rows, size_t cols, size_t& ld) {
+    thread_local std::vector<int32_t> buf;
+    if (buf.size() < rows * cols) buf.resize(rows * cols);
+    ld = cols;
+    return buf.data();
+}
+
+int8_t saturate_s8(float v) {
+    float r = std::nearbyint(v);
+    return static_cast<int8_t>(std::min(127.0f, std::max(-128.0f, r)));
+}
+
+void check_leading_dims(size_t N, size_t K, size_t lda, size_t ldb, size_t ldc) {
+    if (lda < K || ldb < N || ldc < N) {
+        throw std::invalid_argument("Leading dimension too small.");
+    }
+}
+
+} // namespace
+
+void gemm_s8s8s32(size_t M, size_t N, size_t K,
+                  const int8_t* A, size_t lda, const QuantParams& qa,
+                  const int8_t* B, size_t ldb, const QuantParams& qb,
+                  int32_t* C, size_t ldc) {
+    check_leading_dims(N, K, lda, ldb, ldc);
+    run_int8(M, N, K, A, lda, qa, B, ldb, qb,
+             [&](size_t r, size_t c, size_t, size_t, size_t& ld) { ld = ldc; return C + r * ldc + c; },
+             [](size_t, size_t, size_t, size_t, const int32_t*, size_t) {});
+}
+
+void gemm_s8s8_f32(size_t M, size_t N, size_t K,
+                   const int8_t* A, size_t lda, const QuantParams& qa,
+                   const int8_t* B, size_t ldb, const QuantParams& qb,
+                   float* C, size_t ldc) {
+    check_leading_dims(N, K, lda, ldb, ldc);
+    run_int8(M, N, K, A, lda, qa, B, ldb, qb,
+             [](size_t, size_t, size_t rows, size_t cols, size_t& ld) { return scratch_tile(rows, cols, ld); },
+             [&](size_t r0, size_t c0, size_t rows, size_t cols, const int32_t* tile, size_t ld) {
+        for (size_t i = 0; i < rows; ++i) {
+            float sa = qa.scale_at(r0 + i);
+            float* c_row = C + (r0 + i) * ldc + c0;
+            for (size_t j = 0; j < cols; ++j) {
+                c_row[j] = sa * qb.scale_at(c0 + j) * static_cast<float>(tile[i * ld + j]);
+            }
+        }
+    });
+}
+
+void gemm_s8s8_s8(size_t M, size_t N, size_t K,
+                  const int8_t* A, size_t lda, const QuantParams& qa,
+                  const int8_t* B, size_t ldb, const QuantParams& qb,
+                  int8_t* C, size_t ldc, const QuantParams& qc) {
+    check_leading_dims(N, K, lda, ldb, ldc);
+    float invScale = 1.0f / qc.scale;
+    run_int8(M, N, K, A, lda, qa, B, ldb, qb,
+             [](size_t, size_t, size_t rows, size_t cols, size_t& ld) { return scratch_tile(rows, cols, ld); },
+             [&](size_t r0, size_t c0, size_t rows, size_t cols, const int32_t* tile, size_t ld) {
+        for (size_t i = 0; i < rows; ++i) {
+            float sa = qa.scale_at(r0 + i) * invScale;
+            int8_t* c_row = C + (r0 + i) * ldc + c0;
+            for (size_t j = 0; j < cols; ++j) {
+                float real = sa * qb.scale_at(c0 + j) * static_cast<float>(tile[i * ld + j]);
+                c_row[j] = saturate_s8(real + static_cast<float>(qc.zeroPoint));
+            }
+        }
+    });
+}
+
+void quantize(const float* src, size_t count, float scale, int32_t zeroPoint, int8_t* dst) {
+    float invScale = 1.0f / scale;
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = saturate_s8(src[i] * invScale + static_cast<float>(zeroPoint));
+    }
+}
+
+const char* int8_kernel_name() {
+    return select_int8_kernel().name;
+}
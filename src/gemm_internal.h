@@ -0,0 +1,207 @@
+#ifndef GEMM_INTERNAL_H
+#define GEMM_INTERNAL_H
+
+#include <cstddef>
+#include "cpu_features.h"
+#include "epilogue.h"
+#include "half.h"
+
+// Internal building blocks for the packed (Goto/BLIS style) GEMM engine.
+// Not part of the public API; include "matrix.h" for that.
+namespace gemm_detail {
+
+// Computes an MR x NR tile: C = A_panel * B_panel + beta * C.
+// `a` holds kc columns of MR packed rows, `b` holds kc rows of NR packed
+// columns. When beta == 0 the kernel must not read C.
+using MicroKernelFn = void (*)(size_t kc, const float* a, const float* b,
+                               float* c, size_t ldc, float beta);
+
+// Same for a partial tile at the edge of C: only its top mr rows and left nr columns
+// are read and written, with masked loads and stores.
+using MicroKernelEdgeFn = void (*)(size_t kc, const float* a, const float* b,
+                                   float* c, size_t ldc, float beta, size_t mr, size_t nr);
+
+struct MicroKernel {
+    const char* name;
+    size_t mr;          // Rows of the register tile
+    size_t nr;          // Columns of the register tile
+    size_t mc;          // Rows of A kept in L2 (multiple of mr)
+    size_t kc;          // Depth of the packed panels (sized for L1)
+    size_t nc;          // Columns of B kept in L3 (multiple of nr)
+    MicroKernelFn fn;
+    MicroKernelEdgeFn edge;     // Null without masked stores: edges go through scratch
+};
+
+// Micro-kernel for a given instruction set (scalar if the build has none for it).
+const MicroKernel& micro_kernel_for(CpuIsa isa);
+
+// Micro-kernel for active_isa().
+const MicroKernel& select_micro_kernel();
+
+// Copy of `uk` with its cache blocking replaced; mc and nc are rounded to
+// multiples of the register tile.
+MicroKernel with_blocking(const MicroKernel& uk, size_t mc, size_t kc, size_t nc);
+
+// Strided input operand: element (i, j) of op(X) lives at data[i * rs + j * cs].
+// A row-major matrix has rs = ld, cs = 1; its transpose has rs = 1, cs = ld.
+// T is the stored type: float, bfloat16 or float16 for the float engine, whose
+// packing routines widen it so the micro-kernels only ever see float panels, or the
+// element type of the wide engine (double, std::complex<float>, std::complex<double>).
+template <typename T>
+struct BasicOperand {
+    const T* data;
+    size_t rs;
+    size_t cs;
+
+    static BasicOperand of(const T* data, size_t ld, bool transposed) {
+        return transposed ? BasicOperand{data, 1, ld} : BasicOperand{data, ld, 1};
+    }
+    BasicOperand offset(size_t i, size_t j) const {
+        return {data + i * rs + j * cs, rs, cs};
+    }
+};
+
+using Operand = BasicOperand<float>;
+
+// C = beta * C over an M x N block (beta == 0 writes zeros without reading C).
+void scale_c(size_t M, size_t N, float beta, float* C, size_t ldc);
+
+// Applies `ep` to the M x N block of C starting at element (row0, col0) of the
+// product `ep` describes; C points at that element.
+void apply_epilogue(const Epilogue& ep, size_t row0, size_t col0, size_t M, size_t N,
+                    float* C, size_t ldc);
+
+// `ep` re-based so that (row0, col0) becomes its origin, for running a sub-block of C
+// as a product of its own.
+Epilogue offset_epilogue(const Epilogue& ep, size_t row0, size_t col0);
+
+// Threads to use given a caller's cap (0 = no cap) and the pool size.
+unsigned int thread_budget(unsigned int maxThreads);
+
+// 2D tile shape (multiples of mr x nr, at most mc x nc) for spreading an M x N
+// product over `threads` threads with a few tiles each to steal.
+void choose_thread_tiles(size_t mr, size_t nr, size_t mc, size_t nc, size_t M, size_t N,
+                         unsigned int threads, size_t& tileRows, size_t& tileCols);
+
+// Single-threaded packed GEMM: C[M x N] = alpha * op(A)[M x K] * op(B)[K x N] + beta * C.
+// Transposition is absorbed by the packing routines, so no operand is ever copied whole.
+// A non-null `ep` is applied to each register tile as the last K block stores it.
+template <typename T>
+void gemm_packed(const MicroKernel& uk, size_t M, size_t N, size_t K,
+                 float alpha, BasicOperand<T> A, BasicOperand<T> B,
+                 float beta, float* C, size_t ldc, const Epilogue* ep = nullptr);
+
+// Multi-threaded packed GEMM. C is split into 2D tiles (multiples of mr x nr)
+// scheduled on the shared ThreadPool; each tile packs its own panels.
+// maxThreads = 0 uses the whole pool.
+template <typename T>
+void gemm_packed_threaded(const MicroKernel& uk, size_t M, size_t N, size_t K,
+                          float alpha, BasicOperand<T> A, BasicOperand<T> B,
+                          float beta, float* C, size_t ldc, unsigned int maxThreads = 0,
+                          const Epilogue* ep = nullptr);
+
+// Products with at most this many rows (or columns) of C skip packing: the
+// micro-kernels would pad them to a full mr x nr tile, and the wide operand is read
+// only once anyway (see gemm_skinny).
+constexpr size_t kSkinnyRows = 8;
+constexpr size_t kSkinnyCols = 4;
+
+// Whether gemm_skinny handles an M x N product: few rows with op(B)'s rows contiguous
+// (strips of them load as vectors), or few columns with op(A)'s rows contiguous.
+inline bool skinny_supported(size_t M, size_t N, Operand A, Operand B) {
+    return (M <= kSkinnyRows && B.cs == 1) || (N <= kSkinnyCols && A.cs == 1);
+}
+
+// Unpacked kernels for skinny products: C[M x N] = alpha * op(A) * op(B) + beta * C.
+// Few rows (GEMV, short-wide GEMM): strips of C rows stay in vector registers while
+// the matching strips of B's rows stream past, so B is read about once per 4 rows of
+// C. Few columns (tall-skinny, A * x): dot products of A's rows with op(B)'s columns,
+// copied contiguous first if they are strided. Single-threaded; follows active_isa().
+void gemm_skinny(size_t M, size_t N, size_t K, float alpha, Operand A, Operand B,
+                 float beta, float* C, size_t ldc, const Epilogue* ep = nullptr);
+
+// Split-K: the K range is cut into slices computed as independent products on the
+// pool (each with gemm_skinny or gemm_packed), the first into C and the rest into
+// scratch, then summed into C by a parallel reduction that also applies `ep`.
+// Used when C is too small to give every thread its own tiles (see GemmPartition).
+template <typename T>
+void gemm_split_k(const MicroKernel& uk, size_t M, size_t N, size_t K,
+                  float alpha, BasicOperand<T> A, BasicOperand<T> B,
+                  float beta, float* C, size_t ldc, unsigned int threads,
+                  const Epilogue* ep = nullptr);
+
+// Skinny product on the pool, each chunk run by gemm_skinny: few-row products are
+// split by columns, few-column ones by rows.
+void gemm_skinny_threaded(size_t M, size_t N, size_t K, float alpha, Operand A, Operand B,
+                          float beta, float* C, size_t ldc, unsigned int threads,
+                          const Epilogue* ep = nullptr);
+
+// A whole op(B)[K x N] packed ahead of time for one micro-kernel and blocking
+// (see PackedMatrix). Read-only once packed.
+struct PackedB {
+    MicroKernel uk;     // Kernel and kc / nc the panels were packed for
+    size_t K;
+    size_t N;
+    const float* data;
+
+    // Floats needed to pack a K x N operand for `uk`.
+    static size_t size(const MicroKernel& uk, size_t K, size_t N);
+
+    // Packed panel holding rows [pc, pc + kc) from column `col` (a multiple of nr)
+    // to the end of its nc block. `pc` must be a multiple of kc.
+    const float* panel(size_t pc, size_t col) const;
+};
+
+// Packs all of op(B)[K x N] into `dst` (PackedB::size floats) in PackedB's layout.
+void pack_b_whole(const MicroKernel& uk, size_t K, size_t N, Operand B, float* dst);
+
+// Packed GEMM against a pre-packed B: C[M x N] = alpha * op(A) * B[:, colBegin : colBegin + N] + beta * C.
+// Only A is packed per call. colBegin must be a multiple of B.uk.nr.
+void gemm_prepacked(size_t M, size_t N, size_t colBegin, float alpha, Operand A,
+                    const PackedB& B, float beta, float* C, size_t ldc,
+                    const Epilogue* ep = nullptr);
+
+// Multi-threaded form over all N columns of B, tiled like gemm_packed_threaded.
+void gemm_prepacked_threaded(size_t M, float alpha, Operand A, const PackedB& B,
+                             float beta, float* C, size_t ldc, unsigned int maxThreads = 0,
+                             const Epilogue* ep = nullptr);
+
+// Register-tiled kernel of the wide engine, for T = double, std::complex<float> or
+// std::complex<double>: C[MR x NR] = A_panel * B_panel + beta * C, packed as for the
+// float kernels. Complex panels stay interleaved (re, im); see gemm_wide.cpp.
+template <typename T>
+using WideKernelFn = void (*)(size_t kc, const T* a, const T* b, T* c, size_t ldc, T beta);
+
+template <typename T>
+struct WideKernel {
+    size_t mr;
+    size_t nr;
+    size_t mc;
+    size_t kc;
+    size_t nc;
+    WideKernelFn<T> fn;
+};
+
+// Kernel for T on active_isa(), taking its cache blocking from the float kernel
+// `blocking` (e.g. a tuned one): the same mc and nc, and kc scaled so a packed panel
+// spans the same bytes as a float one.
+template <typename T>
+WideKernel<T> wide_kernel(const MicroKernel& blocking);
+
+// Single-threaded packed GEMM in T, structured like gemm_packed; alpha is folded into
+// the packed A.
+template <typename T>
+void gemm_wide(const WideKernel<T>& uk, size_t M, size_t N, size_t K,
+               T alpha, BasicOperand<T> A, BasicOperand<T> B,
+               T beta, T* C, size_t ldc);
+
+// Multi-threaded form: 2D tiles of C on the shared ThreadPool, shaped by
+// choose_thread_tiles as in gemm_packed_threaded. maxThreads = 0 uses the whole pool.
+template <typename T>
+void gemm_wide_threaded(const WideKernel<T>& uk, size_t M, size_t N, size_t K,
+                        T alpha, BasicOperand<T> A, BasicOperand<T> B,
+                        T beta, T* C, size_t ldc, unsigned int maxThreads = 0);
+
+} // namespace gemm_detail
+
+#endif // GEMM_INTERNAL_H
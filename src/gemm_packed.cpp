@@ -0,0 +1,913 @@
+#include "matrix.h"
+#include "gemm_internal.h"
+#include "thread_pool.h"
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include "gemm.h"
+
+namespace gemm_detail {
+
+namespace {
+
+// Largest register tile any micro-kernel may use (sizes the edge buffer).
+constexpr size_t kMaxMR = 16;
+constexpr size_t kMaxNR = 32;
+
+using PackBuffer = std::vector<float, MatrixAllocator<float>>;
+
+// Portable fallback built with the baseline compiler flags.
+template <size_t MR, size_t NR>
+void micro_kernel_generic(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta) {
+    float acc[MR][NR] = {};
+    for (size_t p = 0; p < kc; ++p) {
+        for (size_t i = 0; i < MR; ++i) {
+            float ai = a[i];
+            for (size_t j = 0; j < NR; ++j) {
+                acc[i][j] += ai * b[j];
+            }
+        }
+        a += MR;
+        b += NR;
+    }
+    for (size_t i = 0; i < MR; ++i) {
+        float* c_row = c + i * ldc;
+        for (size_t j = 0; j < NR; ++j) {
+            c_row[j] = (beta == 0.0f) ? acc[i][j] : acc[i][j] + beta * c_row[j];
+        }
+    }
+}
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+// 8x8 tile: 16 accumulators, A broadcast by lane from two vector loads.
+void micro_kernel_neon_8x8(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta) {
+    float32x4_t acc[8][2];
+    for (size_t i = 0; i < 8; ++i) {
+        acc[i][0] = vdupq_n_f32(0.0f);
+        acc[i][1] = vdupq_n_f32(0.0f);
+    }
+    for (size_t p = 0; p < kc; ++p) {
+        float32x4_t b0 = vld1q_f32(b);
+        float32x4_t b1 = vld1q_f32(b + 4);
+        float32x4_t a0 = vld1q_f32(a);
+        float32x4_t a1 = vld1q_f32(a + 4);
+        acc[0][0] = vfmaq_laneq_f32(acc[0][0], b0, a0, 0); acc[0][1] = vfmaq_laneq_f32(acc[0][1], b1, a0, 0);
+        acc[1][0] = vfmaq_laneq_f32(acc[1][0], b0, a0, 1); acc[1][1] = vfmaq_laneq_f32(acc[1][1], b1, a0, 1);
+        acc[2][0] = vfmaq_laneq_f32(acc[2][0], b0, a0, 2); acc[2][1] = vfmaq_laneq_f32(acc[2][1], b1, a0, 2);
+        acc[3][0] = vfmaq_laneq_f32(acc[3][0], b0, a0, 3); acc[3][1] = vfmaq_laneq_f32(acc[3][1], b1, a0, 3);
+        acc[4][0] = vfmaq_laneq_f32(acc[4][0], b0, a1, 0); acc[4][1] = vfmaq_laneq_f32(acc[4][1], b1, a1, 0);
+        acc[5][0] = vfmaq_laneq_f32(acc[5][0], b0, a1, 1); acc[5][1] = vfmaq_laneq_f32(acc[5][1], b1, a1, 1);
+        acc[6][0] = vfmaq_laneq_f32(acc[6][0], b0, a1, 2); acc[6][1] = vfmaq_laneq_f32(acc[6][1], b1, a1, 2);
+        acc[7][0] = vfmaq_laneq_f32(acc[7][0], b0, a1, 3); acc[7][1] = vfmaq_laneq_f32(acc[7][1], b1, a1, 3);
+        a += 8;
+        b += 8;
+    }
+    for (size_t i = 0; i < 8; ++i) {
+        float* c_row = c + i * ldc;
+        if (beta != 0.0f) {
+            acc[i][0] = vfmaq_n_f32(acc[i][0], vld1q_f32(c_row), beta);
+            acc[i][1] = vfmaq_n_f32(acc[i][1], vld1q_f32(c_row + 4), beta);
+        }
+        vst1q_f32(c_row, acc[i][0]);
+        vst1q_f32(c_row + 4, acc[i][1]);
+    }
+}
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+// The x86 kernels are compiled with per-function target attributes so one binary
+// carries all of them; micro_kernel_for() only hands out what cpuid reported.
+
+// 6x8 tile: 12 xmm accumulators + 2 B vectors + 1 A broadcast = 15 of 16 registers.
+__attribute__((target("sse4.2")))
+void micro_kernel_sse42_6x8(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta) {
+    __m128 acc[6][2];
+    for (size_t i = 0; i < 6; ++i) {
+        acc[i][0] = _mm_setzero_ps();
+        acc[i][1] = _mm_setzero_ps();
+    }
+    for (size_t p = 0; p < kc; ++p) {
+        __m128 b0 = _mm_load_ps(b);
+        __m128 b1 = _mm_load_ps(b + 4);
+        for (size_t i = 0; i < 6; ++i) {
+            __m128 ai = _mm_set1_ps(a[i]);
+            acc[i][0] = _mm_add_ps(acc[i][0], _mm_mul_ps(ai, b0));
+            acc[i][1] = _mm_add_ps(acc[i][1], _mm_mul_ps(ai, b1));
+        }
+        a += 6;
+        b += 8;
+    }
+    __m128 vbeta = _mm_set1_ps(beta);
+    for (size_t i = 0; i < 6; ++i) {
+        float* c_row = c + i * ldc;
+        if (beta != 0.0f) {
+            acc[i][0] = _mm_add_ps(acc[i][0], _mm_mul_ps(vbeta, _mm_loadu_ps(c_row)));
+            acc[i][1] = _mm_add_ps(acc[i][1], _mm_mul_ps(vbeta, _mm_loadu_ps(c_row + 4)));
+        }
+        _mm_storeu_ps(c_row, acc[i][0]);
+        _mm_storeu_ps(c_row + 4, acc[i][1]);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+inline void store_row_avx2(float* c_row, __m256 lo, __m256 hi, float beta) {
+    if (beta != 0.0f) {
+        __m256 vbeta = _mm256_set1_ps(beta);
+        lo = _mm256_fmadd_ps(vbeta, _mm256_loadu_ps(c_row), lo);
+        hi = _mm256_fmadd_ps(vbeta, _mm256_loadu_ps(c_row + 8), hi);
+    }
+    _mm256_storeu_ps(c_row, lo);
+    _mm256_storeu_ps(c_row + 8, hi);
+}
+
+// Same for a row cut short: lanes outside the masks are neither read nor written.
+__attribute__((target("avx2,fma")))
+inline void store_row_avx2_masked(float* c_row, __m256 lo, __m256 hi, float beta, __m256i mlo, __m256i mhi) {
+    if (beta != 0.0f) {
+        __m256 vbeta = _mm256_set1_ps(beta);
+        lo = _mm256_fmadd_ps(vbeta, _mm256_maskload_ps(c_row, mlo), lo);
+        hi = _mm256_fmadd_ps(vbeta, _mm256_maskload_ps(c_row + 8, mhi), hi);
+    }
+    _mm256_maskstore_ps(c_row, mlo, lo);
+    _mm256_maskstore_ps(c_row + 8, mhi, hi);
+}
+
+// 6x16 tile: 12 ymm accumulators + 2 B vectors + 1 A broadcast = 15 of 16 registers.
+// Masked stores only the top mr rows and left nr columns, for edge tiles.
+template <bool Masked>
+__attribute__((target("avx2,fma")))
+inline void avx2_6x16(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta,
+                      size_t mr, size_t nr) {
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+    for (size_t p = 0; p < kc; ++p) {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 ai;
+        ai = _mm256_broadcast_ss(a + 0); c00 = _mm256_fmadd_ps(ai, b0, c00); c01 = _mm256_fmadd_ps(ai, b1, c01);
+        ai = _mm256_broadcast_ss(a + 1); c10 = _mm256_fmadd_ps(ai, b0, c10); c11 = _mm256_fmadd_ps(ai, b1, c11);
+        ai = _mm256_broadcast_ss(a + 2); c20 = _mm256_fmadd_ps(ai, b0, c20); c21 = _mm256_fmadd_ps(ai, b1, c21);
+        ai = _mm256_broadcast_ss(a + 3); c30 = _mm256_fmadd_ps(ai, b0, c30); c31 = _mm256_fmadd_ps(ai, b1, c31);
+        ai = _mm256_broadcast_ss(a + 4); c40 = _mm256_fmadd_ps(ai, b0, c40); c41 = _mm256_fmadd_ps(ai, b1, c41);
+        ai = _mm256_broadcast_ss(a + 5); c50 = _mm256_fmadd_ps(ai, b0, c50); c51 = _mm256_fmadd_ps(ai, b1, c51);
+        a += 6;
+        b += 16;
+    }
+
+    if (!Masked) {
+        store_row_avx2(c + 0 * ldc, c00, c01, beta);
+        store_row_avx2(c + 1 * ldc, c10, c11, beta);
+        store_row_avx2(c + 2 * ldc, c20, c21, beta);
+        store_row_avx2(c + 3 * ldc, c30, c31, beta);
+        store_row_avx2(c + 4 * ldc, c40, c41, beta);
+        store_row_avx2(c + 5 * ldc, c50, c51, beta);
+        return;
+    }
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i mlo = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(nr)), lane);
+    const __m256i mhi = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(nr) - 8), lane);
+    __m256 rows[6][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+    for (size_t i = 0; i < mr; ++i) store_row_avx2_masked(c + i * ldc, rows[i][0], rows[i][1], beta, mlo, mhi);
+}
+
+__attribute__((target("avx2,fma")))
+void micro_kernel_avx2_6x16(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta) {
+    avx2_6x16<false>(kc, a, b, c, ldc, beta, 6, 16);
+}
+
+__attribute__((target("avx2,fma")))
+void edge_kernel_avx2_6x16(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta,
+                           size_t mr, size_t nr) {
+    avx2_6x16<true>(kc, a, b, c, ldc, beta, mr, nr);
+}
+
+__attribute__((target("avx512f")))
+inline void store_row_avx512(float* c_row, __m512 lo, __m512 hi, float beta) {
+    if (beta != 0.0f) {
+        __m512 vbeta = _mm512_set1_ps(beta);
+        lo = _mm512_fmadd_ps(vbeta, _mm512_loadu_ps(c_row), lo);
+        hi = _mm512_fmadd_ps(vbeta, _mm512_loadu_ps(c_row + 16), hi);
+    }
+    _mm512_storeu_ps(c_row, lo);
+    _mm512_storeu_ps(c_row + 16, hi);
+}
+
+// Same for a row cut short: lanes outside the masks are neither read nor written
+// (and cannot fault).
+__attribute__((target("avx512f")))
+inline void store_row_avx512_masked(float* c_row, __m512 lo, __m512 hi, float beta, __mmask16 mlo, __mmask16 mhi) {
+    if (beta != 0.0f) {
+        __m512 vbeta = _mm512_set1_ps(beta);
+        lo = _mm512_fmadd_ps(vbeta, _mm512_maskz_loadu_ps(mlo, c_row), lo);
+        hi = _mm512_fmadd_ps(vbeta, _mm512_maskz_loadu_ps(mhi, c_row + 16), hi);
+    }
+    _mm512_mask_storeu_ps(c_row, mlo, lo);
+    _mm512_mask_storeu_ps(c_row + 16, mhi, hi);
+}
+
+// 12x32 tile: 24 zmm accumulators + 2 B vectors + 1 A broadcast = 27 of 32 registers.
+// Masked stores only the top mr rows and left nr columns, for edge tiles.
+template <bool Masked>
+__attribute__((target("avx512f")))
+inline void avx512_12x32(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta,
+                         size_t mr, size_t nr) {
+#define MM_ROW_DECL(r) __m512 c##r##_0 = _mm512_setzero_ps(), c##r##_1 = _mm512_setzero_ps();
+#define MM_ROW_FMA(r) ai = _mm512_set1_ps(a[r]); \
+    c##r##_0 = _mm512_fmadd_ps(ai, b0, c##r##_0); c##r##_1 = _mm512_fmadd_ps(ai, b1, c##r##_1);
+    MM_ROW_DECL(0) MM_ROW_DECL(1) MM_ROW_DECL(2) MM_ROW_DECL(3) MM_ROW_DECL(4) MM_ROW_DECL(5)
+    MM_ROW_DECL(6) MM_ROW_DECL(7) MM_ROW_DECL(8) MM_ROW_DECL(9) MM_ROW_DECL(10) MM_ROW_DECL(11)
+
+    for (size_t p = 0; p < kc; ++p) {
+        __m512 b0 = _mm512_load_ps(b);
+        __m512 b1 = _mm512_load_ps(b + 16);
+        __m512 ai;
+        MM_ROW_FMA(0) MM_ROW_FMA(1) MM_ROW_FMA(2) MM_ROW_FMA(3) MM_ROW_FMA(4) MM_ROW_FMA(5)
+        MM_ROW_FMA(6) MM_ROW_FMA(7) MM_ROW_FMA(8) MM_ROW_FMA(9) MM_ROW_FMA(10) MM_ROW_FMA(11)
+        a += 12;
+        b += 32;
+    }
+#undef MM_ROW_DECL
+#undef MM_ROW_FMA
+
+    if (!Masked) {
+        store_row_avx512(c + 0 * ldc, c0_0, c0_1, beta);
+        store_row_avx512(c + 1 * ldc, c1_0, c1_1, beta);
+        store_row_avx512(c + 2 * ldc, c2_0, c2_1, beta);
+        store_row_avx512(c + 3 * ldc, c3_0, c3_1, beta);
+        store_row_avx512(c + 4 * ldc, c4_0, c4_1, beta);
+        store_row_avx512(c + 5 * ldc, c5_0, c5_1, beta);
+        store_row_avx512(c + 6 * ldc, c6_0, c6_1, beta);
+        store_row_avx512(c + 7 * ldc, c7_0, c7_1, beta);
+        store_row_avx512(c + 8 * ldc, c8_0, c8_1, beta);
+        store_row_avx512(c + 9 * ldc, c9_0, c9_1, beta);
+        store_row_avx512(c + 10 * ldc, c10_0, c10_1, beta);
+        store_row_avx512(c + 11 * ldc, c11_0, c11_1, beta);
+        return;
+    }
+    const __mmask16 mlo = (nr >= 16) ? 0xFFFF : __mmask16((1u << nr) - 1);
+    const __mmask16 mhi = (nr <= 16) ? 0 : __mmask16((1u << (nr - 16)) - 1);
+    __m512 rows[12][2] = {{c0_0, c0_1}, {c1_0, c1_1}, {c2_0, c2_1}, {c3_0, c3_1}, {c4_0, c4_1}, {c5_0, c5_1},
+                          {c6_0, c6_1}, {c7_0, c7_1}, {c8_0, c8_1}, {c9_0, c9_1}, {c10_0, c10_1}, {c11_0, c11_1}};
+    for (size_t i = 0; i < mr; ++i) store_row_avx512_masked(c + i * ldc, rows[i][0], rows[i][1], beta, mlo, mhi);
+}
+
+__attribute__((target("avx512f")))
+void micro_kernel_avx512_12x32(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta) {
+    avx512_12x32<false>(kc, a, b, c, ldc, beta, 12, 32);
+}
+
+__attribute__((target("avx512f")))
+void edge_kernel_avx512_12x32(size_t kc, const float* a, const float* b, float* c, size_t ldc, float beta,
+                              size_t mr, size_t nr) {
+    avx512_12x32<true>(kc, a, b, c, ldc, beta, mr, nr);
+}
+#endif
+
+// Copies an mc x kc block of op(A) into MR-row panels, scaled by alpha; each
+// panel is column-major (MR consecutive values per k). Short panels are zero-padded.
+void pack_a(size_t mc, size_t kc, Operand A, float alpha, size_t mr, float* dst) {
+    for (size_t ir = 0; ir < mc; ir += mr) {
+        size_t rows = std::min(mr, mc - ir);
+        for (size_t p = 0; p < kc; ++p) {
+            const float* a_col = A.data + ir * A.rs + p * A.cs;
+            size_t r = 0;
+            if (A.rs == 1) {
+                // Transposed A: the MR values for this k are contiguous
+                for (; r < rows; ++r) {
+                    dst[r] = alpha * a_col[r];
+                }
+            } else {
+                for (; r < rows; ++r) {
+                    dst[r] = alpha * a_col[r * A.rs];
+                }
+            }
+            for (; r < mr; ++r) {
+                dst[r] = 0.0f;
+            }
+            dst += mr;
+        }
+    }
+}
+
+// Copies a kc x nc block of op(B) into NR-column panels; each panel is row-major
+// (NR consecutive values per k). Short panels are zero-padded.
+void pack_b(size_t kc, size_t nc, Operand B, size_t nr, float* dst) {
+    for (size_t jr = 0; jr < nc; jr += nr) {
+        size_t cols = std::min(nr, nc - jr);
+        for (size_t p = 0; p < kc; ++p) {
+            const float* b_row = B.data + p * B.rs + jr * B.cs;
+            size_t j = 0;
+            if (B.cs == 1) {
+                for (; j < cols; ++j) {
+                    dst[j] = b_row[j];
+                }
+            } else {
+                for (; j < cols; ++j) {
+                    dst[j] = b_row[j * B.cs];
+                }
+            }
+            for (; j < nr; ++j) {
+                dst[j] = 0.0f;
+            }
+            dst += nr;
+        }
+    }
+}
+
+// Half-precision operands: each contiguous run (a row of A, or the MR values of
+// one k when A is transposed) is widened with convert(), which uses F16C / AVX2
+// when available, then laid out exactly like the float panels above.
+template <typename T>
+void pack_a(size_t mc, size_t kc, BasicOperand<T> A, float alpha, size_t mr, float* dst) {
+    thread_local std::vector<float> run;
+    if (run.size() < kc) run.resize(kc);
+
+    for (size_t ir = 0; ir < mc; ir += mr) {
+        size_t rows = std::min(mr, mc - ir);
+        if (A.rs == 1) {
+            for (size_t p = 0; p < kc; ++p) {
+                convert(A.data + ir + p * A.cs, rows, dst);
+                for (size_t r = 0; r < mr; ++r) {
+                    dst[r] = (r < rows) ? alpha * dst[r] : 0.0f;
+                }
+                dst += mr;
+            }
+            continue;
+        }
+        for (size_t r = 0; r < mr; ++r) {
+            if (r < rows) {
+                convert(A.data + (ir + r) * A.rs, kc, run.data());
+            }
+            for (size_t p = 0; p < kc; ++p) {
+                dst[p * mr + r] = (r < rows) ? alpha * run[p] : 0.0f;
+            }
+        }
+        dst += mr * kc;
+    }
+}
+
+template <typename T>
+void pack_b(size_t kc, size_t nc, BasicOperand<T> B, size_t nr, float* dst) {
+    thread_local std::vector<float> run;
+    if (run.size() < kc) run.resize(kc);
+
+    for (size_t jr = 0; jr < nc; jr += nr) {
+        size_t cols = std::min(nr, nc - jr);
+        if (B.cs == 1) {
+            for (size_t p = 0; p < kc; ++p) {
+                convert(B.data + p * B.rs + jr, cols, dst);
+                for (size_t j = cols; j < nr; ++j) {
+                    dst[j] = 0.0f;
+                }
+                dst += nr;
+            }
+            continue;
+        }
+        // Transposed B: each column is a contiguous run along k
+        for (size_t j = 0; j < nr; ++j) {
+            if (j < cols) {
+                convert(B.data + (jr + j) * B.cs, kc, run.data());
+            }
+            for (size_t p = 0; p < kc; ++p) {
+                dst[p * nr + j] = (j < cols) ? run[p] : 0.0f;
+            }
+        }
+        dst += nr * kc;
+    }
+}
+
+} // namespace
+
+const MicroKernel& micro_kernel_for(CpuIsa isa) {
+    static const MicroKernel scalar = {"scalar-4x8", 4, 8, 128, 256, 4096, micro_kernel_generic<4, 8>, nullptr};
+    switch (isa) {
+#if defined(__x86_64__) || defined(_M_X64)
+        case CpuIsa::SSE42: {
+            static const MicroKernel sse = {"sse4.2-6x8", 6, 8, 120, 256, 4096, micro_kernel_sse42_6x8, nullptr};
+            return sse;
+        }
+        case CpuIsa::AVX2: {
+            static const MicroKernel avx2 = {"avx2-6x16", 6, 16, 168, 256, 4080, micro_kernel_avx2_6x16,
+                                                  edge_kernel_avx2_6x16};
+            return avx2;
+        }
+        case CpuIsa::AVX512: {
+            static const MicroKernel avx512 = {"avx512-12x32", 12, 32, 144, 256, 4096, micro_kernel_avx512_12x32,
+                                                    edge_kernel_avx512_12x32};
+            return avx512;
+        }
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+        case CpuIsa::NEON: {
+            static const MicroKernel neon = {"neon-8x8", 8, 8, 128, 256, 4096, micro_kernel_neon_8x8, nullptr};
+            return neon;
+        }
+#endif
+        default:
+            return scalar;
+    }
+}
+
+const MicroKernel& select_micro_kernel() {
+    return micro_kernel_for(active_isa());
+}
+
+MicroKernel with_blocking(const MicroKernel& uk, size_t mc, size_t kc, size_t nc) {
+    MicroKernel tuned = uk;
+    tuned.mc = std::max(uk.mr, (mc / uk.mr) * uk.mr);
+    tuned.kc = std::max<size_t>(1, kc);
+    tuned.nc = std::max(uk.nr, (nc / uk.nr) * uk.nr);
+    return tuned;
+}
+
+void scale_c(size_t M, size_t N, float beta, float* C, size_t ldc) {
+    for (size_t i = 0; i < M; ++i) {
+        float* c_row = C + i * ldc;
+        for (size_t j = 0; j < N; ++j) {
+            c_row[j] = (beta == 0.0f) ? 0.0f : beta * c_row[j];
+        }
+    }
+}
+
+namespace {
+
+// exp(x) for x in [-87, 88], as 2^n * e^r with |r| <= ln(2) / 2 and a degree-6
+// polynomial (Cephes constants, relative error about 2e-7). Unlike libm calls this
+// inlines into the epilogue loops and vectorizes.
+inline float exp_approx(float x) {
+    float t = x * 1.44269504f;
+    int32_t n = static_cast<int32_t>(t + std::copysign(0.5f, t));
+    float fn = static_cast<float>(n);
+    float r = x - fn * 0.693359375f + fn * 2.12194440e-4f;
+    float p = 1.9875691500e-4f;
+    p = p * r + 1.3981999507e-3f;
+    p = p * r + 8.3334519073e-3f;
+    p = p * r + 4.1665795894e-2f;
+    p = p * r + 1.6666665459e-1f;
+    p = p * r + 5.0000001201e-1f;
+    p = p * r * r + r + 1.0f;
+    uint32_t bits = static_cast<uint32_t>(n + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+// erf(x) for |x| <= 9 after Abramowitz & Stegun 7.1.26 (absolute error below 1.5e-7).
+inline float erf_approx(float x) {
+    float ax = std::fabs(x);
+    float t = 1.0f / (1.0f + 0.3275911f * ax);
+    float p = 1.061405429f;
+    p = p * t - 1.453152027f;
+    p = p * t + 1.421413741f;
+    p = p * t - 0.284496736f;
+    p = p * t + 0.254829592f;
+    return std::copysign(1.0f - p * t * exp_approx(-ax * ax), x);
+}
+
+template <Activation Act>
+void activate_row(float* c, size_t N) {
+    if (Act == Activation::ReLU) {
+        for (size_t j = 0; j < N; ++j) c[j] = (c[j] > 0.0f) ? c[j] : 0.0f;
+        return;
+    }
+
+    // The argument of erf / exp is clamped in a loop of its own: GCC keeps
+    // comparisons that feed further floating-point math as branches, which would
+    // leave the whole loop scalar. Outside the clamp range both are saturated.
+    constexpr size_t kChunk = 64;
+    const float scale = (Act == Activation::GELU) ? 0.70710678f : -1.0f;
+    const float lo = (Act == Activation::GELU) ? -9.0f : -87.0f;
+    const float hi = (Act == Activation::GELU) ? 9.0f : 87.0f;
+    alignas(64) float arg[kChunk];
+    for (size_t j0 = 0; j0 < N; j0 += kChunk) {
+        size_t n = std::min(kChunk, N - j0);
+        float* x = c + j0;
+        for (size_t j = 0; j < n; ++j) {
+            float u = x[j] * scale;
+            u = (u < lo) ? lo : u;
+            arg[j] = (u > hi) ? hi : u;
+        }
+        if (Act == Activation::GELU) {
+            for (size_t j = 0; j < n; ++j) x[j] = 0.5f * x[j] * (1.0f + erf_approx(arg[j]));
+        } else {
+            for (size_t j = 0; j < n; ++j) x[j] = 1.0f / (1.0f + exp_approx(arg[j]));
+        }
+    }
+}
+
+// Activation is a template parameter so the row loops carry no per-element branch.
+template <Activation Act>
+void apply_epilogue_rows(const Epilogue& ep, size_t row0, size_t col0, size_t M, size_t N,
+                         float* C, size_t ldc) {
+    for (size_t i = 0; i < M; ++i) {
+        float* c_row = C + i * ldc;
+        if (ep.bias && ep.biasMode == BiasMode::PerRow) {
+            float b = ep.bias[row0 + i];
+            for (size_t j = 0; j < N; ++j) c_row[j] += b;
+        } else if (ep.bias) {
+            const float* b_row = ep.bias + col0;
+            for (size_t j = 0; j < N; ++j) c_row[j] += b_row[j];
+        }
+        if (Act != Activation::None) activate_row<Act>(c_row, N);
+        if (ep.residual) {
+            const float* r_row = ep.residual + (row0 + i) * ep.ldResidual + col0;
+            for (size_t j = 0; j < N; ++j) c_row[j] += r_row[j];
+        }
+    }
+}
+
+} // namespace
+
+void apply_epilogue(const Epilogue& ep, size_t row0, size_t col0, size_t M, size_t N,
+                    float* C, size_t ldc) {
+    switch (ep.activation) {
+        case Activation::None:    apply_epilogue_rows<Activation::None>(ep, row0, col0, M, N, C, ldc); break;
+        case Activation::ReLU:    apply_epilogue_rows<Activation::ReLU>(ep, row0, col0, M, N, C, ldc); break;
+        case Activation::GELU:    apply_epilogue_rows<Activation::GELU>(ep, row0, col0, M, N, C, ldc); break;
+        case Activation::Sigmoid: apply_epilogue_rows<Activation::Sigmoid>(ep, row0, col0, M, N, C, ldc); break;
+    }
+}
+
+Epilogue offset_epilogue(const Epilogue& ep, size_t row0, size_t col0) {
+    Epilogue shifted = ep;
+    if (ep.bias) shifted.bias += (ep.biasMode == BiasMode::PerRow) ? row0 : col0;
+    if (ep.residual) shifted.residual += row0 * ep.ldResidual + col0;
+    return shifted;
+}
+
+void choose_thread_tiles(size_t mr, size_t nr, size_t mc, size_t nc, size_t M, size_t N,
+                         unsigned int threads, size_t& tileRows, size_t& tileCols) {
+    // Start from one cache block per tile and halve the larger side until every
+    // thread has a few tiles to steal from, never going below one register tile.
+    const size_t targetTiles = 4 * static_cast<size_t>(threads);
+    tileRows = std::min(mc, ((M + mr - 1) / mr) * mr);
+    tileCols = std::min(nc, ((N + nr - 1) / nr) * nr);
+    auto tiles = [&] { return ((M + tileRows - 1) / tileRows) * ((N + tileCols - 1) / tileCols); };
+    while (tiles() < targetTiles) {
+        if (tileCols >= tileRows && tileCols > 4 * nr) {
+            tileCols = ((tileCols / 2 + nr - 1) / nr) * nr;
+        } else if (tileRows > mr) {
+            tileRows = ((tileRows / 2 + mr - 1) / mr) * mr;
+        } else {
+            break;
+        }
+    }
+}
+
+unsigned int thread_budget(unsigned int maxThreads) {
+    unsigned int poolThreads = ThreadPool::instance().num_threads();
+    return (maxThreads == 0) ? poolThreads : std::min(maxThreads, poolThreads);
+}
+
+namespace {
+
+// Runs the register tiles of one packed mc x nc block of C. Partial tiles use the
+// kernel's masked edge form, or else go through a scratch tile so the kernel only
+// ever sees full MR x NR tiles. A non-null `ep` is applied to each tile straight
+// after it is stored; (row0, col0) is the block's position in the epilogue's frame.
+void macro_kernel(const MicroKernel& uk, size_t mc, size_t nc, size_t kc,
+                  const float* a_packed, const float* b_packed,
+                  float beta, float* C, size_t ldc,
+                  const Epilogue* ep = nullptr, size_t row0 = 0, size_t col0 = 0) {
+    alignas(64) float edge[kMaxMR * kMaxNR];
+
+    for (size_t jr = 0; jr < nc; jr += uk.nr) {
+        size_t nr = std::min(uk.nr, nc - jr);
+        const float* b_panel = b_packed + jr * kc;
+
+        for (size_t ir = 0; ir < mc; ir += uk.mr) {
+            size_t mr = std::min(uk.mr, mc - ir);
+            const float* a_panel = a_packed + ir * kc;
+            float* c_tile = C + ir * ldc + jr;
+
+            if (mr == uk.mr && nr == uk.nr) {
+                uk.fn(kc, a_panel, b_panel, c_tile, ldc, beta);
+            } else if (uk.edge) {
+                uk.edge(kc, a_panel, b_panel, c_tile, ldc, beta, mr, nr);
+            } else {
+                uk.fn(kc, a_panel, b_panel, edge, uk.nr, 0.0f);
+                for (size_t i = 0; i < mr; ++i) {
+                    float* c_row = c_tile + i * ldc;
+                    const float* e_row = edge + i * uk.nr;
+                    for (size_t j = 0; j < nr; ++j) {
+                        c_row[j] = (beta == 0.0f) ? e_row[j] : e_row[j] + beta * c_row[j];
+                    }
+                }
+            }
+            if (ep) apply_epilogue(*ep, row0 + ir, col0 + jr, mr, nr, c_tile, ldc);
+        }
+    }
+}
+
+// Thread-local buffer for the packed A block, grown on demand.
+float* a_pack_buffer(const MicroKernel& uk) {
+    thread_local PackBuffer a_buf;
+    size_t a_size = ((uk.mc + uk.mr - 1) / uk.mr) * uk.mr * uk.kc;
+    if (a_buf.size() < a_size) a_buf.resize(a_size);
+    return a_buf.data();
+}
+
+} // namespace
+
+template <typename T>
+void gemm_packed(const MicroKernel& uk, size_t M, size_t N, size_t K,
+                 float alpha, BasicOperand<T> A, BasicOperand<T> B,
+                 float beta, float* C, size_t ldc, const Epilogue* ep) {
+    if (M == 0 || N == 0) return;
+    if (ep && ep->empty()) ep = nullptr;
+
+    if (K == 0 || alpha == 0.0f) {
+        scale_c(M, N, beta, C, ldc);
+        if (ep) apply_epilogue(*ep, 0, 0, M, N, C, ldc);
+        return;
+    }
+    if constexpr (std::is_same<T, float>::value) {
+        if (skinny_supported(M, N, A, B)) {
+            gemm_skinny(M, N, K, alpha, A, B, beta, C, ldc, ep);
+            return;
+        }
+    }
+
+    // Packing buffers are reused across calls to avoid an allocation per GEMM.
+    float* a_buf = a_pack_buffer(uk);
+    thread_local PackBuffer b_buf;
+    size_t b_size = ((uk.nc + uk.nr - 1) / uk.nr) * uk.nr * uk.kc;
+    if (b_buf.size() < b_size) b_buf.resize(b_size);
+
+    for (size_t jc = 0; jc < N; jc += uk.nc) {
+        size_t nc = std::min(uk.nc, N - jc);
+
+        for (size_t pc = 0; pc < K; pc += uk.kc) {
+            size_t kc = std::min(uk.kc, K - pc);
+            // Only the first K block applies the caller's beta; later blocks accumulate.
+            // The epilogue runs with the last one, when each tile's sum is complete.
+            float beta_k = (pc == 0) ? beta : 1.0f;
+            const Epilogue* ep_k = (pc + kc == K) ? ep : nullptr;
+
+            pack_b(kc, nc, B.offset(pc, jc), uk.nr, b_buf.data());
+
+            for (size_t ic = 0; ic < M; ic += uk.mc) {
+                size_t mc = std::min(uk.mc, M - ic);
+                pack_a(mc, kc, A.offset(ic, pc), alpha, uk.mr, a_buf);
+                macro_kernel(uk, mc, nc, kc, a_buf, b_buf.data(), beta_k, C + ic * ldc + jc, ldc,
+                             ep_k, ic, jc);
+            }
+        }
+    }
+}
+
+namespace {
+
+// Threaded engine for problems tall enough to split by rows alone. The jc / pc loops
+// run in order; each kc x nc block of B is packed once per cache domain, by the
+// threads together, into a buffer the domain's threads then share from L3. Each
+// thread packs groups of its own domain's copy (first touch puts it in that domain's
+// memory) and only helps another domain once its own is claimed. With one domain
+// (or an unpinned pool) there is a single copy. The threads split C's rows in blocks
+// of at most mc, packing their own A.
+template <typename T>
+void gemm_packed_shared_b(const MicroKernel& uk, size_t M, size_t N, size_t K, size_t taskRows,
+                          float alpha, BasicOperand<T> A, BasicOperand<T> B,
+                          float beta, float* C, size_t ldc, unsigned int threads,
+                          const Epilogue* ep) {
+    ThreadPool& pool = ThreadPool::instance();
+    const size_t domains = pool.num_domains();
+    const size_t blockFloats = ((uk.nc + uk.nr - 1) / uk.nr) * uk.nr * uk.kc;
+
+    // Per calling thread, so concurrent products never share a buffer
+    thread_local PackBuffer shared;
+    if (shared.size() < domains * blockFloats) shared.resize(domains * blockFloats);
+    float* sharedB = shared.data();
+    std::vector<std::atomic<size_t>> nextGroup(domains);
+
+    const size_t rowTasks = (M + taskRows - 1) / taskRows;
+    for (size_t jc = 0; jc < N; jc += uk.nc) {
+        const size_t nc = std::min(uk.nc, N - jc);
+        const size_t panels = (nc + uk.nr - 1) / uk.nr;
+        const size_t groups = std::min<size_t>(panels, threads);
+
+        for (size_t pc = 0; pc < K; pc += uk.kc) {
+            const size_t kc = std::min(uk.kc, K - pc);
+            const float beta_k = (pc == 0) ? beta : 1.0f;
+            const Epilogue* ep_k = (pc + kc == K) ? ep : nullptr;
+
+            // Each domain's copy is packed in groups of whole nr panels, claimed from
+            // the domain's counter; there are as many tasks as groups in all copies,
+            // so every task claims exactly one.
+            for (std::atomic<size_t>& n : nextGroup) n.store(0, std::memory_order_relaxed);
+            pool.parallel_for(domains * groups, [&](size_t) {
+                const size_t home = pool.current_domain();
+                for (size_t i = 0; i < domains; ++i) {
+                    const size_t d = (home + i) % domains;
+                    const size_t g = nextGroup[d].fetch_add(1, std::memory_order_relaxed);
+                    if (g >= groups) continue;
+                    size_t p0 = panels * g / groups, p1 = panels * (g + 1) / groups;
+                    size_t c0 = p0 * uk.nr, c1 = std::min(nc, p1 * uk.nr);
+                    pack_b(kc, c1 - c0, B.offset(pc, jc + c0), uk.nr, sharedB + d * blockFloats + c0 * kc);
+                    return;
+                }
+            }, threads);
+
+            pool.parallel_for(rowTasks, [&](size_t t) {
+                size_t ic = t * taskRows, mc = std::min(taskRows, M - ic);
+                float* a_buf = a_pack_buffer(uk);
+                pack_a(mc, kc, A.offset(ic, pc), alpha, uk.mr, a_buf);
+                macro_kernel(uk, mc, nc, kc, a_buf, sharedB + pool.current_domain() * blockFloats,
+                             beta_k, C + ic * ldc + jc, ldc, ep_k, ic, jc);
+            }, threads);
+        }
+    }
+}
+
+} // namespace
+
+template <typename T>
+void gemm_packed_threaded(const MicroKernel& uk, size_t M, size_t N, size_t K,
+                          float alpha, BasicOperand<T> A, BasicOperand<T> B,
+                          float beta, float* C, size_t ldc, unsigned int maxThreads,
+                          const Epilogue* ep) {
+    unsigned int threads = thread_budget(maxThreads);
+    GemmPartition partition = choose_gemm_partition(M, N, K, threads);
+    if (partition == GemmPartition::SplitK && alpha != 0.0f) {
+        gemm_split_k(uk, M, N, K, alpha, A, B, beta, C, ldc, threads, ep);
+        return;
+    }
+    if (threads <= 1) {
+        gemm_packed(uk, M, N, K, alpha, A, B, beta, C, ldc, ep);
+        return;
+    }
+    if constexpr (std::is_same<T, float>::value) {
+        if (skinny_supported(M, N, A, B)) {
+            gemm_skinny_threaded(M, N, K, alpha, A, B, beta, C, ldc, threads, ep);
+            return;
+        }
+    }
+
+    // Rows enough for two blocks of at least 4 register tiles per thread: share the
+    // packed B instead of having every 2D tile pack its own columns of it
+    size_t taskRows = (M + 2 * threads - 1) / (2 * threads);
+    taskRows = std::min(uk.mc, (taskRows + uk.mr - 1) / uk.mr * uk.mr);
+    if (K > 0 && alpha != 0.0f && taskRows >= 4 * uk.mr) {
+        if (ep && ep->empty()) ep = nullptr;
+        gemm_packed_shared_b(uk, M, N, K, taskRows, alpha, A, B, beta, C, ldc, threads, ep);
+        return;
+    }
+
+    size_t tileRows, tileCols;
+    choose_thread_tiles(uk.mr, uk.nr, uk.mc, uk.nc, M, N, threads, tileRows, tileCols);
+    ThreadPool::instance().parallel_for_2d(M, N, tileRows, tileCols,
+                                           [&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+        Epilogue tileEp;
+        if (ep) tileEp = offset_epilogue(*ep, rowBegin, colBegin);
+        gemm_packed(uk, rowEnd - rowBegin, colEnd - colBegin, K,
+                    alpha, A.offset(rowBegin, 0), B.offset(0, colBegin),
+                    beta, C + rowBegin * ldc + colBegin, ldc, ep ? &tileEp : nullptr);
+    }, threads);
+}
+
+template void gemm_packed<float>(const MicroKernel&, size_t, size_t, size_t, float, Operand, Operand,
+                                 float, float*, size_t, const Epilogue*);
+template void gemm_packed<bfloat16>(const MicroKernel&, size_t, size_t, size_t, float, BasicOperand<bfloat16>,
+                                    BasicOperand<bfloat16>, float, float*, size_t, const Epilogue*);
+template void gemm_packed<float16>(const MicroKernel&, size_t, size_t, size_t, float, BasicOperand<float16>,
+                                   BasicOperand<float16>, float, float*, size_t, const Epilogue*);
+template void gemm_packed_threaded<float>(const MicroKernel&, size_t, size_t, size_t, float, Operand, Operand,
+                                          float, float*, size_t, unsigned int, const Epilogue*);
+template void gemm_packed_threaded<bfloat16>(const MicroKernel&, size_t, size_t, size_t, float,
+                                             BasicOperand<bfloat16>, BasicOperand<bfloat16>,
+                                             float, float*, size_t, unsigned int, const Epilogue*);
+template void gemm_packed_threaded<float16>(const MicroKernel&, size_t, size_t, size_t, float,
+                                            BasicOperand<float16>, BasicOperand<float16>,
+                                            float, float*, size_t, unsigned int, const Epilogue*);
+
+namespace {
+
+// Offset of the packed panel holding op(B)[pc : pc + kc, col : ...] in a whole
+// pre-packed B. Column blocks are stored one after another, each as its K / kc row
+// blocks; every column block but the last is exactly nc wide. `col` must be a
+// multiple of nr.
+size_t packed_b_offset(const MicroKernel& uk, size_t K, size_t N, size_t pc, size_t col) {
+    size_t block = col / uk.nc;
+    size_t blockStart = block * uk.nc;
+    size_t width = std::min(uk.nc, N - blockStart);
+    size_t paddedWidth = ((width + uk.nr - 1) / uk.nr) * uk.nr;
+    size_t kc = std::min(uk.kc, K - pc);
+    return block * K * uk.nc + pc * paddedWidth + (col - blockStart) * kc;
+}
+
+} // namespace
+
+size_t PackedB::size(const MicroKernel& uk, size_t K, size_t N) {
+    size_t fullBlocks = N / uk.nc;
+    size_t tail = N - fullBlocks * uk.nc;
+    return K * (fullBlocks * uk.nc + ((tail + uk.nr - 1) / uk.nr) * uk.nr);
+}
+
+const float* PackedB::panel(size_t pc, size_t col) const {
+    return data + packed_b_offset(uk, K, N, pc, col);
+}
+
+void pack_b_whole(const MicroKernel& uk, size_t K, size_t N, Operand B, float* dst) {
+    // Every kc x nc block is packed independently, so the blocks go to the pool.
+    size_t rowBlocks = (K + uk.kc - 1) / uk.kc;
+    size_t colBlocks = (N + uk.nc - 1) / uk.nc;
+    ThreadPool::instance().parallel_for(rowBlocks * colBlocks, [&](size_t t) {
+        size_t pc = (t % rowBlocks) * uk.kc;
+        size_t jc = (t / rowBlocks) * uk.nc;
+        size_t kc = std::min(uk.kc, K - pc);
+        size_t nc = std::min(uk.nc, N - jc);
+        pack_b(kc, nc, B.offset(pc, jc), uk.nr, dst + packed_b_offset(uk, K, N, pc, jc));
+    });
+}
+
+void gemm_prepacked(size_t M, size_t N, size_t colBegin, float alpha, Operand A,
+                    const PackedB& B, float beta, float* C, size_t ldc, const Epilogue* ep) {
+    const MicroKernel& uk = B.uk;
+    size_t K = B.K;
+    if (M == 0 || N == 0) return;
+    if (ep && ep->empty()) ep = nullptr;
+
+    if (K == 0 || alpha == 0.0f) {
+        scale_c(M, N, beta, C, ldc);
+        if (ep) apply_epilogue(*ep, 0, 0, M, N, C, ldc);
+        return;
+    }
+
+    float* a_buf = a_pack_buffer(uk);
+
+    // Walk the packed column blocks that overlap [colBegin, colBegin + N).
+    size_t colEnd = colBegin + N;
+    for (size_t jc = colBegin; jc < colEnd;) {
+        size_t nc = std::min((jc / uk.nc + 1) * uk.nc, colEnd) - jc;
+
+        for (size_t pc = 0; pc < K; pc += uk.kc) {
+            size_t kc = std::min(uk.kc, K - pc);
+            float beta_k = (pc == 0) ? beta : 1.0f;
+            const Epilogue* ep_k = (pc + kc == K) ? ep : nullptr;
+            const float* b_packed = B.panel(pc, jc);
+
+            for (size_t ic = 0; ic < M; ic += uk.mc) {
+                size_t mc = std::min(uk.mc, M - ic);
+                pack_a(mc, kc, A.offset(ic, pc), alpha, uk.mr, a_buf);
+                macro_kernel(uk, mc, nc, kc, a_buf, b_packed, beta_k, C + ic * ldc + (jc - colBegin), ldc,
+                             ep_k, ic, jc - colBegin);
+            }
+        }
+        jc += nc;
+    }
+}
+
+void gemm_prepacked_threaded(size_t M, float alpha, Operand A, const PackedB& B,
+                             float beta, float* C, size_t ldc, unsigned int maxThreads,
+                             const Epilogue* ep) {
+    unsigned int threads = thread_budget(maxThreads);
+    if (threads <= 1) {
+        gemm_prepacked(M, B.N, 0, alpha, A, B, beta, C, ldc, ep);
+        return;
+    }
+
+    // Tile columns stay multiples of nr, so every tile starts on a packed panel.
+    size_t tileRows, tileCols;
+    choose_thread_tiles(B.uk.mr, B.uk.nr, B.uk.mc, B.uk.nc, M, B.N, threads, tileRows, tileCols);
+    ThreadPool::instance().parallel_for_2d(M, B.N, tileRows, tileCols,
+                                           [&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+        Epilogue tileEp;
+        if (ep) tileEp = offset_epilogue(*ep, rowBegin, colBegin);
+        gemm_prepacked(rowEnd - rowBegin, colEnd - colBegin, colBegin, alpha, A.offset(rowBegin, 0),
+                       B, beta, C + rowBegin * ldc + colBegin, ldc, ep ? &tileEp : nullptr);
+    }, threads);
+}
+
+} // namespace gemm_detail
+
+void multiply_optimized_packed(const Matrix& A, const Matrix& B, Matrix& C) {
+    if (A.cols != B.rows || C.rows != A.rows || C.cols != B.cols) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+
+    gemm_detail::gemm_packed(gemm_detail::select_micro_kernel(), A.rows, B.cols, A.cols,
+                             1.0f, gemm_detail::Operand::of(A.data.data(), A.cols, false),
+                             gemm_detail::Operand::of(B.data.data(), B.cols, false),
+                             0.0f, C.data.data(), C.cols);
+}
+
+void multiply_optimized_packed_threaded(const Matrix& A, const Matrix& B, Matrix& C, unsigned int numThreads) {
+    if (A.cols != B.rows || C.rows != A.rows || C.cols != B.cols) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+
+    gemm_detail::gemm_packed_threaded(gemm_detail::select_micro_kernel(), A.rows, B.cols, A.cols,
+                                      1.0f, gemm_detail::Operand::of(A.data.data(), A.cols, false),
+                                      gemm_detail::Operand::of(B.data.data(), B.cols, false),
+                                      0.0f, C.data.data(), C.cols, numThreads);
+}
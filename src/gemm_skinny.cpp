@@ -0,0 +1,371 @@
+#include "matrix.h"
+#include "gemm.h"
+#include "gemm_internal.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Depth of each pass over a strip of C. Bounds the B rows (and pages) one strip
+// walks before the next strip reuses them.
+constexpr size_t kSkinnyKc = 128;
+
+// Thinnest K slice split-K hands a task, so the reduction stays cheap next to it.
+constexpr size_t kMinSliceK = 256;
+
+// Granularity used to count how many independent blocks of C a product offers.
+constexpr size_t kPartitionRows = 16;
+constexpr size_t kPartitionCols = 64;
+
+using PackBuffer = std::vector<float, MatrixAllocator<float>>;
+
+// W floats as a GCC vector, lowered to the target's registers.
+template <size_t W>
+struct StripVec {
+    typedef float type __attribute__((vector_size(W * sizeof(float))));
+};
+
+// R rows of C: every strip of S vectors is accumulated in registers over a K block,
+// with the rows of B loaded once for all R rows. alpha is folded into A's scalars.
+template <size_t RegBytes, size_t R>
+inline __attribute__((always_inline))
+void skinny_rows_body(size_t N, size_t K, float alpha, gemm_detail::Operand A, gemm_detail::Operand B,
+                      float beta, float* C, size_t ldc) {
+    constexpr size_t W = RegBytes / sizeof(float);
+    constexpr size_t S = (RegBytes == 64) ? 4 : 2;
+    using Vec = typename StripVec<W>::type;
+
+    for (size_t k0 = 0; k0 < K; k0 += kSkinnyKc) {
+        const size_t kb = std::min(kSkinnyKc, K - k0);
+        // The first K block applies beta; later ones accumulate
+        const float b0 = (k0 == 0) ? beta : 1.0f;
+        float a[R][kSkinnyKc];
+        for (size_t r = 0; r < R; ++r) {
+            for (size_t k = 0; k < kb; ++k) a[r][k] = alpha * A.data[r * A.rs + (k0 + k) * A.cs];
+        }
+        const float* b_block = B.data + k0 * B.rs;
+
+        size_t j = 0;
+        for (; j + S * W <= N; j += S * W) {
+            Vec acc[R][S] = {};
+            for (size_t k = 0; k < kb; ++k) {
+                const float* b_row = b_block + k * B.rs + j;
+                Vec bv[S];
+#pragma GCC unroll 4
+                for (size_t s = 0; s < S; ++s) std::memcpy(&bv[s], b_row + s * W, sizeof(Vec));
+#pragma GCC unroll 4
+                for (size_t r = 0; r < R; ++r) {
+#pragma GCC unroll 4
+                    for (size_t s = 0; s < S; ++s) acc[r][s] += a[r][k] * bv[s];
+                }
+            }
+            for (size_t r = 0; r < R; ++r) {
+                float* c = C + r * ldc + j;
+                for (size_t s = 0; s < S; ++s) {
+                    if (b0 != 0.0f) {
+                        Vec old;
+                        std::memcpy(&old, c + s * W, sizeof(Vec));
+                        acc[r][s] += b0 * old;
+                    }
+                    std::memcpy(c + s * W, &acc[r][s], sizeof(Vec));
+                }
+            }
+        }
+        if (j < N) {
+            // Column tail, narrower than a strip
+            const size_t n = N - j;
+            float acc[R][S * W] = {};
+            for (size_t k = 0; k < kb; ++k) {
+                const float* b_row = b_block + k * B.rs + j;
+                for (size_t r = 0; r < R; ++r) {
+                    for (size_t t = 0; t < n; ++t) acc[r][t] += a[r][k] * b_row[t];
+                }
+            }
+            for (size_t r = 0; r < R; ++r) {
+                float* c = C + r * ldc + j;
+                for (size_t t = 0; t < n; ++t) c[t] = (b0 == 0.0f) ? acc[r][t] : acc[r][t] + b0 * c[t];
+            }
+        }
+    }
+}
+
+// Rows in groups of 4, then 2, then 1.
+template <size_t RegBytes>
+inline __attribute__((always_inline))
+void skinny_body(size_t M, size_t N, size_t K, float alpha, gemm_detail::Operand A, gemm_detail::Operand B,
+                 float beta, float* C, size_t ldc) {
+    size_t i = 0;
+    for (; i + 4 <= M; i += 4) skinny_rows_body<RegBytes, 4>(N, K, alpha, A.offset(i, 0), B, beta, C + i * ldc, ldc);
+    if (i + 2 <= M) {
+        skinny_rows_body<RegBytes, 2>(N, K, alpha, A.offset(i, 0), B, beta, C + i * ldc, ldc);
+        i += 2;
+    }
+    if (i < M) skinny_rows_body<RegBytes, 1>(N, K, alpha, A.offset(i, 0), B, beta, C + i * ldc, ldc);
+}
+
+// R x NC block of C as dot products of A's rows with op(B)'s columns, both contiguous
+// in K (Bt column j starts at Bt.data + j * Bt.cs). With few accumulators, K is
+// unrolled twice so consecutive FMAs don't wait on each other.
+template <size_t RegBytes, size_t R, size_t NC>
+inline __attribute__((always_inline))
+void dot_block_body(size_t K, float alpha, gemm_detail::Operand A, gemm_detail::Operand Bt,
+                    float beta, float* C, size_t ldc) {
+    constexpr size_t W = RegBytes / sizeof(float);
+    constexpr size_t U = (R * NC >= 8) ? 1 : 2;
+    using Vec = typename StripVec<W>::type;
+
+    Vec acc[U][R][NC] = {};
+    size_t k = 0;
+    for (; k + U * W <= K; k += U * W) {
+#pragma GCC unroll 2
+        for (size_t u = 0; u < U; ++u) {
+            Vec b[NC];
+#pragma GCC unroll 4
+            for (size_t c = 0; c < NC; ++c) std::memcpy(&b[c], Bt.data + c * Bt.cs + k + u * W, sizeof(Vec));
+#pragma GCC unroll 4
+            for (size_t r = 0; r < R; ++r) {
+                Vec a;
+                std::memcpy(&a, A.data + r * A.rs + k + u * W, sizeof(Vec));
+#pragma GCC unroll 4
+                for (size_t c = 0; c < NC; ++c) acc[u][r][c] += a * b[c];
+            }
+        }
+    }
+    for (size_t r = 0; r < R; ++r) {
+        const float* a_row = A.data + r * A.rs;
+        for (size_t c = 0; c < NC; ++c) {
+            const float* b_col = Bt.data + c * Bt.cs;
+            float lanes[W];
+            Vec total = acc[0][r][c];
+            for (size_t u = 1; u < U; ++u) total += acc[u][r][c];
+            std::memcpy(lanes, &total, sizeof(Vec));
+            float sum = 0.0f;
+            for (size_t t = 0; t < W; ++t) sum += lanes[t];
+            for (size_t kk = k; kk < K; ++kk) sum += a_row[kk] * b_col[kk];
+            float* out = C + r * ldc + c;
+            *out = (beta == 0.0f) ? alpha * sum : alpha * sum + beta * *out;
+        }
+    }
+}
+
+// Few-column products: rows in groups of 4, columns in groups of 4, 2 and 1.
+template <size_t RegBytes, size_t R>
+inline __attribute__((always_inline))
+void dot_rows_body(size_t N, size_t K, float alpha, gemm_detail::Operand A, gemm_detail::Operand Bt,
+                   float beta, float* C, size_t ldc) {
+    size_t j = 0;
+    for (; j + 4 <= N; j += 4) dot_block_body<RegBytes, R, 4>(K, alpha, A, Bt.offset(0, j), beta, C + j, ldc);
+    if (j + 2 <= N) {
+        dot_block_body<RegBytes, R, 2>(K, alpha, A, Bt.offset(0, j), beta, C + j, ldc);
+        j += 2;
+    }
+    if (j < N) dot_block_body<RegBytes, R, 1>(K, alpha, A, Bt.offset(0, j), beta, C + j, ldc);
+}
+
+template <size_t RegBytes>
+inline __attribute__((always_inline))
+void dot_body(size_t M, size_t N, size_t K, float alpha, gemm_detail::Operand A, gemm_detail::Operand Bt,
+              float beta, float* C, size_t ldc) {
+    size_t i = 0;
+    for (; i + 4 <= M; i += 4) dot_rows_body<RegBytes, 4>(N, K, alpha, A.offset(i, 0), Bt, beta, C + i * ldc, ldc);
+    for (; i < M; ++i) dot_rows_body<RegBytes, 1>(N, K, alpha, A.offset(i, 0), Bt, beta, C + i * ldc, ldc);
+}
+
+using SkinnyKernelFn = void (*)(size_t M, size_t N, size_t K, float alpha, gemm_detail::Operand A,
+                                gemm_detail::Operand B, float beta, float* C, size_t ldc);
+
+struct SkinnyKernels {
+    SkinnyKernelFn rows;    // Few rows: B streamed by rows
+    SkinnyKernelFn dots;    // Few columns: dot products, B passed transposed
+};
+
+// One instantiation per instruction set; the bodies are inlined into each and
+// compiled for that target.
+struct GenericSkinny {
+    static void rows(size_t M, size_t N, size_t K, float alpha, gemm_detail::Operand A, gemm_detail::Operand B,
+                     float beta, float* C, size_t ldc) {
+        skinny_body<16>(M, N, K, alpha, A, B, beta, C, ldc);
+    }
+    static void dots(size_t M, size_t N, size_t K, float alpha, gemm_detail::Operand A, gemm_detail::Operand Bt,
+                     float beta, float* C, size_t ldc) {
+        dot_body<16>(M, N, K, alpha, A, Bt, beta, C, ldc);
+    }
+};
+
+#if defined(__x86_64__) || defined(_M_X64)
+struct Avx2Skinny {
+    __attribute__((target("avx2,fma")))
+    static void rows(size_t M, size_t N, size_t K, float alpha, gemm_detail::Operand A, gemm_detail::Operand B,
+                     float beta, float* C, size_t ldc) {
+        skinny_body<32>(M, N, K, alpha, A, B, beta, C, ldc);
+    }
+    __attribute__((target("avx2,fma")))
+    static void dots(size_t M, size_t N, size_t K, float alpha, gemm_detail::Operand A, gemm_detail::Operand Bt,
+                     float beta, float* C, size_t ldc) {
+        dot_body<32>(M, N, K, alpha, A, Bt, beta, C, ldc);
+    }
+};
+
+struct Avx512Skinny {
+    __attribute__((target("avx512f")))
+    static void rows(size_t M, size_t N, size_t K, float alpha, gemm_detail::Operand A, gemm_detail::Operand B,
+                     float beta, float* C, size_t ldc) {
+        skinny_body<64>(M, N, K, alpha, A, B, beta, C, ldc);
+    }
+    __attribute__((target("avx512f")))
+    static void dots(size_t M, size_t N, size_t K, float alpha, gemm_detail::Operand A, gemm_detail::Operand Bt,
+                     float beta, float* C, size_t ldc) {
+        dot_body<64>(M, N, K, alpha, A, Bt, beta, C, ldc);
+    }
+};
+#endif
+
+SkinnyKernels select_skinny_kernels() {
+    switch (active_isa()) {
+#if defined(__x86_64__) || defined(_M_X64)
+        case CpuIsa::AVX512:
+            return {Avx512Skinny::rows, Avx512Skinny::dots};
+        case CpuIsa::AVX2:
+            return {Avx2Skinny::rows, Avx2Skinny::dots};
+#endif
+        default:
+            return {GenericSkinny::rows, GenericSkinny::dots};
+    }
+}
+
+bool few_rows(size_t M, gemm_detail::Operand B) {
+    return M <= gemm_detail::kSkinnyRows && B.cs == 1;
+}
+
+// op(B) with its columns contiguous in K: B itself when it already is, else a copy
+// in `buffer` (N <= kSkinnyCols columns, so at most a few rows' worth).
+gemm_detail::Operand columns_contiguous(size_t N, size_t K, gemm_detail::Operand B, PackBuffer& buffer) {
+    if (B.rs == 1) return B;
+    if (buffer.size() < N * K) buffer.resize(N * K);
+    for (size_t k = 0; k < K; ++k) {
+        for (size_t j = 0; j < N; ++j) buffer[j * K + k] = B.data[k * B.rs + j * B.cs];
+    }
+    return {buffer.data(), 1, K};
+}
+
+size_t blocks(size_t n, size_t block) {
+    return (n + block - 1) / block;
+}
+
+} // namespace
+
+GemmPartition choose_gemm_partition(size_t M, size_t N, size_t K, unsigned int threads) {
+    // Threads kept busy by splitting C alone, against splitting K into slices. Split-K
+    // pays a reduction over C, so it has to at least double the threads in use.
+    const size_t byOutput = std::min<size_t>(threads, blocks(M, kPartitionRows) * blocks(N, kPartitionCols));
+    const size_t byK = std::min<size_t>(threads, K / kMinSliceK);
+    if (threads > 1 && byK >= 2 * byOutput) return GemmPartition::SplitK;
+    return (M <= gemm_detail::kSkinnyRows) ? GemmPartition::Columns : GemmPartition::Tiles2D;
+}
+
+const char* partition_name(GemmPartition partition) {
+    switch (partition) {
+        case GemmPartition::Tiles2D: return "tiles2d";
+        case GemmPartition::Columns: return "columns";
+        case GemmPartition::SplitK:  return "split-k";
+    }
+    return "unknown";
+}
+
+namespace gemm_detail {
+
+void gemm_skinny(size_t M, size_t N, size_t K, float alpha, Operand A, Operand B,
+                 float beta, float* C, size_t ldc, const Epilogue* ep) {
+    if (M == 0 || N == 0) return;
+    if (K == 0 || alpha == 0.0f) {
+        scale_c(M, N, beta, C, ldc);
+    } else if (few_rows(M, B)) {
+        select_skinny_kernels().rows(M, N, K, alpha, A, B, beta, C, ldc);
+    } else {
+        thread_local PackBuffer columns;
+        select_skinny_kernels().dots(M, N, K, alpha, A, columns_contiguous(N, K, B, columns), beta, C, ldc);
+    }
+    if (ep && !ep->empty()) apply_epilogue(*ep, 0, 0, M, N, C, ldc);
+}
+
+void gemm_skinny_threaded(size_t M, size_t N, size_t K, float alpha, Operand A, Operand B,
+                          float beta, float* C, size_t ldc, unsigned int threads, const Epilogue* ep) {
+    ThreadPool& pool = ThreadPool::instance();
+    const size_t parts = 4 * static_cast<size_t>(threads);
+    if (few_rows(M, B)) {
+        // A few column chunks per thread, each a whole number of the widest strip
+        const size_t chunk = std::max(kPartitionCols, blocks(blocks(N, parts), kPartitionCols) * kPartitionCols);
+        pool.parallel_for(blocks(N, chunk), [&](size_t t) {
+            const size_t j0 = t * chunk, n = std::min(chunk, N - j0);
+            Epilogue chunkEp;
+            if (ep) chunkEp = offset_epilogue(*ep, 0, j0);
+            gemm_skinny(M, n, K, alpha, A, B.offset(0, j0), beta, C + j0, ldc, ep ? &chunkEp : nullptr);
+        }, threads);
+        return;
+    }
+
+    // Few columns: row chunks, all reading one copy of op(B) made up front
+    thread_local PackBuffer columns;
+    const Operand Bt = columns_contiguous(N, K, B, columns);
+    const size_t chunk = std::max<size_t>(kPartitionRows, blocks(M, parts));
+    pool.parallel_for(blocks(M, chunk), [&](size_t t) {
+        const size_t i0 = t * chunk, m = std::min(chunk, M - i0);
+        Epilogue chunkEp;
+        if (ep) chunkEp = offset_epilogue(*ep, i0, 0);
+        gemm_skinny(m, N, K, alpha, A.offset(i0, 0), Bt, beta, C + i0 * ldc, ldc, ep ? &chunkEp : nullptr);
+    }, threads);
+}
+
+template <typename T>
+void gemm_split_k(const MicroKernel& uk, size_t M, size_t N, size_t K,
+                  float alpha, BasicOperand<T> A, BasicOperand<T> B,
+                  float beta, float* C, size_t ldc, unsigned int threads, const Epilogue* ep) {
+    if (M == 0 || N == 0) return;
+    if (ep && ep->empty()) ep = nullptr;
+
+    // At most one slice per thread, each a multiple of 16 deep
+    const size_t slices = std::max<size_t>(1, std::min<size_t>(threads, K / kMinSliceK));
+    const size_t sliceK = blocks(blocks(K, slices), 16) * 16;
+    const size_t numSlices = blocks(K, sliceK);
+
+    // Partial products of slices 1.. (slice 0 goes straight into C), per calling thread
+    thread_local PackBuffer partial;
+    const size_t partialFloats = (numSlices - 1) * M * N;
+    if (partial.size() < partialFloats) partial.resize(partialFloats);
+    float* parts = partial.data();
+
+    ThreadPool& pool = ThreadPool::instance();
+    pool.parallel_for(numSlices, [&](size_t s) {
+        const size_t k0 = s * sliceK, kb = std::min(sliceK, K - k0);
+        if (s == 0) {
+            gemm_packed(uk, M, N, kb, alpha, A, B, beta, C, ldc);
+        } else {
+            gemm_packed(uk, M, N, kb, alpha, A.offset(0, k0), B.offset(k0, 0), 0.0f,
+                        parts + (s - 1) * M * N, N);
+        }
+    }, threads);
+
+    // Sum the slices into C in tiles, finishing each tile with the epilogue
+    const size_t tileCols = std::min<size_t>(N, 1024);
+    const size_t tileRows = std::max<size_t>(1, 4096 / tileCols);
+    pool.parallel_for_2d(M, N, tileRows, tileCols, [&](size_t r0, size_t r1, size_t c0, size_t c1) {
+        for (size_t i = r0; i < r1; ++i) {
+            float* c = C + i * ldc;
+            for (size_t s = 0; s + 1 < numSlices; ++s) {
+                const float* p = parts + s * M * N + i * N;
+                for (size_t j = c0; j < c1; ++j) c[j] += p[j];
+            }
+        }
+        if (ep) apply_epilogue(*ep, r0, c0, r1 - r0, c1 - c0, C + r0 * ldc + c0, ldc);
+    }, threads);
+}
+
+template void gemm_split_k<float>(const MicroKernel&, size_t, size_t, size_t, float, Operand, Operand,
+                                  float, float*, size_t, unsigned int, const Epilogue*);
+template void gemm_split_k<bfloat16>(const MicroKernel&, size_t, size_t, size_t, float, BasicOperand<bfloat16>,
+                                     BasicOperand<bfloat16>, float, float*, size_t, unsigned int, const Epilogue*);
+template void gemm_split_k<float16>(const MicroKernel&, size_t, size_t, size_t, float, BasicOperand<float16>,
+                                    BasicOperand<float16>, float, float*, size_t, unsigned int, const Epilogue*);
+
+} // namespace gemm_detail
@@ -0,0 +1,326 @@
+#include "matrix.h"
+#include "gemm_internal.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace gemm_detail {
+
+namespace {
+
+// Largest register tile any wide kernel uses (sizes the edge buffer).
+constexpr size_t kMaxWideMR = 12;
+constexpr size_t kMaxWideNR = 16;
+
+template <typename T>
+struct Scalar {
+    using type = T;
+    static constexpr bool complex = false;
+};
+
+template <typename S>
+struct Scalar<std::complex<S>> {
+    using type = S;
+    static constexpr bool complex = true;
+};
+
+// RegBytes of S as a GCC vector, lowered to the target's registers.
+template <typename S, size_t RegBytes>
+struct WideVec {
+    typedef S type __attribute__((vector_size(RegBytes)));
+};
+
+// x with each (re, im) pair swapped and times (-1, +1): i * x for a vector of
+// interleaved complex numbers. (In place, as vectors passed by value would change
+// the ABI between the per-ISA callers.)
+template <typename S, size_t RegBytes>
+inline __attribute__((always_inline))
+void times_i(typename WideVec<S, RegBytes>::type& x) {
+    using Int = typename std::conditional<sizeof(S) == 4, int32_t, int64_t>::type;
+    using Vec = typename WideVec<S, RegBytes>::type;
+    using Mask = typename WideVec<Int, RegBytes>::type;
+    constexpr size_t W = RegBytes / sizeof(S);
+    Mask swap;
+    Vec sign;
+    for (size_t t = 0; t < W; ++t) {
+        swap[t] = static_cast<Int>(t ^ 1);
+        sign[t] = (t & 1) ? S(1) : S(-1);
+    }
+    x = __builtin_shuffle(x, swap) * sign;
+}
+
+// MR x NR tile with NV vectors per row of C. Real T: each k step loads NV vectors of
+// B and broadcasts MR scalars of A. Complex T: B's vectors hold interleaved (re, im)
+// pairs; re(a) * b and im(a) * b go to separate accumulators, so the k loop is plain
+// multiply-adds, and a * b = re(a) * b + i * (im(a) * b) is formed once per tile.
+template <typename T, size_t RegBytes, size_t MR, size_t NV>
+inline __attribute__((always_inline))
+void wide_kernel_body(size_t kc, const T* a, const T* b, T* c, size_t ldc, T beta) {
+    using S = typename Scalar<T>::type;
+    using Vec = typename WideVec<S, RegBytes>::type;
+    constexpr bool kComplex = Scalar<T>::complex;
+    constexpr size_t W = RegBytes / sizeof(S);
+    constexpr size_t AS = kComplex ? 2 : 1;     // Reals per element of A
+
+    const S* as = reinterpret_cast<const S*>(a);
+    const S* bs = reinterpret_cast<const S*>(b);
+    Vec acc[MR][NV] = {};
+    Vec accIm[kComplex ? MR : 1][NV] = {};
+    for (size_t p = 0; p < kc; ++p) {
+        Vec bv[NV];
+#pragma GCC unroll 4
+        for (size_t v = 0; v < NV; ++v) std::memcpy(&bv[v], bs + v * W, sizeof(Vec));
+#pragma GCC unroll 12
+        for (size_t i = 0; i < MR; ++i) {
+            const S ar = as[i * AS];
+#pragma GCC unroll 4
+            for (size_t v = 0; v < NV; ++v) acc[i][v] += ar * bv[v];
+            if constexpr (kComplex) {
+                const S ai = as[i * AS + 1];
+#pragma GCC unroll 4
+                for (size_t v = 0; v < NV; ++v) accIm[i][v] += ai * bv[v];
+            }
+        }
+        as += MR * AS;
+        bs += NV * W;
+    }
+
+    for (size_t i = 0; i < MR; ++i) {
+        S* c_row = reinterpret_cast<S*>(c + i * ldc);
+        for (size_t v = 0; v < NV; ++v) {
+            Vec out = acc[i][v];
+            if constexpr (kComplex) {
+                times_i<S, RegBytes>(accIm[i][v]);
+                out += accIm[i][v];
+            }
+            if (beta != T()) {
+                Vec old;
+                std::memcpy(&old, c_row + v * W, sizeof(Vec));
+                if constexpr (kComplex) {
+                    Vec rotated = old;
+                    times_i<S, RegBytes>(rotated);
+                    out += beta.real() * old + beta.imag() * rotated;
+                } else {
+                    out += beta * old;
+                }
+            }
+            std::memcpy(c_row + v * W, &out, sizeof(Vec));
+        }
+    }
+}
+
+// Register tiles as for the float kernels: 6 rows with 16- and 32-byte vectors and 12
+// with 64-byte ones, two vectors wide, halved for complex (two accumulators per
+// vector). That leaves 12 (or 24) accumulators plus the B vectors and one broadcast.
+template <typename T, size_t RegBytes>
+struct WideTile {
+    static constexpr size_t mr = ((RegBytes == 64) ? 12 : 6) / (Scalar<T>::complex ? 2 : 1);
+    static constexpr size_t nv = 2;
+    static constexpr size_t nr = nv * RegBytes / sizeof(T);
+};
+
+// One instantiation per instruction set; the body is inlined into each and compiled
+// for that target. The 16-byte one uses the baseline flags (SSE2 or NEON).
+template <typename T>
+struct GenericWide {
+    using Tile = WideTile<T, 16>;
+    static void run(size_t kc, const T* a, const T* b, T* c, size_t ldc, T beta) {
+        wide_kernel_body<T, 16, Tile::mr, Tile::nv>(kc, a, b, c, ldc, beta);
+    }
+};
+
+#if defined(__x86_64__) || defined(_M_X64)
+template <typename T>
+struct Avx2Wide {
+    using Tile = WideTile<T, 32>;
+    __attribute__((target("avx2,fma")))
+    static void run(size_t kc, const T* a, const T* b, T* c, size_t ldc, T beta) {
+        wide_kernel_body<T, 32, Tile::mr, Tile::nv>(kc, a, b, c, ldc, beta);
+    }
+};
+
+template <typename T>
+struct Avx512Wide {
+    using Tile = WideTile<T, 64>;
+    __attribute__((target("avx512f")))
+    static void run(size_t kc, const T* a, const T* b, T* c, size_t ldc, T beta) {
+        wide_kernel_body<T, 64, Tile::mr, Tile::nv>(kc, a, b, c, ldc, beta);
+    }
+};
+#endif
+
+template <typename Impl, typename T>
+WideKernel<T> kernel_of() {
+    return {Impl::Tile::mr, Impl::Tile::nr, 0, 0, 0, Impl::run};
+}
+
+template <typename T>
+using WideBuffer = std::vector<T, MatrixAllocator<T>>;
+
+// Packs an mc x kc block of op(A) into MR-row panels, times alpha, zero-padding the
+// last panel.
+template <typename T>
+void pack_a_wide(size_t mc, size_t kc, BasicOperand<T> A, T alpha, size_t mr, T* dst) {
+    for (size_t ir = 0; ir < mc; ir += mr) {
+        size_t rows = std::min(mr, mc - ir);
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t i = 0; i < mr; ++i) {
+                dst[i] = (i < rows) ? alpha * A.data[(ir + i) * A.rs + p * A.cs] : T();
+            }
+            dst += mr;
+        }
+    }
+}
+
+// Packs a kc x nc block of op(B) into NR-column panels, zero-padding the last one.
+template <typename T>
+void pack_b_wide(size_t kc, size_t nc, BasicOperand<T> B, size_t nr, T* dst) {
+    for (size_t jr = 0; jr < nc; jr += nr) {
+        size_t cols = std::min(nr, nc - jr);
+        for (size_t p = 0; p < kc; ++p) {
+            const T* b_row = B.data + p * B.rs + jr * B.cs;
+            for (size_t j = 0; j < nr; ++j) {
+                dst[j] = (j < cols) ? b_row[j * B.cs] : T();
+            }
+            dst += nr;
+        }
+    }
+}
+
+template <typename T>
+void scale_c_wide(size_t M, size_t N, T beta, T* C, size_t ldc) {
+    for (size_t i = 0; i < M; ++i) {
+        T* c_row = C + i * ldc;
+        for (size_t j = 0; j < N; ++j) {
+            c_row[j] = (beta == T()) ? T() : beta * c_row[j];
+        }
+    }
+}
+
+// Register tiles of one packed mc x nc block; partial tiles go through a scratch tile.
+template <typename T>
+void macro_kernel_wide(const WideKernel<T>& uk, size_t mc, size_t nc, size_t kc,
+                       const T* a_packed, const T* b_packed, T beta, T* C, size_t ldc) {
+    // Raw storage, as the float engine's scratch tile is uninitialized: a T array would
+    // zero every complex element on each call. The kernel writes it with beta = 0.
+    alignas(64) unsigned char edgeBytes[kMaxWideMR * kMaxWideNR * sizeof(T)];
+    T* edge = reinterpret_cast<T*>(edgeBytes);
+
+    for (size_t jr = 0; jr < nc; jr += uk.nr) {
+        size_t nr = std::min(uk.nr, nc - jr);
+        const T* b_panel = b_packed + jr * kc;
+
+        for (size_t ir = 0; ir < mc; ir += uk.mr) {
+            size_t mr = std::min(uk.mr, mc - ir);
+            const T* a_panel = a_packed + ir * kc;
+            T* c_tile = C + ir * ldc + jr;
+
+            if (mr == uk.mr && nr == uk.nr) {
+                uk.fn(kc, a_panel, b_panel, c_tile, ldc, beta);
+                continue;
+            }
+            uk.fn(kc, a_panel, b_panel, edge, uk.nr, T());
+            for (size_t i = 0; i < mr; ++i) {
+                T* c_row = c_tile + i * ldc;
+                const T* e_row = edge + i * uk.nr;
+                for (size_t j = 0; j < nr; ++j) {
+                    c_row[j] = (beta == T()) ? e_row[j] : e_row[j] + beta * c_row[j];
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+template <typename T>
+WideKernel<T> wide_kernel(const MicroKernel& blocking) {
+    WideKernel<T> uk;
+    switch (active_isa()) {
+#if defined(__x86_64__) || defined(_M_X64)
+        case CpuIsa::AVX512:
+            uk = kernel_of<Avx512Wide<T>, T>();
+            break;
+        case CpuIsa::AVX2:
+            uk = kernel_of<Avx2Wide<T>, T>();
+            break;
+#endif
+        default:
+            uk = kernel_of<GenericWide<T>, T>();
+            break;
+    }
+    uk.mc = std::max(uk.mr, blocking.mc / uk.mr * uk.mr);
+    uk.kc = std::max<size_t>(16, blocking.kc * sizeof(float) / sizeof(T));
+    uk.nc = std::max(uk.nr, blocking.nc / uk.nr * uk.nr);
+    return uk;
+}
+
+template <typename T>
+void gemm_wide(const WideKernel<T>& uk, size_t M, size_t N, size_t K,
+               T alpha, BasicOperand<T> A, BasicOperand<T> B,
+               T beta, T* C, size_t ldc) {
+    if (M == 0 || N == 0) return;
+    if (K == 0 || alpha == T()) {
+        scale_c_wide(M, N, beta, C, ldc);
+        return;
+    }
+
+    thread_local WideBuffer<T> a_buf, b_buf;
+    size_t a_size = ((uk.mc + uk.mr - 1) / uk.mr) * uk.mr * uk.kc;
+    size_t b_size = ((uk.nc + uk.nr - 1) / uk.nr) * uk.nr * uk.kc;
+    if (a_buf.size() < a_size) a_buf.resize(a_size);
+    if (b_buf.size() < b_size) b_buf.resize(b_size);
+
+    for (size_t jc = 0; jc < N; jc += uk.nc) {
+        size_t nc = std::min(uk.nc, N - jc);
+
+        for (size_t pc = 0; pc < K; pc += uk.kc) {
+            size_t kc = std::min(uk.kc, K - pc);
+            // Only the first K block applies the caller's beta; later blocks accumulate
+            T beta_k = (pc == 0) ? beta : T(1);
+            pack_b_wide(kc, nc, B.offset(pc, jc), uk.nr, b_buf.data());
+
+            for (size_t ic = 0; ic < M; ic += uk.mc) {
+                size_t mc = std::min(uk.mc, M - ic);
+                pack_a_wide(mc, kc, A.offset(ic, pc), alpha, uk.mr, a_buf.data());
+                macro_kernel_wide(uk, mc, nc, kc, a_buf.data(), b_buf.data(), beta_k, C + ic * ldc + jc, ldc);
+            }
+        }
+    }
+}
+
+template <typename T>
+void gemm_wide_threaded(const WideKernel<T>& uk, size_t M, size_t N, size_t K,
+                        T alpha, BasicOperand<T> A, BasicOperand<T> B,
+                        T beta, T* C, size_t ldc, unsigned int maxThreads) {
+    unsigned int threads = thread_budget(maxThreads);
+    if (threads <= 1) {
+        gemm_wide(uk, M, N, K, alpha, A, B, beta, C, ldc);
+        return;
+    }
+
+    size_t tileRows, tileCols;
+    choose_thread_tiles(uk.mr, uk.nr, uk.mc, uk.nc, M, N, threads, tileRows, tileCols);
+    ThreadPool::instance().parallel_for_2d(M, N, tileRows, tileCols,
+                                           [&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+        gemm_wide(uk, rowEnd - rowBegin, colEnd - colBegin, K, alpha, A.offset(rowBegin, 0),
+                  B.offset(0, colBegin), beta, C + rowBegin * ldc + colBegin, ldc);
+    }, threads);
+}
+
+#define INSTANTIATE_WIDE_ENGINE(T)                                                                        \
+    template WideKernel<T> wide_kernel<T>(const MicroKernel&);                                            \
+    template void gemm_wide<T>(const WideKernel<T>&, size_t, size_t, size_t, T, BasicOperand<T>,          \
+                               BasicOperand<T>, T, T*, size_t);                                          \
+    template void gemm_wide_threaded<T>(const WideKernel<T>&, size_t, size_t, size_t, T, BasicOperand<T>, \
+                                        BasicOperand<T>, T, T*, size_t, unsigned int);
+INSTANTIATE_WIDE_ENGINE(double)
+INSTANTIATE_WIDE_ENGINE(std::complex<float>)
+INSTANTIATE_WIDE_ENGINE(std::complex<double>)
+#undef INSTANTIATE_WIDE_ENGINE
+
+} // namespace gemm_detail
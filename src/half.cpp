@@ -0,0 +1,187 @@
+#include "half.h"
+#include "cpu_features.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+uint32_t float_bits(float f) {
+    uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+float bits_float(uint32_t u) {
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+bool use_avx2() {
+    CpuIsa isa = active_isa();
+    return isa == CpuIsa::AVX2 || isa == CpuIsa::AVX512;
+}
+
+bool use_f16c() {
+    return use_avx2() && cpu_features().f16c;
+}
+
+bool use_avx512bf16() {
+    return active_isa() == CpuIsa::AVX512 && cpu_features().avx512bf16;
+}
+
+// Widening bfloat16 is a 16-bit shift into the upper half of each lane.
+__attribute__((target("avx2")))
+void bf16_to_float_avx2(const bfloat16* src, size_t count, float* dst) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m256i w = _mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16);
+        _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(w));
+    }
+    for (; i < count; ++i) {
+        dst[i] = to_float(src[i]);
+    }
+}
+
+__attribute__((target("avx512f,avx512bf16,avx512vl")))
+void float_to_bf16_avx512(const float* src, size_t count, bfloat16* dst) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256bh h = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), (__m256i)h);
+    }
+    for (; i < count; ++i) {
+        dst[i] = to_bfloat16(src[i]);
+    }
+}
+
+__attribute__((target("avx,f16c")))
+void fp16_to_float_f16c(const float16* src, size_t count, float* dst) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+    for (; i < count; ++i) {
+        dst[i] = to_float(src[i]);
+    }
+}
+
+__attribute__((target("avx,f16c")))
+void float_to_fp16_f16c(const float* src, size_t count, float16* dst) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+    }
+    for (; i < count; ++i) {
+        dst[i] = to_float16(src[i]);
+    }
+}
+#endif
+
+} // namespace
+
+float to_float(bfloat16 h) {
+    return bits_float(static_cast<uint32_t>(h.bits) << 16);
+}
+
+bfloat16 to_bfloat16(float f) {
+    uint32_t u = float_bits(f);
+    if ((u & 0x7FFFFFFFu) > 0x7F800000u) {
+        return {static_cast<uint16_t>((u >> 16) | 0x0040u)}; // Keep NaNs quiet
+    }
+    u += 0x7FFFu + ((u >> 16) & 1u);
+    return {static_cast<uint16_t>(u >> 16)};
+}
+
+float to_float(float16 h) {
+    // Shift exponent and mantissa into place and rebias; infinities, NaNs and
+    // denormals need fixing up.
+    const uint32_t shiftedExp = 0x7C00u << 13;
+    uint32_t u = (h.bits & 0x7FFFu) << 13;
+    uint32_t exp = u & shiftedExp;
+    u += (127 - 15) << 23;
+    if (exp == shiftedExp) {
+        u += (128 - 16) << 23;
+    } else if (exp == 0) {
+        u += 1u << 23;
+        u = float_bits(bits_float(u) - bits_float(113u << 23));
+    }
+    return bits_float(u | (static_cast<uint32_t>(h.bits & 0x8000u) << 16));
+}
+
+float16 to_float16(float f) {
+    uint32_t u = float_bits(f);
+    uint32_t sign = u & 0x80000000u;
+    u ^= sign;
+
+    uint32_t h;
+    if (u >= (127u + 16) << 23) {
+        // Too large (or inf / NaN)
+        h = (u > 0x7F800000u) ? 0x7E00u : 0x7C00u;
+    } else if (u < 113u << 23) {
+        // Denormal or zero in float16: let float addition do the rounding
+        const uint32_t denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+        h = float_bits(bits_float(u) + bits_float(denormMagic)) - denormMagic;
+    } else {
+        uint32_t mantOdd = (u >> 13) & 1u;
+        u += (static_cast<uint32_t>(15 - 127) << 23) + 0xFFFu;
+        u += mantOdd;
+        h = u >> 13;
+    }
+    return {static_cast<uint16_t>(h | (sign >> 16))};
+}
+
+void convert(const float* src, size_t count, bfloat16* dst) {
+#if defined(__x86_64__) || defined(_M_X64)
+    if (use_avx512bf16()) {
+        float_to_bf16_avx512(src, count, dst);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = to_bfloat16(src[i]);
+    }
+}
+
+void convert(const float* src, size_t count, float16* dst) {
+#if defined(__x86_64__) || defined(_M_X64)
+    if (use_f16c()) {
+        float_to_fp16_f16c(src, count, dst);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = to_float16(src[i]);
+    }
+}
+
+void convert(const bfloat16* src, size_t count, float* dst) {
+#if defined(__x86_64__) || defined(_M_X64)
+    if (use_avx2()) {
+        bf16_to_float_avx2(src, count, dst);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = to_float(src[i]);
+    }
+}
+
+void convert(const float16* src, size_t count, float* dst) {
+#if defined(__x86_64__) || defined(_M_X64)
+    if (use_f16c()) {
+        fp16_to_float_f16c(src, count, dst);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = to_float(src[i]);
+    }
+}
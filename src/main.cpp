@@ -1,28 +1,230 @@
+#include <algorithm>
+#include <chrono>
+#include <complex>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <string>
+#include <vector>
 #include "matrix.h"
+#include "matrix_io.h"
+#include "gemm.h"
+#include "thread_pool.h"
+#include "cpu_features.h"
 
-int main() {
-    size_t size = 4;
-    Matrix A(size, size);
-    Matrix B(size, size);
-    Matrix C(size, size);
+namespace {
 
-    // Initialize simple data
-    for (size_t i = 0; i < size; ++i) {
-        for (size_t j = 0; j < size; ++j) {
-            A(i, j) = 1.0f;
-            B(i, j) = 2.0f;
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Float kernels that take whole Matrix objects; they run on copies of the mapped
+// operands (the copies are timed as part of load and store).
+struct MatrixKernel {
+    const char* name;
+    std::function<void(const Matrix&, const Matrix&, Matrix&)> fn;
+};
+
+const std::vector<MatrixKernel>& matrix_kernels() {
+    static const std::vector<MatrixKernel> all = {
+        {"naive", [](const Matrix& A, const Matrix& B, Matrix& C) { multiply_naive(A, B, C); }},
+        {"v1", [](const Matrix& A, const Matrix& B, Matrix& C) { multiply_optimized_v1(A, B, C); }},
+        {"v2", [](const Matrix& A, const Matrix& B, Matrix& C) { multiply_optimized_v2_tiled(A, B, C); }},
+        {"v3", multiply_optimized_v3_unrolled},
+        {"v4", multiply_optimized_v4_simd},
+        {"v5", [](const Matrix& A, const Matrix& B, Matrix& C) { multiply_optimized_v5_threaded(A, B, C); }},
+        {"v6", multiply_optimized_v6_register_blocked_2x2},
+        {"v7", [](const Matrix& A, const Matrix& B, Matrix& C) { multiply_optimized_v7_threaded_register_blocked(A, B, C); }},
+        {"v8", multiply_optimized_v8_prefetch},
+        {"v9", multiply_optimized_v9_transpose},
+        {"v10", multiply_optimized_packed},
+        {"v11", [](const Matrix& A, const Matrix& B, Matrix& C) { multiply_optimized_packed_threaded(A, B, C); }},
+        {"strassen", [](const Matrix& A, const Matrix& B, Matrix& C) { multiply_strassen(A, B, C); }},
+        {"multiply", [](const Matrix& A, const Matrix& B, Matrix& C) { multiply(A, B, C); }},
+    };
+    return all;
+}
+
+void print_usage() {
+    std::cout << "Usage: matrix_mul [options] A B C\n"
+              << "Computes C = A * B. A and B are .npy files or the library's binary matrix\n"
+              << "format (see include/matrix_io.h), memory-mapped and read in place. C is\n"
+              << "created with A's element type, in the format its extension selects, and\n"
+              << "written through its mapping.\n"
+              << "  --kernel NAME   gemm (default): the packed engine on the mapped files, any\n"
+              << "                  element type, Fortran-order .npy read as a transpose.\n"
+              << "                  Float only, on Matrix copies of the operands:\n"
+              << "                  naive, v1 ... v11, strassen, multiply\n"
+              << "  --threads N     Thread pool size (default: all hardware threads)\n"
+              << "  --isa NAME      scalar, sse4.2, avx2, avx512 or neon (default: best supported)\n"
+              << "  --prefault      Read A and B in while loading, so compute does not wait on disk\n"
+              << "  --help          Show this message\n";
+}
+
+struct Options {
+    std::string kernel = "gemm";
+    std::string pathA, pathB, pathC;
+    bool prefault = false;
+};
+
+struct Timings {
+    double load = 0, compute = 0, store = 0;
+};
+
+Transpose op(const MatrixFile& f) {
+    return f.transposed() ? Transpose::Trans : Transpose::NoTrans;
+}
+
+// C = A * B with gemm() straight on the mappings.
+template <typename T>
+void run_gemm(const MatrixFile& A, const MatrixFile& B, MatrixFile& C, Timings& t) {
+    BasicConstMatrixView<T> a = A.view<T>(), b = B.view<T>();
+    BasicMatrixView<T> c = C.mutable_view<T>();
+    auto start = Clock::now();
+    gemm(op(A), op(B), A.rows(), B.cols(), A.cols(), T(1), a.data, a.ld, b.data, b.ld, T(0), c.data, c.ld);
+    t.compute = seconds_since(start);
+}
+
+// Copies a mapped float matrix into an owning one, undoing a stored transpose.
+Matrix to_matrix(const MatrixFile& f) {
+    ConstMatrixView v = f.view<float>();
+    Matrix M(f.rows(), f.cols(), uninitialized);
+    for (size_t i = 0; i < f.rows(); ++i) {
+        for (size_t j = 0; j < f.cols(); ++j) M(i, j) = f.transposed() ? v(j, i) : v(i, j);
+    }
+    return M;
+}
+
+void run_matrix_kernel(const MatrixKernel& kernel, const MatrixFile& A, const MatrixFile& B, MatrixFile& C,
+                       Timings& t) {
+    auto start = Clock::now();
+    Matrix a = to_matrix(A), b = to_matrix(B);
+    Matrix c(A.rows(), B.cols());
+    t.load += seconds_since(start);
+
+    start = Clock::now();
+    kernel.fn(a, b, c);
+    t.compute = seconds_since(start);
+
+    start = Clock::now();
+    MatrixView out = C.mutable_view<float>();
+    for (size_t i = 0; i < c.rows; ++i) std::copy_n(c.data.data() + i * c.cols, c.cols, out.data + i * out.ld);
+    t.store += seconds_since(start);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    std::vector<std::string> paths;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) throw std::invalid_argument(arg + " needs a value");
+                return argv[++i];
+            };
+            if (arg == "--help" || arg == "-h") {
+                print_usage();
+                return 0;
+            } else if (arg == "--kernel") {
+                opt.kernel = value();
+            } else if (arg == "--threads") {
+                int n = std::atoi(value().c_str());
+                if (n <= 0) throw std::invalid_argument("--threads needs a positive count");
+                ThreadPool::instance().set_num_threads(static_cast<unsigned int>(n));
+            } else if (arg == "--isa") {
+                std::string name = value();
+                CpuIsa isa;
+                if (!parse_isa(name.c_str(), isa)) throw std::invalid_argument("unknown ISA " + name);
+                if (!set_active_isa(isa)) throw std::invalid_argument("this CPU does not support " + name);
+            } else if (arg == "--prefault") {
+                opt.prefault = true;
+            } else if (!arg.empty() && arg[0] == '-') {
+                throw std::invalid_argument("unknown option " + arg);
+            } else {
+                paths.push_back(arg);
+            }
         }
+        if (paths.size() != 3) throw std::invalid_argument("expected the paths of A, B and C");
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n\n";
+        print_usage();
+        return 2;
     }
+    opt.pathA = paths[0];
+    opt.pathB = paths[1];
+    opt.pathC = paths[2];
 
     try {
-        multiply_naive(A, B, C);
-        std::cout << "Multiplication successful." << std::endl;
-        std::cout << "C(0,0) = " << C(0, 0) << " (Expected: 8.0)" << std::endl;
+        const MatrixKernel* kernel = nullptr;
+        if (opt.kernel != "gemm") {
+            for (const MatrixKernel& k : matrix_kernels()) {
+                if (opt.kernel == k.name) kernel = &k;
+            }
+            if (!kernel) throw std::invalid_argument("unknown kernel " + opt.kernel);
+        }
+
+        // C is created truncated while A and B are mapped; writing over either would
+        // pull the pages out from under the mapping
+        if (same_file(opt.pathC, opt.pathA) || same_file(opt.pathC, opt.pathB)) {
+            throw std::invalid_argument("output " + opt.pathC + " is also an input; write C to another file.");
+        }
+
+        Timings t;
+        auto start = Clock::now();
+        MatrixFile A(opt.pathA), B(opt.pathB);
+        if (A.cols() != B.rows()) {
+            throw std::invalid_argument("Matrix dimensions mismatch: A is " + std::to_string(A.rows()) + "x" +
+                                        std::to_string(A.cols()) + ", B is " + std::to_string(B.rows()) + "x" +
+                                        std::to_string(B.cols()) + ".");
+        }
+        if (A.type() != B.type()) {
+            throw std::invalid_argument(std::string("A holds ") + element_type_name(A.type()) + ", B holds " +
+                                        element_type_name(B.type()) + ".");
+        }
+        if (kernel && A.type() != ElementType::Float32) {
+            throw std::invalid_argument(std::string("kernel ") + kernel->name + " is float32 only; use gemm.");
+        }
+        if (opt.prefault) {
+            A.prefault();
+            B.prefault();
+        }
+        MatrixFile C(opt.pathC, A.rows(), B.cols(), A.type());
+        t.load = seconds_since(start);
+
+        if (kernel) {
+            run_matrix_kernel(*kernel, A, B, C, t);
+        } else {
+            switch (A.type()) {
+                case ElementType::Float32:    run_gemm<float>(A, B, C, t); break;
+                case ElementType::Float64:    run_gemm<double>(A, B, C, t); break;
+                case ElementType::Complex64:  run_gemm<std::complex<float>>(A, B, C, t); break;
+                case ElementType::Complex128: run_gemm<std::complex<double>>(A, B, C, t); break;
+            }
+        }
+
+        start = Clock::now();
+        C.flush();
+        t.store += seconds_since(start);
+
+        const bool complex = A.type() == ElementType::Complex64 || A.type() == ElementType::Complex128;
+        const double flops = (complex ? 8.0 : 2.0) * A.rows() * A.cols() * B.cols();
+        std::cout << "C = A * B: " << A.rows() << "x" << A.cols() << " * " << B.rows() << "x" << B.cols() << " "
+                  << element_type_name(A.type()) << ", kernel " << opt.kernel << ", "
+                  << ThreadPool::instance().num_threads() << " threads, ISA " << isa_name(active_isa()) << "\n"
+                  << std::fixed << std::setprecision(6)
+                  << "  load     " << t.load << " s" << (opt.prefault ? " (prefaulted)" : " (mapped, read on demand)") << "\n"
+                  << "  compute  " << t.compute << " s  (" << std::setprecision(2)
+                  << (t.compute > 0 ? flops / t.compute * 1e-9 : 0.0) << " GFLOPS)\n"
+                  << std::setprecision(6)
+                  << "  store    " << t.store << " s  (" << opt.pathC << ")" << std::endl;
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
-
     return 0;
 }
@@ -1,10 +1,57 @@
 #include "matrix.h"
+#include "gemm.h"
+#include "thread_pool.h"
+#include "cpu_features.h"
+#include "tuning.h"
 #include <stdexcept>
 #include <algorithm>
-#include <thread>
 #include <vector>
 
-void multiply_naive(const Matrix& A, const Matrix& B, Matrix& C) {
+// Picks a C tile shape that gives each thread several tiles, so idle threads
+// have work to steal. Tile rows are a multiple of rowMultiple; when there are too
+// few rows to go around (GEMV-like shapes), column tiles narrow down to 16.
+static void choose_tile_shape(size_t rows, size_t cols, unsigned int numThreads, size_t rowMultiple,
+                              size_t& tileRows, size_t& tileCols) {
+    const size_t targetTiles = 4 * static_cast<size_t>(numThreads);
+    const size_t maxRowTiles = std::max<size_t>(1, (rows + rowMultiple - 1) / rowMultiple);
+    tileCols = std::max<size_t>(1, std::min<size_t>(cols, 512));
+    size_t colTiles = (cols + tileCols - 1) / tileCols;
+    if (colTiles * maxRowTiles < targetTiles) {
+        size_t wantColTiles = (targetTiles + maxRowTiles - 1) / maxRowTiles;
+        size_t narrow = ((cols + wantColTiles - 1) / wantColTiles + 15) / 16 * 16;
+        tileCols = std::max<size_t>(1, std::min(tileCols, std::max<size_t>(16, narrow)));
+        colTiles = (cols + tileCols - 1) / tileCols;
+    }
+    size_t rowTiles = std::max<size_t>(1, (targetTiles + colTiles - 1) / colTiles);
+    tileRows = (rows + rowTiles - 1) / rowTiles;
+    tileRows = std::max(rowMultiple, ((tileRows + rowMultiple - 1) / rowMultiple) * rowMultiple);
+}
+
+template <typename T>
+void fill_first_touch(T* p, size_t n, T value) {
+    ThreadPool& pool = ThreadPool::instance();
+    const size_t minChunk = kHugePageBytes / sizeof(T);
+    if (n < 2 * minChunk || pool.num_threads() == 1) {
+        std::fill(p, p + n, value);
+        return;
+    }
+    // One task per thread: each thread's first task is its own, so chunk t is
+    // touched by thread t, mirroring the row ranges the threaded kernels hand out
+    size_t chunks = std::min<size_t>(pool.num_threads(), n / minChunk);
+    size_t perChunk = (n + chunks - 1) / chunks;
+    pool.parallel_for(chunks, [&](size_t t) {
+        size_t begin = t * perChunk, end = std::min(n, begin + perChunk);
+        std::fill(p + begin, p + end, value);
+    });
+}
+
+template void fill_first_touch<float>(float*, size_t, float);
+template void fill_first_touch<double>(double*, size_t, double);
+template void fill_first_touch<std::complex<float>>(std::complex<float>*, size_t, std::complex<float>);
+template void fill_first_touch<std::complex<double>>(std::complex<double>*, size_t, std::complex<double>);
+
+template <typename T>
+void multiply_naive(const BasicMatrix<T>& A, const BasicMatrix<T>& B, BasicMatrix<T>& C) {
     if (A.cols != B.rows) {
         throw std::invalid_argument("Matrix dimensions mismatch for multiplication.");
     }
@@ -14,7 +61,7 @@ void multiply_naive(const Matrix& A, const Matrix& B, Matrix& C) {
 
     for (size_t i = 0; i < A.rows; ++i) {
         for (size_t j = 0; j < B.cols; ++j) {
-            float sum = 0.0f;
+            T sum = T();
             for (size_t k = 0; k < A.cols; ++k) {
                 sum += A(i, k) * B(k, j);
             }
@@ -23,17 +70,17 @@ void multiply_naive(const Matrix& A, const Matrix& B, Matrix& C) {
     }
 }
 
-void multiply_optimized_v1(const Matrix& A, const Matrix& B, Matrix& C) {
+template <typename T>
+void multiply_optimized_v1(const BasicMatrix<T>& A, const BasicMatrix<T>& B, BasicMatrix<T>& C) {
     if (A.cols != B.rows || C.rows != A.rows || C.cols != B.cols) {
         throw std::invalid_argument("Matrix dimensions mismatch.");
     }
 
-    // Initialize C to zero (unlike naive, we accumulate directly into C)
-    std::fill(C.data.begin(), C.data.end(), 0.0f);
-
     for (size_t i = 0; i < A.rows; ++i) {
+        // Zero the row just before accumulating into it, while it is in cache
+        std::fill_n(C.data.data() + i * C.cols, C.cols, T());
         for (size_t k = 0; k < A.cols; ++k) {
-            float rA = A(i, k);
+            T rA = A(i, k);
             for (size_t j = 0; j < B.cols; ++j) {
                 C(i, j) += rA * B(k, j);
             }
@@ -46,19 +93,21 @@ void multiply_optimized_v2_tiled(const Matrix& A, const Matrix& B, Matrix& C, si
         throw std::invalid_argument("Matrix dimensions mismatch.");
     }
 
-    std::fill(C.data.begin(), C.data.end(), 0.0f);
+    if (blockSize == 0) {
+        blockSize = tuned_params(A.rows, B.cols, A.cols).blockSize;
+    }
 
-    size_t n = A.rows; // Assuming square matrices for simplicity in loop bounds, but logic holds
+    std::fill(C.data.begin(), C.data.end(), 0.0f);
 
     // Loop over blocks
-    for (size_t ii = 0; ii < n; ii += blockSize) {
-        for (size_t kk = 0; kk < n; kk += blockSize) {
-            for (size_t jj = 0; jj < n; jj += blockSize) {
+    for (size_t ii = 0; ii < A.rows; ii += blockSize) {
+        for (size_t kk = 0; kk < A.cols; kk += blockSize) {
+            for (size_t jj = 0; jj < B.cols; jj += blockSize) {
 
                 // Loop inside the blocks (handling boundary conditions)
-                size_t i_max = std::min(ii + blockSize, n);
-                size_t k_max = std::min(kk + blockSize, n);
-                size_t j_max = std::min(jj + blockSize, n);
+                size_t i_max = std::min(ii + blockSize, A.rows);
+                size_t k_max = std::min(kk + blockSize, A.cols);
+                size_t j_max = std::min(jj + blockSize, B.cols);
 
                 for (size_t i = ii; i < i_max; ++i) {
                     for (size_t k = kk; k < k_max; ++k) {
@@ -78,9 +127,8 @@ void multiply_optimized_v3_unrolled(const Matrix& A, const Matrix& B, Matrix& C)
         throw std::invalid_argument("Matrix dimensions mismatch.");
     }
 
-    std::fill(C.data.begin(), C.data.end(), 0.0f);
-
     for (size_t i = 0; i < A.rows; ++i) {
+        std::fill_n(C.data.data() + i * C.cols, C.cols, 0.0f);
         for (size_t k = 0; k < A.cols; ++k) {
             float rA = A(i, k);
             size_t j = 0;
@@ -99,14 +147,42 @@ void multiply_optimized_v3_unrolled(const Matrix& A, const Matrix& B, Matrix& C)
     }
 }
 
+#if defined(__x86_64__) || defined(_M_X64)
+// C row += rA * B row, compiled for AVX2/FMA and only called when cpuid reports it.
+// Rows start 64-byte aligned only when cols is a multiple of 16, so use unaligned loads;
+// the last partial vector is masked rather than finished one element at a time.
+__attribute__((target("avx2,fma")))
+static size_t axpy_row_avx2(float rA, const float* b_row, float* c_row, size_t n) {
+    __m256 vA = _mm256_set1_ps(rA);
+    size_t j = 0;
+    for (; j + 7 < n; j += 8) {
+        __m256 vB = _mm256_loadu_ps(b_row + j);
+        __m256 vC = _mm256_loadu_ps(c_row + j);
+        vC = _mm256_fmadd_ps(vA, vB, vC);
+        _mm256_storeu_ps(c_row + j, vC);
+    }
+    if (j < n) {
+        __m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(n - j)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256 vB = _mm256_maskload_ps(b_row + j, mask);
+        __m256 vC = _mm256_maskload_ps(c_row + j, mask);
+        _mm256_maskstore_ps(c_row + j, mask, _mm256_fmadd_ps(vA, vB, vC));
+    }
+    return n;
+}
+#endif
+
 void multiply_optimized_v4_simd(const Matrix& A, const Matrix& B, Matrix& C) {
     if (A.cols != B.rows || C.rows != A.rows || C.cols != B.cols) {
         throw std::invalid_argument("Matrix dimensions mismatch.");
     }
 
-    std::fill(C.data.begin(), C.data.end(), 0.0f);
+#if defined(__x86_64__) || defined(_M_X64)
+    CpuIsa isa = active_isa();
+    bool useAvx2 = (isa == CpuIsa::AVX2 || isa == CpuIsa::AVX512);
+#endif
 
     for (size_t i = 0; i < A.rows; ++i) {
+        std::fill_n(C.data.data() + i * C.cols, C.cols, 0.0f);
         for (size_t k = 0; k < A.cols; ++k) {
             float rA = A(i, k);
             size_t j = 0;
@@ -121,19 +197,27 @@ void multiply_optimized_v4_simd(const Matrix& A, const Matrix& B, Matrix& C) {
                 vC = vfmaq_f32(vC, vA, vB); 
                 vst1q_f32(&C(i, j), vC);
             }
-#elif defined(__AVX2__)
-            __m256 vA = _mm256_set1_ps(rA);
-            for (; j + 7 < B.cols; j += 8) {
-                // Use aligned loads/stores for AVX2 (requires 32-byte alignment)
-                // Note: Only valid if cols is multiple of 8, or if we handle boundaries
-                __m256 vB = _mm256_load_ps(&B(k, j));
-                __m256 vC = _mm256_load_ps(&C(i, j));
-                vC = _mm256_fmadd_ps(vA, vB, vC);
-                _mm256_store_ps(&C(i, j), vC);
+            // NEON has no masked loads: finish with a 2-wide step and a single lane
+            if (j + 1 < B.cols) {
+                float32x2_t vB = vld1_f32(&B(k, j));
+                float32x2_t vC = vld1_f32(&C(i, j));
+                vst1_f32(&C(i, j), vfma_f32(vC, vget_low_f32(vA), vB));
+                j += 2;
+            }
+            if (j < B.cols) {
+                float32x2_t vB = vld1_lane_f32(&B(k, j), vdup_n_f32(0.0f), 0);
+                float32x2_t vC = vld1_lane_f32(&C(i, j), vdup_n_f32(0.0f), 0);
+                vst1_lane_f32(&C(i, j), vfma_f32(vC, vget_low_f32(vA), vB), 0);
+                ++j;
+            }
+#elif defined(__x86_64__) || defined(_M_X64)
+            // Selected at runtime, so the AVX2 path runs without -mavx2
+            if (useAvx2) {
+                j = axpy_row_avx2(rA, &B(k, 0), &C(i, 0), B.cols);
             }
 #endif
 
-            // Cleanup loop for remaining elements
+            // Whole row when no SIMD path ran (the vector paths end the row themselves)
             for (; j < B.cols; ++j) {
                 C(i, j) += rA * B(k, j);
             }
@@ -141,43 +225,91 @@ void multiply_optimized_v4_simd(const Matrix& A, const Matrix& B, Matrix& C) {
     }
 }
 
-void multiply_optimized_v5_threaded(const Matrix& A, const Matrix& B, Matrix& C, unsigned int numThreads) {
+template <typename T>
+void multiply_optimized_v5_threaded(const BasicMatrix<T>& A, const BasicMatrix<T>& B, BasicMatrix<T>& C,
+                                    unsigned int numThreads) {
     if (A.cols != B.rows || C.rows != A.rows || C.cols != B.cols) {
         throw std::invalid_argument("Matrix dimensions mismatch.");
     }
 
-    if (numThreads == 0) {
-        numThreads = std::thread::hardware_concurrency();
-        if (numThreads == 0) numThreads = 2; // Fallback
+    ThreadPool& pool = ThreadPool::instance();
+    unsigned int threads = (numThreads == 0) ? pool.num_threads() : std::min(numThreads, pool.num_threads());
+
+    if (choose_gemm_partition(A.rows, B.cols, A.cols, threads) == GemmPartition::SplitK) {
+        // Deep K but too little C to go around: each task runs the i-k-j loop over one
+        // slice of K into its own partial C (slice 0 into C itself), then the partials
+        // are summed into C by row blocks
+        const size_t M = A.rows, N = B.cols, K = A.cols;
+        const size_t slices = std::min<size_t>(threads, std::max<size_t>(2, K / 256));
+        const size_t sliceK = (K + slices - 1) / slices;
+        // Kept per calling thread across calls; each task zeroes its own partial
+        thread_local std::vector<T, MatrixAllocator<T>> partial;
+        if (partial.size() < (slices - 1) * M * N) partial.resize((slices - 1) * M * N);
+        T* parts = partial.data();
+        pool.parallel_for(slices, [&](size_t s) {
+            T* out = (s == 0) ? C.data.data() : parts + (s - 1) * M * N;
+            std::fill(out, out + M * N, T());
+            const size_t kEnd = std::min(K, (s + 1) * sliceK);
+            for (size_t i = 0; i < M; ++i) {
+                for (size_t k = s * sliceK; k < kEnd; ++k) {
+                    T rA = A(i, k);
+                    for (size_t j = 0; j < N; ++j) {
+                        out[i * N + j] += rA * B(k, j);
+                    }
+                }
+            }
+        }, threads);
+        pool.parallel_for(M, [&](size_t i) {
+            for (size_t s = 1; s < slices; ++s) {
+                const T* in = parts + ((s - 1) * M + i) * N;
+                for (size_t j = 0; j < N; ++j) C(i, j) += in[j];
+            }
+        }, threads);
+        return;
     }
 
-    std::fill(C.data.begin(), C.data.end(), 0.0f);
+    size_t tileRows, tileCols;
+    choose_tile_shape(A.rows, B.cols, threads, 1, tileRows, tileCols);
 
-    auto worker = [&](size_t startRow, size_t endRow) {
-        for (size_t i = startRow; i < endRow; ++i) {
+    pool.parallel_for_2d(A.rows, B.cols, tileRows, tileCols,
+                         [&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+        // Each tile zeroes its own part of C, on the thread that computes it
+        for (size_t i = rowBegin; i < rowEnd; ++i) {
+            std::fill(&C(i, colBegin), &C(i, colBegin) + (colEnd - colBegin), T());
+        }
+        for (size_t i = rowBegin; i < rowEnd; ++i) {
             for (size_t k = 0; k < A.cols; ++k) {
-                float rA = A(i, k);
-                for (size_t j = 0; j < B.cols; ++j) {
+                T rA = A(i, k);
+                for (size_t j = colBegin; j < colEnd; ++j) {
                     C(i, j) += rA * B(k, j);
                 }
             }
         }
-    };
+    }, threads);
+}
 
-    std::vector<std::thread> threads;
-    size_t rowsPerThread = A.rows / numThreads;
+// The portable kernels for every element type
+#define INSTANTIATE_PORTABLE_KERNELS(T)                                                                  \
+    template void multiply_naive<T>(const BasicMatrix<T>&, const BasicMatrix<T>&, BasicMatrix<T>&);     \
+    template void multiply_optimized_v1<T>(const BasicMatrix<T>&, const BasicMatrix<T>&, BasicMatrix<T>&); \
+    template void multiply_optimized_v5_threaded<T>(const BasicMatrix<T>&, const BasicMatrix<T>&,       \
+                                                    BasicMatrix<T>&, unsigned int);
+INSTANTIATE_PORTABLE_KERNELS(float)
+INSTANTIATE_PORTABLE_KERNELS(double)
+INSTANTIATE_PORTABLE_KERNELS(std::complex<float>)
+INSTANTIATE_PORTABLE_KERNELS(std::complex<double>)
+#undef INSTANTIATE_PORTABLE_KERNELS
 
-    for (unsigned int t = 0; t < numThreads; ++t) {
-        size_t startRow = t * rowsPerThread;
-        size_t endRow = (t == numThreads - 1) ? A.rows : (t + 1) * rowsPerThread;
-        if (startRow < endRow) {
-            threads.emplace_back(worker, startRow, endRow);
-        }
-    }
+void multiply_naive(const Matrix& A, const Matrix& B, Matrix& C) {
+    multiply_naive<float>(A, B, C);
+}
 
-    for (auto& t : threads) {
-        t.join();
-    }
+void multiply_optimized_v1(const Matrix& A, const Matrix& B, Matrix& C) {
+    multiply_optimized_v1<float>(A, B, C);
+}
+
+void multiply_optimized_v5_threaded(const Matrix& A, const Matrix& B, Matrix& C, unsigned int numThreads) {
+    multiply_optimized_v5_threaded<float>(A, B, C, numThreads);
 }
 
 void multiply_optimized_v6_register_blocked_2x2(const Matrix& A, const Matrix& B, Matrix& C) {
@@ -187,11 +319,11 @@ void multiply_optimized_v6_register_blocked_2x2(const Matrix& A, const Matrix& B
 
     std::fill(C.data.begin(), C.data.end(), 0.0f);
 
-    size_t n = A.rows; // Assuming square for simplicity of logic, but works for rect
-    
-    for (size_t i = 0; i < n; i += 2) {
+    const size_t rows = A.rows;
+
+    for (size_t i = 0; i < rows; i += 2) {
         // Handle odd row at bottom
-        if (i + 1 >= n) {
+        if (i + 1 >= rows) {
             for (size_t k = 0; k < A.cols; ++k) {
                 float rA = A(i, k);
                 for (size_t j = 0; j < B.cols; ++j) {
@@ -232,22 +364,24 @@ void multiply_optimized_v7_threaded_register_blocked(const Matrix& A, const Matr
         throw std::invalid_argument("Matrix dimensions mismatch.");
     }
 
-    if (numThreads == 0) {
-        numThreads = std::thread::hardware_concurrency();
-        if (numThreads == 0) numThreads = 2; // Fallback
-    }
-
-    std::fill(C.data.begin(), C.data.end(), 0.0f);
+    ThreadPool& pool = ThreadPool::instance();
+    unsigned int threads = (numThreads == 0) ? pool.num_threads() : std::min(numThreads, pool.num_threads());
 
-    size_t n = A.rows; // Assuming square matrices for simplicity
+    // Tiles hold an even number of rows so only the last one can end on an odd row
+    size_t tileRows, tileCols;
+    choose_tile_shape(A.rows, B.cols, threads, 2, tileRows, tileCols);
 
-    auto worker = [&](size_t startRow, size_t endRow) {
-        for (size_t i = startRow; i < endRow; i += 2) {
+    pool.parallel_for_2d(A.rows, B.cols, tileRows, tileCols,
+                         [&](size_t rowBegin, size_t rowEnd, size_t colBegin, size_t colEnd) {
+        for (size_t i = rowBegin; i < rowEnd; ++i) {
+            std::fill(&C(i, colBegin), &C(i, colBegin) + (colEnd - colBegin), 0.0f);
+        }
+        for (size_t i = rowBegin; i < rowEnd; i += 2) {
             // Handle odd row at bottom
-            if (i + 1 >= n) {
+            if (i + 1 >= rowEnd) {
                 for (size_t k = 0; k < A.cols; ++k) {
                     float rA = A(i, k);
-                    for (size_t j = 0; j < B.cols; ++j) {
+                    for (size_t j = colBegin; j < colEnd; ++j) {
                         C(i, j) += rA * B(k, j);
                     }
                 }
@@ -258,9 +392,9 @@ void multiply_optimized_v7_threaded_register_blocked(const Matrix& A, const Matr
                 float rA0 = A(i, k);
                 float rA1 = A(i + 1, k);
 
-                size_t j = 0;
+                size_t j = colBegin;
                 // Main 2x2 loop
-                for (; j + 1 < B.cols; j += 2) {
+                for (; j + 1 < colEnd; j += 2) {
                     float rB0 = B(k, j);
                     float rB1 = B(k, j + 1);
 
@@ -269,31 +403,16 @@ void multiply_optimized_v7_threaded_register_blocked(const Matrix& A, const Matr
                     C(i + 1, j) += rA1 * rB0;
                     C(i + 1, j + 1) += rA1 * rB1;
                 }
-                
+
                 // Cleanup columns
-                for (; j < B.cols; ++j) {
+                for (; j < colEnd; ++j) {
                     float rB = B(k, j);
                     C(i, j) += rA0 * rB;
                     C(i + 1, j) += rA1 * rB;
                 }
             }
         }
-    };
-
-    std::vector<std::thread> threads;
-    size_t rowsPerThread = (n + numThreads - 1) / numThreads; // ceiling division
-
-    for (unsigned int t = 0; t < numThreads; ++t) {
-        size_t startRow = t * rowsPerThread;
-        size_t endRow = std::min(startRow + rowsPerThread, n);
-        if (startRow < endRow) {
-            threads.emplace_back(worker, startRow, endRow);
-        }
-    }
-
-    for (auto& t : threads) {
-        t.join();
-    }
+    }, threads);
 }
 
 void multiply_optimized_v8_prefetch(const Matrix& A, const Matrix& B, Matrix& C) {
@@ -301,9 +420,8 @@ void multiply_optimized_v8_prefetch(const Matrix& A, const Matrix& B, Matrix& C)
         throw std::invalid_argument("Matrix dimensions mismatch.");
     }
 
-    std::fill(C.data.begin(), C.data.end(), 0.0f);
-
     for (size_t i = 0; i < A.rows; ++i) {
+        std::fill_n(C.data.data() + i * C.cols, C.cols, 0.0f);
         for (size_t k = 0; k < A.cols; ++k) {
             float rA = A(i, k);
             const float* b_row = &B(k, 0);
@@ -321,7 +439,7 @@ void multiply_optimized_v8_prefetch(const Matrix& A, const Matrix& B, Matrix& C)
 }
 
 Matrix transpose(const Matrix& M) {
-    Matrix T(M.cols, M.rows);
+    Matrix T(M.cols, M.rows, uninitialized);
     for (size_t r = 0; r < M.rows; ++r) {
         for (size_t c = 0; c < M.cols; ++c) {
             T(c, r) = M(r, c);
@@ -0,0 +1,373 @@
+#include "matrix_io.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char kBinaryMagic[8] = {'M', 'A', 'T', 'M', 'U', 'L', 'F', '\0'};
+constexpr uint32_t kBinaryVersion = 1;
+constexpr char kNpyMagic[6] = {'\x93', 'N', 'U', 'M', 'P', 'Y'};
+
+// Data starts on a cache-line boundary in both formats
+constexpr size_t kDataAlignment = 64;
+
+struct BinaryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t elementType;
+    uint64_t rows;
+    uint64_t cols;
+    char reserved[32];
+};
+static_assert(sizeof(BinaryHeader) == kDataAlignment, "Binary header must keep the data aligned.");
+
+// What a header says about the data that follows it.
+struct Layout {
+    size_t rows = 0;
+    size_t cols = 0;
+    ElementType type = ElementType::Float32;
+    bool transposed = false;
+    size_t dataOffset = 0;
+};
+
+std::runtime_error io_error(const std::string& what, const std::string& path) {
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+std::runtime_error format_error(const std::string& what, const std::string& path) {
+    return std::runtime_error("Invalid matrix file " + path + ": " + what);
+}
+
+bool ends_with(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+const char* npy_descr(ElementType type) {
+    switch (type) {
+        case ElementType::Float32:    return "<f4";
+        case ElementType::Float64:    return "<f8";
+        case ElementType::Complex64:  return "<c8";
+        case ElementType::Complex128: return "<c16";
+    }
+    return "";
+}
+
+// Version 1.0 header, padded with spaces so the data starts 64-byte aligned
+std::string npy_header(size_t rows, size_t cols, ElementType type) {
+    std::string dict = std::string("{'descr': '") + npy_descr(type) + "', 'fortran_order': False, 'shape': (" +
+                       std::to_string(rows) + ", " + std::to_string(cols) + "), }";
+    const size_t prefix = sizeof(kNpyMagic) + 4;
+    dict.append((kDataAlignment - (prefix + dict.size() + 1) % kDataAlignment) % kDataAlignment, ' ');
+    dict += '\n';
+    std::string header(kNpyMagic, sizeof(kNpyMagic));
+    header += '\x01';
+    header += '\x00';
+    header += static_cast<char>(dict.size() & 0xff);
+    header += static_cast<char>(dict.size() >> 8);
+    return header + dict;
+}
+
+std::string binary_header(size_t rows, size_t cols, ElementType type) {
+    BinaryHeader h{};
+    std::memcpy(h.magic, kBinaryMagic, sizeof(kBinaryMagic));
+    h.version = kBinaryVersion;
+    h.elementType = static_cast<uint32_t>(type);
+    h.rows = rows;
+    h.cols = cols;
+    return std::string(reinterpret_cast<const char*>(&h), sizeof(h));
+}
+
+// Text of the value following `'key':` in a NumPy header dict, up to the end of the dict.
+std::string npy_value(const std::string& dict, const std::string& key, const std::string& path) {
+    size_t at = dict.find("'" + key + "'");
+    if (at == std::string::npos) at = dict.find("\"" + key + "\"");
+    if (at == std::string::npos) throw format_error("missing '" + key + "' in .npy header", path);
+    at = dict.find(':', at);
+    if (at == std::string::npos) throw format_error("malformed .npy header", path);
+    at = dict.find_first_not_of(" \t", at + 1);
+    return at == std::string::npos ? std::string() : dict.substr(at);
+}
+
+Layout parse_npy(const char* p, size_t bytes, const std::string& path) {
+    if (bytes < 10 || std::memcmp(p, kNpyMagic, sizeof(kNpyMagic)) != 0) {
+        throw format_error("not a .npy file", path);
+    }
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    size_t headerStart, headerBytes;
+    if (u[6] == 1) {
+        headerStart = 10;
+        headerBytes = u[8] | (size_t(u[9]) << 8);
+    } else if ((u[6] == 2 || u[6] == 3) && bytes >= 12) {
+        headerStart = 12;
+        headerBytes = u[8] | (size_t(u[9]) << 8) | (size_t(u[10]) << 16) | (size_t(u[11]) << 24);
+    } else {
+        throw format_error("unsupported .npy version " + std::to_string(u[6]), path);
+    }
+    if (headerStart + headerBytes > bytes) throw format_error("truncated .npy header", path);
+    const std::string dict(p + headerStart, headerBytes);
+
+    Layout layout;
+    layout.dataOffset = headerStart + headerBytes;
+
+    std::string descr = npy_value(dict, "descr", path);
+    size_t close = descr.empty() ? std::string::npos : descr.find(descr[0], 1);
+    if (close == std::string::npos) throw format_error("malformed descr", path);
+    descr = descr.substr(1, close - 1);
+    if (descr.size() < 2 || (descr[0] != '<' && descr[0] != '=' && descr[0] != '|')) {
+        throw format_error("only little-endian data is supported (descr " + descr + ")", path);
+    }
+    const std::string kind = descr.substr(1);
+    if (kind == "f4") {
+        layout.type = ElementType::Float32;
+    } else if (kind == "f8") {
+        layout.type = ElementType::Float64;
+    } else if (kind == "c8") {
+        layout.type = ElementType::Complex64;
+    } else if (kind == "c16") {
+        layout.type = ElementType::Complex128;
+    } else {
+        throw format_error("unsupported dtype " + descr, path);
+    }
+
+    const bool fortran = npy_value(dict, "fortran_order", path).compare(0, 4, "True") == 0;
+
+    const std::string shape = npy_value(dict, "shape", path);
+    if (shape.empty() || shape[0] != '(' || shape.find(')') == std::string::npos) {
+        throw format_error("malformed shape", path);
+    }
+    std::vector<size_t> dims;
+    const char* s = shape.c_str() + 1;
+    while (true) {
+        while (*s == ' ' || *s == ',') ++s;
+        if (*s == ')') break;
+        char* end = nullptr;
+        unsigned long long d = std::strtoull(s, &end, 10);
+        if (end == s) throw format_error("malformed shape", path);
+        dims.push_back(static_cast<size_t>(d));
+        s = end;
+    }
+    if (dims.size() == 1) {
+        layout.rows = 1;
+        layout.cols = dims[0];
+    } else if (dims.size() == 2) {
+        layout.rows = dims[0];
+        layout.cols = dims[1];
+        layout.transposed = fortran;
+    } else {
+        throw format_error("expected a 1-D or 2-D array, got " + std::to_string(dims.size()) + "-D", path);
+    }
+    return layout;
+}
+
+Layout parse_binary(const char* p, size_t bytes, const std::string& path) {
+    BinaryHeader h;
+    if (bytes < sizeof(h)) throw format_error("truncated header", path);
+    std::memcpy(&h, p, sizeof(h));
+    if (std::memcmp(h.magic, kBinaryMagic, sizeof(kBinaryMagic)) != 0) {
+        throw format_error("bad magic (not a matrix file)", path);
+    }
+    if (h.version != kBinaryVersion) throw format_error("unsupported version " + std::to_string(h.version), path);
+    if (h.elementType > static_cast<uint32_t>(ElementType::Complex128)) {
+        throw format_error("unknown element type " + std::to_string(h.elementType), path);
+    }
+    Layout layout;
+    layout.rows = h.rows;
+    layout.cols = h.cols;
+    layout.type = static_cast<ElementType>(h.elementType);
+    layout.dataOffset = sizeof(h);
+    return layout;
+}
+
+} // namespace
+
+size_t element_size(ElementType type) {
+    switch (type) {
+        case ElementType::Float32:    return sizeof(float);
+        case ElementType::Float64:    return sizeof(double);
+        case ElementType::Complex64:  return sizeof(std::complex<float>);
+        case ElementType::Complex128: return sizeof(std::complex<double>);
+    }
+    return 0;
+}
+
+const char* element_type_name(ElementType type) {
+    switch (type) {
+        case ElementType::Float32:    return "float32";
+        case ElementType::Float64:    return "float64";
+        case ElementType::Complex64:  return "complex64";
+        case ElementType::Complex128: return "complex128";
+    }
+    return "unknown";
+}
+
+MatrixFileFormat matrix_file_format(const std::string& path) {
+    return ends_with(path, ".npy") ? MatrixFileFormat::Npy : MatrixFileFormat::Binary;
+}
+
+bool same_file(const std::string& a, const std::string& b) {
+    struct stat sa, sb;
+    if (::stat(a.c_str(), &sa) != 0 || ::stat(b.c_str(), &sb) != 0) return false;
+    return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+MatrixFile::MatrixFile(const std::string& path, MapMode mode)
+    : format_(matrix_file_format(path)), writable_(mode == MapMode::ReadWrite) {
+    if (mode == MapMode::Create) {
+        throw std::invalid_argument("Creating a matrix file needs its shape and element type.");
+    }
+    int fd = ::open(path.c_str(), writable_ ? O_RDWR : O_RDONLY);
+    if (fd < 0) throw io_error("Cannot open", path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw io_error("Cannot stat", path);
+    }
+    if (st.st_size == 0) {
+        ::close(fd);
+        throw format_error("empty file", path);
+    }
+    map(path, fd, static_cast<size_t>(st.st_size));
+
+    const char* bytes = static_cast<const char*>(mapBase_);
+    Layout layout;
+    try {
+        layout = (format_ == MatrixFileFormat::Npy) ? parse_npy(bytes, mappedBytes_, path)
+                                                    : parse_binary(bytes, mappedBytes_, path);
+        const size_t size = element_size(layout.type);
+        if (layout.rows != 0 && layout.cols > (std::numeric_limits<size_t>::max() / size) / layout.rows) {
+            throw format_error("shape too large", path);
+        }
+        if (layout.dataOffset + layout.rows * layout.cols * size > mappedBytes_) {
+            throw format_error("file too small for a " + std::to_string(layout.rows) + "x" +
+                               std::to_string(layout.cols) + " " + element_type_name(layout.type) + " matrix", path);
+        }
+        // Complex values only need their component's alignment
+        const bool complex = layout.type == ElementType::Complex64 || layout.type == ElementType::Complex128;
+        if (layout.dataOffset % (complex ? size / 2 : size) != 0) {
+            throw format_error("data is not aligned to its element type", path);
+        }
+    } catch (...) {
+        release();
+        throw;
+    }
+    rows_ = layout.rows;
+    cols_ = layout.cols;
+    type_ = layout.type;
+    transposed_ = layout.transposed;
+    dataOffset_ = layout.dataOffset;
+    data_ = static_cast<char*>(mapBase_) + dataOffset_;
+}
+
+MatrixFile::MatrixFile(const std::string& path, size_t rows, size_t cols, ElementType type)
+    : rows_(rows), cols_(cols), type_(type), format_(matrix_file_format(path)), writable_(true) {
+    const std::string header = (format_ == MatrixFileFormat::Npy) ? npy_header(rows, cols, type)
+                                                                  : binary_header(rows, cols, type);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw io_error("Cannot open", path);
+    const size_t bytes = header.size() + rows * cols * element_size(type);
+    if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+        ::close(fd);
+        throw io_error("Cannot size", path);
+    }
+    map(path, fd, bytes);
+    std::memcpy(mapBase_, header.data(), header.size());
+    dataOffset_ = header.size();
+    data_ = static_cast<char*>(mapBase_) + dataOffset_;
+}
+
+void MatrixFile::map(const std::string& path, int fd, size_t fileBytes) {
+    void* p = mmap(nullptr, fileBytes, writable_ ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // The mapping keeps the file referenced
+    if (p == MAP_FAILED) throw io_error("Cannot map", path);
+    mapBase_ = p;
+    mappedBytes_ = fileBytes;
+}
+
+MatrixFile::~MatrixFile() {
+    release();
+}
+
+MatrixFile::MatrixFile(MatrixFile&& other) noexcept
+    : rows_(other.rows_), cols_(other.cols_), type_(other.type_), format_(other.format_),
+      transposed_(other.transposed_), writable_(other.writable_), dataOffset_(other.dataOffset_),
+      data_(other.data_), mapBase_(other.mapBase_), mappedBytes_(other.mappedBytes_) {
+    other.data_ = nullptr;
+    other.mapBase_ = nullptr;
+    other.mappedBytes_ = 0;
+}
+
+MatrixFile& MatrixFile::operator=(MatrixFile&& other) noexcept {
+    if (this != &other) {
+        release();
+        rows_ = other.rows_;
+        cols_ = other.cols_;
+        type_ = other.type_;
+        format_ = other.format_;
+        transposed_ = other.transposed_;
+        writable_ = other.writable_;
+        dataOffset_ = other.dataOffset_;
+        data_ = other.data_;
+        mapBase_ = other.mapBase_;
+        mappedBytes_ = other.mappedBytes_;
+        other.data_ = nullptr;
+        other.mapBase_ = nullptr;
+        other.mappedBytes_ = 0;
+    }
+    return *this;
+}
+
+void MatrixFile::release() noexcept {
+    if (mapBase_) munmap(mapBase_, mappedBytes_);
+    mapBase_ = nullptr;
+    data_ = nullptr;
+    mappedBytes_ = 0;
+}
+
+void MatrixFile::check_type(ElementType type) const {
+    if (type != type_) {
+        throw std::invalid_argument(std::string("Matrix file holds ") + element_type_name(type_) + ", not " +
+                                    element_type_name(type) + ".");
+    }
+}
+
+void MatrixFile::prefault() const {
+    if (!mapBase_) return;
+    // A hint only: failures (e.g. on filesystems that ignore it) are not errors
+    madvise(mapBase_, mappedBytes_, MADV_WILLNEED);
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const volatile char* bytes = static_cast<const char*>(mapBase_);
+    char sink = 0;
+    for (size_t offset = 0; offset < mappedBytes_; offset += page) sink ^= bytes[offset];
+    (void)sink;
+}
+
+void MatrixFile::flush(bool wait) {
+    if (!writable_ || !mapBase_) return;
+    if (msync(mapBase_, mappedBytes_, wait ? MS_SYNC : MS_ASYNC) != 0) {
+        throw std::runtime_error(std::string("msync failed: ") + std::strerror(errno));
+    }
+}
+
+template <typename T>
+void save_matrix(const std::string& path, const BasicConstMatrixView<T>& m) {
+    MatrixFile file(path, m.rows, m.cols, ElementTypeOf<T>::value);
+    BasicMatrixView<T> out = file.mutable_view<T>();
+    for (size_t i = 0; i < m.rows; ++i) {
+        std::copy(m.data + i * m.ld, m.data + i * m.ld + m.cols, out.data + i * out.ld);
+    }
+    file.flush();
+}
+
+template void save_matrix<float>(const std::string&, const BasicConstMatrixView<float>&);
+template void save_matrix<double>(const std::string&, const BasicConstMatrixView<double>&);
+template void save_matrix<std::complex<float>>(const std::string&, const BasicConstMatrixView<std::complex<float>>&);
+template void save_matrix<std::complex<double>>(const std::string&, const BasicConstMatrixView<std::complex<double>>&);
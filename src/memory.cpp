@@ -0,0 +1,124 @@
+#include "matrix.h"
+#include <cstdlib>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <sys/mman.h>
+
+namespace {
+
+size_t default_pool_limit() {
+    if (const char* env = std::getenv("MATMUL_POOL_MB")) {
+        char* end = nullptr;
+        unsigned long long mb = std::strtoull(env, &end, 10);
+        if (end != env) return static_cast<size_t>(mb) << 20;
+    }
+    return size_t(1) << 30;
+}
+
+// Free huge blocks by size. Exact-size reuse is enough for the common case of the
+// same shapes being allocated over and over (benchmarks, layers, scratch buffers).
+struct HugeBlockPool {
+    std::mutex mutex;
+    std::unordered_map<size_t, std::vector<void*>> free;
+    size_t cached = 0;
+    size_t limit = default_pool_limit();
+
+    // Frees cached blocks until at most `target` bytes remain. Caller holds the lock.
+    void shrink_to(size_t target) {
+        for (auto it = free.begin(); it != free.end() && cached > target;) {
+            while (!it->second.empty() && cached > target) {
+                std::free(it->second.back());
+                it->second.pop_back();
+                cached -= it->first;
+            }
+            it = it->second.empty() ? free.erase(it) : std::next(it);
+        }
+    }
+};
+
+// Never destroyed, so matrices freed during static destruction can still return here
+HugeBlockPool& pool() {
+    static HugeBlockPool* p = new HugeBlockPool;
+    return *p;
+}
+
+size_t huge_size(size_t bytes) {
+    return (bytes + kHugePageBytes - 1) / kHugePageBytes * kHugePageBytes;
+}
+
+} // namespace
+
+void* matrix_alloc(size_t bytes) {
+    void* ptr = nullptr;
+    if (bytes < kHugePageBytes) {
+        if (posix_memalign(&ptr, 64, bytes) != 0) throw std::bad_alloc();
+        return ptr;
+    }
+
+    const size_t size = huge_size(bytes);
+    {
+        HugeBlockPool& p = pool();
+        std::lock_guard<std::mutex> lk(p.mutex);
+        auto it = p.free.find(size);
+        if (it != p.free.end() && !it->second.empty()) {
+            ptr = it->second.back();
+            it->second.pop_back();
+            p.cached -= size;
+            return ptr;
+        }
+    }
+    if (posix_memalign(&ptr, kHugePageBytes, size) != 0) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    // A hint: without THP support (or with it disabled) this fails and normal pages are used
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+void matrix_free(void* ptr, size_t bytes) noexcept {
+    if (bytes < kHugePageBytes) {
+        std::free(ptr);
+        return;
+    }
+
+    const size_t size = huge_size(bytes);
+    HugeBlockPool& p = pool();
+    std::lock_guard<std::mutex> lk(p.mutex);
+    if (p.cached + size > p.limit) {
+        std::free(ptr);
+        return;
+    }
+    try {
+        p.free[size].push_back(ptr);
+        p.cached += size;
+    } catch (...) {
+        std::free(ptr);
+    }
+}
+
+void set_matrix_pool_limit(size_t bytes) {
+    HugeBlockPool& p = pool();
+    std::lock_guard<std::mutex> lk(p.mutex);
+    p.limit = bytes;
+    p.shrink_to(bytes);
+}
+
+size_t matrix_pool_limit() {
+    HugeBlockPool& p = pool();
+    std::lock_guard<std::mutex> lk(p.mutex);
+    return p.limit;
+}
+
+size_t matrix_pool_cached_bytes() {
+    HugeBlockPool& p = pool();
+    std::lock_guard<std::mutex> lk(p.mutex);
+    return p.cached;
+}
+
+void matrix_pool_trim() {
+    HugeBlockPool& p = pool();
+    std::lock_guard<std::mutex> lk(p.mutex);
+    p.shrink_to(0);
+}
@@ -0,0 +1,251 @@
+#include "out_of_core.h"
+#include "gemm.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Tiles never shrink below this (and are multiples of it), so each product keeps
+// enough work per byte to stay compute bound.
+constexpr size_t kMinTile = 64;
+
+size_t page_size() {
+    static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+std::runtime_error io_error(const std::string& what, const std::string& path) {
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+// madvise over the pages covering [begin, end), clipped to the mapping.
+void advise_range(const float* mapBase, size_t mappedBytes, const float* begin, const float* end, int advice) {
+    if (begin >= end) return;
+    const uintptr_t base = reinterpret_cast<uintptr_t>(mapBase);
+    const uintptr_t page = page_size();
+    uintptr_t lo = reinterpret_cast<uintptr_t>(begin) & ~(page - 1);
+    uintptr_t hi = std::min((reinterpret_cast<uintptr_t>(end) + page - 1) & ~(page - 1), base + mappedBytes);
+    // Hints only: failures (e.g. on filesystems that ignore them) are not errors
+    madvise(reinterpret_cast<void*>(lo), hi - lo, advice);
+}
+
+struct TileShape {
+    size_t mt;
+    size_t nt;
+    size_t kt;
+};
+
+// Largest tiles whose resident set (one C tile, plus one A and one B tile, or two
+// of each when prefetching) fits the budget: starting from the whole problem, the
+// largest side is halved until it fits.
+TileShape choose_tiles(size_t M, size_t N, size_t K, size_t budgetBytes, bool prefetch) {
+    const size_t copies = prefetch ? 2 : 1;
+    const size_t budget = budgetBytes / sizeof(float);
+    TileShape t{M, N, K};
+    auto footprint = [&] { return t.mt * t.nt + copies * (t.mt * t.kt + t.kt * t.nt); };
+    while (footprint() > budget) {
+        size_t* largest = &t.mt;
+        if (t.nt > *largest) largest = &t.nt;
+        if (t.kt > *largest) largest = &t.kt;
+        if (*largest <= kMinTile) {
+            throw std::invalid_argument("Memory budget too small.");
+        }
+        *largest = std::max(kMinTile, (*largest / 2 + kMinTile - 1) / kMinTile * kMinTile);
+    }
+    return t;
+}
+
+// One step of the out-of-core loop: C[i0:i1, j0:j1] += A[i0:i1, k0:k1] * B[k0:k1, j0:j1].
+struct Step {
+    size_t i0, i1, j0, j1, k0, k1;
+};
+
+// Faults in the A and B tiles of a step: madvise starts asynchronous readahead,
+// then one read per page waits for it, off the compute thread.
+void read_ahead(const MappedMatrix& A, const MappedMatrix& B, const Step& s) {
+    A.will_need(s.i0, s.i1, s.k0, s.k1);
+    B.will_need(s.k0, s.k1, s.j0, s.j1);
+    const size_t stride = page_size() / sizeof(float);
+    volatile float sink = 0.0f;
+    auto touch = [&](const MappedMatrix& X, size_t r0, size_t r1, size_t c0, size_t c1) {
+        for (size_t r = r0; r < r1; ++r) {
+            const float* row = X.data() + r * X.cols();
+            for (size_t c = c0; c < c1; c += stride) sink = row[c];
+            sink = row[c1 - 1];
+        }
+    };
+    touch(A, s.i0, s.i1, s.k0, s.k1);
+    touch(B, s.k0, s.k1, s.j0, s.j1);
+    (void)sink;
+}
+
+} // namespace
+
+MappedMatrix::MappedMatrix(const std::string& path, size_t rows, size_t cols, MapMode mode)
+    : rows_(rows), cols_(cols), writable_(mode != MapMode::ReadOnly) {
+    int flags = (mode == MapMode::ReadOnly) ? O_RDONLY : O_RDWR;
+    if (mode == MapMode::Create) flags |= O_CREAT | O_TRUNC;
+    int fd = ::open(path.c_str(), flags, 0644);
+    if (fd < 0) throw io_error("Cannot open", path);
+
+    const size_t bytes = rows * cols * sizeof(float);
+    if (mode == MapMode::Create) {
+        if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+            ::close(fd);
+            throw io_error("Cannot size", path);
+        }
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < bytes) {
+            ::close(fd);
+            throw std::runtime_error("File too small for a " + std::to_string(rows) + "x" +
+                                     std::to_string(cols) + " matrix: " + path);
+        }
+    }
+
+    if (bytes > 0) {
+        int prot = writable_ ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        void* p = mmap(nullptr, bytes, prot, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw io_error("Cannot map", path);
+        }
+        data_ = static_cast<float*>(p);
+        mappedBytes_ = bytes;
+    }
+    ::close(fd); // The mapping keeps the file referenced
+}
+
+MappedMatrix::~MappedMatrix() {
+    release();
+}
+
+MappedMatrix::MappedMatrix(MappedMatrix&& other) noexcept
+    : rows_(other.rows_), cols_(other.cols_), data_(other.data_),
+      mappedBytes_(other.mappedBytes_), writable_(other.writable_) {
+    other.data_ = nullptr;
+    other.mappedBytes_ = 0;
+}
+
+MappedMatrix& MappedMatrix::operator=(MappedMatrix&& other) noexcept {
+    if (this != &other) {
+        release();
+        rows_ = other.rows_;
+        cols_ = other.cols_;
+        data_ = other.data_;
+        mappedBytes_ = other.mappedBytes_;
+        writable_ = other.writable_;
+        other.data_ = nullptr;
+        other.mappedBytes_ = 0;
+    }
+    return *this;
+}
+
+void MappedMatrix::release() noexcept {
+    if (data_) munmap(data_, mappedBytes_);
+    data_ = nullptr;
+    mappedBytes_ = 0;
+}
+
+void MappedMatrix::will_need(size_t r0, size_t r1, size_t c0, size_t c1) const {
+    if (c0 == 0 && c1 == cols_) {
+        advise_range(data_, mappedBytes_, data_ + r0 * cols_, data_ + r1 * cols_, MADV_WILLNEED);
+        return;
+    }
+    for (size_t r = r0; r < r1; ++r) {
+        advise_range(data_, mappedBytes_, data_ + r * cols_ + c0, data_ + r * cols_ + c1, MADV_WILLNEED);
+    }
+}
+
+void MappedMatrix::dont_need(size_t r0, size_t r1, size_t c0, size_t c1) const {
+    // Only pages wholly inside the block are dropped, so neighbouring tiles that
+    // share a page at the edges stay resident.
+    const uintptr_t page = page_size();
+    auto drop = [&](const float* begin, const float* end) {
+        uintptr_t lo = (reinterpret_cast<uintptr_t>(begin) + page - 1) & ~(page - 1);
+        uintptr_t hi = reinterpret_cast<uintptr_t>(end) & ~(page - 1);
+        if (lo < hi) madvise(reinterpret_cast<void*>(lo), hi - lo, MADV_DONTNEED);
+    };
+    if (c0 == 0 && c1 == cols_) {
+        drop(data_ + r0 * cols_, data_ + r1 * cols_);
+        return;
+    }
+    for (size_t r = r0; r < r1; ++r) {
+        drop(data_ + r * cols_ + c0, data_ + r * cols_ + c1);
+    }
+}
+
+void MappedMatrix::flush(size_t r0, size_t r1, bool wait) {
+    if (!writable_ || r0 >= r1) return;
+    const uintptr_t page = page_size();
+    uintptr_t lo = reinterpret_cast<uintptr_t>(data_ + r0 * cols_) & ~(page - 1);
+    uintptr_t hi = reinterpret_cast<uintptr_t>(data_ + r1 * cols_);
+    if (msync(reinterpret_cast<void*>(lo), hi - lo, wait ? MS_SYNC : MS_ASYNC) != 0) {
+        throw std::runtime_error(std::string("msync failed: ") + std::strerror(errno));
+    }
+}
+
+void multiply_out_of_core(const MappedMatrix& A, const MappedMatrix& B, MappedMatrix& C,
+                          const OutOfCoreOptions& options) {
+    if (A.cols() != B.rows() || C.rows() != A.rows() || C.cols() != B.cols()) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+    if (!C.writable()) {
+        throw std::invalid_argument("Output matrix is read-only.");
+    }
+
+    const size_t M = A.rows(), N = B.cols(), K = A.cols();
+    if (M == 0 || N == 0) return;
+    if (K == 0) {
+        std::fill(C.data(), C.data() + M * N, 0.0f);
+        return;
+    }
+
+    const TileShape t = choose_tiles(M, N, K, options.memoryBudget, options.prefetch);
+    std::vector<Step> steps;
+    for (size_t i0 = 0; i0 < M; i0 += t.mt) {
+        for (size_t j0 = 0; j0 < N; j0 += t.nt) {
+            for (size_t k0 = 0; k0 < K; k0 += t.kt) {
+                steps.push_back({i0, std::min(i0 + t.mt, M), j0, std::min(j0 + t.nt, N),
+                                 k0, std::min(k0 + t.kt, K)});
+            }
+        }
+    }
+
+    if (options.prefetch) read_ahead(A, B, steps[0]);
+    for (size_t s = 0; s < steps.size(); ++s) {
+        const Step& cur = steps[s];
+        const Step* next = (s + 1 < steps.size()) ? &steps[s + 1] : nullptr;
+
+        std::future<void> pending;
+        if (options.prefetch && next) {
+            pending = std::async(std::launch::async, read_ahead, std::cref(A), std::cref(B), *next);
+        }
+
+        const size_t mi = cur.i1 - cur.i0, nj = cur.j1 - cur.j0, kk = cur.k1 - cur.k0;
+        gemm(Transpose::NoTrans, Transpose::NoTrans, 1.0f,
+             A.view().block(cur.i0, cur.k0, mi, kk), B.view().block(cur.k0, cur.j0, kk, nj),
+             (cur.k0 == 0) ? 0.0f : 1.0f, C.view().block(cur.i0, cur.j0, mi, nj));
+
+        if (pending.valid()) pending.get();
+
+        // Drop what the next step won't use; a finished C tile is written back first.
+        bool sameA = next && next->i0 == cur.i0 && next->k0 == cur.k0;
+        bool sameB = next && next->k0 == cur.k0 && next->j0 == cur.j0;
+        if (!sameA) A.dont_need(cur.i0, cur.i1, cur.k0, cur.k1);
+        if (!sameB) B.dont_need(cur.k0, cur.k1, cur.j0, cur.j1);
+        if (cur.k1 == K) {
+            C.flush(cur.i0, cur.i1);
+            C.dont_need(cur.i0, cur.i1, cur.j0, cur.j1);
+        }
+    }
+}
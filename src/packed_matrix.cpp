@@ -0,0 +1,88 @@
+#include "packed_matrix.h"
+#include "gemm_internal.h"
+#include "tuning.h"
+#include <stdexcept>
+
+namespace {
+
+gemm_detail::PackedB packed_operand(const PackedMatrix& B, size_t mc) {
+    gemm_detail::MicroKernel uk = gemm_detail::with_blocking(gemm_detail::micro_kernel_for(B.isa()),
+                                                             mc, B.kc(), B.nc());
+    return {uk, B.rows(), B.cols(), B.data()};
+}
+
+void gemm_with(Transpose transA, size_t M, float alpha, const float* A, size_t lda,
+               const PackedMatrix& B, float beta, float* C, size_t ldc, const Epilogue* ep) {
+    bool tA = (transA == Transpose::Trans);
+    size_t K = B.rows();
+    size_t N = B.cols();
+    if (lda < (tA ? M : K) || ldc < N || (ep && ep->residual && ep->ldResidual < N)) {
+        throw std::invalid_argument("Leading dimension too small.");
+    }
+
+    // B's kernel and kc / nc are fixed; only mc and the thread count are tuned per call
+    TuningParams p = tuned_params(M, N, K);
+    gemm_detail::gemm_prepacked_threaded(M, alpha, gemm_detail::Operand::of(A, lda, tA),
+                                         packed_operand(B, p.mc), beta, C, ldc, p.threads, ep);
+}
+
+} // namespace
+
+PackedMatrix::PackedMatrix(const Matrix& B, Transpose trans)
+    : PackedMatrix(B.view(), trans) {}
+
+PackedMatrix::PackedMatrix(const ConstMatrixView& B, Transpose trans)
+    : isa_(active_isa()) {
+    bool transposed = (trans == Transpose::Trans);
+    rows_ = transposed ? B.cols : B.rows;
+    cols_ = transposed ? B.rows : B.cols;
+
+    // The number of rows of A is unknown here, so kc and nc are tuned as for a square
+    // product; mc is still chosen per call.
+    TuningParams p = tuned_params(cols_, cols_, rows_);
+    gemm_detail::MicroKernel uk = gemm_detail::with_blocking(gemm_detail::micro_kernel_for(isa_),
+                                                             p.mc, p.kc, p.nc);
+    kc_ = uk.kc;
+    nc_ = uk.nc;
+
+    data_.resize(gemm_detail::PackedB::size(uk, rows_, cols_));
+    gemm_detail::pack_b_whole(uk, rows_, cols_, gemm_detail::Operand::of(B.data, B.ld, transposed),
+                              data_.data());
+}
+
+void gemm(Transpose transA, size_t M, float alpha, const float* A, size_t lda,
+          const PackedMatrix& B, float beta, float* C, size_t ldc) {
+    gemm_with(transA, M, alpha, A, lda, B, beta, C, ldc, nullptr);
+}
+
+void gemm(Transpose transA, size_t M, float alpha, const float* A, size_t lda,
+          const PackedMatrix& B, float beta, float* C, size_t ldc, const Epilogue& epilogue) {
+    gemm_with(transA, M, alpha, A, lda, B, beta, C, ldc, &epilogue);
+}
+
+void gemm(Transpose transA, float alpha, const ConstMatrixView& A, const PackedMatrix& B,
+          float beta, const MatrixView& C) {
+    size_t M = (transA == Transpose::Trans) ? A.cols : A.rows;
+    size_t K = (transA == Transpose::Trans) ? A.rows : A.cols;
+    if (K != B.rows() || C.rows != M || C.cols != B.cols()) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+
+    gemm(transA, M, alpha, A.data, A.ld, B, beta, C.data, C.ld);
+}
+
+void multiply(const Matrix& A, const PackedMatrix& B, Matrix& C) {
+    if (A.cols != B.rows() || C.rows != A.rows || C.cols != B.cols()) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+
+    gemm(Transpose::NoTrans, A.rows, 1.0f, A.data.data(), A.cols, B, 0.0f, C.data.data(), C.cols);
+}
+
+void multiply(const Matrix& A, const PackedMatrix& B, Matrix& C, const Epilogue& epilogue, float alpha) {
+    if (A.cols != B.rows() || C.rows != A.rows || C.cols != B.cols()) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+
+    gemm(Transpose::NoTrans, A.rows, alpha, A.data.data(), A.cols, B, 0.0f, C.data.data(), C.cols, epilogue);
+}
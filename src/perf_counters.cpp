@@ -0,0 +1,268 @@
+#include "perf_counters.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "matrix.h"
+#include "thread_pool.h"
+#if defined(__linux__)
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64)
+#include <cpuid.h>
+#endif
+
+namespace {
+
+#if defined(__linux__)
+bool is_intel() {
+#if defined(__x86_64__) || defined(_M_X64)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) return false;
+    char vendor[13];
+    std::memcpy(vendor, &ebx, 4);
+    std::memcpy(vendor + 4, &edx, 4);
+    std::memcpy(vendor + 8, &ecx, 4);
+    vendor[12] = '\0';
+    return std::strcmp(vendor, "GenuineIntel") == 0;
+#else
+    return false;
+#endif
+}
+
+constexpr unsigned long long cache_event(unsigned long long cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+// perf_event_attr type and config for `event`; false if this CPU has no encoding.
+bool event_config(PerfEvent event, unsigned int& type, unsigned long long& config) {
+    switch (event) {
+        case PerfEvent::Cycles:
+            type = PERF_TYPE_HARDWARE;
+            config = PERF_COUNT_HW_CPU_CYCLES;
+            return true;
+        case PerfEvent::Instructions:
+            type = PERF_TYPE_HARDWARE;
+            config = PERF_COUNT_HW_INSTRUCTIONS;
+            return true;
+        case PerfEvent::L1DMisses:
+            type = PERF_TYPE_HW_CACHE;
+            config = cache_event(PERF_COUNT_HW_CACHE_L1D);
+            return true;
+        case PerfEvent::LLCMisses:
+            type = PERF_TYPE_HW_CACHE;
+            config = cache_event(PERF_COUNT_HW_CACHE_LL);
+            return true;
+        case PerfEvent::DTLBMisses:
+            type = PERF_TYPE_HW_CACHE;
+            config = cache_event(PERF_COUNT_HW_CACHE_DTLB);
+            return true;
+        case PerfEvent::FpVectorOps:
+            // FP_ARITH_INST_RETIRED (0xC7) with the 128B, 256B and 512B packed-single
+            // umasks (0x08 | 0x20 | 0x80) combined. Other vendors encode it differently.
+            if (!is_intel()) return false;
+            type = PERF_TYPE_RAW;
+            config = 0xC7 | (0xA8ull << 8);
+            return true;
+        case PerfEvent::TaskClock:
+            type = PERF_TYPE_SOFTWARE;
+            config = PERF_COUNT_SW_TASK_CLOCK;
+            return true;
+    }
+    return false;
+}
+
+int open_event(PerfEvent event, pid_t tid) {
+    unsigned int type;
+    unsigned long long config;
+    if (!event_config(event, type, config)) return -1;
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    // User space only, which perf_event_paranoid = 2 still allows for our own threads
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0));
+}
+
+std::vector<pid_t> process_threads() {
+    std::vector<pid_t> tids;
+    if (DIR* dir = opendir("/proc/self/task")) {
+        while (dirent* entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') tids.push_back(static_cast<pid_t>(std::atol(entry->d_name)));
+        }
+        closedir(dir);
+    }
+    if (tids.empty()) tids.push_back(static_cast<pid_t>(syscall(SYS_gettid)));
+    return tids;
+}
+#endif
+
+} // namespace
+
+const char* perf_event_name(PerfEvent event) {
+    switch (event) {
+        case PerfEvent::Cycles:       return "cycles";
+        case PerfEvent::Instructions: return "instructions";
+        case PerfEvent::L1DMisses:    return "l1d_misses";
+        case PerfEvent::LLCMisses:    return "llc_misses";
+        case PerfEvent::DTLBMisses:   return "dtlb_misses";
+        case PerfEvent::FpVectorOps:  return "fp_vector_ops";
+        case PerfEvent::TaskClock:    return "task_clock_ns";
+    }
+    return "unknown";
+}
+
+double PerfSample::ipc() const {
+    if (!has(PerfEvent::Cycles) || !has(PerfEvent::Instructions) || (*this)[PerfEvent::Cycles] == 0) return 0.0;
+    return (*this)[PerfEvent::Instructions] / (*this)[PerfEvent::Cycles];
+}
+
+PerfCounters::PerfCounters() {
+#if defined(__linux__)
+    const std::vector<pid_t> tids = process_threads();
+    for (int e = 0; e < kNumPerfEvents; ++e) {
+        PerfEvent event = static_cast<PerfEvent>(e);
+        std::vector<Counter> opened;
+        for (pid_t tid : tids) {
+            int fd = open_event(event, tid);
+            if (fd < 0) break;
+            opened.push_back({fd, event});
+        }
+        // An event counts only if it could be opened on every thread
+        if (opened.size() == tids.size()) {
+            counters_.insert(counters_.end(), opened.begin(), opened.end());
+        } else {
+            for (const Counter& c : opened) close(c.fd);
+        }
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#if defined(__linux__)
+    for (const Counter& c : counters_) close(c.fd);
+#endif
+}
+
+bool PerfCounters::available(PerfEvent event) const {
+    return std::any_of(counters_.begin(), counters_.end(), [event](const Counter& c) { return c.event == event; });
+}
+
+bool PerfCounters::hardware_available() const {
+    return std::any_of(counters_.begin(), counters_.end(),
+                       [](const Counter& c) { return c.event != PerfEvent::TaskClock; });
+}
+
+void PerfCounters::start() {
+#if defined(__linux__)
+    for (const Counter& c : counters_) {
+        ioctl(c.fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(c.fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    begin_ = std::chrono::steady_clock::now();
+}
+
+PerfSample PerfCounters::stop() {
+    PerfSample sample;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin_;
+    sample.seconds = elapsed.count();
+#if defined(__linux__)
+    for (const Counter& c : counters_) ioctl(c.fd, PERF_EVENT_IOC_DISABLE, 0);
+    // A counter enabled but never scheduled on the PMU (multiplexed out the whole
+    // time) has no estimate, so its event reports as unavailable rather than 0. One
+    // never enabled belongs to a thread that didn't run, and rightly counts 0.
+    bool unscheduled[kNumPerfEvents] = {};
+    for (const Counter& c : counters_) {
+        unsigned long long buf[3];  // value, time enabled, time running
+        if (read(c.fd, buf, sizeof(buf)) != static_cast<ssize_t>(sizeof(buf))) continue;
+        const int e = static_cast<int>(c.event);
+        if (buf[2] == 0 && buf[1] > 0) unscheduled[e] = true;
+        double value = static_cast<double>(buf[0]);
+        if (buf[2] > 0 && buf[2] < buf[1]) value *= static_cast<double>(buf[1]) / buf[2];
+        sample.valid[e] = true;
+        sample.value[e] += value;
+    }
+    for (int e = 0; e < kNumPerfEvents; ++e) {
+        if (unscheduled[e]) {
+            sample.valid[e] = false;
+            sample.value[e] = 0;
+        }
+    }
+#endif
+    return sample;
+}
+
+RooflinePoint roofline(double flops, double bytes, double seconds, const MachinePeaks& peaks) {
+    RooflinePoint p;
+    p.intensity = bytes > 0 ? flops / bytes : 0.0;
+    p.attainable = std::min(peaks.gflops, p.intensity * peaks.gbps);
+    p.achieved = seconds > 0 ? flops / seconds / 1e9 : 0.0;
+    p.fraction = p.attainable > 0 ? p.achieved / p.attainable : 0.0;
+    p.memoryBound = p.intensity * peaks.gbps < peaks.gflops;
+    return p;
+}
+
+double peak_gflops(CpuIsa isa, double ghz, unsigned int cores) {
+    double flopsPerCycle = 2.0;                                 // Scalar: one add and one multiply
+    switch (isa) {
+        case CpuIsa::Scalar: flopsPerCycle = 2.0; break;
+        case CpuIsa::SSE42:  flopsPerCycle = 2.0 * 4; break;   // 4-wide add + 4-wide multiply
+        case CpuIsa::AVX2:   flopsPerCycle = 2.0 * 2 * 8; break;
+        case CpuIsa::AVX512: flopsPerCycle = 2.0 * 2 * 16; break;
+        case CpuIsa::NEON:   flopsPerCycle = 2.0 * 2 * 4; break;
+    }
+    return flopsPerCycle * ghz * cores;
+}
+
+double nominal_ghz() {
+    std::ifstream sysfs("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq");
+    double khz = 0;
+    if (sysfs >> khz && khz > 0) return khz / 1e6;
+
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.compare(0, 7, "cpu MHz") != 0) continue;
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) return std::strtod(line.c_str() + colon + 1, nullptr) / 1e3;
+    }
+    return 0.0;
+}
+
+double measure_memory_bandwidth(size_t bytes) {
+    const size_t n = std::max<size_t>(bytes / (3 * sizeof(float)), 1024);
+    std::vector<float, MatrixAllocator<float>> a(n), b(n), c(n);
+    fill_first_touch(a.data(), n, 0.0f);
+    fill_first_touch(b.data(), n, 1.0f);
+    fill_first_touch(c.data(), n, 2.0f);
+
+    // One chunk per thread, as in fill_first_touch, so each thread streams the pages it touched
+    ThreadPool& pool = ThreadPool::instance();
+    const size_t chunks = pool.num_threads();
+    const size_t chunk = (n + chunks - 1) / chunks;
+    float* pa = a.data();
+    const float* pb = b.data();
+    const float* pc = c.data();
+    double best = 0.0;
+    for (int rep = 0; rep < 5; ++rep) {
+        auto begin = std::chrono::steady_clock::now();
+        pool.parallel_for(chunks, [=](size_t t) {
+            const size_t end = std::min(n, (t + 1) * chunk);
+            for (size_t i = t * chunk; i < end; ++i) pa[i] = pb[i] + 0.5f * pc[i];
+        });
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        best = std::max(best, 3.0 * n * sizeof(float) / elapsed.count() / 1e9);
+    }
+    return best;
+}
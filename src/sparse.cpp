@@ -0,0 +1,365 @@
+#include "sparse.h"
+#include "cpu_features.h"
+#include "gemm_internal.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+void check_index_range(size_t cols) {
+    if (cols > std::numeric_limits<uint32_t>::max()) {
+        throw std::invalid_argument("Too many columns for 32-bit indices.");
+    }
+}
+
+// W floats as a GCC vector, lowered to the target's registers.
+template <size_t W>
+struct StripVec {
+    typedef float type __attribute__((vector_size(W * sizeof(float))));
+};
+
+// C rows [rowBegin, rowEnd) of a CSR product. Each strip of S vectors of a C row
+// is accumulated in registers over the row's nonzeros and stored once.
+template <size_t RegBytes>
+inline __attribute__((always_inline))
+void csr_rows_body(const CsrMatrix& A, size_t rowBegin, size_t rowEnd,
+                   const float* B, size_t ldb, size_t N, float* C, size_t ldc) {
+    constexpr size_t W = RegBytes / sizeof(float);
+    constexpr size_t S = 4;
+    using Vec = typename StripVec<W>::type;
+    const size_t* rowPtr = A.row_ptr().data();
+    const uint32_t* colIdx = A.col_idx().data();
+    const float* values = A.values().data();
+
+    for (size_t i = rowBegin; i < rowEnd; ++i) {
+        const size_t pBegin = rowPtr[i], pEnd = rowPtr[i + 1];
+        float* c_row = C + i * ldc;
+        size_t j = 0;
+        for (; j + S * W <= N; j += S * W) {
+            Vec acc[S] = {};
+            for (size_t p = pBegin; p < pEnd; ++p) {
+                const float* b_row = B + colIdx[p] * ldb + j;
+                for (size_t s = 0; s < S; ++s) {
+                    Vec b;
+                    std::memcpy(&b, b_row + s * W, sizeof(Vec));
+                    acc[s] += values[p] * b;
+                }
+            }
+            std::memcpy(c_row + j, acc, sizeof(acc));
+        }
+        for (; j + W <= N; j += W) {
+            Vec acc = {};
+            for (size_t p = pBegin; p < pEnd; ++p) {
+                Vec b;
+                std::memcpy(&b, B + colIdx[p] * ldb + j, sizeof(Vec));
+                acc += values[p] * b;
+            }
+            std::memcpy(c_row + j, &acc, sizeof(Vec));
+        }
+        if (j < N) {
+            float acc[W] = {};
+            for (size_t p = pBegin; p < pEnd; ++p) {
+                const float* b_row = B + colIdx[p] * ldb;
+                for (size_t t = j; t < N; ++t) acc[t - j] += values[p] * b_row[t];
+            }
+            std::copy(acc, acc + (N - j), c_row + j);
+        }
+    }
+}
+
+// Rows [r0, r0 + R) of one block row of a BSR product, C pointing at row r0.
+// For each strip of C columns, every row of B a block touches is loaded once and
+// applied to all R rows.
+template <size_t RegBytes, size_t R>
+inline __attribute__((always_inline))
+void bsr_rows_body(const BsrMatrix& A, size_t blockRow, size_t r0,
+                   const float* B, size_t ldb, size_t N, float* C, size_t ldc) {
+    constexpr size_t W = RegBytes / sizeof(float);
+    constexpr size_t S = (4 * R <= (RegBytes == 64 ? 24 : 12)) ? 4 : ((2 * R <= (RegBytes == 64 ? 24 : 12)) ? 2 : 1);
+    using Vec = typename StripVec<W>::type;
+    const size_t bc = A.block_cols();
+    const size_t blockSize = A.block_rows() * bc;
+    const size_t bBegin = A.block_ptr()[blockRow], bEnd = A.block_ptr()[blockRow + 1];
+    const uint32_t* blockCol = A.block_col().data();
+    const float* values = A.values().data() + r0 * bc;
+    const size_t K = A.cols();
+
+    size_t j = 0;
+    for (; j + S * W <= N; j += S * W) {
+        Vec acc[R][S] = {};
+        for (size_t b = bBegin; b < bEnd; ++b) {
+            const size_t k0 = blockCol[b] * bc;
+            const size_t cols = std::min(bc, K - k0);
+            const float* blk = values + b * blockSize;
+            for (size_t c = 0; c < cols; ++c) {
+                const float* b_row = B + (k0 + c) * ldb + j;
+                Vec bv[S];
+#pragma GCC unroll 4
+                for (size_t s = 0; s < S; ++s) std::memcpy(&bv[s], b_row + s * W, sizeof(Vec));
+#pragma GCC unroll 8
+                for (size_t r = 0; r < R; ++r) {
+                    float a = blk[r * bc + c];
+#pragma GCC unroll 4
+                    for (size_t s = 0; s < S; ++s) acc[r][s] += a * bv[s];
+                }
+            }
+        }
+#pragma GCC unroll 8
+        for (size_t r = 0; r < R; ++r) std::memcpy(C + r * ldc + j, acc[r], sizeof(acc[r]));
+    }
+    if (j < N) {
+        // Column tail, narrower than a strip
+        float acc[R][S * W] = {};
+        const size_t n = N - j;
+        for (size_t b = bBegin; b < bEnd; ++b) {
+            const size_t k0 = blockCol[b] * bc;
+            const size_t cols = std::min(bc, K - k0);
+            const float* blk = values + b * blockSize;
+            for (size_t c = 0; c < cols; ++c) {
+                const float* b_row = B + (k0 + c) * ldb + j;
+                for (size_t r = 0; r < R; ++r) {
+                    float a = blk[r * bc + c];
+                    for (size_t t = 0; t < n; ++t) acc[r][t] += a * b_row[t];
+                }
+            }
+        }
+        for (size_t r = 0; r < R; ++r) std::copy(acc[r], acc[r] + n, C + r * ldc + j);
+    }
+}
+
+// Block rows [blockBegin, blockEnd). Blocks of any height are run as slices of
+// 8, 4, 2 and 1 rows, which also trims the last block row at the bottom edge.
+template <size_t RegBytes>
+inline __attribute__((always_inline))
+void bsr_block_rows_body(const BsrMatrix& A, size_t blockBegin, size_t blockEnd,
+                         const float* B, size_t ldb, size_t N, float* C, size_t ldc) {
+    const size_t br = A.block_rows();
+    for (size_t blockRow = blockBegin; blockRow < blockEnd; ++blockRow) {
+        const size_t rowStart = blockRow * br;
+        const size_t rows = std::min(br, A.rows() - rowStart);
+        size_t r0 = 0;
+        while (r0 < rows) {
+            float* c_rows = C + (rowStart + r0) * ldc;
+            size_t left = rows - r0;
+            if (left >= 8) {
+                bsr_rows_body<RegBytes, 8>(A, blockRow, r0, B, ldb, N, c_rows, ldc);
+                r0 += 8;
+            } else if (left >= 4) {
+                bsr_rows_body<RegBytes, 4>(A, blockRow, r0, B, ldb, N, c_rows, ldc);
+                r0 += 4;
+            } else if (left >= 2) {
+                bsr_rows_body<RegBytes, 2>(A, blockRow, r0, B, ldb, N, c_rows, ldc);
+                r0 += 2;
+            } else {
+                bsr_rows_body<RegBytes, 1>(A, blockRow, r0, B, ldb, N, c_rows, ldc);
+                r0 += 1;
+            }
+        }
+    }
+}
+
+using CsrKernelFn = void (*)(const CsrMatrix& A, size_t rowBegin, size_t rowEnd,
+                             const float* B, size_t ldb, size_t N, float* C, size_t ldc);
+using BsrKernelFn = void (*)(const BsrMatrix& A, size_t blockBegin, size_t blockEnd,
+                             const float* B, size_t ldb, size_t N, float* C, size_t ldc);
+
+struct SpmmKernels {
+    CsrKernelFn csr;
+    BsrKernelFn bsr;
+};
+
+// One instantiation per instruction set; the bodies are inlined into each and
+// compiled for that target.
+struct GenericSpmm {
+    static void csr(const CsrMatrix& A, size_t rowBegin, size_t rowEnd,
+                    const float* B, size_t ldb, size_t N, float* C, size_t ldc) {
+        csr_rows_body<16>(A, rowBegin, rowEnd, B, ldb, N, C, ldc);
+    }
+    static void bsr(const BsrMatrix& A, size_t blockBegin, size_t blockEnd,
+                    const float* B, size_t ldb, size_t N, float* C, size_t ldc) {
+        bsr_block_rows_body<16>(A, blockBegin, blockEnd, B, ldb, N, C, ldc);
+    }
+};
+
+#if defined(__x86_64__) || defined(_M_X64)
+struct Avx2Spmm {
+    __attribute__((target("avx2,fma")))
+    static void csr(const CsrMatrix& A, size_t rowBegin, size_t rowEnd,
+                    const float* B, size_t ldb, size_t N, float* C, size_t ldc) {
+        csr_rows_body<32>(A, rowBegin, rowEnd, B, ldb, N, C, ldc);
+    }
+    __attribute__((target("avx2,fma")))
+    static void bsr(const BsrMatrix& A, size_t blockBegin, size_t blockEnd,
+                    const float* B, size_t ldb, size_t N, float* C, size_t ldc) {
+        bsr_block_rows_body<32>(A, blockBegin, blockEnd, B, ldb, N, C, ldc);
+    }
+};
+
+struct Avx512Spmm {
+    __attribute__((target("avx512f")))
+    static void csr(const CsrMatrix& A, size_t rowBegin, size_t rowEnd,
+                    const float* B, size_t ldb, size_t N, float* C, size_t ldc) {
+        csr_rows_body<64>(A, rowBegin, rowEnd, B, ldb, N, C, ldc);
+    }
+    __attribute__((target("avx512f")))
+    static void bsr(const BsrMatrix& A, size_t blockBegin, size_t blockEnd,
+                    const float* B, size_t ldb, size_t N, float* C, size_t ldc) {
+        bsr_block_rows_body<64>(A, blockBegin, blockEnd, B, ldb, N, C, ldc);
+    }
+};
+#endif
+
+SpmmKernels select_spmm_kernels() {
+    switch (active_isa()) {
+#if defined(__x86_64__) || defined(_M_X64)
+        case CpuIsa::AVX512:
+            return {Avx512Spmm::csr, Avx512Spmm::bsr};
+        case CpuIsa::AVX2:
+            return {Avx2Spmm::csr, Avx2Spmm::bsr};
+#endif
+        default:
+            return {GenericSpmm::csr, GenericSpmm::bsr};
+    }
+}
+
+// Splits [0, n) into at most `parts` ranges of about equal work, where item i costs
+// (ptr[i + 1] - ptr[i]) * perEntry + perItem. Returns the boundaries, from 0 to n.
+std::vector<size_t> balanced_ranges(const std::vector<size_t>& ptr, size_t perEntry, size_t perItem,
+                                    size_t parts) {
+    const size_t n = ptr.size() - 1;
+    auto workBefore = [&](size_t i) { return ptr[i] * perEntry + i * perItem; };
+    const size_t total = workBefore(n);
+
+    std::vector<size_t> bounds{0};
+    for (size_t t = 1; t < parts; ++t) {
+        // First i whose preceding work reaches t / parts of the total
+        size_t target = total / parts * t + total % parts * t / parts;
+        size_t lo = bounds.back(), hi = n;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (workBefore(mid) < target) lo = mid + 1; else hi = mid;
+        }
+        if (lo > bounds.back() && lo < n) bounds.push_back(lo);
+    }
+    if (n > 0) bounds.push_back(n);
+    return bounds;
+}
+
+// Runs kernel(begin, end) over balanced ranges on the pool: a few ranges per
+// thread, so a range that turns out slow can be balanced by stealing.
+template <typename Fn>
+void run_balanced(const std::vector<size_t>& ptr, size_t perEntry, size_t perItem,
+                  unsigned int numThreads, const Fn& kernel) {
+    unsigned int threads = gemm_detail::thread_budget(numThreads);
+    std::vector<size_t> bounds = balanced_ranges(ptr, perEntry, perItem, threads > 1 ? 4 * threads : 1);
+    ThreadPool::instance().parallel_for(bounds.size() - 1, [&](size_t t) {
+        kernel(bounds[t], bounds[t + 1]);
+    }, threads);
+}
+
+} // namespace
+
+CsrMatrix::CsrMatrix(const Matrix& A, float dropTolerance)
+    : rows_(A.rows), cols_(A.cols), rowPtr_(A.rows + 1, 0) {
+    check_index_range(cols_);
+    for (size_t i = 0; i < rows_; ++i) {
+        for (size_t j = 0; j < cols_; ++j) {
+            float v = A(i, j);
+            if (std::fabs(v) > dropTolerance) {
+                colIdx_.push_back(static_cast<uint32_t>(j));
+                values_.push_back(v);
+            }
+        }
+        rowPtr_[i + 1] = values_.size();
+    }
+}
+
+Matrix CsrMatrix::to_dense() const {
+    Matrix D(rows_, cols_);
+    for (size_t i = 0; i < rows_; ++i) {
+        for (size_t p = rowPtr_[i]; p < rowPtr_[i + 1]; ++p) {
+            D(i, colIdx_[p]) = values_[p];
+        }
+    }
+    return D;
+}
+
+BsrMatrix::BsrMatrix(const Matrix& A, size_t blockRows, size_t blockCols, float dropTolerance)
+    : rows_(A.rows), cols_(A.cols), blockRows_(blockRows), blockCols_(blockCols) {
+    if (blockRows == 0 || blockCols == 0) {
+        throw std::invalid_argument("Block size must be positive.");
+    }
+    check_index_range(cols_);
+
+    const size_t numBlockRows = (rows_ + blockRows - 1) / blockRows;
+    const size_t numBlockCols = (cols_ + blockCols - 1) / blockCols;
+    blockPtr_.assign(numBlockRows + 1, 0);
+    for (size_t bi = 0; bi < numBlockRows; ++bi) {
+        const size_t i0 = bi * blockRows, rows = std::min(blockRows, rows_ - i0);
+        for (size_t bj = 0; bj < numBlockCols; ++bj) {
+            const size_t j0 = bj * blockCols, cols = std::min(blockCols, cols_ - j0);
+            bool keep = false;
+            for (size_t i = 0; i < rows && !keep; ++i) {
+                for (size_t j = 0; j < cols && !keep; ++j) {
+                    keep = std::fabs(A(i0 + i, j0 + j)) > dropTolerance;
+                }
+            }
+            if (!keep) continue;
+
+            blockCol_.push_back(static_cast<uint32_t>(bj));
+            size_t base = values_.size();
+            values_.resize(base + blockRows * blockCols, 0.0f);
+            for (size_t i = 0; i < rows; ++i) {
+                for (size_t j = 0; j < cols; ++j) {
+                    float v = A(i0 + i, j0 + j);
+                    values_[base + i * blockCols + j] = (std::fabs(v) > dropTolerance) ? v : 0.0f;
+                }
+            }
+        }
+        blockPtr_[bi + 1] = blockCol_.size();
+    }
+}
+
+Matrix BsrMatrix::to_dense() const {
+    Matrix D(rows_, cols_);
+    const size_t blockSize = blockRows_ * blockCols_;
+    for (size_t bi = 0; bi + 1 < blockPtr_.size(); ++bi) {
+        for (size_t b = blockPtr_[bi]; b < blockPtr_[bi + 1]; ++b) {
+            const size_t i0 = bi * blockRows_, j0 = blockCol_[b] * blockCols_;
+            for (size_t i = 0; i < std::min(blockRows_, rows_ - i0); ++i) {
+                for (size_t j = 0; j < std::min(blockCols_, cols_ - j0); ++j) {
+                    D(i0 + i, j0 + j) = values_[b * blockSize + i * blockCols_ + j];
+                }
+            }
+        }
+    }
+    return D;
+}
+
+void multiply(const CsrMatrix& A, const Matrix& B, Matrix& C, unsigned int numThreads) {
+    if (A.cols() != B.rows || C.rows != A.rows() || C.cols != B.cols) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+
+    // Each nonzero costs one pass over a strip of B; each row also stores a row of C
+    const SpmmKernels kernels = select_spmm_kernels();
+    run_balanced(A.row_ptr(), 1, 1, numThreads, [&](size_t rowBegin, size_t rowEnd) {
+        kernels.csr(A, rowBegin, rowEnd, B.data.data(), B.cols, B.cols, C.data.data(), C.cols);
+    });
+}
+
+void multiply(const BsrMatrix& A, const Matrix& B, Matrix& C, unsigned int numThreads) {
+    if (A.cols() != B.rows || C.rows != A.rows() || C.cols != B.cols) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+
+    const SpmmKernels kernels = select_spmm_kernels();
+    run_balanced(A.block_ptr(), A.block_rows() * A.block_cols(), A.block_rows(), numThreads,
+                 [&](size_t blockBegin, size_t blockEnd) {
+        kernels.bsr(A, blockBegin, blockEnd, B.data.data(), B.cols, B.cols, C.data.data(), C.cols);
+    });
+}
@@ -0,0 +1,264 @@
+#include "matrix.h"
+#include "gemm.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+constexpr size_t kDefaultCutoff = 1024;
+
+size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+// Floats taken by a rows x cols temporary (rows start on 64-byte boundaries).
+size_t padded(size_t rows, size_t cols) {
+    return rows * round_up(cols, 16);
+}
+
+// Bump allocator over a buffer sized up front; temporaries are released in LIFO order.
+class ScratchArena {
+public:
+    ScratchArena(float* base, size_t capacity) : base_(base), capacity_(capacity), used_(0) {}
+
+    float* take_raw(size_t floats) {
+        if (used_ + floats > capacity_) {
+            throw std::logic_error("Strassen scratch arena exhausted.");
+        }
+        float* p = base_ + used_;
+        used_ += floats;
+        return p;
+    }
+
+    MatrixView take(size_t rows, size_t cols) {
+        return MatrixView(take_raw(padded(rows, cols)), rows, cols, round_up(cols, 16));
+    }
+
+    size_t mark() const { return used_; }
+    void release(size_t mark) { used_ = mark; }
+
+private:
+    float* base_;
+    size_t capacity_;
+    size_t used_;
+};
+
+bool recurse(size_t M, size_t N, size_t K, size_t cutoff) {
+    return std::min({M, N, K}) > std::max<size_t>(cutoff, 1);
+}
+
+// Scratch for strassen_sequential on an M x K by K x N product: two temporaries
+// per level plus whatever one sub-product needs.
+size_t sequential_scratch(size_t M, size_t N, size_t K, size_t cutoff) {
+    if (!recurse(M, N, K, cutoff)) return 0;
+    size_t h = M / 2, kk = K / 2, w = N / 2;
+    return padded(h, std::max(kk, w)) + padded(kk, w) + sequential_scratch(h, w, kk, cutoff);
+}
+
+// Z = X + Y and Z = X - Y; Z may be X or Y. Bands of rows run on the pool, or inline
+// when called from a pool task (the products of strassen_parallel).
+template <typename Op>
+void combine(const ConstMatrixView& X, const ConstMatrixView& Y, const MatrixView& Z, Op op) {
+    const size_t rowsPerTask = 16;
+    ThreadPool::instance().parallel_for((Z.rows + rowsPerTask - 1) / rowsPerTask, [&](size_t t) {
+        size_t end = std::min(Z.rows, (t + 1) * rowsPerTask);
+        for (size_t i = t * rowsPerTask; i < end; ++i) {
+            const float* x = X.data + i * X.ld;
+            const float* y = Y.data + i * Y.ld;
+            float* z = Z.data + i * Z.ld;
+            for (size_t j = 0; j < Z.cols; ++j) z[j] = op(x[j], y[j]);
+        }
+    });
+}
+
+void add(const ConstMatrixView& X, const ConstMatrixView& Y, const MatrixView& Z) {
+    combine(X, Y, Z, [](float x, float y) { return x + y; });
+}
+
+void sub(const ConstMatrixView& X, const ConstMatrixView& Y, const MatrixView& Z) {
+    combine(X, Y, Z, [](float x, float y) { return x - y; });
+}
+
+// Fills in what the even-sized m x k x n core left out: the last column of A times
+// the last row of B when K is odd, and the last column / row of C when N / M are odd.
+void peel(const ConstMatrixView& A, const ConstMatrixView& B, const MatrixView& C,
+          size_t m, size_t k, size_t n) {
+    size_t M = A.rows, K = A.cols, N = B.cols;
+    if (k < K) {
+        gemm(Transpose::NoTrans, Transpose::NoTrans, 1.0f, A.block(0, k, m, 1), B.block(k, 0, 1, n),
+             1.0f, C.block(0, 0, m, n));
+    }
+    if (n < N) {
+        gemm(Transpose::NoTrans, Transpose::NoTrans, 1.0f, A.block(0, 0, m, K), B.block(0, n, K, 1),
+             0.0f, C.block(0, n, m, 1));
+    }
+    if (m < M) {
+        gemm(Transpose::NoTrans, Transpose::NoTrans, 1.0f, A.block(m, 0, 1, K), B,
+             0.0f, C.block(m, 0, 1, N));
+    }
+}
+
+// Winograd's variant with the two-temporary schedule of Douglas et al.: X holds the
+// A-side sums and later P1, Y the B-side sums, and the other products go straight
+// into the C quadrants.
+void strassen_sequential(const ConstMatrixView& A, const ConstMatrixView& B, const MatrixView& C,
+                         size_t cutoff, ScratchArena& arena) {
+    size_t M = A.rows, K = A.cols, N = B.cols;
+    if (!recurse(M, N, K, cutoff)) {
+        gemm(Transpose::NoTrans, Transpose::NoTrans, 1.0f, A, B, 0.0f, C);
+        return;
+    }
+
+    size_t h = M / 2, kk = K / 2, w = N / 2;
+    ConstMatrixView A11 = A.block(0, 0, h, kk), A12 = A.block(0, kk, h, kk);
+    ConstMatrixView A21 = A.block(h, 0, h, kk), A22 = A.block(h, kk, h, kk);
+    ConstMatrixView B11 = B.block(0, 0, kk, w), B12 = B.block(0, w, kk, w);
+    ConstMatrixView B21 = B.block(kk, 0, kk, w), B22 = B.block(kk, w, kk, w);
+    MatrixView C11 = C.block(0, 0, h, w), C12 = C.block(0, w, h, w);
+    MatrixView C21 = C.block(h, 0, h, w), C22 = C.block(h, w, h, w);
+
+    size_t top = arena.mark();
+    MatrixView XBuf = arena.take(h, std::max(kk, w));
+    MatrixView X = XBuf.block(0, 0, h, kk);
+    MatrixView P1 = XBuf.block(0, 0, h, w);
+    MatrixView Y = arena.take(kk, w);
+
+    sub(A11, A21, X);                                   // S3
+    sub(B22, B12, Y);                                   // T3
+    strassen_sequential(X, Y, C21, cutoff, arena);      // P7
+    add(A21, A22, X);                                   // S1
+    sub(B12, B11, Y);                                   // T1
+    strassen_sequential(X, Y, C22, cutoff, arena);      // P5
+    sub(X, A11, X);                                     // S2
+    sub(B22, Y, Y);                                     // T2
+    strassen_sequential(X, Y, C12, cutoff, arena);      // P6
+    sub(A12, X, X);                                     // S4
+    strassen_sequential(X, B22, C11, cutoff, arena);    // P3
+    strassen_sequential(A11, B11, P1, cutoff, arena);   // P1 (S4 is done with)
+    add(P1, C12, C12);                                  // U2 = P1 + P6
+    add(C12, C21, C21);                                 // U3 = U2 + P7
+    add(C12, C22, C12);                                 // U4 = U2 + P5
+    add(C21, C22, C22);                                 // U7 = U3 + P5 -> C22
+    add(C12, C11, C12);                                 // U5 = U4 + P3 -> C12
+    sub(Y, B21, Y);                                     // T4
+    strassen_sequential(A22, Y, C11, cutoff, arena);    // P4
+    sub(C21, C11, C21);                                 // U6 = U3 - P4 -> C21
+    strassen_sequential(A12, B21, C11, cutoff, arena);  // P2
+    add(P1, C11, C11);                                  // U1 = P1 + P2 -> C11
+    arena.release(top);
+
+    peel(A, B, C, 2 * h, 2 * kk, 2 * w);
+}
+
+// Top level with the seven products running as independent pool tasks. Each one
+// recurses with the sequential schedule in its own slice of the arena.
+void strassen_parallel(const ConstMatrixView& A, const ConstMatrixView& B, const MatrixView& C,
+                       size_t cutoff, ScratchArena& arena) {
+    size_t M = A.rows, K = A.cols, N = B.cols;
+    size_t h = M / 2, kk = K / 2, w = N / 2;
+    ConstMatrixView A11 = A.block(0, 0, h, kk), A12 = A.block(0, kk, h, kk);
+    ConstMatrixView A21 = A.block(h, 0, h, kk), A22 = A.block(h, kk, h, kk);
+    ConstMatrixView B11 = B.block(0, 0, kk, w), B12 = B.block(0, w, kk, w);
+    ConstMatrixView B21 = B.block(kk, 0, kk, w), B22 = B.block(kk, w, kk, w);
+    MatrixView C11 = C.block(0, 0, h, w), C12 = C.block(0, w, h, w);
+    MatrixView C21 = C.block(h, 0, h, w), C22 = C.block(h, w, h, w);
+
+    MatrixView S1 = arena.take(h, kk), S2 = arena.take(h, kk), S3 = arena.take(h, kk), S4 = arena.take(h, kk);
+    MatrixView T1 = arena.take(kk, w), T2 = arena.take(kk, w), T3 = arena.take(kk, w), T4 = arena.take(kk, w);
+    MatrixView P1 = arena.take(h, w), P2 = arena.take(h, w), P4 = arena.take(h, w);
+    size_t childScratch = sequential_scratch(h, w, kk, cutoff);
+    std::vector<ScratchArena> children;
+    for (int i = 0; i < 7; ++i) {
+        children.emplace_back(arena.take_raw(childScratch), childScratch);
+    }
+
+    ThreadPool& pool = ThreadPool::instance();
+    pool.parallel_for(4, [&](size_t t) {
+        switch (t) {
+            case 0: add(A21, A22, S1); sub(S1, A11, S2); sub(A12, S2, S4); break;
+            case 1: sub(A11, A21, S3); break;
+            case 2: sub(B12, B11, T1); sub(B22, T1, T2); sub(T2, B21, T4); break;
+            case 3: sub(B22, B12, T3); break;
+        }
+    });
+
+    // P3, P5, P6 and P7 land in the C quadrants that are combined in place below
+    pool.parallel_for(7, [&](size_t t) {
+        ScratchArena& scratch = children[t];
+        switch (t) {
+            case 0: strassen_sequential(A11, B11, P1, cutoff, scratch); break;
+            case 1: strassen_sequential(A12, B21, P2, cutoff, scratch); break;
+            case 2: strassen_sequential(S4, B22, C11, cutoff, scratch); break;
+            case 3: strassen_sequential(A22, T4, P4, cutoff, scratch); break;
+            case 4: strassen_sequential(S1, T1, C22, cutoff, scratch); break;
+            case 5: strassen_sequential(S2, T2, C12, cutoff, scratch); break;
+            case 6: strassen_sequential(S3, T3, C21, cutoff, scratch); break;
+        }
+    });
+
+    // All the U sums in a single pass over each row
+    const size_t rowsPerTask = 16;
+    pool.parallel_for((h + rowsPerTask - 1) / rowsPerTask, [&](size_t t) {
+        size_t end = std::min(h, (t + 1) * rowsPerTask);
+        for (size_t i = t * rowsPerTask; i < end; ++i) {
+            float* c11 = &C11(i, 0);
+            float* c12 = &C12(i, 0);
+            float* c21 = &C21(i, 0);
+            float* c22 = &C22(i, 0);
+            const float* p1 = &P1(i, 0);
+            const float* p2 = &P2(i, 0);
+            const float* p4 = &P4(i, 0);
+            for (size_t j = 0; j < w; ++j) {
+                float u2 = p1[j] + c12[j];
+                float u3 = u2 + c21[j];
+                float u4 = u2 + c22[j];
+                c22[j] = u3 + c22[j];
+                c12[j] = u4 + c11[j];
+                c21[j] = u3 - p4[j];
+                c11[j] = p1[j] + p2[j];
+            }
+        }
+    });
+
+    peel(A, B, C, 2 * h, 2 * kk, 2 * w);
+}
+
+size_t parallel_scratch(size_t M, size_t N, size_t K, size_t cutoff) {
+    size_t h = M / 2, kk = K / 2, w = N / 2;
+    return 4 * padded(h, kk) + 4 * padded(kk, w) + 3 * padded(h, w) + 7 * sequential_scratch(h, w, kk, cutoff);
+}
+
+} // namespace
+
+void multiply_strassen(const Matrix& A, const Matrix& B, Matrix& C, size_t cutoff) {
+    if (A.cols != B.rows || C.rows != A.rows || C.cols != B.cols) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+    if (cutoff == 0) cutoff = kDefaultCutoff;
+
+    size_t M = A.rows, N = B.cols, K = A.cols;
+    if (!recurse(M, N, K, cutoff)) {
+        multiply(A, B, C);
+        return;
+    }
+
+    // Up to 7 threads, the top level's seven products run side by side, one per thread.
+    // Past that, one task per product would leave threads idle: the products run in
+    // turn instead, each spreading its leaf multiplies and sums over the whole pool.
+    unsigned int threads = ThreadPool::instance().num_threads();
+    bool parallel = threads > 1 && threads <= 7;
+
+    // One arena for the whole recursion, kept per thread so repeated calls reuse it
+    size_t floats = parallel ? parallel_scratch(M, N, K, cutoff) : sequential_scratch(M, N, K, cutoff);
+    thread_local std::vector<float, MatrixAllocator<float>> buffer;
+    if (buffer.size() < floats) buffer.resize(floats);
+    ScratchArena arena(buffer.data(), floats);
+
+    if (parallel) {
+        strassen_parallel(A.view(), B.view(), C.view(), cutoff, arena);
+    } else {
+        strassen_sequential(A.view(), B.view(), C.view(), cutoff, arena);
+    }
+}
@@ -0,0 +1,268 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// Set while a thread is executing pool tasks; nested parallel_for runs inline.
+thread_local bool t_inPool = false;
+
+unsigned int default_thread_count() {
+    if (const char* env = std::getenv("MATMUL_NUM_THREADS")) {
+        long n = std::strtol(env, nullptr, 10);
+        if (n > 0) return static_cast<unsigned int>(n);
+    }
+    unsigned int n = std::thread::hardware_concurrency();
+    return n == 0 ? 2 : n; // Fallback
+}
+
+AffinityPolicy default_affinity() {
+    AffinityPolicy policy = AffinityPolicy::None;
+    if (const char* env = std::getenv("MATMUL_AFFINITY")) {
+        if (!parse_affinity(env, policy)) {
+            std::cerr << "MATMUL_AFFINITY: unknown policy '" << env << "', threads are not pinned" << std::endl;
+        }
+    }
+    return policy;
+}
+
+void pin_thread(std::thread& thread, unsigned int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    // Best effort: a CPU taken away since the topology was read leaves the thread unpinned
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#else
+    (void)thread;
+    (void)cpu;
+#endif
+}
+
+} // namespace
+
+// Per-thread task range. Padded to a cache line so owners don't false-share.
+struct alignas(64) ThreadPool::Slot {
+    std::mutex lock;
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::ThreadPool() : affinity_(default_affinity()) {
+    start(default_thread_count());
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+void ThreadPool::start(unsigned int numThreads) {
+    numThreads_ = std::max(1u, numThreads);
+    slots_.reset(new Slot[numThreads_]);
+    {
+        // New workers start with seen = 0, so they wake to the last job's generation
+        // at once; with no participants left over they skip it instead of running it.
+        std::lock_guard<std::mutex> lk(mutex_);
+        stopping_ = false;
+        job_ = nullptr;
+        participants_ = 0;
+        busyWorkers_ = 0;
+    }
+    for (unsigned int id = 1; id < numThreads_; ++id) {
+        workers_.emplace_back(&ThreadPool::worker_loop, this, id);
+    }
+
+    // Worker `id` runs on plan[id]; plan[0] is where the calling thread would go
+    const CpuTopology& topo = cpu_topology();
+    std::vector<unsigned int> plan = affinity_plan(topo, affinity_, numThreads_);
+    numDomains_ = 1;
+    cpuDomain_.clear();
+    if (plan.empty()) return;
+    for (unsigned int id = 1; id < numThreads_; ++id) pin_thread(workers_[id - 1], plan[id]);
+
+    std::vector<int> domainIndex(topo.numDomains, -1);
+    int domains = 0;
+    for (unsigned int cpu : plan) {
+        unsigned int topoDomain = 0;
+        for (const LogicalCpu& c : topo.cpus) {
+            if (c.id == cpu) topoDomain = c.domain;
+        }
+        if (domainIndex[topoDomain] < 0) domainIndex[topoDomain] = domains++;
+        if (cpuDomain_.size() <= cpu) cpuDomain_.resize(cpu + 1, -1);
+        cpuDomain_[cpu] = domainIndex[topoDomain];
+    }
+    numDomains_ = static_cast<unsigned int>(domains);
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : workers_) {
+        t.join();
+    }
+    workers_.clear();
+}
+
+void ThreadPool::set_num_threads(unsigned int numThreads) {
+    if (numThreads == 0) numThreads = default_thread_count();
+    std::lock_guard<std::mutex> submit(submitMutex_);
+    if (numThreads == numThreads_) return;
+    stop();
+    start(numThreads);
+}
+
+void ThreadPool::set_affinity(AffinityPolicy policy) {
+    std::lock_guard<std::mutex> submit(submitMutex_);
+    if (policy == affinity_) return;
+    stop();
+    affinity_ = policy;
+    start(numThreads_);
+}
+
+unsigned int ThreadPool::current_domain() const {
+    if (numDomains_ <= 1) return 0;
+#if defined(__linux__)
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && static_cast<size_t>(cpu) < cpuDomain_.size() && cpuDomain_[cpu] >= 0) {
+        return static_cast<unsigned int>(cpuDomain_[cpu]);
+    }
+#endif
+    return 0;
+}
+
+void ThreadPool::worker_loop(unsigned int id) {
+    unsigned long long seen = 0;
+    std::unique_lock<std::mutex> lk(mutex_);
+    for (;;) {
+        wake_.wait(lk, [&] { return stopping_ || generation_ != seen; });
+        if (stopping_) return;
+        seen = generation_;
+        if (id >= participants_) continue;
+
+        lk.unlock();
+        t_inPool = true;
+        run_slots(id);
+        t_inPool = false;
+        lk.lock();
+
+        if (--busyWorkers_ == 0) done_.notify_one();
+    }
+}
+
+bool ThreadPool::take_task(unsigned int self, size_t& task) {
+    {
+        Slot& own = slots_[self];
+        std::lock_guard<std::mutex> lk(own.lock);
+        if (own.begin < own.end) {
+            task = own.begin++;
+            return true;
+        }
+    }
+    // Own range is empty: steal from the back of another thread's range.
+    for (unsigned int offset = 1; offset < participants_; ++offset) {
+        Slot& victim = slots_[(self + offset) % participants_];
+        std::lock_guard<std::mutex> lk(victim.lock);
+        if (victim.begin < victim.end) {
+            task = --victim.end;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run_slots(unsigned int self) {
+    size_t task;
+    while (take_task(self, task)) {
+        try {
+            (*job_)(task);
+        } catch (...) {
+            std::lock_guard<std::mutex> lk(mutex_);
+            if (!error_) error_ = std::current_exception();
+        }
+    }
+}
+
+void ThreadPool::parallel_for(size_t numTasks, const std::function<void(size_t)>& task,
+                              unsigned int maxThreads) {
+    if (numTasks == 0) return;
+
+    if (t_inPool || numThreads_ == 1 || numTasks == 1 || maxThreads == 1) {
+        for (size_t i = 0; i < numTasks; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(submitMutex_);
+
+    unsigned int participants = numThreads_;
+    if (maxThreads != 0) participants = std::min(participants, maxThreads);
+    if (numTasks < participants) participants = static_cast<unsigned int>(numTasks);
+
+    // Contiguous initial ranges keep neighbouring tiles on the same thread.
+    size_t chunk = numTasks / participants;
+    size_t extra = numTasks % participants;
+    size_t next = 0;
+    for (unsigned int t = 0; t < participants; ++t) {
+        size_t count = chunk + (t < extra ? 1 : 0);
+        std::lock_guard<std::mutex> lk(slots_[t].lock);
+        slots_[t].begin = next;
+        slots_[t].end = next + count;
+        next += count;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        job_ = &task;
+        participants_ = participants;
+        busyWorkers_ = participants - 1;
+        error_ = nullptr;
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    t_inPool = true;
+    run_slots(0);
+    t_inPool = false;
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lk(mutex_);
+        done_.wait(lk, [&] { return busyWorkers_ == 0; });
+        job_ = nullptr;
+        error = error_;
+        error_ = nullptr;
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+void ThreadPool::parallel_for_2d(size_t rows, size_t cols, size_t tileRows, size_t tileCols,
+                                 const std::function<void(size_t, size_t, size_t, size_t)>& tile,
+                                 unsigned int maxThreads) {
+    if (rows == 0 || cols == 0) return;
+    tileRows = std::max<size_t>(1, tileRows);
+    tileCols = std::max<size_t>(1, tileCols);
+
+    size_t rowTiles = (rows + tileRows - 1) / tileRows;
+    size_t colTiles = (cols + tileCols - 1) / tileCols;
+
+    // Row-major tile order: a thread's initial range covers whole bands of C rows.
+    parallel_for(rowTiles * colTiles, [&](size_t t) {
+        size_t r0 = (t / colTiles) * tileRows;
+        size_t c0 = (t % colTiles) * tileCols;
+        tile(r0, std::min(r0 + tileRows, rows), c0, std::min(c0 + tileCols, cols));
+    }, maxThreads);
+}
@@ -0,0 +1,293 @@
+#include "tiled_matrix.h"
+#include "gemm_internal.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+
+// Same threshold as the row-major chain: waves of products smaller than this per
+// thread run one product per task.
+constexpr double kMinThreadedFlops = 2.0 * 128 * 128 * 128;
+
+// Independent blocks of C per thread in the tiled multiply, for stealing.
+constexpr size_t kTasksPerThread = 4;
+
+// Bits of x spread out to the even bit positions
+uint64_t spread_bits(uint64_t x) {
+    x &= 0xffffffffULL;
+    x = (x | (x << 16)) & 0x0000ffff0000ffffULL;
+    x = (x | (x << 8)) & 0x00ff00ff00ff00ffULL;
+    x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    x = (x | (x << 2)) & 0x3333333333333333ULL;
+    x = (x | (x << 1)) & 0x5555555555555555ULL;
+    return x;
+}
+
+uint64_t morton_key(size_t tr, size_t tc) {
+    return (spread_bits(tr) << 1) | spread_bits(tc);
+}
+
+// Where a range of n tiles is halved: at the largest power of two below n, so the
+// halves of a range starting at 0 stay aligned with the quadrants of the Morton order.
+size_t split_point(size_t n) {
+    size_t half = 1;
+    while (half * 2 < n) half *= 2;
+    return half;
+}
+
+struct TileRange {
+    size_t i0, i1;      // Tile rows of C
+    size_t j0, j1;      // Tile columns of C
+};
+
+// C's tile grid halved along its longer side until there are enough blocks to keep
+// every thread busy, in recursion order so neighbouring blocks share operand tiles.
+void split_output(TileRange r, size_t depth, std::vector<TileRange>& out) {
+    const size_t m = r.i1 - r.i0;
+    const size_t n = r.j1 - r.j0;
+    if (depth == 0 || (m == 1 && n == 1)) {
+        out.push_back(r);
+        return;
+    }
+    if (m >= n) {
+        const size_t mid = r.i0 + split_point(m);
+        split_output({r.i0, mid, r.j0, r.j1}, depth - 1, out);
+        split_output({mid, r.i1, r.j0, r.j1}, depth - 1, out);
+    } else {
+        const size_t mid = r.j0 + split_point(n);
+        split_output({r.i0, r.i1, r.j0, mid}, depth - 1, out);
+        split_output({r.i0, r.i1, mid, r.j1}, depth - 1, out);
+    }
+}
+
+struct TiledProduct {
+    const TiledMatrix& A;
+    const TiledMatrix& B;
+    TiledMatrix& C;
+    gemm_detail::MicroKernel uk;
+    const float* packedB;       // Every tile of B packed for uk, packedStride floats apart
+    size_t packedStride;
+
+    // Tile-grid extents in elements, trimmed at the edges so padding is not multiplied
+    size_t extent(size_t t, size_t total) const {
+        return std::min(C.tile(), total - t * C.tile());
+    }
+
+    // Tile (k, j) of B in the packed engine's layout
+    gemm_detail::PackedB packed_tile(size_t k, size_t j) const {
+        return {uk, extent(k, B.rows()), extent(j, B.cols()), packedB + (k * B.tile_cols() + j) * packedStride};
+    }
+
+    // C(i, j) = A(i, k) * B(k, j) + (k == 0 ? 0 : C(i, j)). Every C tile meets its k
+    // tiles in increasing order, so the first one overwrites it.
+    void leaf(size_t i, size_t j, size_t k) const {
+        gemm_detail::gemm_prepacked(extent(i, C.rows()), extent(j, C.cols()), 0, 1.0f,
+                                    gemm_detail::Operand::of(A.tile_data(i, k), A.tile(), false),
+                                    packed_tile(k, j), k == 0 ? 0.0f : 1.0f, C.tile_data(i, j), C.tile());
+    }
+
+    // Halves the largest of the three dimensions until a single tile product is left;
+    // the inner dimension is walked low half first.
+    void recurse(size_t i0, size_t i1, size_t j0, size_t j1, size_t k0, size_t k1) const {
+        const size_t m = i1 - i0;
+        const size_t n = j1 - j0;
+        const size_t k = k1 - k0;
+        if (m == 1 && n == 1 && k == 1) {
+            leaf(i0, j0, k0);
+        } else if (m >= n && m >= k) {
+            const size_t mid = i0 + split_point(m);
+            recurse(i0, mid, j0, j1, k0, k1);
+            recurse(mid, i1, j0, j1, k0, k1);
+        } else if (n >= k) {
+            const size_t mid = j0 + split_point(n);
+            recurse(i0, i1, j0, mid, k0, k1);
+            recurse(i0, i1, mid, j1, k0, k1);
+        } else {
+            const size_t mid = k0 + split_point(k);
+            recurse(i0, i1, j0, j1, k0, mid);
+            recurse(i0, i1, j0, j1, mid, k1);
+        }
+    }
+};
+
+} // namespace
+
+TiledMatrix::TiledMatrix(size_t rows, size_t cols, TileOrder order, size_t tile)
+    : rows_(rows), cols_(cols), tile_(tile), order_(order) {
+    if (tile == 0) {
+        throw std::invalid_argument("Tile size must be positive.");
+    }
+    tileRows_ = (rows + tile - 1) / tile;
+    tileCols_ = (cols + tile - 1) / tile;
+    const size_t count = tileRows_ * tileCols_;
+
+    // Slot of each tile: its position in row-major grid order, or its rank by Morton key
+    std::vector<size_t> slot(count);
+    std::iota(slot.begin(), slot.end(), size_t(0));
+    if (order == TileOrder::Morton) {
+        std::vector<size_t> byKey(count);
+        std::iota(byKey.begin(), byKey.end(), size_t(0));
+        std::sort(byKey.begin(), byKey.end(), [&](size_t a, size_t b) {
+            return morton_key(a / tileCols_, a % tileCols_) < morton_key(b / tileCols_, b % tileCols_);
+        });
+        for (size_t s = 0; s < count; ++s) slot[byKey[s]] = s;
+    }
+    tileOffset_.resize(count);
+    for (size_t t = 0; t < count; ++t) tileOffset_[t] = slot[t] * tile * tile;
+
+    data_.resize(count * tile * tile);
+    fill_first_touch(data_.data(), data_.size(), 0.0f);
+}
+
+TiledMatrix::TiledMatrix(const Matrix& A, TileOrder order, size_t tile)
+    : TiledMatrix(A.view(), order, tile) {}
+
+TiledMatrix::TiledMatrix(const ConstMatrixView& A, TileOrder order, size_t tile)
+    : TiledMatrix(A.rows, A.cols, order, tile) {
+    ThreadPool::instance().parallel_for(tileRows_ * tileCols_, [&](size_t t) {
+        const size_t tr = t / tileCols_;
+        const size_t tc = t % tileCols_;
+        const size_t r0 = tr * tile_;
+        const size_t c0 = tc * tile_;
+        const size_t h = std::min(tile_, rows_ - r0);
+        const size_t w = std::min(tile_, cols_ - c0);
+        float* dst = tile_data(tr, tc);
+        for (size_t i = 0; i < h; ++i) {
+            std::memcpy(dst + i * tile_, A.data + (r0 + i) * A.ld + c0, w * sizeof(float));
+        }
+    });
+}
+
+Matrix TiledMatrix::to_matrix() const {
+    Matrix out(rows_, cols_, uninitialized);
+    copy_to(out.view());
+    return out;
+}
+
+void TiledMatrix::copy_to(const MatrixView& out) const {
+    if (out.rows != rows_ || out.cols != cols_) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+    ThreadPool::instance().parallel_for(tileRows_ * tileCols_, [&](size_t t) {
+        const size_t tr = t / tileCols_;
+        const size_t tc = t % tileCols_;
+        const size_t r0 = tr * tile_;
+        const size_t c0 = tc * tile_;
+        const size_t h = std::min(tile_, rows_ - r0);
+        const size_t w = std::min(tile_, cols_ - c0);
+        const float* src = tile_data(tr, tc);
+        for (size_t i = 0; i < h; ++i) {
+            std::memcpy(out.data + (r0 + i) * out.ld + c0, src + i * tile_, w * sizeof(float));
+        }
+    });
+}
+
+void multiply(const TiledMatrix& A, const TiledMatrix& B, TiledMatrix& C) {
+    if (A.cols() != B.rows() || C.rows() != A.rows() || C.cols() != B.cols() || &C == &A || &C == &B) {
+        throw std::invalid_argument("Matrix dimensions mismatch.");
+    }
+    if (A.tile() != B.tile() || A.tile() != C.tile()) {
+        throw std::invalid_argument("Tile sizes differ.");
+    }
+    if (C.tile_rows() == 0 || C.tile_cols() == 0) return;
+    if (A.tile_cols() == 0) {
+        for (size_t i = 0; i < C.tile_rows(); ++i) {
+            for (size_t j = 0; j < C.tile_cols(); ++j) {
+                std::fill_n(C.tile_data(i, j), C.tile() * C.tile(), 0.0f);
+            }
+        }
+        return;
+    }
+
+    // One tile is a whole packed block: mc, kc and nc cover it in a single pass. B's
+    // tiles are packed once up front, as each is used by every tile row of C; A's are
+    // packed by each leaf product.
+    const gemm_detail::MicroKernel& base = gemm_detail::select_micro_kernel();
+    const size_t t = C.tile();
+    const gemm_detail::MicroKernel uk = gemm_detail::with_blocking(base, t + base.mr - 1, t, t + base.nr - 1);
+    const size_t stride = gemm_detail::PackedB::size(uk, t, t);
+    std::vector<float, MatrixAllocator<float>> packed(B.tile_rows() * B.tile_cols() * stride);
+    TiledProduct product{A, B, C, uk, packed.data(), stride};
+    ThreadPool::instance().parallel_for(B.tile_rows() * B.tile_cols(), [&](size_t b) {
+        const size_t k = b / B.tile_cols();
+        const size_t j = b % B.tile_cols();
+        gemm_detail::pack_b_whole(uk, product.extent(k, B.rows()), product.extent(j, B.cols()),
+                                  gemm_detail::Operand::of(B.tile_data(k, j), t, false), packed.data() + b * stride);
+    });
+
+    ThreadPool& pool = ThreadPool::instance();
+    const size_t threads = pool.num_threads();
+    size_t depth = 0;
+    while ((size_t(1) << depth) < threads * kTasksPerThread) ++depth;
+    if (threads == 1) depth = 0;
+
+    std::vector<TileRange> blocks;
+    split_output({0, C.tile_rows(), 0, C.tile_cols()}, depth, blocks);
+    pool.parallel_for(blocks.size(), [&](size_t b) {
+        const TileRange& r = blocks[b];
+        product.recurse(r.i0, r.i1, r.j0, r.j1, 0, A.tile_cols());
+    });
+}
+
+void multiply_chain(const std::vector<const TiledMatrix*>& factors, TiledMatrix& C) {
+    std::vector<size_t> dims;
+    for (const TiledMatrix* X : factors) dims.push_back(X->rows());
+    if (!factors.empty()) dims.push_back(factors.back()->cols());
+    multiply_chain(factors, C, plan_chain(dims));
+}
+
+void multiply_chain(const std::vector<const TiledMatrix*>& factors, TiledMatrix& C, const ChainPlan& plan) {
+    const size_t n = plan.factors();
+    bool match = factors.size() == n && C.rows() == plan.dims[0] && C.cols() == plan.dims[n];
+    for (size_t i = 0; match && i < n; ++i) {
+        match = factors[i]->rows() == plan.dims[i] && factors[i]->cols() == plan.dims[i + 1] &&
+                factors[i] != &C && factors[i]->tile() == C.tile();
+    }
+    if (!match) {
+        throw std::invalid_argument("Matrix dimensions mismatch for chain plan.");
+    }
+
+    // Intermediates in C's layout, each freed once the wave consuming it has run
+    std::vector<std::unique_ptr<TiledMatrix>> results(plan.steps.size());
+    auto operand = [&](size_t id) -> const TiledMatrix& {
+        return id < n ? *factors[id] : *results[id - n];
+    };
+    auto run = [&](size_t i) {
+        const ChainPlan::Step& s = plan.steps[i];
+        multiply(operand(s.left), operand(s.right), i + 1 == plan.steps.size() ? C : *results[i]);
+    };
+
+    ThreadPool& pool = ThreadPool::instance();
+    const unsigned int threads = pool.num_threads();
+    size_t begin = 0;
+    while (begin < plan.steps.size()) {
+        size_t end = begin;
+        double waveFlops = 0;
+        while (end < plan.steps.size() && plan.steps[end].wave == plan.steps[begin].wave) {
+            const ChainPlan::Step& s = plan.steps[end];
+            if (end + 1 < plan.steps.size()) {
+                results[end] = std::make_unique<TiledMatrix>(s.rows, s.cols, C.order(), C.tile());
+            }
+            waveFlops += 2.0 * s.rows * s.inner * s.cols;
+            ++end;
+        }
+        // As in the row-major chain: small or plentiful independent products run one
+        // per task, otherwise each gets the whole pool in turn.
+        const size_t count = end - begin;
+        if (count > 1 && (count >= threads || waveFlops < kMinThreadedFlops * threads)) {
+            pool.parallel_for(count, [&](size_t t) { run(begin + t); });
+        } else {
+            for (size_t i = begin; i < end; ++i) run(i);
+        }
+        for (size_t i = begin; i < end; ++i) {
+            const ChainPlan::Step& s = plan.steps[i];
+            if (s.left >= n) results[s.left - n].reset();
+            if (s.right >= n) results[s.right - n].reset();
+        }
+        begin = end;
+    }
+}
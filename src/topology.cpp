@@ -0,0 +1,175 @@
+#include "topology.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace {
+
+// Parses sysfs CPU lists such as "0-3,8-11".
+std::vector<unsigned int> parse_cpu_list(const std::string& text) {
+    std::vector<unsigned int> cpus;
+    std::stringstream ss(text);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty()) continue;
+        size_t dash = range.find('-');
+        unsigned long lo = std::strtoul(range.c_str(), nullptr, 10);
+        unsigned long hi = (dash == std::string::npos) ? lo : std::strtoul(range.c_str() + dash + 1, nullptr, 10);
+        for (unsigned long c = lo; c <= hi; ++c) cpus.push_back(static_cast<unsigned int>(c));
+    }
+    return cpus;
+}
+
+bool read_line(const std::string& path, std::string& line) {
+    std::ifstream in(path);
+    return in && std::getline(in, line);
+}
+
+bool allowed(unsigned int cpu) {
+#if defined(__linux__)
+    static cpu_set_t mask;
+    static bool haveMask = sched_getaffinity(0, sizeof(mask), &mask) == 0;
+    if (haveMask && cpu < CPU_SETSIZE) return CPU_ISSET(cpu, &mask);
+#endif
+    (void)cpu;
+    return true;
+}
+
+// Renumbers raw sysfs ids (which may be sparse) to 0..n-1 in order of first use.
+unsigned int dense_id(std::map<long, unsigned int>& ids, long raw) {
+    return ids.emplace(raw, static_cast<unsigned int>(ids.size())).first->second;
+}
+
+CpuTopology detect_topology() {
+    CpuTopology topo;
+    const std::string base = "/sys/devices/system/cpu/";
+    std::string online;
+    std::vector<unsigned int> ids;
+    if (read_line(base + "online", online)) ids = parse_cpu_list(online);
+    if (ids.empty()) {
+        unsigned int n = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int c = 0; c < n; ++c) ids.push_back(c);
+    }
+
+    struct Raw {
+        unsigned int id;
+        long package, core, domain;
+    };
+    std::vector<Raw> raw;
+    for (unsigned int id : ids) {
+        if (!allowed(id)) continue;
+        std::string dir = base + "cpu" + std::to_string(id) + "/", line;
+        long package = read_line(dir + "topology/physical_package_id", line) ? std::stol(line) : 0;
+        long core = read_line(dir + "topology/core_id", line) ? std::stol(line) : static_cast<long>(id);
+        // Threads that share the last-level cache: the L3's CPU list, else the
+        // cluster, else the socket. The lowest CPU in the list names the domain.
+        long domain = package;
+        if (read_line(dir + "cache/index3/shared_cpu_list", line) && !parse_cpu_list(line).empty()) {
+            domain = 1000000 + parse_cpu_list(line).front();
+        } else if (read_line(dir + "topology/cluster_cpus_list", line) && !parse_cpu_list(line).empty()) {
+            domain = 1000000 + parse_cpu_list(line).front();
+        }
+        raw.push_back({id, package, core, domain});
+    }
+    if (raw.empty()) raw.push_back({0, 0, 0, 0});
+
+    std::sort(raw.begin(), raw.end(), [](const Raw& a, const Raw& b) {
+        return std::tie(a.domain, a.package, a.core, a.id) < std::tie(b.domain, b.package, b.core, b.id);
+    });
+    std::map<long, unsigned int> packages, domains;
+    std::map<std::pair<long, long>, unsigned int> cores;
+    for (const Raw& r : raw) {
+        unsigned int core = cores.emplace(std::make_pair(r.package, r.core),
+                                          static_cast<unsigned int>(cores.size())).first->second;
+        topo.cpus.push_back({r.id, core, dense_id(packages, r.package), dense_id(domains, r.domain)});
+    }
+    topo.numCores = static_cast<unsigned int>(cores.size());
+    topo.numPackages = static_cast<unsigned int>(packages.size());
+    topo.numDomains = static_cast<unsigned int>(domains.size());
+    return topo;
+}
+
+} // namespace
+
+const CpuTopology& cpu_topology() {
+    static const CpuTopology topo = detect_topology();
+    return topo;
+}
+
+std::vector<unsigned int> affinity_plan(const CpuTopology& topology, AffinityPolicy policy,
+                                        unsigned int numThreads) {
+    std::vector<unsigned int> plan;
+    if (policy == AffinityPolicy::None || topology.cpus.empty()) return plan;
+
+    // SMT siblings of each core, and the cores of each domain, in topology order
+    std::vector<std::vector<unsigned int>> siblings(topology.numCores);
+    std::vector<std::vector<unsigned int>> domainCores(topology.numDomains);
+    for (const LogicalCpu& cpu : topology.cpus) {
+        if (siblings[cpu.core].empty()) domainCores[cpu.domain].push_back(cpu.core);
+        siblings[cpu.core].push_back(cpu.id);
+    }
+    size_t maxSmt = 0;
+    for (const auto& s : siblings) maxSmt = std::max(maxSmt, s.size());
+
+    std::vector<unsigned int> order;
+    switch (policy) {
+        case AffinityPolicy::Compact:
+            for (const LogicalCpu& cpu : topology.cpus) order.push_back(cpu.id);
+            break;
+        case AffinityPolicy::Cores:
+            // Every core's first sibling, then every core's second, ...
+            for (size_t smt = 0; smt < maxSmt; ++smt) {
+                for (const auto& s : siblings) {
+                    if (smt < s.size()) order.push_back(s[smt]);
+                }
+            }
+            break;
+        case AffinityPolicy::Scatter: {
+            size_t maxCores = 0;
+            for (const auto& d : domainCores) maxCores = std::max(maxCores, d.size());
+            for (size_t smt = 0; smt < maxSmt; ++smt) {
+                for (size_t c = 0; c < maxCores; ++c) {
+                    for (const auto& d : domainCores) {
+                        if (c < d.size() && smt < siblings[d[c]].size()) order.push_back(siblings[d[c]][smt]);
+                    }
+                }
+            }
+            break;
+        }
+        case AffinityPolicy::None:
+            break;
+    }
+
+    for (unsigned int t = 0; t < numThreads; ++t) plan.push_back(order[t % order.size()]);
+    return plan;
+}
+
+const char* affinity_name(AffinityPolicy policy) {
+    switch (policy) {
+        case AffinityPolicy::None:    return "none";
+        case AffinityPolicy::Cores:   return "cores";
+        case AffinityPolicy::Compact: return "compact";
+        case AffinityPolicy::Scatter: return "scatter";
+    }
+    return "unknown";
+}
+
+bool parse_affinity(const char* name, AffinityPolicy& policy) {
+    for (AffinityPolicy p : {AffinityPolicy::None, AffinityPolicy::Cores, AffinityPolicy::Compact,
+                             AffinityPolicy::Scatter}) {
+        if (std::strcmp(name, affinity_name(p)) == 0) {
+            policy = p;
+            return true;
+        }
+    }
+    return false;
+}
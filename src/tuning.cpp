@@ -0,0 +1,316 @@
+#include "tuning.h"
+#include "matrix.h"
+#include "gemm_internal.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+constexpr int kNumIsas = 5;
+
+struct TableEntry {
+    bool valid = false;
+    TuningParams params{};
+};
+
+// Tuned parameters indexed by [CpuIsa][ShapeClass]. Guarded by g_tableMutex.
+TableEntry g_table[kNumIsas][kNumShapeClasses];
+std::mutex g_tableMutex;
+std::once_flag g_loadOnce;
+
+const ShapeClass kAllShapes[kNumShapeClasses] = {
+    ShapeClass::Small, ShapeClass::Medium, ShapeClass::Large,
+    ShapeClass::FewRows, ShapeClass::FewCols, ShapeClass::DeepK
+};
+
+// Parses sysfs sizes such as "48K" or "32M".
+size_t parse_cache_size(const std::string& text) {
+    size_t value = std::strtoul(text.c_str(), nullptr, 10);
+    if (text.find('K') != std::string::npos) value *= 1024;
+    if (text.find('M') != std::string::npos) value *= 1024 * 1024;
+    return value;
+}
+
+CacheSizes detect_cache_sizes() {
+    CacheSizes sizes = {32 * 1024, 256 * 1024, 8 * 1024 * 1024};
+    for (int index = 0; index < 16; ++index) {
+        std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+        std::ifstream levelFile(dir + "level"), typeFile(dir + "type"), sizeFile(dir + "size");
+        if (!levelFile || !typeFile || !sizeFile) break;
+
+        int level = 0;
+        std::string type, sizeText;
+        levelFile >> level;
+        typeFile >> type;
+        sizeFile >> sizeText;
+        if (type == "Instruction") continue;
+
+        size_t bytes = parse_cache_size(sizeText);
+        if (bytes == 0) continue;
+        if (level == 1) sizes.l1d = bytes;
+        else if (level == 2) sizes.l2 = bytes;
+        else if (level == 3) sizes.l3 = bytes;
+    }
+    return sizes;
+}
+
+size_t round_down(size_t value, size_t multiple) {
+    return std::max(multiple, (value / multiple) * multiple);
+}
+
+bool read_table(const std::string& path);
+
+// The default file is read on first use unless load_tuning_file() got there first.
+void ensure_loaded() {
+    std::call_once(g_loadOnce, [] { read_table(tuning_file_path()); });
+}
+
+// Representative problem for each shape class, used when tuning.
+void representative_shape(ShapeClass shape, size_t& M, size_t& N, size_t& K) {
+    switch (shape) {
+        case ShapeClass::Small:   M = 128;  N = 128;  K = 128;  break;
+        case ShapeClass::Medium:  M = 512;  N = 512;  K = 512;  break;
+        case ShapeClass::Large:   M = 1536; N = 1536; K = 1536; break;
+        case ShapeClass::FewRows: M = 32;   N = 2048; K = 1024; break;
+        case ShapeClass::FewCols: M = 2048; N = 32;   K = 1024; break;
+        case ShapeClass::DeepK:   M = 128;  N = 128;  K = 8192; break;
+    }
+}
+
+// Best-of-N wall time in seconds.
+template <typename Func>
+double time_best(Func&& func, int repetitions) {
+    func(); // Warmup
+    double best = 1e30;
+    for (int r = 0; r < repetitions; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+bool write_table(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    const CacheSizes& caches = cache_sizes();
+    out << "# matmul tuning file: isa shape mc kc nc block threads\n";
+    out << "# cache l1d=" << caches.l1d << " l2=" << caches.l2 << " l3=" << caches.l3 << "\n";
+    for (int isa = 0; isa < kNumIsas; ++isa) {
+        for (ShapeClass shape : kAllShapes) {
+            const TableEntry& e = g_table[isa][static_cast<int>(shape)];
+            if (!e.valid) continue;
+            out << isa_name(static_cast<CpuIsa>(isa)) << " " << shape_class_name(shape) << " "
+                << e.params.mc << " " << e.params.kc << " " << e.params.nc << " "
+                << e.params.blockSize << " " << e.params.threads << "\n";
+        }
+    }
+    return static_cast<bool>(out);
+}
+
+} // namespace
+
+const CacheSizes& cache_sizes() {
+    static const CacheSizes sizes = detect_cache_sizes();
+    return sizes;
+}
+
+ShapeClass classify_shape(size_t M, size_t N, size_t K) {
+    if (K >= 8 * std::max(M, N)) return ShapeClass::DeepK;
+    if (M <= 64 && N >= 4 * M) return ShapeClass::FewRows;
+    if (N <= 64 && M >= 4 * N) return ShapeClass::FewCols;
+
+    double size = std::cbrt(static_cast<double>(M) * N * K);
+    if (size <= 256) return ShapeClass::Small;
+    if (size <= 1024) return ShapeClass::Medium;
+    return ShapeClass::Large;
+}
+
+const char* shape_class_name(ShapeClass shape) {
+    switch (shape) {
+        case ShapeClass::Small: return "small";
+        case ShapeClass::Medium: return "medium";
+        case ShapeClass::Large: return "large";
+        case ShapeClass::FewRows: return "few_rows";
+        case ShapeClass::FewCols: return "few_cols";
+        case ShapeClass::DeepK: return "deep_k";
+    }
+    return "unknown";
+}
+
+TuningParams default_tuning(CpuIsa isa, ShapeClass) {
+    const gemm_detail::MicroKernel& uk = gemm_detail::micro_kernel_for(isa);
+    const CacheSizes& caches = cache_sizes();
+
+    // Half of each cache level holds the panel that lives there (B micro-panel in
+    // L1, packed A block in L2, packed B block in L3); the rest is for C and A/B streams.
+    TuningParams p;
+    p.kc = std::min<size_t>(512, round_down(caches.l1d / 2 / (uk.nr * sizeof(float)), 16));
+    p.mc = std::min(round_down(512, uk.mr), round_down(caches.l2 / 2 / (p.kc * sizeof(float)), uk.mr));
+    p.nc = std::min(round_down(8192, uk.nr), round_down(caches.l3 / 2 / (p.kc * sizeof(float)), uk.nr));
+
+    // v2 keeps a block each of A, B and C in L1.
+    p.blockSize = 16;
+    while (3 * (2 * p.blockSize) * (2 * p.blockSize) * sizeof(float) <= caches.l1d) {
+        p.blockSize *= 2;
+    }
+    p.threads = 0;
+    return p;
+}
+
+TuningParams tuned_params(size_t M, size_t N, size_t K) {
+    ensure_loaded();
+    CpuIsa isa = active_isa();
+    ShapeClass shape = classify_shape(M, N, K);
+    {
+        std::lock_guard<std::mutex> lk(g_tableMutex);
+        const TableEntry& e = g_table[static_cast<int>(isa)][static_cast<int>(shape)];
+        if (e.valid) return e.params;
+    }
+    return default_tuning(isa, shape);
+}
+
+std::string tuning_file_path() {
+    if (const char* env = std::getenv("MATMUL_TUNING_FILE")) {
+        return env;
+    }
+    if (const char* home = std::getenv("HOME")) {
+        return std::string(home) + "/.cache/matmul_tuning.txt";
+    }
+    return "matmul_tuning.txt";
+}
+
+bool load_tuning_file(const std::string& path) {
+    // An explicit load replaces the default one, so a later first use doesn't
+    // overwrite it with the default file's contents
+    std::call_once(g_loadOnce, [] {});
+    return read_table(path);
+}
+
+namespace {
+
+bool read_table(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) return false;
+
+    TableEntry table[kNumIsas][kNumShapeClasses];
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream fields(line);
+        std::string isaText, shapeText;
+        TuningParams p;
+        if (!(fields >> isaText >> shapeText >> p.mc >> p.kc >> p.nc >> p.blockSize >> p.threads)) continue;
+
+        CpuIsa isa;
+        if (!parse_isa(isaText.c_str(), isa)) continue;
+        for (ShapeClass shape : kAllShapes) {
+            if (shapeText == shape_class_name(shape) && p.mc > 0 && p.kc > 0 && p.nc > 0 && p.blockSize > 0) {
+                table[static_cast<int>(isa)][static_cast<int>(shape)] = {true, p};
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lk(g_tableMutex);
+    std::copy(&table[0][0], &table[0][0] + kNumIsas * kNumShapeClasses, &g_table[0][0]);
+    return true;
+}
+
+} // namespace
+
+bool autotune(const std::string& path, std::ostream& log) {
+    ensure_loaded();
+    CpuIsa isa = active_isa();
+    const gemm_detail::MicroKernel& base = gemm_detail::micro_kernel_for(isa);
+    unsigned int poolThreads = ThreadPool::instance().num_threads();
+
+    const CacheSizes& caches = cache_sizes();
+    log << "Tuning for " << base.name << " (L1d " << caches.l1d / 1024 << " KiB, L2 "
+        << caches.l2 / 1024 << " KiB, L3 " << caches.l3 / 1024 << " KiB, "
+        << poolThreads << " threads)" << std::endl;
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
+
+    for (ShapeClass shape : kAllShapes) {
+        size_t M = 0, N = 0, K = 0;
+        representative_shape(shape, M, N, K);
+        Matrix A(M, K), B(K, N), C(M, N);
+        for (auto& v : A.data) v = dis(gen);
+        for (auto& v : B.data) v = dis(gen);
+
+        TuningParams best = default_tuning(isa, shape);
+        auto time_packed = [&](const TuningParams& p) {
+            gemm_detail::MicroKernel uk = gemm_detail::with_blocking(base, p.mc, p.kc, p.nc);
+            return time_best([&] {
+                gemm_detail::gemm_packed_threaded(uk, M, N, K, 1.0f,
+                                                  gemm_detail::Operand::of(A.data.data(), K, false),
+                                                  gemm_detail::Operand::of(B.data.data(), N, false),
+                                                  0.0f, C.data.data(), N, p.threads);
+            }, 3);
+        };
+
+        // Coordinate descent: one parameter at a time, keeping the best so far.
+        double bestTime = time_packed(best);
+        auto try_values = [&](size_t TuningParams::*field, const std::vector<size_t>& values) {
+            for (size_t v : values) {
+                TuningParams candidate = best;
+                candidate.*field = v;
+                double t = time_packed(candidate);
+                if (t < bestTime) {
+                    bestTime = t;
+                    best = candidate;
+                }
+            }
+        };
+        try_values(&TuningParams::kc, {64, 128, 192, 256, 320, 384, 512});
+        try_values(&TuningParams::mc, {base.mr * 4, base.mr * 8, base.mr * 12, base.mr * 16,
+                                       base.mr * 24, base.mr * 32});
+        try_values(&TuningParams::nc, {base.nr * 32, base.nr * 64, base.nr * 128, base.nr * 256});
+
+        std::vector<unsigned int> threadCounts;
+        for (unsigned int t = 1; t < poolThreads; t *= 2) threadCounts.push_back(t);
+        threadCounts.push_back(0);
+        for (unsigned int t : threadCounts) {
+            TuningParams candidate = best;
+            candidate.threads = t;
+            double time = time_packed(candidate);
+            if (time < bestTime) {
+                bestTime = time;
+                best = candidate;
+            }
+        }
+
+        double bestTiled = 1e30;
+        for (size_t blockSize : {16, 32, 64, 128, 256}) {
+            double t = time_best([&] { multiply_optimized_v2_tiled(A, B, C, blockSize); }, 2);
+            if (t < bestTiled) {
+                bestTiled = t;
+                best.blockSize = blockSize;
+            }
+        }
+
+        log << "  " << shape_class_name(shape) << " (" << M << "x" << N << "x" << K << "): mc=" << best.mc
+            << " kc=" << best.kc << " nc=" << best.nc << " threads=" << best.threads
+            << " -> " << 2.0 * M * N * K / bestTime / 1e9 << " GFLOPS; v2 block=" << best.blockSize
+            << std::endl;
+
+        std::lock_guard<std::mutex> lk(g_tableMutex);
+        g_table[static_cast<int>(isa)][static_cast<int>(shape)] = {true, best};
+    }
+
+    std::lock_guard<std::mutex> lk(g_tableMutex);
+    return write_table(path);
+}
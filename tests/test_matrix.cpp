@@ -1,8 +1,31 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <random>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <complex>
+#include <type_traits>
+#include <limits>
 #include "matrix.h"
+#include "thread_pool.h"
+#include "cpu_features.h"
+#include "tuning.h"
+#include "gemm.h"
+#include "packed_matrix.h"
+#include "quantized.h"
+#include "sparse.h"
+#include "out_of_core.h"
+#include "topology.h"
+#include "perf_counters.h"
+#include "chain.h"
+#include "expr.h"
+#include "matrix_io.h"
+#include "tiled_matrix.h"
 
 bool are_matrices_equal(const Matrix& A, const Matrix& B, float epsilon = 1e-4f) {
     if (A.rows != B.rows || A.cols != B.cols) return false;
@@ -22,13 +45,110 @@ void fill_random(Matrix& M) {
     for (auto& val : M.data) val = dis(gen);
 }
 
+template <typename T>
+void fill_random(BasicMatrix<T>& M) {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_real_distribution<double> dis(-1.0, 1.0);
+    for (auto& val : M.data) {
+        if constexpr (std::is_same<T, double>::value) {
+            val = dis(gen);
+        } else {
+            val = T(dis(gen), dis(gen));
+        }
+    }
+}
+
+template <typename T>
+bool are_matrices_close(const BasicMatrix<T>& A, const BasicMatrix<T>& B, double epsilon) {
+    if (A.rows != B.rows || A.cols != B.cols) return false;
+    for (size_t i = 0; i < A.data.size(); ++i) {
+        if (std::abs(A.data[i] - B.data[i]) > epsilon) {
+            std::cout << "Mismatch at index " << i << ": " << A.data[i] << " vs " << B.data[i] << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// gemm() in T on every ISA, all four transpose combinations, against a reference
+// accumulated in complex<double>; then the portable kernels against multiply().
+template <typename T>
+bool check_wide_gemm(T alpha, T beta, double epsilon) {
+    using Ref = std::complex<double>;
+    bool ok = true;
+    CpuIsa savedIsa = active_isa();
+    struct WideShape { size_t M, N, K; };
+    for (const WideShape& sh : {WideShape{37, 29, 53}, WideShape{5, 70, 300}, WideShape{130, 45, 17}}) {
+        for (bool ta : {false, true}) {
+            for (bool tb : {false, true}) {
+                BasicMatrix<T> WA(ta ? sh.K : sh.M, ta ? sh.M : sh.K), WB(tb ? sh.N : sh.K, tb ? sh.K : sh.N);
+                BasicMatrix<T> WC(sh.M, sh.N);
+                fill_random(WA);
+                fill_random(WB);
+                fill_random(WC);
+                std::vector<Ref> ref(sh.M * sh.N);
+                for (size_t i = 0; i < sh.M; ++i) {
+                    for (size_t j = 0; j < sh.N; ++j) {
+                        Ref sum = 0.0;
+                        for (size_t k = 0; k < sh.K; ++k) {
+                            sum += Ref(ta ? WA(k, i) : WA(i, k)) * Ref(tb ? WB(j, k) : WB(k, j));
+                        }
+                        ref[i * sh.N + j] = Ref(alpha) * sum + Ref(beta) * Ref(WC(i, j));
+                    }
+                }
+                for (CpuIsa isa : {CpuIsa::Scalar, CpuIsa::SSE42, CpuIsa::AVX2, CpuIsa::AVX512, CpuIsa::NEON}) {
+                    if (!set_active_isa(isa)) continue;
+                    BasicMatrix<T> Result = WC;
+                    gemm(ta ? Transpose::Trans : Transpose::NoTrans, tb ? Transpose::Trans : Transpose::NoTrans,
+                         sh.M, sh.N, sh.K, alpha, WA.data.data(), WA.cols, WB.data.data(), WB.cols,
+                         beta, Result.data.data(), sh.N);
+                    for (size_t i = 0; ok && i < ref.size(); ++i) {
+                        if (std::abs(Ref(Result.data[i]) - ref[i]) > epsilon) {
+                            std::cout << "Mismatch at index " << i << " (" << isa_name(isa) << "): "
+                                      << Result.data[i] << " vs " << ref[i] << std::endl;
+                            ok = false;
+                        }
+                    }
+                }
+                set_active_isa(savedIsa);
+            }
+        }
+    }
+
+    BasicMatrix<T> PA(67, 301), PB(301, 45), Front(67, 45), Other(67, 45, uninitialized);
+    fill_random(PA);
+    fill_random(PB);
+    multiply(PA, PB, Front);
+    multiply_naive(PA, PB, Other);
+    ok = ok && are_matrices_close(Front, Other, epsilon);
+    multiply_optimized_v1(PA, PB, Other);
+    ok = ok && are_matrices_close(Front, Other, epsilon);
+    multiply_optimized_v5_threaded(PA, PB, Other, 3);
+    ok = ok && are_matrices_close(Front, Other, epsilon);
+    return ok;
+}
+
 int main() {
+    // Keep the run independent of any tuning file in the home directory: the default
+    // path points at a temporary file, and an explicit load made before first use
+    // must win over it
+    const std::filesystem::path tmp = std::filesystem::temp_directory_path();
+    const std::string defaultTuning = (tmp / "matmul_tuning_default.txt").string();
+    const std::string explicitTuning = (tmp / "matmul_tuning_explicit.txt").string();
+    std::ofstream(defaultTuning) << isa_name(active_isa()) << " few_cols 18 56 48 24 2\n";
+    std::ofstream(explicitTuning) << isa_name(active_isa()) << " few_cols 18 40 48 24 3\n";
+    setenv("MATMUL_TUNING_FILE", defaultTuning.c_str(), 1);
+    const bool explicitLoadWins = load_tuning_file(explicitTuning) && tuned_params(1000, 37, 300).kc == 40;
+    std::filesystem::remove(explicitTuning);
+
     const size_t size = 128;
     Matrix A(size, size), B(size, size), Expected(size, size);
     fill_random(A);
     fill_random(B);
 
-    std::cout << "Running correctness tests (Size " << size << "x" << size << ")..." << std::endl;
+    std::cout << "Running correctness tests (Size " << size << "x" << size << ", ISA "
+              << isa_name(active_isa()) << ")..." << std::endl;
 
     // Baseline
     multiply_naive(A, B, Expected);
@@ -46,7 +166,10 @@ int main() {
         {"Opt V6 (RegBlk)", multiply_optimized_v6_register_blocked_2x2},
         {"Opt V7 (Thread+RegBlk)", [](const Matrix& A, const Matrix& B, Matrix& C) { multiply_optimized_v7_threaded_register_blocked(A, B, C); }},
         {"Opt V8 (Prefetch)", multiply_optimized_v8_prefetch},
-        {"Opt V9 (Transp)", multiply_optimized_v9_transpose}
+        {"Opt V9 (Transp)", multiply_optimized_v9_transpose},
+        {"Opt V10 (Packed)", multiply_optimized_packed},
+        {"Opt V11 (Packed+Thread)", [](const Matrix& A, const Matrix& B, Matrix& C) { multiply_optimized_packed_threaded(A, B, C); }},
+        {"multiply()", multiply}
     };
 
     bool all_passed = true;
@@ -66,17 +189,1181 @@ int main() {
         }
     }
 
-    // Special case for V2 (Tiled) because it takes an extra argument
-    {
+    // Special case for V2 (Tiled) because it takes an extra argument (0 = tuned block size)
+    for (size_t blockSize : {0, 32, 48}) {
         Matrix Result(size, size);
-        multiply_optimized_v2_tiled(A, B, Result, 32);
+        multiply_optimized_v2_tiled(A, B, Result, blockSize);
         if (are_matrices_equal(Expected, Result)) {
-            std::cout << "[PASS] Opt V2 (Tiled)" << std::endl;
+            std::cout << "[PASS] Opt V2 (Tiled) block=" << blockSize << std::endl;
+        } else {
+            std::cout << "[FAIL] Opt V2 (Tiled) block=" << blockSize << std::endl;
+            all_passed = false;
+        }
+    }
+
+    // Packed GEMM on a shape that leaves partial MR/NR tiles and spans several KC blocks
+    {
+        Matrix RA(173, 601), RB(601, 97), RExpected(173, 97), Result(173, 97);
+        fill_random(RA);
+        fill_random(RB);
+        multiply_naive(RA, RB, RExpected);
+        multiply_optimized_packed(RA, RB, Result);
+        if (are_matrices_equal(RExpected, Result, 1e-3f)) {
+            std::cout << "[PASS] Opt V10 (Packed, 173x601x97)" << std::endl;
         } else {
-            std::cout << "[FAIL] Opt V2 (Tiled)" << std::endl;
+            std::cout << "[FAIL] Opt V10 (Packed, 173x601x97)" << std::endl;
             all_passed = false;
         }
     }
 
+    // Strassen-Winograd: several levels, odd sizes peeled at every level, on one thread,
+    // with the seven top-level products side by side, and with them in turn on 8 threads
+    {
+        ThreadPool& pool = ThreadPool::instance();
+        unsigned int saved = pool.num_threads();
+        Matrix SA(301, 257), SB(257, 199), SExpected(301, 199), Result(301, 199);
+        fill_random(SA);
+        fill_random(SB);
+        multiply_naive(SA, SB, SExpected);
+        bool ok = true;
+        for (unsigned int threads : {1u, 4u, 8u}) {
+            pool.set_num_threads(threads);
+            multiply_strassen(SA, SB, Result, 24);
+            ok = ok && are_matrices_equal(SExpected, Result, 1e-3f);
+        }
+        pool.set_num_threads(saved);
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Strassen (301x257x199, cutoff 24, 1/4/8 threads)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Matrix chain: the textbook 6-factor chain plans to the known optimum, and a
+    // chain with independent sub-products matches the pairwise left-to-right result
+    {
+        ChainPlan textbook = plan_chain({30, 35, 15, 5, 10, 20, 25});
+        bool ok = textbook.flops == 2.0 * 15125 && textbook.parenthesization() == "((X0 (X1 X2)) ((X3 X4) X5))";
+
+        std::vector<size_t> dims = {67, 301, 9, 145, 11, 83};
+        std::vector<Matrix> X;
+        for (size_t i = 0; i + 1 < dims.size(); ++i) {
+            X.emplace_back(dims[i], dims[i + 1]);
+            fill_random(X.back());
+        }
+        Matrix Pairwise(dims[0], dims[1]);
+        Pairwise = X[0];
+        for (size_t i = 1; i < X.size(); ++i) {
+            Matrix Next(dims[0], dims[i + 1]);
+            multiply_naive(Pairwise, X[i], Next);
+            Pairwise = Next;
+        }
+        ChainPlan plan = plan_chain(dims);
+        ok = ok && plan.steps.size() == 4 && plan.numWaves < 4 && plan.flops < chain_flops_left_to_right(dims);
+        Matrix Result(dims[0], dims.back(), uninitialized);
+        multiply_chain({&X[0], &X[1], &X[2], &X[3], &X[4]}, Result, plan);
+        ok = ok && are_matrices_equal(Pairwise, Result, 1e-2f);
+        try {
+            multiply_chain({&X[1], &X[0]}, Result);
+            ok = false;
+        } catch (const std::invalid_argument&) {
+        }
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Matrix chain " << plan.parenthesization() << " ("
+                  << plan.scratchFloats * sizeof(float) << " bytes scratch)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Tiled layout: round trips in both tile orders, Morton placement of the first
+    // quad, the recursive multiply on odd shapes with mixed orders, and the same
+    // chain kept tiled end to end
+    {
+        std::vector<size_t> dims = {67, 301, 9, 145, 11, 83};
+        std::vector<Matrix> X;
+        for (size_t i = 0; i + 1 < dims.size(); ++i) {
+            X.emplace_back(dims[i], dims[i + 1]);
+            fill_random(X.back());
+        }
+        Matrix Pairwise = X[0];
+        for (size_t i = 1; i < X.size(); ++i) {
+            Matrix Next(dims[0], dims[i + 1]);
+            multiply_naive(Pairwise, X[i], Next);
+            Pairwise = Next;
+        }
+        ChainPlan plan = plan_chain(dims);
+
+        TiledMatrix T0(X[0], TileOrder::Morton, 16), T1(X[1], TileOrder::RowMajor, 16);
+        bool ok = are_matrices_equal(X[0], T0.to_matrix(), 0.0f) && are_matrices_equal(X[1], T1.to_matrix(), 0.0f);
+        ok = ok && T0.tile_rows() == 5 && T0.tile_cols() == 19 && T0(66, 300) == X[0](66, 300);
+        ok = ok && T0.tile_data(0, 1) - T0.tile_data(0, 0) == 256 && T0.tile_data(1, 0) - T0.tile_data(0, 0) == 512;
+        ok = ok && size_t(T1.tile_data(1, 0) - T1.tile_data(0, 0)) == 256 * T1.tile_cols();
+
+        Matrix Front(dims[0], dims[2]);
+        multiply_naive(X[0], X[1], Front);
+        TiledMatrix TFront(dims[0], dims[2], TileOrder::Morton, 16);
+        multiply(T0, T1, TFront);
+        ok = ok && are_matrices_equal(Front, TFront.to_matrix(), 1e-3f);
+
+        std::vector<TiledMatrix> TX;
+        for (const Matrix& Xi : X) TX.emplace_back(Xi, TileOrder::Morton, 16);
+        TiledMatrix TResult(dims[0], dims.back(), TileOrder::Morton, 16);
+        multiply_chain({&TX[0], &TX[1], &TX[2], &TX[3], &TX[4]}, TResult, plan);
+        ok = ok && are_matrices_equal(Pairwise, TResult.to_matrix(), 1e-2f);
+        // Mismatched shapes with matching tiles, then matching shapes with a mismatched
+        // tile size, each rejected with its own message
+        auto rejects = [](const TiledMatrix& L, const TiledMatrix& R, size_t tile, const std::string& message) {
+            try {
+                TiledMatrix Other(L.rows(), R.cols(), TileOrder::Morton, tile);
+                multiply(L, R, Other);
+            } catch (const std::invalid_argument& e) {
+                return message == e.what();
+            }
+            return false;
+        };
+        ok = ok && rejects(TX[1], TX[0], 16, "Matrix dimensions mismatch.") &&
+             rejects(T0, T1, 32, "Tile sizes differ.");
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Tiled layout (Morton / block-major, recursive multiply, chain)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Every micro-kernel this CPU can run, forced through the runtime dispatcher
+    {
+        CpuIsa saved = active_isa();
+        Matrix RA(173, 601), RB(601, 97), RExpected(173, 97);
+        fill_random(RA);
+        fill_random(RB);
+        multiply_naive(RA, RB, RExpected);
+        for (CpuIsa isa : {CpuIsa::Scalar, CpuIsa::SSE42, CpuIsa::AVX2, CpuIsa::AVX512, CpuIsa::NEON}) {
+            if (!set_active_isa(isa)) continue;
+            Matrix Result(173, 97), SimdResult(173, 97);
+            multiply(RA, RB, Result);
+            multiply_optimized_v4_simd(RA, RB, SimdResult);
+            bool ok = are_matrices_equal(RExpected, Result, 1e-3f) && are_matrices_equal(RExpected, SimdResult, 1e-3f);
+            std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Dispatch " << isa_name(isa) << std::endl;
+            all_passed = all_passed && ok;
+        }
+        set_active_isa(saved);
+    }
+
+    // Shape sweep: every kernel on degenerate, odd and rectangular shapes, and on every
+    // ISA the packed engine's edge tiles with beta != 0 into a C whose padding columns
+    // must come back untouched
+    {
+        CpuIsa saved = active_isa();
+        const size_t shapes[][3] = {{1, 1, 1}, {1, 37, 5}, {5, 1, 37}, {2, 3, 1}, {7, 13, 9}, {13, 29, 17},
+                                    {37, 11, 100}, {100, 37, 3}, {33, 65, 31}, {65, 17, 129}, {129, 64, 47}};
+        bool ok = true;
+        for (const auto& shape : shapes) {
+            const size_t M = shape[0], K = shape[1], N = shape[2];
+            Matrix SA(M, K), SB(K, N), SExpected(M, N);
+            fill_random(SA);
+            fill_random(SB);
+            multiply_naive(SA, SB, SExpected);
+            for (const auto& c : cases) {
+                Matrix Result(M, N);
+                c.func(SA, SB, Result);
+                ok = ok && are_matrices_equal(SExpected, Result, 1e-3f);
+            }
+            for (size_t blockSize : {0, 7}) {
+                Matrix Result(M, N);
+                multiply_optimized_v2_tiled(SA, SB, Result, blockSize);
+                ok = ok && are_matrices_equal(SExpected, Result, 1e-3f);
+            }
+            Matrix StrassenResult(M, N);
+            multiply_strassen(SA, SB, StrassenResult, 8);
+            ok = ok && are_matrices_equal(SExpected, StrassenResult, 1e-3f);
+
+            const size_t ldc = N + 5;
+            for (CpuIsa isa : {CpuIsa::Scalar, CpuIsa::SSE42, CpuIsa::AVX2, CpuIsa::AVX512, CpuIsa::NEON}) {
+                if (!set_active_isa(isa)) continue;
+                std::vector<float> C(M * ldc, 3.0f);
+                gemm(Transpose::NoTrans, Transpose::NoTrans, M, N, K, 1.0f, SA.data.data(), K, SB.data.data(), N,
+                     0.5f, C.data(), ldc);
+                for (size_t i = 0; i < M; ++i) {
+                    for (size_t j = 0; j < ldc; ++j) {
+                        const float expected = (j < N) ? SExpected(i, j) + 1.5f : 3.0f;
+                        ok = ok && std::abs(C[i * ldc + j] - expected) <= 1e-3f;
+                    }
+                }
+            }
+            set_active_isa(saved);
+        }
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Shape sweep (odd / rectangular, masked edge tiles)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Tuning file: shape classes, sane defaults, and odd tuned blocking loaded from disk
+    {
+        bool ok = classify_shape(1024, 1024, 1024) == ShapeClass::Medium &&
+                  classify_shape(4, 4096, 512) == ShapeClass::FewRows &&
+                  classify_shape(4096, 8, 512) == ShapeClass::FewCols &&
+                  classify_shape(64, 64, 8192) == ShapeClass::DeepK;
+        TuningParams d = default_tuning(active_isa(), ShapeClass::Large);
+        ok = ok && d.mc > 0 && d.kc > 0 && d.nc > 0 && d.blockSize >= 16 && explicitLoadWins;
+        std::filesystem::remove(defaultTuning);
+
+        std::string path = (std::filesystem::temp_directory_path() / "matmul_tuning_test.txt").string();
+        {
+            std::ofstream out(path);
+            out << "# test\n" << isa_name(active_isa()) << " few_cols 18 40 48 24 3\n";
+        }
+        ok = ok && load_tuning_file(path);
+        TuningParams t = tuned_params(1000, 37, 300);
+        ok = ok && t.kc == 40 && t.blockSize == 24 && t.threads == 3;
+
+        Matrix RA(1000, 300), RB(300, 37), RExpected(1000, 37), Result(1000, 37), TiledResult(1000, 37);
+        fill_random(RA);
+        fill_random(RB);
+        multiply_naive(RA, RB, RExpected);
+        multiply(RA, RB, Result);
+        multiply_optimized_v2_tiled(RA, RB, TiledResult);
+        ok = ok && are_matrices_equal(RExpected, Result, 1e-3f) && are_matrices_equal(RExpected, TiledResult, 1e-3f);
+
+        { std::ofstream reset(path); }
+        load_tuning_file(path);
+        std::filesystem::remove(path);
+
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Tuning table" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // BLAS-style gemm on sub-block views: every transpose combination, alpha and beta
+    {
+        const size_t M = 67, N = 45, K = 91;
+        Matrix Storage(300, 300), CInit(M + 10, N + 10);
+        fill_random(Storage);
+        fill_random(CInit);
+        bool ok = true;
+        for (Transpose tA : {Transpose::NoTrans, Transpose::Trans}) {
+            for (Transpose tB : {Transpose::NoTrans, Transpose::Trans}) {
+                bool ta = (tA == Transpose::Trans), tb = (tB == Transpose::Trans);
+                ConstMatrixView AV = Storage.view().block(3, 5, ta ? K : M, ta ? M : K);
+                ConstMatrixView BV = Storage.view().block(120, 150, tb ? N : K, tb ? K : N);
+                Matrix CM = CInit, Ref = CInit;
+                MatrixView CV = CM.view().block(4, 7, M, N);
+
+                for (size_t i = 0; i < M; ++i) {
+                    for (size_t j = 0; j < N; ++j) {
+                        float sum = 0.0f;
+                        for (size_t k = 0; k < K; ++k) {
+                            sum += (ta ? AV(k, i) : AV(i, k)) * (tb ? BV(j, k) : BV(k, j));
+                        }
+                        Ref(4 + i, 7 + j) = 0.5f * sum - 1.5f * Ref(4 + i, 7 + j);
+                    }
+                }
+                gemm(tA, tB, 0.5f, AV, BV, -1.5f, CV);
+                // Elements outside the C block must be untouched
+                ok = ok && are_matrices_equal(Ref, CM, 1e-3f);
+            }
+        }
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "gemm (transA/transB, alpha/beta, views)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Batched gemm: specialized small shapes and the general path, both batch layouts
+    {
+        bool ok = true;
+        struct BatchShape { size_t M, N, K; Transpose tB; };
+        for (const BatchShape& sh : {BatchShape{8, 16, 4, Transpose::NoTrans}, BatchShape{32, 32, 32, Transpose::NoTrans},
+                                     BatchShape{5, 7, 9, Transpose::NoTrans}, BatchShape{16, 16, 16, Transpose::Trans}}) {
+            const size_t batch = 37;
+            bool tb = (sh.tB == Transpose::Trans);
+            size_t ldb = tb ? sh.K : sh.N;
+            Matrix As(batch, sh.M * sh.K), Bs(batch, sh.K * sh.N), Cs(batch, sh.M * sh.N), Cp(batch, sh.M * sh.N);
+            fill_random(As);
+            fill_random(Bs);
+            fill_random(Cs);
+            Cp = Cs;
+            Matrix Ref = Cs;
+
+            std::vector<const float*> aPtrs, bPtrs;
+            std::vector<float*> cPtrs;
+            for (size_t b = 0; b < batch; ++b) {
+                aPtrs.push_back(&As(b, 0));
+                bPtrs.push_back(&Bs(b, 0));
+                cPtrs.push_back(&Cp(b, 0));
+                for (size_t i = 0; i < sh.M; ++i) {
+                    for (size_t j = 0; j < sh.N; ++j) {
+                        float sum = 0.0f;
+                        for (size_t k = 0; k < sh.K; ++k) {
+                            sum += As(b, i * sh.K + k) * Bs(b, tb ? j * ldb + k : k * ldb + j);
+                        }
+                        Ref(b, i * sh.N + j) = 2.0f * sum + 0.5f * Ref(b, i * sh.N + j);
+                    }
+                }
+            }
+            gemm_batch_strided(Transpose::NoTrans, sh.tB, sh.M, sh.N, sh.K, 2.0f, As.data.data(), sh.K, As.cols,
+                               Bs.data.data(), ldb, Bs.cols, 0.5f, Cs.data.data(), sh.N, Cs.cols, batch);
+            gemm_batch(Transpose::NoTrans, sh.tB, sh.M, sh.N, sh.K, 2.0f, aPtrs.data(), sh.K, bPtrs.data(), ldb,
+                       0.5f, cPtrs.data(), sh.N, batch);
+            ok = ok && are_matrices_equal(Ref, Cs, 1e-3f) && are_matrices_equal(Ref, Cp, 1e-3f);
+        }
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "gemm_batch / gemm_batch_strided" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Int8 GEMM on every int8 kernel: per-row / per-column zero points and scales,
+    // int32 output exact, dequantized and requantized outputs against a reference
+    {
+        const size_t M = 77, N = 83, K = 1203;
+        std::mt19937 gen(7);
+        std::uniform_int_distribution<int> byte(-128, 127), zero(-20, 20);
+        std::vector<int8_t> QA(M * K), QB(K * N);
+        std::vector<int32_t> zA(M), zB(N);
+        std::vector<float> sA(M), sB(N);
+        for (auto& v : QA) v = static_cast<int8_t>(byte(gen));
+        for (auto& v : QB) v = static_cast<int8_t>(byte(gen));
+        for (size_t i = 0; i < M; ++i) { zA[i] = zero(gen); sA[i] = 0.01f + 0.001f * i; }
+        for (size_t j = 0; j < N; ++j) { zB[j] = zero(gen); sB[j] = 0.02f - 0.0001f * j; }
+        QuantParams qa, qb, qc;
+        qa.zeroPoints = zA.data();
+        qa.scales = sA.data();
+        qb.zeroPoints = zB.data();
+        qb.scales = sB.data();
+        qc.scale = 4.0f;
+        qc.zeroPoint = 3;
+
+        std::vector<int32_t> ref(M * N);
+        for (size_t i = 0; i < M; ++i) {
+            for (size_t j = 0; j < N; ++j) {
+                int64_t sum = 0;
+                for (size_t k = 0; k < K; ++k) {
+                    sum += (QA[i * K + k] - zA[i]) * (QB[k * N + j] - zB[j]);
+                }
+                ref[i * N + j] = static_cast<int32_t>(sum);
+            }
+        }
+
+        CpuIsa saved = active_isa();
+        for (CpuIsa isa : {CpuIsa::Scalar, CpuIsa::AVX2, CpuIsa::AVX512}) {
+            if (!set_active_isa(isa)) continue;
+            std::vector<int32_t> C32(M * N);
+            std::vector<float> CF(M * N);
+            std::vector<int8_t> C8(M * N);
+            gemm_s8s8s32(M, N, K, QA.data(), K, qa, QB.data(), N, qb, C32.data(), N);
+            gemm_s8s8_f32(M, N, K, QA.data(), K, qa, QB.data(), N, qb, CF.data(), N);
+            gemm_s8s8_s8(M, N, K, QA.data(), K, qa, QB.data(), N, qb, C8.data(), N, qc);
+
+            bool ok = (C32 == ref);
+            for (size_t i = 0; i < M && ok; ++i) {
+                for (size_t j = 0; j < N && ok; ++j) {
+                    float real = sA[i] * sB[j] * static_cast<float>(ref[i * N + j]);
+                    float q = std::min(127.0f, std::max(-128.0f, std::nearbyint(real / qc.scale) + qc.zeroPoint));
+                    ok = std::abs(CF[i * N + j] - real) <= 1e-4f * std::max(1.0f, std::abs(real)) &&
+                         std::abs(C8[i * N + j] - q) <= 1.0f;
+                }
+            }
+            std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Int8 GEMM (" << int8_kernel_name() << ")" << std::endl;
+            all_passed = all_passed && ok;
+        }
+        set_active_isa(saved);
+    }
+
+    // Half precision: scalar rounding and special values, bulk conversion on every
+    // path, and bf16 / fp16 gemm (all transposes) against float on the widened inputs
+    {
+        bool ok = to_bfloat16(1.0f).bits == 0x3F80 && to_float16(1.0f).bits == 0x3C00 &&
+                  to_bfloat16(1.00390625f).bits == 0x3F80 &&   // Tie rounds to even
+                  to_float16(65504.0f).bits == 0x7BFF && to_float16(65520.0f).bits == 0x7C00 &&
+                  to_float16(5.9604645e-8f).bits == 0x0001 && to_float(float16{0x0001}) == 5.9604645e-8f &&
+                  std::isnan(to_float(to_bfloat16(NAN))) && std::isnan(to_float(to_float16(NAN))) &&
+                  to_float(to_float16(-2.5f)) == -2.5f;
+
+        const size_t M = 53, N = 70, K = 301;
+        Matrix HA(M, K), HB(K, N);
+        fill_random(HA);
+        fill_random(HB);
+        std::vector<bfloat16> bA(M * K), bB(K * N), bRef(M * K);
+        std::vector<float16> fA(M * K), fB(K * N), fRef(M * K);
+        for (size_t i = 0; i < M * K; ++i) {
+            bRef[i] = to_bfloat16(HA.data[i]);
+            fRef[i] = to_float16(HA.data[i]);
+        }
+
+        CpuIsa saved = active_isa();
+        for (CpuIsa isa : {CpuIsa::Scalar, CpuIsa::AVX2, CpuIsa::AVX512}) {
+            if (!set_active_isa(isa)) continue;
+            convert(HA.data.data(), M * K, bA.data());
+            convert(HB.data.data(), K * N, bB.data());
+            convert(HA.data.data(), M * K, fA.data());
+            convert(HB.data.data(), K * N, fB.data());
+            for (size_t i = 0; i < M * K; ++i) {
+                ok = ok && bA[i].bits == bRef[i].bits && fA[i].bits == fRef[i].bits;
+            }
+
+            // Widened copies of the rounded inputs, plain and transposed
+            Matrix WA(M, K), WB(K, N), WAt(K, M), WBt(N, K), Ref(M, N);
+            for (bool bf : {true, false}) {
+                if (bf) {
+                    convert(bA.data(), M * K, WA.data.data());
+                    convert(bB.data(), K * N, WB.data.data());
+                } else {
+                    convert(fA.data(), M * K, WA.data.data());
+                    convert(fB.data(), K * N, WB.data.data());
+                }
+                multiply_naive(WA, WB, Ref);
+                for (bool tr : {false, true}) {
+                    Matrix Result(M, N);
+                    if (!tr) {
+                        if (bf) gemm(Transpose::NoTrans, Transpose::NoTrans, M, N, K, 1.0f, bA.data(), K, bB.data(), N, 0.0f, Result.data.data(), N);
+                        else    gemm(Transpose::NoTrans, Transpose::NoTrans, M, N, K, 1.0f, fA.data(), K, fB.data(), N, 0.0f, Result.data.data(), N);
+                    } else {
+                        // Transposed storage of the same values
+                        std::vector<bfloat16> bAt(K * M), bBt(N * K);
+                        std::vector<float16> fAt(K * M), fBt(N * K);
+                        for (size_t i = 0; i < M; ++i) {
+                            for (size_t k = 0; k < K; ++k) { bAt[k * M + i] = bA[i * K + k]; fAt[k * M + i] = fA[i * K + k]; }
+                        }
+                        for (size_t k = 0; k < K; ++k) {
+                            for (size_t j = 0; j < N; ++j) { bBt[j * K + k] = bB[k * N + j]; fBt[j * K + k] = fB[k * N + j]; }
+                        }
+                        if (bf) gemm(Transpose::Trans, Transpose::Trans, M, N, K, 1.0f, bAt.data(), M, bBt.data(), K, 0.0f, Result.data.data(), N);
+                        else    gemm(Transpose::Trans, Transpose::Trans, M, N, K, 1.0f, fAt.data(), M, fBt.data(), K, 0.0f, Result.data.data(), N);
+                    }
+                    ok = ok && are_matrices_equal(Ref, Result, 1e-3f);
+                }
+            }
+        }
+        set_active_isa(saved);
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Half precision (bf16 / fp16 conversion and gemm)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Threaded kernels on the shared pool with more threads than cores and uneven tiles
+    {
+        ThreadPool& pool = ThreadPool::instance();
+        unsigned int saved = pool.num_threads();
+        pool.set_num_threads(4);
+
+        Matrix TA(131, 77), TB(77, 1029), TExpected(131, 1029);
+        fill_random(TA);
+        fill_random(TB);
+        multiply_naive(TA, TB, TExpected);
+
+        struct ThreadedCase {
+            std::string name;
+            void (*func)(const Matrix&, const Matrix&, Matrix&, unsigned int);
+        };
+        std::vector<ThreadedCase> threaded = {
+            {"Opt V5 (Thread, 131x77x1029)", multiply_optimized_v5_threaded},
+            {"Opt V7 (Thread+RegBlk, 131x77x1029)", multiply_optimized_v7_threaded_register_blocked},
+            {"Opt V11 (Packed+Thread, 131x77x1029)", multiply_optimized_packed_threaded},
+            {"Strassen (parallel top level, 131x77x1029)",
+             [](const Matrix& A, const Matrix& B, Matrix& C, unsigned int) { multiply_strassen(A, B, C, 16); }}
+        };
+        for (const auto& c : threaded) {
+            for (unsigned int threads : {0u, 3u}) {
+                // Uninitialized output holding garbage: kernels must not read it
+                Matrix Result(131, 1029, uninitialized);
+                std::fill(Result.data.begin(), Result.data.end(), std::nanf(""));
+                c.func(TA, TB, Result, threads);
+                bool ok = are_matrices_equal(TExpected, Result, 1e-3f);
+                std::cout << (ok ? "[PASS] " : "[FAIL] ") << c.name << " threads=" << threads << std::endl;
+                all_passed = all_passed && ok;
+            }
+        }
+
+        // Every task runs exactly once, nested calls run inline, and task exceptions propagate
+        std::vector<std::atomic<int>> hits(1000);
+        pool.parallel_for(hits.size(), [&](size_t i) {
+            pool.parallel_for(2, [&](size_t) { hits[i].fetch_add(1); });
+        });
+        bool once = std::all_of(hits.begin(), hits.end(), [](const std::atomic<int>& h) { return h.load() == 2; });
+        bool propagated = false;
+        try {
+            pool.parallel_for(64, [](size_t i) { if (i == 37) throw std::runtime_error("task failed"); });
+        } catch (const std::runtime_error&) {
+            propagated = true;
+        }
+
+        // Restarting the pool after a job (shrinking, then growing) must not replay it
+        bool restarted = true;
+        for (unsigned int threads : {8u, 3u, 2u, 6u}) {
+            pool.set_num_threads(threads);
+            std::vector<std::atomic<int>> counts(257);
+            pool.parallel_for(counts.size(), [&](size_t i) { counts[i].fetch_add(1); });
+            restarted = restarted && pool.num_threads() == threads &&
+                        std::all_of(counts.begin(), counts.end(), [](const std::atomic<int>& c) { return c.load() == 1; });
+        }
+        pool.set_num_threads(4);
+
+        bool ok = once && propagated && restarted;
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "ThreadPool scheduling (incl. resize after a job)" << std::endl;
+        all_passed = all_passed && ok;
+
+        pool.set_num_threads(saved);
+    }
+
+    // Pre-packed B: several kc / nc blocks, threaded tiles, transposes, and one
+    // PackedMatrix shared by concurrent products
+    {
+        ThreadPool& pool = ThreadPool::instance();
+        const unsigned int savedThreads = pool.num_threads();
+        pool.set_num_threads(4);
+        std::string path = (std::filesystem::temp_directory_path() / "matmul_tuning_packed.txt").string();
+        {
+            std::ofstream out(path);
+            out << isa_name(active_isa()) << " medium 24 64 160 32 0\n";
+        }
+        bool ok = load_tuning_file(path);
+
+        const size_t M = 131, K = 300, N = 1100;
+        Matrix PA(M, K), PB(K, N), PBt(N, K), PExpected(M, N);
+        fill_random(PA);
+        fill_random(PB);
+        for (size_t k = 0; k < K; ++k) {
+            for (size_t j = 0; j < N; ++j) PBt(j, k) = PB(k, j);
+        }
+        multiply_naive(PA, PB, PExpected);
+
+        PackedMatrix packed(PB), packedT(PBt, Transpose::Trans);
+        ok = ok && packed.kc() == 64 && packed.nc() == 160 && packedT.rows() == K && packedT.cols() == N;
+
+        std::vector<Matrix> results(4, Matrix(M, N));
+        pool.parallel_for(results.size(), [&](size_t i) { multiply(PA, i % 2 ? packedT : packed, results[i]); });
+        for (const Matrix& r : results) ok = ok && are_matrices_equal(PExpected, r, 1e-3f);
+
+        // C = 2 * (A^T)^T * B - C, on a transposed copy of A
+        Matrix PAt(K, M), PC(M, N), PRef(M, N);
+        fill_random(PC);
+        for (size_t i = 0; i < M; ++i) {
+            for (size_t k = 0; k < K; ++k) PAt(k, i) = PA(i, k);
+        }
+        for (size_t i = 0; i < PC.data.size(); ++i) PRef.data[i] = 2.0f * PExpected.data[i] - PC.data[i];
+        gemm(Transpose::Trans, 2.0f, PAt.view(), packed, -1.0f, PC.view());
+        ok = ok && are_matrices_equal(PRef, PC, 2e-3f);
+
+        { std::ofstream reset(path); }
+        load_tuning_file(path);
+        std::filesystem::remove(path);
+
+        pool.set_num_threads(savedThreads);
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "PackedMatrix (pre-packed B)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Fused epilogues on threaded tiles: every activation, both bias modes, a strided
+    // residual and beta != 0, against separate passes over C
+    {
+        ThreadPool& pool = ThreadPool::instance();
+        const unsigned int savedThreads = pool.num_threads();
+        pool.set_num_threads(4);
+        const size_t M = 131, K = 300, N = 203;
+        Matrix EA(M, K), EB(K, N), EC(M, N), Res(M, N + 9), Product(M, N);
+        fill_random(EA);
+        fill_random(EB);
+        fill_random(EC);
+        fill_random(Res);
+        multiply_naive(EA, EB, Product);
+        std::vector<float> rowBias(M), colBias(N);
+        for (size_t i = 0; i < M; ++i) rowBias[i] = 0.01f * static_cast<float>(i) - 0.5f;
+        for (size_t j = 0; j < N; ++j) colBias[j] = 0.5f - 0.02f * static_cast<float>(j);
+
+        bool ok = true;
+        for (Activation act : {Activation::None, Activation::ReLU, Activation::GELU, Activation::Sigmoid}) {
+            for (BiasMode mode : {BiasMode::PerRow, BiasMode::PerColumn}) {
+                Epilogue ep;
+                ep.bias = (mode == BiasMode::PerRow) ? rowBias.data() : colBias.data();
+                ep.biasMode = mode;
+                ep.activation = act;
+                ep.residual = Res.data.data();
+                ep.ldResidual = Res.cols;
+
+                Matrix Ref(M, N), Fused = EC;
+                for (size_t i = 0; i < M; ++i) {
+                    for (size_t j = 0; j < N; ++j) {
+                        float x = 0.5f * Product(i, j) + 0.25f * EC(i, j) +
+                                  (mode == BiasMode::PerRow ? rowBias[i] : colBias[j]);
+                        if (act == Activation::ReLU) x = std::max(x, 0.0f);
+                        if (act == Activation::GELU) x = 0.5f * x * (1.0f + std::erf(x / std::sqrt(2.0f)));
+                        if (act == Activation::Sigmoid) x = 1.0f / (1.0f + std::exp(-x));
+                        Ref(i, j) = x + Res(i, j);
+                    }
+                }
+                gemm(Transpose::NoTrans, Transpose::NoTrans, M, N, K, 0.5f, EA.data.data(), K,
+                     EB.data.data(), N, 0.25f, Fused.data.data(), N, ep);
+                ok = ok && are_matrices_equal(Ref, Fused, 2e-3f);
+            }
+        }
+
+        // Pre-packed B: a dense layer, relu(A * W + b)
+        Epilogue layer;
+        layer.bias = colBias.data();
+        layer.activation = Activation::ReLU;
+        Matrix Layer(M, N), LayerRef(M, N);
+        for (size_t i = 0; i < M; ++i) {
+            for (size_t j = 0; j < N; ++j) LayerRef(i, j) = std::max(Product(i, j) + colBias[j], 0.0f);
+        }
+        multiply(EA, PackedMatrix(EB), Layer, layer);
+        ok = ok && are_matrices_equal(LayerRef, Layer, 2e-3f);
+
+        pool.set_num_threads(savedThreads);
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Fused epilogues (bias, activation, residual)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Skinny shapes on every ISA with 4 threads: GEMV and short-wide products split by
+    // columns, tall-skinny ones by rows, deep-K products split by K (with beta and a
+    // fused bias), and transposed operands, against a double-precision reference
+    {
+        ThreadPool& pool = ThreadPool::instance();
+        const unsigned int savedThreads = pool.num_threads();
+        pool.set_num_threads(4);
+        bool ok = choose_gemm_partition(1, 4096, 1024, 4) == GemmPartition::Columns &&
+                  choose_gemm_partition(64, 64, 8192, 16) == GemmPartition::SplitK &&
+                  choose_gemm_partition(1, 16, 100000, 4) == GemmPartition::SplitK &&
+                  choose_gemm_partition(1024, 1024, 1024, 4) == GemmPartition::Tiles2D &&
+                  choose_gemm_partition(64, 64, 8192, 1) == GemmPartition::Tiles2D;
+
+        CpuIsa savedIsa = active_isa();
+        const Transpose NT = Transpose::NoTrans, T = Transpose::Trans;
+        struct SkinnyShape { size_t M, N, K; Transpose tA, tB; };
+        for (const SkinnyShape& sh : {SkinnyShape{1, 1000, 700, NT, NT}, SkinnyShape{7, 333, 129, T, NT},
+                                      SkinnyShape{3, 37, 5000, NT, NT}, SkinnyShape{40, 50, 3000, T, NT},
+                                      SkinnyShape{1, 1, 2048, NT, NT}, SkinnyShape{1000, 1, 300, NT, NT},
+                                      SkinnyShape{517, 3, 261, NT, T}, SkinnyShape{300, 4, 2000, NT, NT}}) {
+            bool ta = (sh.tA == T), tb = (sh.tB == T);
+            Matrix SA(ta ? sh.K : sh.M, ta ? sh.M : sh.K), SB(tb ? sh.N : sh.K, tb ? sh.K : sh.N), SC(sh.M, sh.N);
+            fill_random(SA);
+            fill_random(SB);
+            fill_random(SC);
+            std::vector<float> bias(sh.N);
+            for (size_t j = 0; j < sh.N; ++j) bias[j] = 0.01f * static_cast<float>(j % 13);
+            Matrix Ref(sh.M, sh.N);
+            for (size_t i = 0; i < sh.M; ++i) {
+                for (size_t j = 0; j < sh.N; ++j) {
+                    double sum = 0.0;
+                    for (size_t k = 0; k < sh.K; ++k) sum += double(ta ? SA(k, i) : SA(i, k)) * (tb ? SB(j, k) : SB(k, j));
+                    Ref(i, j) = static_cast<float>(1.5 * sum - 0.5 * SC(i, j) + bias[j]);
+                }
+            }
+            Epilogue ep;
+            ep.bias = bias.data();
+            for (CpuIsa isa : {CpuIsa::Scalar, CpuIsa::SSE42, CpuIsa::AVX2, CpuIsa::AVX512, CpuIsa::NEON}) {
+                if (!set_active_isa(isa)) continue;
+                Matrix Result = SC;
+                gemm(sh.tA, sh.tB, sh.M, sh.N, sh.K, 1.5f, SA.data.data(), SA.cols,
+                     SB.data.data(), SB.cols, -0.5f, Result.data.data(), sh.N, ep);
+                ok = ok && are_matrices_equal(Ref, Result, 5e-3f);
+            }
+            set_active_isa(savedIsa);
+            Matrix V5(sh.M, sh.N, uninitialized);
+            if (!ta && !tb) {
+                multiply_optimized_v5_threaded(SA, SB, V5);
+                for (size_t i = 0; i < V5.data.size(); ++i) V5.data[i] = 1.5f * V5.data[i] - 0.5f * SC.data[i];
+                for (size_t i = 0; i < sh.M; ++i) {
+                    for (size_t j = 0; j < sh.N; ++j) V5(i, j) += bias[j];
+                }
+                ok = ok && are_matrices_equal(Ref, V5, 5e-3f);
+            }
+        }
+        pool.set_num_threads(savedThreads);
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Skinny GEMM / GEMV (column, row and split-K partitions)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Double and complex element types, threaded on 4 threads
+    {
+        ThreadPool& pool = ThreadPool::instance();
+        const unsigned int savedThreads = pool.num_threads();
+        pool.set_num_threads(4);
+        bool ok = check_wide_gemm<double>(1.5, -0.5, 1e-10) &&
+                  check_wide_gemm<std::complex<float>>({0.5f, -1.25f}, {0.75f, 0.5f}, 2e-3) &&
+                  check_wide_gemm<std::complex<double>>({0.5, -1.25}, {0.0, 0.0}, 1e-10) &&
+                  check_wide_gemm<std::complex<double>>({-1.0, 0.0}, {0.25, 1.0}, 1e-10);
+        pool.set_num_threads(savedThreads);
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Double / complex GEMM (dgemm, cgemm, zgemm)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Matrix expressions: fused sums of products, transposes and scalars, terms
+    // folded into beta, aliasing, and shape errors
+    {
+        const size_t M = 45, K = 70, N = 33;
+        Matrix EA(M, K), EB(K, N), EC(M, 20), EE(20, N), EF(M, N), EAt(K, M);
+        for (Matrix* X : {&EA, &EB, &EC, &EE, &EF, &EAt}) fill_random(*X);
+        Matrix AB(M, N), CE(M, N), AtB(M, N);
+        multiply_naive(EA, EB, AB);
+        multiply_naive(EC, EE, CE);
+        Matrix EAtT(M, K);
+        for (size_t i = 0; i < M; ++i) {
+            for (size_t k = 0; k < K; ++k) EAtT(i, k) = EAt(k, i);
+        }
+        multiply_naive(EAtT, EB, AtB);
+
+        Matrix Ref(M, N);
+        for (size_t i = 0; i < Ref.data.size(); ++i) Ref.data[i] = AB.data[i] + CE.data[i] - EF.data[i];
+        Matrix D = EA * EB + EC * EE - EF;
+        bool ok = are_matrices_equal(Ref, D, 1e-3f);
+
+        for (size_t i = 0; i < Ref.data.size(); ++i) Ref.data[i] = AB.data[i] + EF.data[i];
+        D = EA * EB + EF;
+        ok = ok && are_matrices_equal(Ref, D, 1e-3f);
+
+        for (size_t i = 0; i < Ref.data.size(); ++i) Ref.data[i] = 2.0f * AtB.data[i] - 0.5f * D.data[i];
+        D = 2.0f * EAt.t() * EB - 0.5f * D;     // D folds into beta
+        ok = ok && are_matrices_equal(Ref, D, 1e-3f);
+
+        for (size_t i = 0; i < Ref.data.size(); ++i) Ref.data[i] += AB.data[i] - 3.0f * EF.data[i];
+        D += EA * EB - EF * 3.0f;
+        ok = ok && are_matrices_equal(Ref, D, 1e-3f);
+
+        Matrix Sq(N, N);
+        fill_random(Sq);
+        multiply_naive(D, Sq, Ref);
+        for (size_t i = 0; i < Ref.data.size(); ++i) Ref.data[i] += D.data[i];
+        D = D * Sq + D;         // Reads D through a product: evaluated via a temporary
+        ok = ok && are_matrices_equal(Ref, D, 1e-3f);
+
+        Matrix FT(N, M);
+        for (size_t i = 0; i < M; ++i) {
+            for (size_t j = 0; j < N; ++j) FT(j, i) = EF(i, j);
+        }
+        Matrix G = -(EF.t() - FT) + EF.t().t().t();
+        ok = ok && are_matrices_equal(FT, G, 1e-6f);
+
+        CMatrix ZA(M, K), ZB(K, N), ZC(M, N), ZRef(M, N);
+        fill_random(ZA);
+        fill_random(ZB);
+        fill_random(ZC);
+        multiply_naive(ZA, ZB, ZRef);
+        const std::complex<float> z(0.5f, -1.0f);
+        for (size_t i = 0; i < ZRef.data.size(); ++i) ZRef.data[i] = z * ZRef.data[i] + ZC.data[i];
+        CMatrix ZD = z * ZA * ZB + ZC;
+        ok = ok && are_matrices_close(ZRef, ZD, 1e-3);
+
+        int threw = 0;
+        try {
+            D = EA * EB + EC;
+        } catch (const std::invalid_argument&) {
+            ++threw;
+        }
+        try {
+            Matrix Bad = EA * EC;
+        } catch (const std::invalid_argument&) {
+            ++threw;
+        }
+        ok = ok && threw == 2;
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Matrix expressions (fused GEMM sums, aliasing)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Sparse x dense on every ISA: ~10% density with a few dense rows to skew the
+    // nonzero balance, ragged column tails, and blocks that don't divide the shape
+    {
+        ThreadPool& pool = ThreadPool::instance();
+        const unsigned int savedThreads = pool.num_threads();
+        pool.set_num_threads(4);
+        const size_t M = 157, K = 203, N = 77;
+        Matrix SA(M, K), SB(K, N), SExpected(M, N);
+        fill_random(SA);
+        fill_random(SB);
+        for (size_t i = 0; i < M; ++i) {
+            for (size_t k = 0; k < K; ++k) {
+                if (i % 50 != 7 && (i * 31 + k * 17) % 10 != 0) SA(i, k) = 0.0f;
+            }
+        }
+        multiply_naive(SA, SB, SExpected);
+
+        CsrMatrix csr(SA);
+        BsrMatrix bsr(SA), bsrOdd(SA, 3, 5), bsrTall(SA, 11, 2);
+        bool ok = are_matrices_equal(SA, csr.to_dense(), 0.0f) && are_matrices_equal(SA, bsrOdd.to_dense(), 0.0f);
+        CpuIsa savedIsa = active_isa();
+        for (CpuIsa isa : {CpuIsa::Scalar, CpuIsa::AVX2, CpuIsa::AVX512}) {
+            if (!set_active_isa(isa)) continue;
+            for (unsigned int threads : {0u, 3u}) {
+                Matrix R1(M, N), R2(M, N), R3(M, N), R4(M, N);
+                multiply(csr, SB, R1, threads);
+                multiply(bsr, SB, R2, threads);
+                multiply(bsrOdd, SB, R3, threads);
+                multiply(bsrTall, SB, R4, threads);
+                ok = ok && are_matrices_equal(SExpected, R1, 1e-3f) && are_matrices_equal(SExpected, R2, 1e-3f) &&
+                     are_matrices_equal(SExpected, R3, 1e-3f) && are_matrices_equal(SExpected, R4, 1e-3f);
+            }
+        }
+        set_active_isa(savedIsa);
+        pool.set_num_threads(savedThreads);
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Sparse x dense (CSR / BSR)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Out-of-core on mapped files: a budget that forces tiling in M, N and K, with
+    // and without readahead, results read back through a fresh mapping
+    {
+        const size_t M = 300, K = 257, N = 190;
+        auto dir = std::filesystem::temp_directory_path();
+        std::string pathA = (dir / "matmul_ooc_a.bin").string(), pathB = (dir / "matmul_ooc_b.bin").string(),
+                    pathC = (dir / "matmul_ooc_c.bin").string();
+        Matrix OA(M, K), OB(K, N), OExpected(M, N);
+        fill_random(OA);
+        fill_random(OB);
+        multiply_naive(OA, OB, OExpected);
+        {
+            MappedMatrix fa(pathA, M, K, MapMode::Create), fb(pathB, K, N, MapMode::Create);
+            std::copy(OA.data.begin(), OA.data.end(), fa.data());
+            std::copy(OB.data.begin(), OB.data.end(), fb.data());
+            fa.flush(0, M, true);
+            fb.flush(0, K, true);
+        }
+
+        bool ok = true;
+        MappedMatrix fa(pathA, M, K), fb(pathB, K, N);
+        for (bool prefetch : {true, false}) {
+            {
+                MappedMatrix fc(pathC, M, N, MapMode::Create);
+                OutOfCoreOptions opts;
+                opts.memoryBudget = 160 * 1024;
+                opts.prefetch = prefetch;
+                multiply_out_of_core(fa, fb, fc, opts);
+            }
+            MappedMatrix fc(pathC, M, N);
+            Matrix Result(M, N);
+            std::copy(fc.data(), fc.data() + M * N, Result.data.begin());
+            ok = ok && are_matrices_equal(OExpected, Result, 1e-3f);
+        }
+
+        bool threw = false;
+        try {
+            MappedMatrix fc(pathC, M, N, MapMode::ReadWrite);
+            OutOfCoreOptions tiny;
+            tiny.memoryBudget = 4096;
+            multiply_out_of_core(fa, fb, fc, tiny);
+        } catch (const std::invalid_argument&) {
+            threw = true;
+        }
+        ok = ok && threw;
+
+        for (const std::string& p : {pathA, pathB, pathC}) std::filesystem::remove(p);
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Out-of-core (mapped files, tiled)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Matrix files: both formats round-trip through zero-copy views, a hand-written
+    // Fortran-order .npy maps as a transpose, and bad files and types are rejected
+    {
+        auto dir = std::filesystem::temp_directory_path();
+        std::string pathNpy = (dir / "matmul_io.npy").string(), pathBin = (dir / "matmul_io.bin").string(),
+                    pathF = (dir / "matmul_io_f.npy").string();
+        Matrix IA(37, 53);
+        fill_random(IA);
+        ZMatrix IZ(9, 4);
+        fill_random(IZ);
+
+        bool ok = true;
+        for (const std::string& path : {pathNpy, pathBin}) {
+            save_matrix(path, IA);
+            MatrixFile f(path);
+            ConstMatrixView v = f.view<float>();
+            ok = ok && f.rows() == 37 && f.cols() == 53 && !f.transposed() && f.type() == ElementType::Float32 &&
+                 reinterpret_cast<uintptr_t>(v.data) % 64 == 0 &&
+                 std::equal(IA.data.begin(), IA.data.end(), v.data);
+
+            save_matrix(path, IZ);
+            MatrixFile z(path);
+            ok = ok && z.type() == ElementType::Complex128 &&
+                 std::equal(IZ.data.begin(), IZ.data.end(), z.view<std::complex<double>>().data);
+        }
+
+        // A Fortran-order 3 x 2 array: stored column by column
+        {
+            std::string dict = "{'descr': '<f4', 'fortran_order': True, 'shape': (3, 2), }";
+            dict.append(64 - (10 + dict.size() + 1) % 64, ' ');
+            dict += '\n';
+            std::ofstream out(pathF, std::ios::binary);
+            out.write("\x93NUMPY\x01\x00", 8);
+            out.put(static_cast<char>(dict.size() & 0xff)).put(static_cast<char>(dict.size() >> 8));
+            out << dict;
+            const float values[6] = {1, 2, 3, 4, 5, 6};
+            out.write(reinterpret_cast<const char*>(values), sizeof(values));
+        }
+        MatrixFile ff(pathF);
+        ConstMatrixView fv = ff.view<float>();
+        ok = ok && ff.rows() == 3 && ff.cols() == 2 && ff.transposed() && fv.rows == 2 && fv.cols == 3 &&
+             fv(1, 0) == 4.0f && fv(0, 2) == 3.0f;
+
+        // gemm straight from and into mapped files: C = F^T * IA[0:3, :], where F^T is
+        // the Fortran-order file's stored layout
+        save_matrix(pathNpy, IA);
+        {
+            MatrixFile fa(pathNpy), fc(pathBin, 2, 53, ElementType::Float32);
+            MatrixView c = fc.mutable_view<float>();
+            gemm(Transpose::NoTrans, Transpose::NoTrans, 2, 53, 3, 1.0f, fv.data, fv.ld,
+                 fa.view<float>().data, 53, 0.0f, c.data, c.ld);
+        }
+        MatrixFile fc(pathBin);
+        for (size_t j = 0; j < 53; ++j) {
+            ok = ok && std::abs(fc.view<float>()(1, j) - (4 * IA(0, j) + 5 * IA(1, j) + 6 * IA(2, j))) < 1e-5f;
+        }
+
+        int threw = 0;
+        auto expect_throw = [&](auto&& fn) {
+            try {
+                fn();
+            } catch (const std::exception&) {
+                ++threw;
+            }
+        };
+        expect_throw([&] { fc.view<double>(); });
+        expect_throw([&] { MatrixFile(pathBin).mutable_view<float>(); });
+        {
+            std::ofstream out(pathF, std::ios::binary);
+            out << "not a matrix";
+        }
+        expect_throw([&] { MatrixFile bad(pathF); });
+        std::filesystem::resize_file(pathBin, 100);
+        expect_throw([&] { MatrixFile truncated(pathBin); });
+        ok = ok && threw == 4;
+
+        // Output-aliases-input detection sees through a differently spelled path
+        const std::string dotted = (std::filesystem::path(pathBin).parent_path() / "." /
+                                    std::filesystem::path(pathBin).filename()).string();
+        ok = ok && same_file(pathBin, dotted) && !same_file(pathBin, pathNpy) &&
+             !same_file(pathBin, pathBin + ".missing");
+
+        for (const std::string& p : {pathNpy, pathBin, pathF}) std::filesystem::remove(p);
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Matrix files (.npy / binary, zero-copy views)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Symmetric and triangular products against gemm-style references on full
+    // matrices: every uplo / side / transpose / diag, and the triangle that must
+    // not be read filled with NaN (C too when beta == 0)
+    {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        const float alpha = 1.5f, beta = 0.5f;
+        std::mt19937 gen(23);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        auto random_vector = [&](size_t n) {
+            std::vector<float> v(n);
+            for (float& x : v) x = dist(gen);
+            return v;
+        };
+        // alpha * X[M x K] * Y[K x N] + beta * C, X and Y row-major
+        auto reference = [&](size_t M, size_t N, size_t K, const std::vector<float>& X,
+                             const std::vector<float>& Y, const std::vector<float>& C, float b) {
+            std::vector<float> R(M * N);
+            for (size_t i = 0; i < M; ++i) {
+                for (size_t j = 0; j < N; ++j) {
+                    double sum = 0.0;
+                    for (size_t k = 0; k < K; ++k) sum += double(X[i * K + k]) * Y[k * N + j];
+                    R[i * N + j] = float(alpha * sum) + (b == 0.0f ? 0.0f : b * C[i * N + j]);
+                }
+            }
+            return R;
+        };
+        auto close = [](float a, float b) { return std::abs(a - b) <= 1e-3f * (1.0f + std::abs(b)); };
+        bool ok = true;
+
+        // SYRK: N = 203 spans several triangle tiles and recursive diagonal splits
+        const size_t N = 203, K = 77;
+        const std::vector<float> SA = random_vector(N * K), C0 = random_vector(N * N);
+        std::vector<float> SAt(K * N);
+        for (size_t i = 0; i < N; ++i) {
+            for (size_t k = 0; k < K; ++k) SAt[k * N + i] = SA[i * K + k];
+        }
+        const std::vector<float> gram = reference(N, N, K, SA, SAt, C0, beta);
+        for (Uplo uplo : {Uplo::Upper, Uplo::Lower}) {
+            for (Transpose t : {Transpose::NoTrans, Transpose::Trans}) {
+                for (bool mirror : {false, true}) {
+                    std::vector<float> C = C0;
+                    const std::vector<float>& A = (t == Transpose::Trans) ? SAt : SA;
+                    syrk(uplo, t, N, K, alpha, A.data(), t == Transpose::Trans ? N : K, beta, C.data(), N, mirror);
+                    for (size_t i = 0; i < N; ++i) {
+                        for (size_t j = 0; j < N; ++j) {
+                            // The other triangle is untouched, or the transpose of the computed one
+                            const bool computed = (uplo == Uplo::Lower) ? j <= i : j >= i;
+                            const float expected = computed ? gram[i * N + j] : mirror ? gram[j * N + i] : C0[i * N + j];
+                            ok = ok && close(C[i * N + j], expected);
+                        }
+                    }
+                }
+            }
+        }
+        {
+            std::vector<float> C(N * N, nan);
+            syrk(Uplo::Lower, Transpose::NoTrans, N, K, alpha, SA.data(), K, 0.0f, C.data(), N, true);
+            const std::vector<float> ref = reference(N, N, K, SA, SAt, C0, 0.0f);
+            for (size_t i = 0; i < N * N; ++i) ok = ok && close(C[i], ref[i]);
+        }
+
+        // SYMM and TRMM: C is M x Nc; the structured operand is M x M (Left) or Nc x Nc
+        const size_t M = 150, Nc = 91;
+        const std::vector<float> B = random_vector(M * Nc), CS = random_vector(M * Nc);
+        for (Side side : {Side::Left, Side::Right}) {
+            const bool left = (side == Side::Left);
+            const size_t n = left ? M : Nc;
+            const std::vector<float> full = random_vector(n * n);
+            for (Uplo uplo : {Uplo::Upper, Uplo::Lower}) {
+                auto in_triangle = [&](size_t i, size_t j) { return uplo == Uplo::Lower ? j <= i : j >= i; };
+
+                std::vector<float> sym(n * n), stored(n * n);
+                for (size_t i = 0; i < n; ++i) {
+                    for (size_t j = 0; j < n; ++j) {
+                        sym[i * n + j] = in_triangle(i, j) ? full[i * n + j] : full[j * n + i];
+                        stored[i * n + j] = in_triangle(i, j) ? full[i * n + j] : nan;
+                    }
+                }
+                std::vector<float> C = CS;
+                symm(side, uplo, M, Nc, alpha, stored.data(), n, B.data(), Nc, beta, C.data(), Nc);
+                std::vector<float> ref = left ? reference(M, Nc, M, sym, B, CS, beta)
+                                              : reference(M, Nc, Nc, B, sym, CS, beta);
+                for (size_t i = 0; i < M * Nc; ++i) ok = ok && close(C[i], ref[i]);
+
+                for (Transpose t : {Transpose::NoTrans, Transpose::Trans}) {
+                    for (Diag diag : {Diag::NonUnit, Diag::Unit}) {
+                        // tri: op(A) in full, with its zeros and unit diagonal
+                        std::vector<float> tri(n * n);
+                        for (size_t i = 0; i < n; ++i) {
+                            for (size_t j = 0; j < n; ++j) {
+                                if (diag == Diag::Unit && i == j) stored[i * n + j] = nan;
+                                const size_t si = t == Transpose::Trans ? j : i, sj = t == Transpose::Trans ? i : j;
+                                float v = in_triangle(si, sj) ? full[si * n + sj] : 0.0f;
+                                if (diag == Diag::Unit && i == j) v = 1.0f;
+                                tri[i * n + j] = v;
+                            }
+                        }
+                        for (float b : {beta, 0.0f}) {
+                            C = (b == 0.0f) ? std::vector<float>(M * Nc, nan) : CS;
+                            trmm(side, uplo, t, diag, M, Nc, alpha, stored.data(), n, B.data(), Nc, b, C.data(), Nc);
+                            ref = left ? reference(M, Nc, M, tri, B, CS, b) : reference(M, Nc, Nc, B, tri, CS, b);
+                            for (size_t i = 0; i < M * Nc; ++i) ok = ok && close(C[i], ref[i]);
+                        }
+                        for (size_t i = 0; i < n; ++i) stored[i * n + i] = full[i * n + i];
+                    }
+                }
+            }
+        }
+
+        bool threw = false;
+        try {
+            std::vector<float> C(N * N);
+            syrk(Uplo::Upper, Transpose::Trans, N, K, alpha, SAt.data(), N - 1, 0.0f, C.data(), N);
+        } catch (const std::invalid_argument&) {
+            threw = true;
+        }
+        ok = ok && threw;
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "SYRK / SYMM / TRMM (triangles, sides, unread NaN triangle)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Topology and affinity: plans on a synthetic 2-socket, 2-core, 2-way SMT
+    // machine, then pinned workers running the shared-B engine (tall enough that
+    // each thread gets whole row blocks)
+    {
+        ThreadPool& pool = ThreadPool::instance();
+        const unsigned int savedThreads = pool.num_threads();
+        pool.set_num_threads(4);
+        const CpuTopology& topo = cpu_topology();
+        bool ok = !topo.cpus.empty() && topo.numCores > 0 && topo.numDomains > 0;
+        for (const LogicalCpu& cpu : topo.cpus) {
+            ok = ok && cpu.core < topo.numCores && cpu.package < topo.numPackages && cpu.domain < topo.numDomains;
+        }
+
+        CpuTopology fake;
+        for (unsigned int core = 0; core < 4; ++core) {
+            for (unsigned int smt = 0; smt < 2; ++smt) {
+                fake.cpus.push_back({core + 4 * smt, core, core / 2, core / 2});
+            }
+        }
+        fake.numCores = 4;
+        fake.numPackages = 2;
+        fake.numDomains = 2;
+        using Plan = std::vector<unsigned int>;
+        ok = ok && affinity_plan(fake, AffinityPolicy::None, 4).empty() &&
+             affinity_plan(fake, AffinityPolicy::Compact, 4) == Plan{0, 4, 1, 5} &&
+             affinity_plan(fake, AffinityPolicy::Cores, 6) == Plan{0, 1, 2, 3, 4, 5} &&
+             affinity_plan(fake, AffinityPolicy::Scatter, 4) == Plan{0, 2, 1, 3} &&
+             affinity_plan(fake, AffinityPolicy::Compact, 10)[8] == 0;
+        AffinityPolicy parsed;
+        ok = ok && parse_affinity("scatter", parsed) && parsed == AffinityPolicy::Scatter &&
+             !parse_affinity("everywhere", parsed);
+
+        Matrix PA(517, 389), PB(389, 613), PExpected(517, 613);
+        fill_random(PA);
+        fill_random(PB);
+        multiply_naive(PA, PB, PExpected);
+        for (AffinityPolicy policy : {AffinityPolicy::Cores, AffinityPolicy::Scatter, AffinityPolicy::None}) {
+            pool.set_affinity(policy);
+            ok = ok && pool.affinity() == policy && pool.current_domain() < pool.num_domains();
+            Matrix Result(517, 613, uninitialized);
+            multiply_optimized_packed_threaded(PA, PB, Result);
+            ok = ok && are_matrices_equal(PExpected, Result, 1e-3f);
+
+            // C = 0.5 * A * B + 0.25 * C, exercising beta on the first K block only
+            Matrix Scaled = PExpected;
+            gemm(Transpose::NoTrans, Transpose::NoTrans, 0.5f, PA.view(), PB.view(), 0.25f, Scaled.view());
+            for (size_t i = 0; i < Scaled.data.size(); ++i) Scaled.data[i] -= 0.75f * PExpected.data[i];
+            ok = ok && std::all_of(Scaled.data.begin(), Scaled.data.end(), [](float v) { return std::abs(v) < 1e-3f; });
+        }
+        ok = ok && pool.num_domains() == 1;
+        pool.set_num_threads(savedThreads);
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Topology / affinity (shared-B threaded engine)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Matrix storage: parallel zeroing, huge-block alignment and reuse through the
+    // pool, the pool limit, and uninitialized outputs for the serial kernels
+    {
+        ThreadPool& pool = ThreadPool::instance();
+        const unsigned int savedThreads = pool.num_threads();
+        pool.set_num_threads(4);
+        bool ok = true;
+        const size_t n = 1024;  // 4 MB: above the huge-page threshold
+        const float* first = nullptr;
+        {
+            Matrix Big(n, n);
+            ok = ok && std::all_of(Big.data.begin(), Big.data.end(), [](float v) { return v == 0.0f; });
+            ok = ok && reinterpret_cast<uintptr_t>(Big.data.data()) % kHugePageBytes == 0;
+            first = Big.data.data();
+        }
+        ok = ok && matrix_pool_cached_bytes() >= n * n * sizeof(float);
+        {
+            Matrix Reused(n, n, uninitialized);
+            ok = ok && Reused.data.data() == first;
+            std::fill(Reused.data.begin(), Reused.data.end(), 1.0f);
+        }
+        {
+            Matrix Zeroed(n, n);  // Reused block, so zeroing must not be skipped
+            ok = ok && std::all_of(Zeroed.data.begin(), Zeroed.data.end(), [](float v) { return v == 0.0f; });
+        }
+        size_t savedLimit = matrix_pool_limit();
+        set_matrix_pool_limit(0);
+        ok = ok && matrix_pool_cached_bytes() == 0;
+        set_matrix_pool_limit(savedLimit);
+
+        for (auto func : {multiply_optimized_v1, multiply_optimized_v3_unrolled, multiply_optimized_v4_simd,
+                          multiply_optimized_v8_prefetch, multiply}) {
+            Matrix Result(size, size, uninitialized);
+            std::fill(Result.data.begin(), Result.data.end(), std::nanf(""));
+            func(A, B, Result);
+            ok = ok && are_matrices_equal(Expected, Result);
+        }
+        pool.set_num_threads(savedThreads);
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Matrix memory (first touch, huge-page pool)" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
+    // Performance counters: a region always gets its wall time, and whatever events
+    // this machine allows count something; the roofline places a point on either side
+    // of the ridge (100 GFLOPS / 10 GB/s = 10 flop/B)
+    {
+        PerfCounters counters;
+        counters.start();
+        Matrix Result(size, size, uninitialized);
+        multiply_optimized_packed_threaded(A, B, Result);
+        PerfSample sample = counters.stop();
+        bool ok = sample.seconds > 0 && are_matrices_equal(Expected, Result);
+        for (PerfEvent event : {PerfEvent::Cycles, PerfEvent::Instructions, PerfEvent::TaskClock}) {
+            ok = ok && sample.has(event) == counters.available(event) && (!sample.has(event) || sample[event] > 0);
+        }
+        ok = ok && (sample.ipc() > 0) == (sample.has(PerfEvent::Cycles) && sample.has(PerfEvent::Instructions));
+
+        MachinePeaks peaks{100.0, 10.0};
+        RooflinePoint low = roofline(2e9, 1e9, 1.0, peaks);    // 2 flop/B
+        RooflinePoint high = roofline(2e9, 1e7, 0.04, peaks);  // 200 flop/B
+        ok = ok && low.memoryBound && std::abs(low.attainable - 20.0) < 1e-9 && std::abs(low.fraction - 0.1) < 1e-9;
+        ok = ok && !high.memoryBound && high.attainable == 100.0 && std::abs(high.achieved - 50.0) < 1e-9;
+        ok = ok && peak_gflops(CpuIsa::AVX2, 2.0, 4) == 256.0 && peak_gflops(CpuIsa::AVX512, 1.0, 1) == 64.0;
+        std::cout << (ok ? "[PASS] " : "[FAIL] ") << "Performance counters / roofline ("
+                  << (counters.hardware_available() ? "hardware events" : "timing only") << ")" << std::endl;
+        all_passed = all_passed && ok;
+    }
+
     return all_passed ? 0 : 1;
 }